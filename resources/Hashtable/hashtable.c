@@ -3,25 +3,50 @@
 * OU3
 *
 * File: hashtable.c
-* A hashtable implementation handling collisions by chaining.
+* An open-addressing hashtable in the style of a Swiss table. Slots are split
+* into groups of GROUP_WIDTH control bytes that are probed with SIMD compares,
+* and the table grows incrementally by draining the previous table a few
+* groups per operation instead of rehashing everything at once.
 * Author: Hanna Littorin
 * Username: c19hln
-* Version: 1.0
+* Version: 2.0
 **/
 #include "hashtable.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GROUP_WIDTH 16
+#define MIN_CAPACITY 16
+#define MIGRATE_GROUPS 4 // groups of the old table moved into the new one per operation
+
+// control byte values, a full slot stores the low 7 bits of the key hash.
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+struct table {
+    int8_t *ctrl;           // one control byte per slot.
+    uint8_t (*keys)[SSN_KEY_BYTES]; // packed keys stored inline.
+    void **values;
+    size_t capacity;        // number of slots, a power of two and a multiple of GROUP_WIDTH.
+    size_t used;            // number of full slots.
+    size_t tombstones;      // number of deleted slots.
+};
 
-// key value set. 
-typedef struct node {
-    char *key;
-    void *value;
-    struct node *next; // pointer to next node in the chain.
-} node_t;
+/*
+* Entries of one ring hash slot. Every slot has its own table so a slot can be
+* iterated, detached or attached without touching the rest of the store.
+*/
+struct ht_partition {
+    struct table cur;       // table receiving new inserts.
+    struct table old;       // table being drained during a resize, capacity 0 otherwise.
+    size_t migrate_group;   // next group of old to move into cur.
+};
 
 struct ht {
-    node_t **entries;   // buckets.
-    int num_entries;    // number of buckets containing data in hash table.
-    size_t length;      // number of items in hash table, including each node in the buckets.
+    struct ht_partition partitions[HT_SLOTS]; // indexed by hash_ssn() of the key.
+    size_t length;          // number of items in hash table.
     free_function value_free_function; // a function that is called when a nodes
                                             //value is to be freed
 };
@@ -29,215 +54,593 @@ struct ht {
 // code used from previous years provided hash.h and hash.c, uses djb2-algorithm
 // for hashing but adapted to this assignment (as no null termination on key)
 // https://git.cs.umu.se/courses/5dv213ht21/-/tree/master/provided%20code
-static hash_t digest(char* ssn, uint32_t len) {
+static uint32_t djb2(char* ssn, uint32_t len) {
     uint32_t hash = 5381;
     for(int i = 0; i < len; i++) {
         hash = ((hash << 5) + hash) + (uint32_t)ssn[i];
     }
-    return (hash_t) (hash % 256);
+    return hash;
+}
+
+static hash_t digest(char* ssn, uint32_t len) {
+    return (hash_t) (djb2(ssn, len) % 256);
+}
+
+static enum ht_partitioning partitioning = HT_PARTITION_HASH;
+
+static int digits_value(const char *digits, int count) {
+    int value = 0;
+    for(int i = 0; i < count; i++) {
+        value = value * 10 + (digits[i] - '0');
+    }
+    return value;
+}
+
+// birth year and half year, so the slot order follows the SSN order.
+static hash_t ordered_slot(const char *ssn) {
+    int year = digits_value(ssn, 4);
+    int month = digits_value(ssn + 4, 2);
+    int slot = (year - ORDERED_BASE_YEAR) * 2 + (month >= 7);
+
+    if(slot < 0) {
+        return 0;
+    }
+    return slot >= HT_SLOTS ? HT_SLOTS - 1 : (hash_t)slot;
 }
 
 hash_t hash_ssn(char* ssn) {
+    if(partitioning == HT_PARTITION_ORDERED) {
+        return ordered_slot(ssn);
+    }
     return digest(ssn, 12);
 }
 
+// month and day within the half year, clamped so the order still follows the SSN.
+static slot_t ordered_ring_slot(const char *ssn) {
+    int year = digits_value(ssn, 4);
+    int month = digits_value(ssn + 4, 2);
+    int day = digits_value(ssn + 6, 2);
+    int slot = (year - ORDERED_BASE_YEAR) * 2 + (month >= 7);
 
-ht* ht_create(free_function value_free_function){
-    struct ht *ht = calloc(1, sizeof(struct ht));
-    if(ht == NULL){
-        perror("Calloc:");
-        exit(EXIT_FAILURE);
+    if(slot < 0) {
+        return 0;
     }
+    if(slot >= HT_SLOTS) {
+        return RING_SLOTS - 1;
+    }
+    day = day < 1 ? 1 : day > 31 ? 31 : day;
+    int position = (month - (month >= 7 ? 7 : 1)) * 31 + day - 1;
+    position = position < 0 ? 0 : position >= 6 * 31 ? 6 * 31 - 1 : position;
+    return FIRST_RING_SLOT(slot) + position * SLOTS_PER_HASH_SLOT / (6 * 31);
+}
 
-    ht->entries = calloc(MAX_SIZE, sizeof(struct node_t*));
-    if(ht->entries == NULL){
-        perror("Calloc:");
-        exit(EXIT_FAILURE);
+slot_t ring_slot(char* ssn) {
+    if(partitioning == HT_PARTITION_ORDERED) {
+        return ordered_ring_slot(ssn);
     }
+    uint32_t hash = djb2(ssn, 12);
+    return FIRST_RING_SLOT(hash % 256) + (hash >> 8) % SLOTS_PER_HASH_SLOT;
+}
 
-    ht->value_free_function = value_free_function;
-    ht->length = 0;
-    ht->num_entries = 0;
+void ht_set_partitioning(enum ht_partitioning mode) {
+    partitioning = mode;
+}
 
-    return ht;
+enum ht_partitioning ht_get_partitioning(void) {
+    return partitioning;
 }
 
-ht* ht_insert(struct ht *ht, char *key, void *value){
-    hash_t index = hash_ssn(key);
+/*
+* Full-width hash used for table placement. hash_ssn() only has 256 values and
+* decides ring ownership, so every key a node owns shares a handful of them.
+* Keys are hashed and compared in their packed form, see ssn_key.h.
+*/
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline uint64_t key_hash(ssn_key_t key) {
+    return mix64(key ^ 0x9e3779b97f4a7c15ULL);
+}
 
-    node_t *n = calloc(1, sizeof(node_t));
-    if(n == NULL){
-        perror("calloc:");
+static inline int8_t h2(uint64_t hash) {
+    return (int8_t)(hash & 0x7f);
+}
+
+static inline size_t h1(uint64_t hash) {
+    return (size_t)(hash >> 7);
+}
+
+/*
+* Group scans. Each returns a bitmask with bit i set when slot i of the group
+* matches.
+*/
+static inline uint32_t group_match(const int8_t *ctrl, int8_t byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for(int i = 0; i < GROUP_WIDTH; i++) {
+        if(ctrl[i] == byte) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+// empty and deleted both have the high bit set.
+static inline uint32_t group_match_free(const int8_t *ctrl) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+    uint32_t mask = 0;
+    for(int i = 0; i < GROUP_WIDTH; i++) {
+        if(ctrl[i] < 0) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static void table_init(struct table *t, size_t capacity) {
+    t->ctrl = aligned_alloc(GROUP_WIDTH, capacity);
+    t->keys = malloc(capacity * SSN_KEY_BYTES);
+    t->values = malloc(capacity * sizeof(void *));
+    if(t->ctrl == NULL || t->keys == NULL || t->values == NULL){
+        perror("malloc:");
         exit(EXIT_FAILURE);
     }
-    n->key = key;
-    n->value = value;
-    n->next = NULL;
+    memset(t->ctrl, CTRL_EMPTY, capacity);
+    t->capacity = capacity;
+    t->used = 0;
+    t->tombstones = 0;
+}
 
+static void table_free(struct table *t) {
+    free(t->ctrl);
+    free(t->keys);
+    free(t->values);
+    memset(t, 0, sizeof(*t));
+}
 
-    if(ht->entries[index] == NULL){
-        ht->entries[index] = n;
-        ht->length++;
-        ht->num_entries++;
+/*
+* Returns the slot holding key, or -1. Probing is triangular over groups and
+* stops at the first group that still has an empty slot.
+*/
+static ssize_t table_find(const struct table *t, ssn_key_t key, uint64_t hash) {
+    if(t->capacity == 0) {
+        return -1;
     }
 
-    else {
+    size_t group_mask = t->capacity / GROUP_WIDTH - 1;
+    size_t group = h1(hash) & group_mask;
+    int8_t tag = h2(hash);
 
-        node_t *entry = ht->entries[index], *prev;
+    for(size_t step = 1; ; step++) {
+        const int8_t *ctrl = t->ctrl + group * GROUP_WIDTH;
+        uint32_t match = group_match(ctrl, tag);
 
-        /*
-        * As long as we are not in the end of the chain and as long as we don't
-        * find duplicates.
-        */
-        while(entry != NULL && strncmp(entry->key,key, KEY_LEN) != 0){
-            prev = entry;
-            entry = entry->next;
+        while(match != 0) {
+            size_t slot = group * GROUP_WIDTH + __builtin_ctz(match);
+            if(ssn_key_load(t->keys[slot]) == key) {
+                return (ssize_t)slot;
+            }
+            match &= match - 1;
         }
 
-
-        if(entry == NULL){
-            // no duplicates found
-            entry = prev;
-            entry->next = n;
-            ht->length++;
+        if(group_match(ctrl, CTRL_EMPTY) != 0 || step > group_mask) {
+            return -1;
         }
+        group = (group + step) & group_mask;
+    }
+}
 
-        else {
-            // duplicate keys found, replace the old value.
-            if(ht->value_free_function != NULL) {
-                (ht->value_free_function)(entry->value);
+// places a key known not to be in the table, there must be a free slot.
+static void table_place(struct table *t, ssn_key_t key, void *value, uint64_t hash) {
+    size_t group_mask = t->capacity / GROUP_WIDTH - 1;
+    size_t group = h1(hash) & group_mask;
+
+    for(size_t step = 1; ; step++) {
+        uint32_t free_slots = group_match_free(t->ctrl + group * GROUP_WIDTH);
+        if(free_slots != 0) {
+            size_t slot = group * GROUP_WIDTH + __builtin_ctz(free_slots);
+            if(t->ctrl[slot] == CTRL_DELETED) {
+                t->tombstones--;
             }
+            t->ctrl[slot] = h2(hash);
+            ssn_key_store(t->keys[slot], key);
+            t->values[slot] = value;
+            t->used++;
+            return;
+        }
+        group = (group + step) & group_mask;
+    }
+}
 
-            entry->value = value;
-            free(n);
+static void table_erase(struct table *t, size_t slot) {
+    /*
+    * A lookup only continues past a group that is completely full, so when the
+    * slot's group still has an empty slot it can be marked empty directly.
+    */
+    const int8_t *group = t->ctrl + (slot & ~(size_t)(GROUP_WIDTH - 1));
+    if(group_match(group, CTRL_EMPTY) != 0) {
+        t->ctrl[slot] = CTRL_EMPTY;
+    }
+    else {
+        t->ctrl[slot] = CTRL_DELETED;
+        t->tombstones++;
+    }
+    t->used--;
+}
 
+// moves up to max_groups groups of the old table into the current one.
+static void migrate(struct ht_partition *p, size_t max_groups) {
+    if(p->old.capacity == 0) {
+        return;
+    }
+
+    // clamped before adding, migrate(p, SIZE_MAX) drains whatever is left.
+    size_t groups = p->old.capacity / GROUP_WIDTH;
+    if(max_groups > groups - p->migrate_group) {
+        max_groups = groups - p->migrate_group;
+    }
+    size_t end = p->migrate_group + max_groups;
+
+    for(size_t slot = p->migrate_group * GROUP_WIDTH; slot < end * GROUP_WIDTH; slot++) {
+        if(p->old.ctrl[slot] >= 0) {
+            ssn_key_t key = ssn_key_load(p->old.keys[slot]);
+            table_place(&p->cur, key, p->old.values[slot], key_hash(key));
+            // deleted rather than empty, keys further along a probe sequence are still found.
+            p->old.ctrl[slot] = CTRL_DELETED;
+            p->old.used--;
         }
+    }
 
+    p->migrate_group = end;
+    if(p->migrate_group == groups) {
+        table_free(&p->old);
+        p->migrate_group = 0;
+    }
+}
 
+/*
+* Starts an incremental resize when the current table would pass 7/8 load.
+* The old table keeps serving lookups until migrate() has drained it.
+*/
+static void reserve_one(struct ht_partition *p) {
+    struct table *t = &p->cur;
+    if(t->capacity == 0) {
+        table_init(t, MIN_CAPACITY); // partitions are allocated on first insert.
+        return;
+    }
+    if((t->used + t->tombstones + 1) * 8 <= t->capacity * 7) {
+        return;
     }
 
+    // a resize still in progress is finished before the next one starts.
+    migrate(p, SIZE_MAX);
 
-    return ht;
+    size_t capacity = t->capacity;
+    if((t->used + 1) * 8 > capacity * 7 / 2) {
+        capacity *= 2; // mostly live entries, grow. Otherwise rehash to clear tombstones.
+    }
+
+    p->old = p->cur;
+    p->migrate_group = 0;
+    table_init(&p->cur, capacity);
+    migrate(p, MIGRATE_GROUPS);
 }
 
-void* ht_lookup(struct ht *ht, char *key){
-    hash_t index = hash_ssn(key);
+static size_t partition_length(const struct ht_partition *p) {
+    return p->cur.used + p->old.used;
+}
 
-    if(ht->entries[index] == NULL){
-        return NULL;
+/*
+* Finds key in the partition, returns the table holding it and sets *slot, or
+* returns NULL.
+*/
+static struct table *partition_find(struct ht_partition *p, ssn_key_t key, uint64_t hash, ssize_t *slot) {
+    *slot = table_find(&p->cur, key, hash);
+    if(*slot >= 0) {
+        return &p->cur;
     }
 
-    node_t *entry = ht->entries[index];
-    if(strncmp(entry->key,key, KEY_LEN) == 0){
-        return entry->value;
+    // a key that has not been migrated yet is still in the old table.
+    *slot = table_find(&p->old, key, hash);
+    if(*slot >= 0) {
+        return &p->old;
     }
 
-    else {
+    return NULL;
+}
+
+// inserts or replaces, returns true if a new entry was created.
+static bool partition_insert(struct ht_partition *p, ssn_key_t key, void *value, free_function value_free_function) {
+    uint64_t hash = key_hash(key);
+    migrate(p, MIGRATE_GROUPS);
+
+    ssize_t slot;
+    struct table *t = partition_find(p, key, hash, &slot);
+    if(t != NULL) {
+        // duplicate keys found, replace the old value.
+        if(value_free_function != NULL) {
+            (value_free_function)(t->values[slot]);
+        }
+        t->values[slot] = value;
+        return false;
+    }
 
+    reserve_one(p);
+    table_place(&p->cur, key, value, hash);
+    return true;
+}
 
-        while(entry != NULL){
+static void partition_foreach(const struct ht_partition *p, ht_visit_function visit, void *arg) {
+    const struct table *tables[] = {&p->cur, &p->old};
+    char ssn[KEY_LEN];
 
-            if(strncmp(entry->key,key, KEY_LEN) == 0){
-                return entry->value;
+    for(size_t i = 0; i < 2; i++) {
+        const struct table *t = tables[i];
+        for(size_t slot = 0; slot < t->capacity; slot++) {
+            if(t->ctrl[slot] >= 0) {
+                ssn_unpack(ssn_key_load(t->keys[slot]), ssn);
+                visit(ssn, t->values[slot], arg);
             }
+        }
+    }
+}
 
-            entry = entry->next;
+static void table_free_values(const struct table *t, free_function value_free_function) {
+    for(size_t slot = 0; slot < t->capacity; slot++) {
+        if(t->ctrl[slot] >= 0) {
+            (value_free_function)(t->values[slot]);
         }
+    }
+}
 
+static void partition_clear(struct ht_partition *p, free_function value_free_function) {
+    if(value_free_function != NULL) {
+        table_free_values(&p->cur, value_free_function);
+        table_free_values(&p->old, value_free_function);
     }
+    table_free(&p->cur);
+    table_free(&p->old);
+    p->migrate_group = 0;
+}
 
-    return NULL;
+ht* ht_create(free_function value_free_function){
+    struct ht *ht = calloc(1, sizeof(struct ht));
+    if(ht == NULL){
+        perror("Calloc:");
+        exit(EXIT_FAILURE);
+    }
+
+    ht->value_free_function = value_free_function;
+    ht->length = 0;
+
+    return ht;
+}
+
+ht* ht_insert(struct ht *ht, char *key, void *value){
+    ssn_key_t packed;
+    if(!ssn_pack(key, &packed)) {
+        fprintf(stderr, "%.12s: key is not 12 digits, not inserted\n", key);
+        if(ht->value_free_function != NULL) {
+            (ht->value_free_function)(value);
+        }
+        return ht;
+    }
+
+    struct ht_partition *p = &ht->partitions[hash_ssn(key)];
+    if(partition_insert(p, packed, value, ht->value_free_function)) {
+        ht->length++;
+    }
+
+    return ht;
+}
+
+void* ht_lookup(struct ht *ht, char *key){
+    ssn_key_t packed;
+    if(!ssn_pack(key, &packed)) {
+        return NULL;
+    }
+
+    struct ht_partition *p = &ht->partitions[hash_ssn(key)];
+    ssize_t slot;
+    struct table *t = partition_find(p, packed, key_hash(packed), &slot);
+
+    return t != NULL ? t->values[slot] : NULL;
 }
 
 ht* ht_remove(struct ht *ht, char *key){
-    hash_t index = hash_ssn(key);
-    node_t *entry = ht->entries[index], *prev;
+    ssn_key_t packed;
+    struct table *t = NULL;
+    ssize_t slot;
+    struct ht_partition *p = &ht->partitions[hash_ssn(key)];
+
+    if(ssn_pack(key, &packed)) {
+        migrate(p, MIGRATE_GROUPS);
+        t = partition_find(p, packed, key_hash(packed), &slot);
+    }
+    if(t == NULL) {
+        fprintf(stderr, "%.12s: no such key exists in table\n",key);
+        return ht;
+    }
 
-    if(entry == NULL){
-        fprintf(stderr, "%s: no such key exists in table\n",key);
+    if(ht->value_free_function != NULL) {
+        (ht->value_free_function)(t->values[slot]);
     }
+    table_erase(t, (size_t)slot);
+    ht->length--;
 
-    else {
+    return ht;
+}
 
+void ht_destroy(struct ht *ht){
+    for(size_t i = 0; i < HT_SLOTS; i++) {
+        partition_clear(&ht->partitions[i], ht->value_free_function);
+    }
+    free(ht);
+}
 
-        if(strncmp(entry->key,key,KEY_LEN) == 0){
-            ht->entries[index] = entry->next;
-            if(ht->value_free_function != NULL) {
-                (ht->value_free_function)(entry->value);
-            }
+bool is_empty(struct ht *ht){
+    return ht->length == 0;
+}
 
-            free(entry);
-            ht->length--;
+int get_num_entries(struct ht *ht){
+    return ht->length;
+}
 
-            // bucket is empty.
-            if(ht->entries[index] == NULL) {
-                ht->num_entries--;
-            }
-        }
+int ht_slot_entries(struct ht *ht, hash_t slot){
+    return partition_length(&ht->partitions[slot]);
+}
 
-        else {
-            /*
-            * As long as we are not in the end of the chain and as long as we
-            * don't have a match, keep searching.
-            */
-            while(entry != NULL && strncmp(entry->key,key, KEY_LEN) != 0){
-                prev = entry;
-                entry = entry->next;
-            }
+void ht_slot_memory(struct ht *ht, hash_t slot, struct ht_memory *memory){
+    const struct ht_partition *p = &ht->partitions[slot];
+    size_t capacity = p->cur.capacity + p->old.capacity;
+
+    memory->table = capacity * (sizeof(int8_t) + sizeof(void *));
+    memory->keys = capacity * SSN_KEY_BYTES;
+}
+
+void ht_foreach_in_slot(struct ht *ht, hash_t slot, ht_visit_function visit, void *arg){
+    partition_foreach(&ht->partitions[slot], visit, arg);
+}
+
+struct sorted_entry {
+    ssn_key_t key;
+    void *value;
+};
+
+static int compare_entries(const void *a, const void *b) {
+    ssn_key_t x = ((const struct sorted_entry *)a)->key;
+    ssn_key_t y = ((const struct sorted_entry *)b)->key;
+    return (x > y) - (x < y);
+}
+
+size_t ht_foreach_sorted_in_slot(struct ht *ht, hash_t slot, ssn_key_t from, ssn_key_t to, ht_visit_function visit, void *arg){
+    const struct ht_partition *p = &ht->partitions[slot];
+    size_t length = partition_length(p);
+    if(length == 0) {
+        return 0;
+    }
+
+    struct sorted_entry *entries = malloc(length * sizeof(struct sorted_entry));
+    if(entries == NULL){
+        perror("malloc:");
+        exit(EXIT_FAILURE);
+    }
 
-            // if there was a match, delete that match, and unlink it from the chain.
-            if(entry != NULL) {
-                prev->next = entry->next;
-                if(ht->value_free_function != NULL) {
-                    (ht->value_free_function)(entry->value);
-                }
-                free(entry);
-                ht->length--;
+    size_t count = 0;
+    const struct table *tables[] = {&p->cur, &p->old};
+    for(size_t i = 0; i < 2; i++) {
+        const struct table *t = tables[i];
+        for(size_t s = 0; s < t->capacity; s++) {
+            if(t->ctrl[s] < 0) {
+                continue;
+            }
+            ssn_key_t key = ssn_key_load(t->keys[s]);
+            if(key >= from && key <= to) {
+                entries[count].key = key;
+                entries[count].value = t->values[s];
+                count++;
             }
         }
+    }
+    qsort(entries, count, sizeof(struct sorted_entry), compare_entries);
 
+    char ssn[KEY_LEN];
+    for(size_t i = 0; i < count; i++) {
+        ssn_unpack(entries[i].key, ssn);
+        visit(ssn, entries[i].value, arg);
     }
+    free(entries);
+    return count;
+}
 
-    return ht;
+void ht_update_in_slot(struct ht *ht, hash_t slot, ht_update_function update, void *arg){
+    struct ht_partition *p = &ht->partitions[slot];
+    struct table *tables[] = {&p->cur, &p->old};
+
+    for(size_t i = 0; i < 2; i++) {
+        struct table *t = tables[i];
+        for(size_t s = 0; s < t->capacity; s++) {
+            if(t->ctrl[s] >= 0) {
+                t->values[s] = update(t->values[s], arg);
+            }
+        }
+    }
 }
 
-void ht_destroy(struct ht *ht){
+ht_partition *ht_detach_slot(struct ht *ht, hash_t slot){
+    ht_partition *p = malloc(sizeof(ht_partition));
+    if(p == NULL){
+        perror("malloc:");
+        exit(EXIT_FAILURE);
+    }
 
-    int i = 0;
+    *p = ht->partitions[slot];
+    memset(&ht->partitions[slot], 0, sizeof(ht->partitions[slot]));
+    ht->length -= partition_length(p);
 
-    while (!is_empty(ht)) {
-        node_t *entry = ht->entries[i], *temp;
+    return p;
+}
 
+ht* ht_attach_slot(struct ht *ht, hash_t slot, ht_partition *p){
+    struct ht_partition *target = &ht->partitions[slot];
 
-        while(entry != NULL) {
-            temp = entry;
-            entry = entry->next;
-            ht = ht_remove(ht, temp->key);
-        }
+    if(partition_length(target) == 0) {
+        // common case, adopt the tables as they are.
+        partition_clear(target, NULL);
+        *target = *p;
+        ht->length += partition_length(p);
+        free(p);
+        return ht;
+    }
 
-        i++;
+    const struct table *tables[] = {&p->cur, &p->old};
+    for(size_t i = 0; i < 2; i++) {
+        const struct table *t = tables[i];
+        for(size_t s = 0; s < t->capacity; s++) {
+            if(t->ctrl[s] >= 0 && partition_insert(target, ssn_key_load(t->keys[s]), t->values[s], ht->value_free_function)) {
+                ht->length++;
+            }
+        }
     }
+    partition_clear(p, NULL);
+    free(p);
 
+    return ht;
+}
 
-    free(ht->entries);
-    free(ht);
+size_t ht_partition_size(const ht_partition *p){
+    return partition_length(p);
 }
 
-bool is_empty(struct ht *ht){
-    return ht->length == 0;
+void ht_partition_foreach(const ht_partition *p, ht_visit_function visit, void *arg){
+    partition_foreach(p, visit, arg);
 }
 
-int get_num_entries(struct ht *ht){
-    return ht->length;
+void ht_partition_destroy(ht_partition *p, free_function value_free_function){
+    partition_clear(p, value_free_function);
+    free(p);
+}
+
+static void print_key(const char *key, void *value, void *arg) {
+    printf("Key: %.12s\n", key);
 }
 
 void ht_print_keys(ht *hash_table) {
     printf("Printing all keys in the hash table:\n");
-    for (int i = 0; i < MAX_SIZE; i++) {
-        node_t *entry = hash_table->entries[i];
-        while (entry != NULL) {
-            printf("Key: %s\n", entry->key);
-            entry = entry->next; // Move to the next node in the chain
-        }
+    for (int i = 0; i < HT_SLOTS; i++) {
+        ht_foreach_in_slot(hash_table, i, print_key, NULL);
     }
-}
\ No newline at end of file
+}
@@ -18,18 +18,55 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <string.h>
+#include "ssn_key.h"
 
 typedef struct ht ht;
 typedef struct entry entry;
+typedef struct ht_partition ht_partition;
 typedef void (*free_function)();
+typedef void (*ht_visit_function)(const char *key, void *value, void *arg);
+typedef void *(*ht_update_function)(void *value, void *arg);
+
+/*
+* Bytes a slot's tables allocate, including free slots and a table being
+* drained by a resize.
+*/
+struct ht_memory {
+    size_t table;   // control bytes and value pointers.
+    size_t keys;    // packed keys stored inline.
+};
 
-#define MAX_SIZE 256
 #define KEY_LEN 12
 #define hash_t uint8_t
+#define HT_SLOTS 256 // one partition per value of hash_ssn()
+#define ORDERED_BASE_YEAR 1900 // first birth year of the ordered partitioning, two slots per year
+
+/*
+* Ring slots, the unit nodes own ranges of. A hash slot is the top 8 bits of
+* a ring slot, so a range boundary may fall inside a hash slot and two nodes
+* then share its partition between them.
+*/
+#define slot_t uint16_t
+#define SLOT_BITS 16
+#define RING_SLOTS (1 << SLOT_BITS)
+#define SLOTS_PER_HASH_SLOT (RING_SLOTS / HT_SLOTS)
+#define HASH_SLOT_OF(ring_slot) ((hash_t)((ring_slot) / SLOTS_PER_HASH_SLOT))
+#define FIRST_RING_SLOT(hash_slot) ((slot_t)((hash_slot) * SLOTS_PER_HASH_SLOT))
+#define LAST_RING_SLOT(hash_slot) ((slot_t)(FIRST_RING_SLOT(hash_slot) + SLOTS_PER_HASH_SLOT - 1))
+
+/*
+* How keys are mapped to the slots. Every node of a ring must use the same
+* mode.
+*/
+enum ht_partitioning {
+    HT_PARTITION_HASH = 0,  // djb2 of the key, spreads keys evenly.
+    HT_PARTITION_ORDERED = 1, // birth year and half year, adjacent SSNs share a slot.
+};
 
 /**
 * Function:     ht_create()
-* Description:  Initializes an empty hashtable.
+* Description:  Initializes an empty hashtable. The table grows on demand, a resize
+*               moves entries over a few groups at a time during later operations.
 * Input:        *value_free_function - a function aimed to free the value of the key-value set
 *               or NULL if wanting to free outside of remove/destroy functions.
 * Returns:      pointer to a struct ht
@@ -42,7 +79,9 @@ ht* ht_create(free_function val_free_function);
 *               in table, then the corresponding value of that key will be replaced
 *               with the new value. NOTE - if no value_free_function was specified
 *               at creation of the table, the old value needs to be freed outside
-*               of this function.
+*               of this function. The key is stored packed into 5 bytes, so the caller
+*               keeps ownership of the key buffer. A key that is not 12 ASCII digits
+*               is rejected and its value freed with the value_free_function.
 *
 * Input:        *ht - pointer to a struct ht
                 *key - character pointer or uint8_t* array, 12 bytes, no null-termination.
@@ -84,7 +123,36 @@ void *ht_lookup(struct ht *ht, char *key);
 **/
 void ht_destroy(struct ht *ht);
 
+/**
+* Function:     hash_ssn()
+* Description:  The hash slot of a key under the current partitioning. In the
+*               ordered mode slots follow SSN order: slot = (year - 1900) * 2,
+*               plus one for months 07 and later, clamped to 0..255.
+* Input:        *ssn - 12 ASCII digits, no null-termination
+* Returns:      the slot.
+**/
 hash_t hash_ssn(char* ssn);
+
+/**
+* Function:     ring_slot()
+* Description:  The ring slot of a key, its hash slot followed by 8 more bits:
+*               the next byte of the djb2 hash, or in the ordered mode the day
+*               within the half year so ring slots follow SSN order too.
+*               HASH_SLOT_OF(ring_slot(ssn)) is always hash_ssn(ssn).
+* Input:        *ssn - 12 ASCII digits, no null-termination
+* Returns:      the ring slot.
+**/
+slot_t ring_slot(char* ssn);
+
+/**
+* Function:     ht_set_partitioning()
+* Description:  Selects how hash_ssn() maps keys. Must be called before any
+*               table is created.
+* Input:        mode - the partitioning
+* Returns:      Nothing.
+**/
+void ht_set_partitioning(enum ht_partitioning mode);
+enum ht_partitioning ht_get_partitioning(void);
 /**
 * Function:     get_num_entries()
 * Description:
@@ -102,4 +170,114 @@ int get_num_entries(struct ht *ht);
 **/
 bool is_empty(struct ht *ht);
 void ht_print_keys(ht *hash_table);
+
+/**
+* Function:     ht_slot_entries()
+* Description:  The table is partitioned by hash_ssn(), one partition per ring hash slot.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot
+*
+* Returns:      the number of entries whose key hashes to slot.
+**/
+int ht_slot_entries(struct ht *ht, hash_t slot);
+
+/**
+* Function:     ht_slot_memory()
+* Description:  Reports how much memory the tables of a slot hold.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot
+*               *memory - filled in with the byte counts
+* Returns:      Nothing.
+**/
+void ht_slot_memory(struct ht *ht, hash_t slot, struct ht_memory *memory);
+
+/**
+* Function:     ht_foreach_in_slot()
+* Description:  Calls visit(key, value, arg) for every entry whose key hashes to slot.
+*               The key passed to visit is 12 bytes without null-termination. The table
+*               must not be modified from inside visit.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot
+*               visit - callback
+*               *arg - passed through to visit
+* Returns:      Nothing.
+**/
+void ht_foreach_in_slot(struct ht *ht, hash_t slot, ht_visit_function visit, void *arg);
+
+/**
+* Function:     ht_foreach_sorted_in_slot()
+* Description:  Like ht_foreach_in_slot() but only visits keys between from and
+*               to, inclusive, in ascending key order. The matching entries are
+*               sorted on every call.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot
+*               from, to - packed key range
+*               visit - callback
+*               *arg - passed through to visit
+* Returns:      the number of entries visited.
+**/
+size_t ht_foreach_sorted_in_slot(struct ht *ht, hash_t slot, ssn_key_t from, ssn_key_t to, ht_visit_function visit, void *arg);
+
+/**
+* Function:     ht_update_in_slot()
+* Description:  Replaces the value of every entry whose key hashes to slot with
+*               update(value, arg). The old value is not freed, update takes
+*               over its ownership. Keys are not touched, so update can move a
+*               value without rehashing.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot
+*               update - callback returning the new value
+*               *arg - passed through to update
+* Returns:      Nothing.
+**/
+void ht_update_in_slot(struct ht *ht, hash_t slot, ht_update_function update, void *arg);
+
+/**
+* Function:     ht_detach_slot()
+* Description:  Removes every entry of a slot from the table as one unit, without
+*               freeing any values. The partition can be iterated, attached to
+*               a table again or destroyed.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot
+* Returns:      the detached partition, empty if the slot had no entries.
+**/
+ht_partition *ht_detach_slot(struct ht *ht, hash_t slot);
+
+/**
+* Function:     ht_attach_slot()
+* Description:  Moves all entries of a detached partition into slot. If the slot is
+*               empty the partition is adopted as is, otherwise its entries are
+*               inserted one by one. The partition is consumed.
+* Input:        *ht - pointer to a struct ht
+*               slot - ring hash slot the partition was detached from
+*               *p - detached partition
+* Returns:      pointer to the modified table.
+**/
+ht* ht_attach_slot(struct ht *ht, hash_t slot, ht_partition *p);
+
+/**
+* Function:     ht_partition_size()
+* Input:        *p - detached partition
+* Returns:      the number of entries in the partition.
+**/
+size_t ht_partition_size(const ht_partition *p);
+
+/**
+* Function:     ht_partition_foreach()
+* Description:  Calls visit(key, value, arg) for every entry of a detached partition.
+* Input:        *p - detached partition
+*               visit - callback
+*               *arg - passed through to visit
+* Returns:      Nothing.
+**/
+void ht_partition_foreach(const ht_partition *p, ht_visit_function visit, void *arg);
+
+/**
+* Function:     ht_partition_destroy()
+* Description:  Frees a detached partition.
+* Input:        *p - detached partition
+*               value_free_function - called for every value, or NULL to keep them
+* Returns:      Nothing.
+**/
+void ht_partition_destroy(ht_partition *p, free_function value_free_function);
 #endif
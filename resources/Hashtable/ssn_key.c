@@ -0,0 +1,144 @@
+/**
+* File: ssn_key.c
+* Parsing and formatting of packed SSN keys. The vector paths subtract '0' from
+* all digits at once, check them against 9 and fold digit pairs with multiply-add
+* instructions: pairs into 2 digit numbers, those into 4 digit numbers, which are
+* then combined into the 12 digit value.
+**/
+#include "ssn_key.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SSN_KEY_X86
+#endif
+
+static bool scalar_pack(const char *ssn, ssn_key_t *key) {
+    ssn_key_t value = 0;
+    for(int i = 0; i < SSN_DIGITS; i++) {
+        uint8_t digit = (uint8_t)ssn[i] - '0';
+        if(digit > 9) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+    *key = value;
+    return true;
+}
+
+#ifdef SSN_KEY_X86
+
+static inline ssn_key_t combine_quads(uint32_t high, uint32_t mid, uint32_t low) {
+    return (ssn_key_t)high * 100000000ULL + (ssn_key_t)mid * 10000ULL + low;
+}
+
+__attribute__((target("ssse3")))
+static bool ssse3_pack(const char *ssn, ssn_key_t *key) {
+    // the 4 bytes after the key are padded with valid digits so only 12 bytes are read.
+    char padded[16];
+    memset(padded + SSN_DIGITS, '0', sizeof(padded) - SSN_DIGITS);
+    memcpy(padded, ssn, SSN_DIGITS);
+
+    __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)padded), _mm_set1_epi8('0'));
+    // bytes below '0' wrap around to large values, so one unsigned compare checks both ends.
+    __m128i above_nine = _mm_subs_epu8(digits, _mm_set1_epi8(9));
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(above_nine, _mm_setzero_si128())) != 0xffff) {
+        return false;
+    }
+
+    __m128i pairs = _mm_maddubs_epi16(digits, _mm_set1_epi16(0x010a));   // d0 * 10 + d1
+    __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010064));   // p0 * 100 + p1
+
+    *key = combine_quads((uint32_t)_mm_cvtsi128_si32(quads),
+                         (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(quads, 4)),
+                         (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(quads, 8)));
+    return true;
+}
+
+// packs the keys at a and b, invalid ones become SSN_KEY_INVALID.
+__attribute__((target("avx2")))
+static int avx2_pack_two(const char *a, const char *b, ssn_key_t *keys) {
+    char padded[32];
+    memset(padded, '0', sizeof(padded));
+    memcpy(padded, a, SSN_DIGITS);
+    memcpy(padded + 16, b, SSN_DIGITS);
+
+    __m256i digits = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)padded), _mm256_set1_epi8('0'));
+    __m256i above_nine = _mm256_subs_epu8(digits, _mm256_set1_epi8(9));
+    uint32_t valid = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(above_nine, _mm256_setzero_si256()));
+
+    __m256i pairs = _mm256_maddubs_epi16(digits, _mm256_set1_epi16(0x010a));
+    __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010064));
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, quads);
+
+    keys[0] = (valid & 0xffff) == 0xffff ? combine_quads(lanes[0], lanes[1], lanes[2]) : SSN_KEY_INVALID;
+    keys[1] = (valid >> 16) == 0xffff ? combine_quads(lanes[4], lanes[5], lanes[6]) : SSN_KEY_INVALID;
+    return (keys[0] != SSN_KEY_INVALID) + (keys[1] != SSN_KEY_INVALID);
+}
+
+static bool cpu_has_ssse3(void) {
+    static int supported = -1;
+    if(supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("ssse3") != 0;
+    }
+    return supported;
+}
+
+static bool cpu_has_avx2(void) {
+    static int supported = -1;
+    if(supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") != 0;
+    }
+    return supported;
+}
+
+#endif
+
+bool ssn_pack(const char *ssn, ssn_key_t *key) {
+#ifdef SSN_KEY_X86
+    if(cpu_has_ssse3()) {
+        return ssse3_pack(ssn, key);
+    }
+#endif
+    return scalar_pack(ssn, key);
+}
+
+size_t ssn_pack_batch(const char *ssns, size_t stride, size_t count, ssn_key_t *keys) {
+    size_t valid = 0;
+    size_t i = 0;
+
+#ifdef SSN_KEY_X86
+    if(cpu_has_avx2()) {
+        for(; i + 2 <= count; i += 2) {
+            valid += avx2_pack_two(ssns + i * stride, ssns + (i + 1) * stride, keys + i);
+        }
+    }
+#endif
+
+    for(; i < count; i++) {
+        if(ssn_pack(ssns + i * stride, &keys[i])) {
+            valid++;
+        }
+        else {
+            keys[i] = SSN_KEY_INVALID;
+        }
+    }
+    return valid;
+}
+
+static void format_quad(uint32_t quad, char *out) {
+    out[0] = '0' + quad / 1000;
+    out[1] = '0' + quad / 100 % 10;
+    out[2] = '0' + quad / 10 % 10;
+    out[3] = '0' + quad % 10;
+}
+
+void ssn_unpack(ssn_key_t key, char *ssn) {
+    format_quad((uint32_t)(key / 100000000ULL), ssn);
+    format_quad((uint32_t)(key / 10000ULL % 10000ULL), ssn + 4);
+    format_quad((uint32_t)(key % 10000ULL), ssn + 8);
+}
@@ -0,0 +1,66 @@
+/**
+* File: ssn_key.h
+* Compact binary form of the 12 digit SSN keys. Twelve decimal digits are below
+* 2^40, so a key fits in 5 bytes and compares as a single integer.
+**/
+
+#ifndef __SSN_KEY_H
+#define __SSN_KEY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+typedef uint64_t ssn_key_t;
+
+#define SSN_DIGITS 12
+#define SSN_KEY_BYTES 5
+#define SSN_KEY_INVALID UINT64_MAX
+
+/**
+* Function:     ssn_pack()
+* Description:  Validates that ssn is 12 ASCII digits and converts it to its packed
+*               form. Uses SSSE3 when the CPU has it.
+* Input:        *ssn - 12 bytes, no null-termination
+*               *key - set to the packed key on success
+* Returns:      true if ssn was valid.
+**/
+bool ssn_pack(const char *ssn, ssn_key_t *key);
+
+/**
+* Function:     ssn_pack_batch()
+* Description:  Packs count keys stored stride bytes apart, two at a time with AVX2
+*               when the CPU has it. Invalid keys are set to SSN_KEY_INVALID.
+* Input:        *ssns - first key
+*               stride - distance in bytes between two keys, at least 12
+*               count - number of keys
+*               *keys - output array of count keys
+* Returns:      the number of valid keys.
+**/
+size_t ssn_pack_batch(const char *ssns, size_t stride, size_t count, ssn_key_t *keys);
+
+/**
+* Function:     ssn_unpack()
+* Description:  Writes the 12 ASCII digits of a packed key.
+* Input:        key - packed key
+*               *ssn - 12 byte output buffer, no null-termination is written
+* Returns:      Nothing.
+**/
+void ssn_unpack(ssn_key_t key, char *ssn);
+
+/**
+* Function:     ssn_key_load()/ssn_key_store()
+* Description:  Read and write the 5 byte inline form used by the hash table.
+**/
+static inline ssn_key_t ssn_key_load(const uint8_t *bytes) {
+    return (ssn_key_t)bytes[0] | (ssn_key_t)bytes[1] << 8 | (ssn_key_t)bytes[2] << 16 |
+           (ssn_key_t)bytes[3] << 24 | (ssn_key_t)bytes[4] << 32;
+}
+
+static inline void ssn_key_store(uint8_t *bytes, ssn_key_t key) {
+    for(int i = 0; i < SSN_KEY_BYTES; i++) {
+        bytes[i] = (uint8_t)(key >> (8 * i));
+    }
+}
+
+#endif
@@ -14,11 +14,19 @@
 #define NET_NEW_RANGE 6
 #define NET_LEAVING 7
 #define NET_NEW_RANGE_RESPONSE 8
+#define NET_ANNOUNCE 9
+#define NET_FORWARD 10
+#define NET_BACKWARD 11
+#define NET_WIDE_JOIN 12
+#define NET_WIDE_JOIN_RESPONSE 13
+#define NET_WIDE_NEW_RANGE 14
 
 #define VAL_INSERT 100
 #define VAL_REMOVE 101
 #define VAL_LOOKUP 102
 #define VAL_LOOKUP_RESPONSE 103
+#define VAL_RANGE_SCAN 104
+#define VAL_RANGE_SCAN_DONE 105
 
 #define STUN_LOOKUP 200
 #define STUN_RESPONSE 201
@@ -90,6 +98,92 @@ struct NET_LEAVING_PDU
 };
 #pragma pack(pop)
 
+/*
+ * NET_JOIN, NET_JOIN_RESPONSE and NET_NEW_RANGE with ranges of 16-bit ring slots instead of the 256
+ * hash slots, for rings whose nodes all run with ring extensions. The classic PDUs keep their layout.
+ */
+#pragma pack(push, 1)
+struct NET_WIDE_JOIN_PDU
+{
+	uint8_t type;
+	uint32_t src_address;
+	uint16_t src_port;
+	uint16_t max_span; // in ring slots, network byte order
+	uint32_t max_address;
+	uint16_t max_port;
+	uint32_t max_load; // entries and recent requests of the node at max_address, network byte order
+};
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+struct NET_WIDE_JOIN_RESPONSE_PDU
+{
+	uint8_t type;
+	uint32_t next_address;
+	uint16_t next_port;
+	uint16_t range_start; // ring slots, network byte order
+	uint16_t range_end;
+	uint32_t version; // highest slot owner version the sender has seen, network byte order
+};
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+struct NET_WIDE_NEW_RANGE_PDU
+{
+	uint8_t type;
+	uint16_t range_start; // ring slots, network byte order
+	uint16_t range_end;
+	uint32_t version; // highest slot owner version the sender has seen, network byte order
+};
+#pragma pack(pop)
+
+/*
+ * Tells the other nodes which range a node holds and where it takes forwarded requests, for their
+ * finger tables and slot owner maps. Sent to the successor and passed on around the ring until it
+ * is back at its origin, hops ends a trip whose origin has left. The version orders the claims of
+ * different nodes on a slot, a node announces a new range with a version above any it has seen.
+ */
+#pragma pack(push, 1)
+struct NET_ANNOUNCE_PDU
+{
+	uint8_t type;
+	uint32_t address;
+	uint16_t port;	      // peer port
+	uint16_t range_start; // ring slots, network byte order
+	uint16_t range_end;
+	uint16_t hops;
+	uint16_t udp_port;
+	uint32_t version;
+};
+#pragma pack(pop)
+
+/*
+ * A request passed on successor-wise by a node that does not hold its slot: by UDP straight to the
+ * owner in the sender's map, or on a finger or successor connection. The VAL_INSERT, VAL_REMOVE,
+ * VAL_LOOKUP or VAL_RANGE_SCAN PDU follows unchanged. A receiver that does not hold the slot either
+ * keeps passing it on successor-wise, so it cannot circle between two nodes with stale maps, and
+ * drops it once hops says it has been around the ring.
+ */
+#define NET_FORWARD_HEADER 3 // type and hops, the request follows
+
+struct NET_FORWARD_PDU
+{
+	uint8_t type;
+	uint16_t hops; // network byte order
+	uint8_t *request;
+};
+
+/*
+ * A request passed on to the predecessor, the owner is closer that way. Like NET_FORWARD, only
+ * predecessor-wise, it never turns around.
+ */
+struct NET_BACKWARD_PDU
+{
+	uint8_t type;
+	uint16_t hops; // network byte order
+	uint8_t *request;
+};
+
 struct VAL_INSERT_PDU
 {
 	uint8_t type;
@@ -116,6 +210,33 @@ struct VAL_LOOKUP_PDU
 };
 #pragma pack(pop)
 
+/*
+ * Asks for every entry with an SSN between ssn_from and ssn_to, inclusive. Matches are sent
+ * to the sender as VAL_LOOKUP_RESPONSE PDUs, in SSN order per node, and every node that took
+ * part ends with a VAL_RANGE_SCAN_DONE for the slots it covered. The PDU travels the ring to
+ * the owner of the first slot, which sets started, and on through the owners of the later slots.
+ */
+#pragma pack(push, 1)
+struct VAL_RANGE_SCAN_PDU
+{
+	uint8_t type;
+	uint8_t ssn_from[SSN_LENGTH];
+	uint8_t ssn_to[SSN_LENGTH];
+	uint32_t sender_address;
+	uint16_t sender_port;
+	uint8_t started;
+};
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+struct VAL_RANGE_SCAN_DONE_PDU
+{
+	uint8_t type;
+	uint16_t slot_start; // ring slots, network byte order
+	uint16_t slot_end;
+	uint32_t entries;     // network byte order
+};
+#pragma pack(pop)
 
 struct VAL_LOOKUP_RESPONSE_PDU
 {
@@ -0,0 +1,127 @@
+#include "byte_ring.h"
+#include "memory.h"
+#include "util.h"
+#include <string.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Copies the unread bytes to the start of a new buffer of the given capacity.
+ */
+static void byte_ring_resize(struct byte_ring *ring, size_t capacity)
+{
+	uint8_t *data = malloc(capacity);
+	if (!data)
+		exit_with_error("Failed to allocate receive buffer", NULL);
+
+	size_t first = ring->capacity - ring->head;
+	if (first > ring->length)
+		first = ring->length;
+	if (ring->length > 0)
+	{
+		memcpy(data, ring->data + ring->head, first);
+		memcpy(data + first, ring->data, ring->length - first);
+	}
+
+	memory_track(MEM_IO, (ssize_t)capacity - (ssize_t)ring->capacity);
+	free(ring->data);
+	ring->data = data;
+	ring->capacity = capacity;
+	ring->head = 0;
+}
+
+void byte_ring_free(struct byte_ring *ring)
+{
+	memory_track(MEM_IO, -(ssize_t)ring->capacity);
+	free(ring->data);
+	ring->data = NULL;
+	ring->capacity = 0;
+	ring->head = 0;
+	ring->length = 0;
+}
+
+void byte_ring_clear(struct byte_ring *ring)
+{
+	ring->head = 0;
+	ring->length = 0;
+}
+
+ssize_t byte_ring_read(struct byte_ring *ring, int fd)
+{
+	if (ring->capacity == 0)
+		byte_ring_resize(ring, BYTE_RING_INITIAL_CAPACITY);
+	else if (ring->capacity - ring->length < BYTE_RING_MIN_READ)
+		byte_ring_resize(ring, ring->capacity * 2);
+	else if (ring->length == 0)
+		ring->head = 0; // start over at the front so reads and PDUs rarely wrap
+
+	// the free space is the tail up to the end of the buffer and then the front up to the head
+	size_t tail = (ring->head + ring->length) & (ring->capacity - 1);
+	size_t free_bytes = ring->capacity - ring->length;
+	struct iovec iov[2];
+	int iovcnt = 1;
+	iov[0].iov_base = ring->data + tail;
+	iov[0].iov_len = ring->capacity - tail;
+	if (iov[0].iov_len >= free_bytes)
+		iov[0].iov_len = free_bytes;
+	else
+	{
+		iov[1].iov_base = ring->data;
+		iov[1].iov_len = free_bytes - iov[0].iov_len;
+		iovcnt = 2;
+	}
+
+	ssize_t bytes = readv(fd, iov, iovcnt);
+	if (bytes > 0)
+		ring->length += bytes;
+	return bytes;
+}
+
+void byte_ring_append(struct byte_ring *ring, const void *data, size_t length)
+{
+	size_t capacity = ring->capacity ? ring->capacity : BYTE_RING_INITIAL_CAPACITY;
+	while (capacity - ring->length < length)
+		capacity *= 2;
+	if (capacity != ring->capacity)
+		byte_ring_resize(ring, capacity);
+	else if (ring->length == 0)
+		ring->head = 0;
+
+	size_t tail = (ring->head + ring->length) & (ring->capacity - 1);
+	size_t first = ring->capacity - tail;
+	if (first > length)
+		first = length;
+	memcpy(ring->data + tail, data, first);
+	memcpy(ring->data, (const uint8_t *)data + first, length - first);
+	ring->length += length;
+}
+
+int byte_ring_spans(const struct byte_ring *ring, struct iovec iov[2])
+{
+	if (ring->length == 0)
+		return 0;
+
+	// the unread bytes are the head up to the end of the buffer and then the front
+	iov[0].iov_base = ring->data + ring->head;
+	iov[0].iov_len = ring->capacity - ring->head;
+	if (iov[0].iov_len >= ring->length)
+	{
+		iov[0].iov_len = ring->length;
+		return 1;
+	}
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = ring->length - iov[0].iov_len;
+	return 2;
+}
+
+uint8_t *byte_ring_contiguous(struct byte_ring *ring, size_t length)
+{
+	if (ring->head + length > ring->capacity)
+		byte_ring_resize(ring, ring->capacity);
+	return ring->data + ring->head;
+}
+
+void byte_ring_consume(struct byte_ring *ring, size_t length)
+{
+	ring->head = (ring->head + length) & (ring->capacity - 1);
+	ring->length -= length;
+}
@@ -0,0 +1,79 @@
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define BYTE_RING_INITIAL_CAPACITY (64 * 1024)
+#define BYTE_RING_MIN_READ (16 * 1024) // grow rather than read fewer bytes than this
+
+/**
+ * @brief Receive or send buffer of a stream connection.
+ *
+ * Bytes are read in at the tail and PDUs are taken off the head. A PDU that is only partly
+ * received stays in the ring until the rest arrives. As a send queue PDUs are appended at the
+ * tail and written from the head, as many as the socket takes per call. The capacity is a
+ * power of two and doubles when the free space gets small, the buffer is allocated on first use.
+ */
+struct byte_ring
+{
+	uint8_t *data;
+	size_t capacity;
+	size_t head;   // offset of the first unread byte
+	size_t length; // unread bytes
+};
+
+/**
+ * @brief Frees the buffer, the ring can be used again afterwards.
+ */
+void byte_ring_free(struct byte_ring *ring);
+
+/**
+ * @brief Drops all unread bytes, used when the connection is replaced.
+ */
+void byte_ring_clear(struct byte_ring *ring);
+
+/**
+ * @brief Reads what the socket has into the free space of the ring, growing it first if needed.
+ *
+ * @param ring The ring.
+ * @param fd The socket.
+ * @return ssize_t Bytes read, 0 when the peer closed the connection, -1 on error.
+ */
+ssize_t byte_ring_read(struct byte_ring *ring, int fd);
+
+/**
+ * @brief Appends bytes at the tail, growing the ring if they do not fit.
+ */
+void byte_ring_append(struct byte_ring *ring, const void *data, size_t length);
+
+/**
+ * @brief Describes the unread bytes for a vectored write, they wrap around at most once.
+ *
+ * @return int Number of entries of iov used, 0 if the ring is empty.
+ */
+int byte_ring_spans(const struct byte_ring *ring, struct iovec iov[2]);
+
+/**
+ * @brief Byte at offset from the head, offset must be below length.
+ */
+static inline uint8_t byte_ring_peek(const struct byte_ring *ring, size_t offset)
+{
+	return ring->data[(ring->head + offset) & (ring->capacity - 1)];
+}
+
+/**
+ * @brief Makes the first length bytes contiguous, moving the data if they wrap around.
+ *
+ * @return uint8_t* Pointer to the head, valid until the next read into the ring.
+ */
+uint8_t *byte_ring_contiguous(struct byte_ring *ring, size_t length);
+
+/**
+ * @brief Removes length bytes from the head. The bytes stay in place until the next read.
+ */
+void byte_ring_consume(struct byte_ring *ring, size_t length);
+
+#endif // BYTE_RING_H
@@ -1,7 +1,18 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+
 #include "c_node.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define SHUTDOWN_DRAIN_TIMEOUT 5000 // milliseconds a step of leaving the ring may take
 
 // To signal that shutdown is requested
 volatile sig_atomic_t shutdown_requested = false;
+// To signal that a memory report is requested
+volatile sig_atomic_t memory_report_requested = false;
+
+void q8(struct self_data *self_data);
 
 /**
  * @brief Signal handler to set the shutdown flag.
@@ -9,7 +20,14 @@ volatile sig_atomic_t shutdown_requested = false;
 void set_shutdown()
 {
 	shutdown_requested = true;
-	printf("\tShutdown requested\n");
+}
+
+/**
+ * @brief Signal handler to request a memory report from the main loop.
+ */
+void set_memory_report()
+{
+	memory_report_requested = true;
 }
 
 /**
@@ -22,11 +40,10 @@ void set_shutdown()
  */
 int handle_val_insert(uint8_t *buffer, size_t bytes_received, struct self_data *self_data)
 {
-	printf("\033[0;32m[VAL INSERT] \033[0m");
-	print_state(9);
+	log_debug("[VAL INSERT] [Q9]");
 	if (bytes_received < 1 + SSN_LENGTH + 1) // Minimum size check
 	{
-		fprintf(stderr, "Invalid VAL_INSERT_PDU received\n");
+		log_warn("Invalid VAL_INSERT_PDU received");
 		return -1;
 	}
 
@@ -40,45 +57,27 @@ int handle_val_insert(uint8_t *buffer, size_t bytes_received, struct self_data *
 
 	// Get name length
 	pdu.name_length = buffer[offset++];
-	if (offset + pdu.name_length > bytes_received)
-	{
-		fprintf(stderr, "Invalid VAL_INSERT_PDU received\n");
-		return -1;
-	}
-	// allocate memory for dynamic name
-	pdu.name = malloc(pdu.name_length);
-	if (pdu.name == NULL)
+	if (offset + pdu.name_length + 1 > bytes_received) // name and the email length byte
 	{
-		perror("malloc");
+		log_warn("Invalid VAL_INSERT_PDU received");
 		return -1;
 	}
-	// Copy name
-	memcpy(pdu.name, &buffer[offset], pdu.name_length);
+	// name and email point into the receive buffer, they are copied once when stored
+	pdu.name = &buffer[offset];
 	offset += pdu.name_length;
 
 	// Get email length
 	pdu.email_length = buffer[offset++];
 	if (offset + pdu.email_length > bytes_received)
 	{
+		log_warn("Invalid VAL_INSERT_PDU received");
 		return -1;
 	}
-	// allocate memory for dynamic email
-	pdu.email = malloc(pdu.email_length);
-	if (pdu.email == NULL)
-	{
-		perror("malloc");
-		free(pdu.name);
-		return -1;
-	}
-	// copy email
-	memcpy(pdu.email, &buffer[offset], pdu.email_length);
+	pdu.email = &buffer[offset];
 
-	// Process the PDU
-	handle_ht_insert(self_data, pdu);
+	// Process the PDU, forwarded as the bytes it came in
+	handle_ht_insert(self_data, pdu, buffer, offset + pdu.email_length);
 
-	// Free dynamically allocated memory
-	free(pdu.name);
-	free(pdu.email);
 	// Return the total size of the PDU
 	return (1 + SSN_LENGTH + 1 + pdu.name_length + 1 + pdu.email_length);
 }
@@ -91,8 +90,7 @@ int handle_val_insert(uint8_t *buffer, size_t bytes_received, struct self_data *
  */
 void handle_val_lookup(struct VAL_LOOKUP_PDU pdu, struct self_data *self_data)
 {
-	printf("\033[0;32m[VAL LOOKUP] \033[0m");
-	print_state(9);
+	log_debug("[VAL LOOKUP] [Q9]");
 	handle_ht_lookup(self_data, pdu);
 }
 
@@ -104,26 +102,83 @@ void handle_val_lookup(struct VAL_LOOKUP_PDU pdu, struct self_data *self_data)
  */
 void handle_val_remove(struct VAL_REMOVE_PDU pdu, struct self_data *self_data)
 {
-	printf("\033[0;32m[VAL DELETE] \033[0m");
-	print_state(9);
+	log_debug("[VAL DELETE] [Q9]");
 	// Empty implementation
 	handle_ht_remove(self_data, pdu);
 }
 
 /**
- * @brief Handles the NET_JOIN PDU.
+ * @brief Span of the own range as the ring's join PDUs carry it: in ring slots with ring extensions,
+ *        in hash slots in a classic NET_JOIN.
+ */
+static int range_span(const struct self_data *self_data)
+{
+	if (self_data->config.ring_extensions)
+		return self_data->range_end - self_data->range_start;
+	return HASH_SLOT_OF(self_data->range_end) - HASH_SLOT_OF(self_data->range_start);
+}
+
+/**
+ * @brief Whether the node at max_address of a join should be this one instead. With ring extensions
+ *        the load decides and the span breaks ties, a classic NET_JOIN only carries the span. A range
+ *        of one slot cannot be split and is never chosen.
+ */
+static bool takes_join(const struct NET_WIDE_JOIN_PDU *pdu, int self_range, uint32_t self_load, bool ring_extensions)
+{
+	if (self_range == 0)
+		return false;
+	if (!ring_extensions)
+		return ntohs(pdu->max_span) < self_range;
+	return ntohl(pdu->max_load) < self_load || (ntohl(pdu->max_load) == self_load && ntohs(pdu->max_span) < self_range);
+}
+
+/**
+ * @brief Passes a join on to the successor, as a classic NET_JOIN unless the ring uses extensions.
+ */
+static void forward_join(struct self_data *self_data, const struct NET_WIDE_JOIN_PDU *pdu)
+{
+	if (self_data->config.ring_extensions)
+	{
+		send_tcp_pdu(&self_data->successor, pdu, sizeof(*pdu));
+		return;
+	}
+	struct NET_JOIN_PDU classic = {
+	    .type = NET_JOIN,
+	    .src_address = pdu->src_address,
+	    .src_port = pdu->src_port,
+	    .max_span = ntohs(pdu->max_span),
+	    .max_address = pdu->max_address,
+	    .max_port = pdu->max_port,
+	};
+	send_tcp_pdu(&self_data->successor, &classic, sizeof(classic));
+}
+
+/**
+ * @brief Handles the NET_WIDE_JOIN PDU, and a NET_JOIN taken into one.
  *
- * @param pdu The NET_JOIN_PDU structure.
+ * @param pdu The NET_WIDE_JOIN_PDU structure, max_span in the units of range_span().
  * @param self_data Pointer to the self_data structure.
  */
-void handle_net_join(struct NET_JOIN_PDU pdu, struct self_data *self_data)
+void handle_net_wide_join(struct NET_WIDE_JOIN_PDU pdu, struct self_data *self_data)
 {
-	int self_range = self_data->range_end - self_data->range_start;
+	int self_range = range_span(self_data);
+	uint32_t self_load = load_of_range(self_data);
 
 	print_state(12);
+	if (!ring_settled(self_data))
+	{ // a connection is still being set up, the join is handled once the ring has settled
+		if (self_data->join_deferred)
+		{
+			log_warn("\tAnother join is waiting, NET_JOIN dropped");
+			return;
+		}
+		log_info("\tRing is changing, NET_JOIN deferred");
+		self_data->deferred_join = pdu;
+		self_data->join_deferred = true;
+		return;
+	}
 	if ((self_data->predecessor.socket == 0) && (self_data->successor.socket == 0))
 	{ // alone in network
-		printf("\t");
 		print_state(5);
 		self_data->predecessor.dest_addr.sin_addr.s_addr = pdu.src_address;
 		self_data->predecessor.dest_addr.sin_port = pdu.src_port;
@@ -133,15 +188,15 @@ void handle_net_join(struct NET_JOIN_PDU pdu, struct self_data *self_data)
 		self_data->successor.dest_addr.sin_port = pdu.src_port;
 		self_data->successor.dest_addr.sin_family = AF_INET;
 
-		// Connect to sucessor
+		// Connect to sucessor, the response and the upper half are queued until it is up
 		connect_to_tcp(self_data);
 
 		// transfer upper half
-		printf("\tSending net_join_respons\n");
+		log_info("\tSending net_join_respons");
 		send_new_range_and_entries(self_data, self_data->my_ip_addr.s_addr, self_data->listening.dest_addr.sin_port);
 
-		// accept predecessor
-		accept_predecessor_connection(self_data);
+		// the new node connects as predecessor once it has the response
+		await_predecessor_connection(self_data);
 		// q6
 	}
 	else if (self_data->predecessor.socket == 0 || self_data->successor.socket == 0) // this should be impossible
@@ -149,16 +204,24 @@ void handle_net_join(struct NET_JOIN_PDU pdu, struct self_data *self_data)
 		exit_with_error("One of predecessor and successor is 0 but not both", self_data);
 	}
 
+	else if ((pdu.max_address == self_data->my_ip_addr.s_addr) && (pdu.max_port == self_data->listening.dest_addr.sin_port) && self_range == 0)
+	{ // chosen, but the range shrank to one slot since, the join goes around again for another node
+		log_warn("\tRange %d-%d cannot be split, NET_JOIN passed on", self_data->range_start, self_data->range_end);
+		pdu.max_address = 0;
+		pdu.max_port = 0;
+		pdu.max_span = 0;
+		pdu.max_load = 0;
+		forward_join(self_data, &pdu);
+	}
 	else if ((pdu.max_address == self_data->my_ip_addr.s_addr) && (pdu.max_port == self_data->listening.dest_addr.sin_port))
-	{ // I have the largest span
-		printf("\t");
+	{ // I have the largest load
 		print_state(13);
-		printf("\t Im the larges node, sending net_join_respons\n");
+		log_info("\t Im the larges node, sending net_join_respons");
 		// SEND NET_CLOSE to successor
 		struct NET_CLOSE_CONNECTION_PDU close_pdu = {
 		    .type = NET_CLOSE_CONNECTION,
 		};
-		send_tcp_pdu(self_data->successor.socket, &close_pdu, sizeof(close_pdu));
+		send_tcp_pdu(&self_data->successor, &close_pdu, sizeof(close_pdu));
 
 		// Connect to new successor
 		// SEt successor adress and port
@@ -174,43 +237,78 @@ void handle_net_join(struct NET_JOIN_PDU pdu, struct self_data *self_data)
 		// Send NET_JOIN_RESPONSE
 		// TRANSFER UPPER HALF
 	}
-	// Check if im largest range
-	else if (pdu.max_span < self_range)
-	{ // My range is larger than span
-		printf("\t");
+	// Check if im the most loaded, the span decides between equal loads
+	else if (takes_join(&pdu, self_range, self_load, self_data->config.ring_extensions))
+	{ // My load is larger than max_load
 		print_state(14);
-		printf("\t I have the largest span, altering net_join\n");
+		log_info("\t I have the largest load, altering net_join");
 		// Update pdu
 		pdu.max_address = self_data->my_ip_addr.s_addr;
 		pdu.max_port = self_data->listening.dest_addr.sin_port,
-		pdu.max_span = self_range;
+		pdu.max_span = htons(self_range);
+		pdu.max_load = htonl(self_load);
 
 		// FORWARD PDU to successor
-		send_tcp_pdu(self_data->successor.socket, &pdu, sizeof(pdu));
+		forward_join(self_data, &pdu);
 	}
 
 	else
-	{ // My span is smaller then pdu.max_span
-		printf("\t");
+	{ // My load is smaller then pdu.max_load
 		print_state(14);
-		printf("\tMy span is smaller then net_join span\n");
-		printf("\tMy span[%d] - received span [%d]\n", self_range, pdu.max_span);
+		log_info("\tMy load is smaller then net_join load");
+		log_info("\tMy load[%u] span[%d] - received load[%u] span [%d]", self_load, self_range, ntohl(pdu.max_load), ntohs(pdu.max_span));
 		// FOrward PDU as is to successor!
-		send_tcp_pdu(self_data->successor.socket, &pdu, sizeof(pdu));
+		forward_join(self_data, &pdu);
 	}
 }
 
 /**
- * @brief Handles the NET_NEW_RANGE PDU.
+ * @brief Handles the NET_JOIN PDU of a classic ring, its span is in hash slots.
  *
- * @param pdu The NET_NEW_RANGE_PDU structure.
+ * @param pdu The NET_JOIN_PDU structure.
  * @param self_data Pointer to the self_data structure.
  */
-void handle_net_new_range(struct NET_NEW_RANGE_PDU pdu, struct self_data *self_data)
+void handle_net_join(struct NET_JOIN_PDU pdu, struct self_data *self_data)
+{
+	struct NET_WIDE_JOIN_PDU wide = {
+	    .type = NET_WIDE_JOIN,
+	    .src_address = pdu.src_address,
+	    .src_port = pdu.src_port,
+	    .max_span = htons(pdu.max_span),
+	    .max_address = pdu.max_address,
+	    .max_port = pdu.max_port,
+	};
+	handle_net_wide_join(wide, self_data);
+}
+
+/**
+ * @brief Handles the NET_WIDE_NEW_RANGE PDU, and a NET_NEW_RANGE taken into one.
+ *
+ * @param pdu The NET_WIDE_NEW_RANGE_PDU structure.
+ * @param self_data Pointer to the self_data structure.
+ */
+void handle_net_wide_new_range(struct NET_WIDE_NEW_RANGE_PDU pdu, struct self_data *self_data)
 {
 	print_state(15);
+	routing_seen_version(self_data, ntohl(pdu.version));
 	update_range(pdu, self_data);
-	printf("\tNew range: %d-%d\n", self_data->range_start, self_data->range_end);
+	log_info("\tNew range: %d-%d", self_data->range_start, self_data->range_end);
+}
+
+/**
+ * @brief Handles the NET_NEW_RANGE PDU of a classic ring, the range is in hash slots.
+ *
+ * @param pdu The NET_NEW_RANGE_PDU structure.
+ * @param self_data Pointer to the self_data structure.
+ */
+void handle_net_new_range(struct NET_NEW_RANGE_PDU pdu, struct self_data *self_data)
+{
+	struct NET_WIDE_NEW_RANGE_PDU wide = {
+	    .type = NET_WIDE_NEW_RANGE,
+	    .range_start = htons(FIRST_RING_SLOT(pdu.range_start)),
+	    .range_end = htons(LAST_RING_SLOT(pdu.range_end)),
+	};
+	handle_net_wide_new_range(wide, self_data);
 }
 
 /**
@@ -222,19 +320,20 @@ void handle_net_new_range(struct NET_NEW_RANGE_PDU pdu, struct self_data *self_d
 void handle_net_leaving_pdu(struct NET_LEAVING_PDU pdu, struct self_data *self_data)
 {
 	print_state(16);
-	printf("\tClosing connection to successor\n");
-	close(self_data->successor.socket);
+	log_info("\tClosing connection to successor");
+	flush_connection(&self_data->successor, 0);
+	close_connection(self_data, &self_data->successor);
 	if (pdu.new_address == self_data->my_ip_addr.s_addr && pdu.new_port == self_data->listening.dest_addr.sin_port)
 	{ // I am the last node
-		self_data->successor.socket = 0;
-		self_data->fds[SUCCESSOR_FDS].fd = -1;
+		log_info("\tI am the last node");
 	}
 	else
-	{ // New node connecting, will overwrite socket and fd
+	{ // New node connecting, will overwrite socket
 		self_data->successor.dest_addr.sin_addr.s_addr = pdu.new_address;
 		self_data->successor.dest_addr.sin_port = pdu.new_port;
 		self_data->successor.dest_addr.sin_family = AF_INET;
 		connect_to_tcp(self_data);
+		routing_announce(self_data); // the ring is shorter, the announce travels it right away
 	}
 }
 
@@ -247,169 +346,571 @@ void handle_net_close_connection(struct self_data *self_data)
 {
 	print_state(17);
 
-	printf("\tClosing connection to predecessor\n");
-	close(self_data->predecessor.socket);
-	self_data->predecessor.socket = 0;
-	self_data->fds[PREDECESSOR_FDS].fd = -1;
+	log_info("\tClosing connection to predecessor");
+	flush_connection(&self_data->predecessor, 0);
+	close_connection(self_data, &self_data->predecessor);
 
-	if (self_data->range_start == 0 && self_data->range_end == 255)
-		printf("\t I am the last Node\n");
+	if (self_data->range_start == 0 && self_data->range_end == RING_SLOTS - 1)
+		log_info("\t I am the last Node");
 	else
 	{
-		printf("\tAwaiting new predecessor\n");
-		accept_predecessor_connection(self_data);
+		log_info("\tAwaiting new predecessor");
+		await_predecessor_connection(self_data);
 	}
 }
 
+/**
+ * @brief Handles the NET_WIDE_JOIN_RESPONSE PDU, and a NET_JOIN_RESPONSE taken into one. The
+ *        predecessor hands over the upper half of its range.
+ *
+ * @param pdu The NET_WIDE_JOIN_RESPONSE_PDU structure.
+ * @param self_data Pointer to the self_data structure.
+ */
+void handle_net_wide_join_response(struct NET_WIDE_JOIN_RESPONSE_PDU pdu, struct self_data *self_data)
+{
+	if (self_data->ring_state != RING_JOINING)
+	{
+		log_warn("\tUnexpected NET_JOIN_RESPONSE dropped");
+		return;
+	}
+
+	memset(&self_data->successor.dest_addr, 0, sizeof(self_data->successor.dest_addr));
+	self_data->successor.dest_addr.sin_addr.s_addr = pdu.next_address;
+	self_data->successor.dest_addr.sin_port = pdu.next_port;
+	self_data->successor.dest_addr.sin_family = AF_INET;
+	self_data->range_start = ntohs(pdu.range_start);
+	self_data->range_end = ntohs(pdu.range_end);
+	routing_seen_version(self_data, ntohl(pdu.version)); // routing_start() announces the range above it
+
+	log_info("\tGot NET_JOIN_RESPONSE_PDU: address=%s, port=%u", inet_ntoa(self_data->successor.dest_addr.sin_addr), ntohs(self_data->successor.dest_addr.sin_port));
+	log_info("\trange start: %d", self_data->range_start);
+	log_info("\trange end: %d", self_data->range_end);
+
+	// the entries of the range follow on the same connection, the store has to be there first
+	q8(self_data);
+}
+
+/**
+ * @brief Handles the NET_JOIN_RESPONSE PDU of a classic ring, the range is in hash slots.
+ *
+ * @param pdu The NET_JOIN_RESPONSE_PDU structure.
+ * @param self_data Pointer to the self_data structure.
+ */
+void handle_net_join_response(struct NET_JOIN_RESPONSE_PDU pdu, struct self_data *self_data)
+{
+	struct NET_WIDE_JOIN_RESPONSE_PDU wide = {
+	    .type = NET_WIDE_JOIN_RESPONSE,
+	    .next_address = pdu.next_address,
+	    .next_port = pdu.next_port,
+	    .range_start = htons(FIRST_RING_SLOT(pdu.range_start)),
+	    .range_end = htons(LAST_RING_SLOT(pdu.range_end)),
+	};
+	handle_net_wide_join_response(wide, self_data);
+}
+
+/**
+ * @brief Handles the NET_NEW_RANGE_RESPONSE PDU, the neighbour has taken over the range of a leaving node.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+void handle_net_new_range_response(struct self_data *self_data)
+{
+	if (self_data->ring_state != RING_LEAVING)
+	{
+		log_warn("\tUnexpected NET_NEW_RANGE_RESPONSE dropped");
+		return;
+	}
+	self_data->ring_state = RING_HANDING_OVER;
+}
+
+/**
+ * @brief Size of a PDU in a ring.
+ *
+ * @param ring The received bytes.
+ * @param at Where the PDU starts.
+ * @return ssize_t The size of the PDU, 0 if more bytes are needed to tell, -1 for an unknown type.
+ */
+static ssize_t pdu_length_at(const struct byte_ring *ring, size_t at)
+{
+	if (ring->length <= at)
+		return 0;
+
+	switch (byte_ring_peek(ring, at))
+	{
+	case VAL_INSERT:
+	{
+		// name and email are preceded by their lengths
+		size_t name_length_at = at + 1 + SSN_LENGTH;
+		if (ring->length <= name_length_at)
+			return 0;
+		size_t email_length_at = name_length_at + 1 + byte_ring_peek(ring, name_length_at);
+		if (ring->length <= email_length_at)
+			return 0;
+		return email_length_at + 1 + byte_ring_peek(ring, email_length_at) - at;
+	}
+	case VAL_LOOKUP:
+		return sizeof(struct VAL_LOOKUP_PDU);
+	case VAL_RANGE_SCAN:
+		return sizeof(struct VAL_RANGE_SCAN_PDU);
+	case VAL_REMOVE:
+		return sizeof(struct VAL_REMOVE_PDU);
+	case NET_JOIN:
+		return sizeof(struct NET_JOIN_PDU);
+	case NET_JOIN_RESPONSE:
+		return sizeof(struct NET_JOIN_RESPONSE_PDU);
+	case NET_NEW_RANGE:
+		return sizeof(struct NET_NEW_RANGE_PDU);
+	case NET_NEW_RANGE_RESPONSE:
+		return sizeof(struct NET_NEW_RANGE_RESPONSE_PDU);
+	case NET_WIDE_JOIN:
+		return sizeof(struct NET_WIDE_JOIN_PDU);
+	case NET_WIDE_JOIN_RESPONSE:
+		return sizeof(struct NET_WIDE_JOIN_RESPONSE_PDU);
+	case NET_WIDE_NEW_RANGE:
+		return sizeof(struct NET_WIDE_NEW_RANGE_PDU);
+	case NET_LEAVING:
+		return sizeof(struct NET_LEAVING_PDU);
+	case NET_CLOSE_CONNECTION:
+		return sizeof(struct NET_CLOSE_CONNECTION_PDU);
+	case NET_ANNOUNCE:
+		return sizeof(struct NET_ANNOUNCE_PDU);
+	case NET_FORWARD:
+	case NET_BACKWARD:
+	{
+		// type and hops, only a request can follow
+		if (ring->length <= at + NET_FORWARD_HEADER)
+			return 0;
+		uint8_t type = byte_ring_peek(ring, at + NET_FORWARD_HEADER);
+		if (type != VAL_INSERT && type != VAL_LOOKUP && type != VAL_RANGE_SCAN && type != VAL_REMOVE)
+			return -1;
+		ssize_t length = pdu_length_at(ring, at + NET_FORWARD_HEADER);
+		return length > 0 ? NET_FORWARD_HEADER + length : length;
+	}
+	default:
+		return -1;
+	}
+}
+
+/**
+ * @brief Size of the PDU at the head of a ring.
+ *
+ * @param ring The received bytes.
+ * @return ssize_t The size of the PDU, 0 if more bytes are needed to tell, -1 for an unknown type.
+ */
+static ssize_t pdu_length(const struct byte_ring *ring)
+{
+	return pdu_length_at(ring, 0);
+}
+
+/**
+ * @brief Handles one complete PDU.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param buffer The PDU.
+ * @param length The size of the PDU as given by pdu_length().
+ */
+static void handle_pdu(struct self_data *self_data, uint8_t *buffer, size_t length)
+{
+	switch (buffer[0])
+	{
+	case VAL_INSERT:
+		if (handle_val_insert(buffer, length, self_data) < 0)
+			log_warn("\tFailed to handle VAL_INSERT_PDU");
+		break;
+	case VAL_LOOKUP:
+	{
+		struct VAL_LOOKUP_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_val_lookup(pdu, self_data);
+	}
+	break;
+	case VAL_RANGE_SCAN:
+	{
+		struct VAL_RANGE_SCAN_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		log_debug("[VAL RANGE SCAN] [Q9]");
+		handle_range_scan(self_data, pdu);
+	}
+	break;
+	case VAL_REMOVE:
+	{
+		struct VAL_REMOVE_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_val_remove(pdu, self_data);
+	}
+	break;
+	case NET_JOIN:
+	{
+		struct NET_JOIN_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_join(pdu, self_data);
+	}
+	break;
+	case NET_JOIN_RESPONSE:
+	{
+		struct NET_JOIN_RESPONSE_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_join_response(pdu, self_data);
+	}
+	break;
+	case NET_NEW_RANGE:
+	{
+		struct NET_NEW_RANGE_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_new_range(pdu, self_data);
+	}
+	break;
+	case NET_NEW_RANGE_RESPONSE:
+		handle_net_new_range_response(self_data);
+		break;
+	case NET_WIDE_JOIN:
+	{
+		struct NET_WIDE_JOIN_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_wide_join(pdu, self_data);
+	}
+	break;
+	case NET_WIDE_JOIN_RESPONSE:
+	{
+		struct NET_WIDE_JOIN_RESPONSE_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_wide_join_response(pdu, self_data);
+	}
+	break;
+	case NET_WIDE_NEW_RANGE:
+	{
+		struct NET_WIDE_NEW_RANGE_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_wide_new_range(pdu, self_data);
+	}
+	break;
+	case NET_LEAVING:
+	{
+		struct NET_LEAVING_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_leaving_pdu(pdu, self_data);
+	}
+	break;
+	case NET_CLOSE_CONNECTION:
+		handle_net_close_connection(self_data);
+		break;
+	case NET_ANNOUNCE:
+	{
+		struct NET_ANNOUNCE_PDU pdu;
+		memcpy(&pdu, buffer, sizeof(pdu));
+		handle_net_announce(pdu, self_data);
+	}
+	break;
+	case NET_FORWARD:
+	case NET_BACKWARD:
+		// passed on by another node, it keeps its direction if this node does not hold it either
+		self_data->routing.heading = buffer[0] == NET_FORWARD ? ROUTE_FORWARD : ROUTE_BACKWARD;
+		self_data->routing.hops = buffer[1] << 8 | buffer[2];
+		handle_pdu(self_data, buffer + NET_FORWARD_HEADER, length - NET_FORWARD_HEADER);
+		self_data->routing.heading = ROUTE_ANY;
+		self_data->routing.hops = 0;
+		break;
+	}
+}
+
+/**
+ * @brief Handles every complete PDU in a ring. A partly received PDU is left for the next read.
+ *
+ * A handler that replaces the connection clears its ring, which ends the loop.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param ring The received bytes.
+ */
+static void handle_received_pdus(struct self_data *self_data, struct byte_ring *ring)
+{
+	ssize_t length;
+	while ((length = pdu_length(ring)) > 0 && (size_t)length <= ring->length)
+	{
+		uint8_t *pdu = byte_ring_contiguous(ring, length);
+		byte_ring_consume(ring, length); // the bytes stay valid until the next read
+		handle_pdu(self_data, pdu, length);
+	}
+
+	if (length < 0)
+	{
+		// a stream cannot be resynchronized after an unknown type
+		log_warn("\tInvalid PDU type: %u", byte_ring_peek(ring, 0));
+		log_warn("\tError occured, in buffer cleared");
+		byte_ring_clear(ring);
+	}
+}
+
+/**
+ * @brief reactor_datagram_handler of the UDP socket, a datagram holds whole PDUs.
+ */
+static void handle_udp_datagram(struct self_data *self_data, struct reactor_source *source, uint8_t *data, size_t length, bool truncated)
+{
+	if (self_data->ring_state == RING_JOINING)
+	{ // no range and no store yet
+		log_warn("\tNot part of the ring yet, datagram dropped");
+		return;
+	}
+	struct byte_ring datagram = {.data = data, .capacity = UDP_DATAGRAM_MAX, .head = 0, .length = length};
+	handle_received_pdus(self_data, &datagram);
+	if (datagram.length > 0 || truncated)
+		log_warn("\tTruncated PDU in datagram dropped");
+}
+
+/**
+ * @brief reactor_handler of the successor and predecessor connections.
+ *
+ * Completes a connect in progress, handles the complete PDUs the reactor has read into the
+ * connection's receive ring, writes queued PDUs when the socket is writable and closes the
+ * connection once the peer is gone.
+ */
+static void handle_connection_event(struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	struct connection_point *connection = source->arg;
+	const char *name = connection == &self_data->successor ? "successor" : "predecessor";
+
+	// the first event of a connect in progress tells whether it worked
+	if (connection->connecting && ((events & (EPOLLERR | EPOLLRDHUP)) || ((events & EPOLLOUT) && finish_connect(self_data) < 0)))
+	{
+		connect_failed(self_data);
+		return;
+	}
+
+	if (events & EPOLLOUT)
+		write_queued(connection);
+	if (events & EPOLLIN)
+		handle_received_pdus(self_data, &connection->inbox);
+
+	if (connection->socket <= 0)
+		return;
+	if (events & EPOLLERR)
+	{
+		log_info("\tClosing connection to %s", name);
+		close_connection(self_data, connection);
+	}
+	else if (events & EPOLLRDHUP) // the peer closed its connection
+	{
+		log_info("Connection closed by %s", name);
+		if (connection->inbox.length > 0)
+			log_warn("\tConnection closed with %zu bytes of an incomplete PDU", connection->inbox.length);
+		close_connection(self_data, connection);
+	}
+}
+
+/**
+ * @brief reactor_handler of the listening socket, the new predecessor connects here.
+ */
+static void handle_listen_event(struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	accept_predecessor_connection(self_data);
+}
+
+/**
+ * @brief reactor_handler of the connections other nodes forward requests on.
+ */
+static void handle_inbound_event(struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	struct connection_point *connection = source->arg;
+	if (events & EPOLLIN)
+		handle_received_pdus(self_data, &connection->inbox);
+	if (connection->socket > 0 && (events & (EPOLLERR | EPOLLRDHUP)))
+	{
+		close_connection(self_data, connection);
+		accept_peer_connections(self_data); // one may have waited for a free entry
+	}
+}
+
+/**
+ * @brief reactor_handler of the peer listening socket, other nodes connect their pools here.
+ */
+static void handle_peer_listen_event(struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	accept_peer_connections(self_data);
+}
+
+/**
+ * @brief Routes the events of the UDP socket, the listening sockets and the connections to their handlers.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+static void register_handlers(struct self_data *self_data)
+{
+	self_data->successor.source.handler = handle_connection_event;
+	self_data->successor.source.inbox = &self_data->successor.inbox;
+	self_data->successor.source.arg = &self_data->successor;
+	self_data->predecessor.source.handler = handle_connection_event;
+	self_data->predecessor.source.inbox = &self_data->predecessor.inbox;
+	self_data->predecessor.source.arg = &self_data->predecessor;
+
+	self_data->udp_source.datagram = handle_udp_datagram;
+	if (reactor_add(&self_data->reactor, &self_data->udp_source, self_data->udp_socket, EPOLLIN) < 0)
+		exit_with_error("Failed to register UDP socket", self_data);
+
+	self_data->listening.source.handler = handle_listen_event;
+	if (reactor_add(&self_data->reactor, &self_data->listening.source, self_data->listening.socket, EPOLLIN) < 0)
+		exit_with_error("Failed to register listening socket", self_data);
+
+	for (int i = 0; i < PEER_INBOUND; i++)
+		self_data->routing.inbound[i].source.handler = handle_inbound_event;
+	self_data->routing.listening.source.handler = handle_peer_listen_event;
+	if (reactor_add(&self_data->reactor, &self_data->routing.listening.source, self_data->routing.listening.socket, EPOLLIN) < 0)
+		exit_with_error("Failed to register peer listening socket", self_data);
+}
+
+static uint64_t clock_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Adds the time of a poll to where the busy-polling loop spends it.
+ */
+static void account_poll(struct busy_poll_stats *stats, bool spinning, bool input, uint64_t started)
+{
+	uint64_t elapsed = clock_ns() - started;
+	if (input)
+		stats->last_input = timer_now();
+	if (!spinning)
+	{
+		stats->sleep += elapsed;
+		stats->wakeups += input;
+	}
+	else if (input)
+		stats->work += elapsed;
+	else
+		stats->spin += elapsed;
+}
+
 /**
  * @brief Polls for incoming data.
  *
- * This function continuously checks for incoming data and processes it accordingly.
+ * Waits for events on the registered sockets and lets their handlers process them. The ring
+ * connections are read into their receive rings, so PDUs split across reads are handled once
+ * they are complete. What the handlers queued is written out afterwards, many PDUs per call.
+ * With --busy-poll the sockets are polled without waiting, so input is picked up without a wakeup,
+ * until none has come for --busy-poll-idle milliseconds.
  *
  * @param self_data Pointer to the structure containing the necessary data for the function to operate.
+ * @param time Milliseconds to wait at most, negative to wait until input arrives. The next timer cuts the wait short.
  */
 void poll_for_incoming_data(struct self_data *self_data, int time)
 {
-	int ret;
-	uint8_t buffer[25600]; // Buffer to store incoming data (larger size)
-	struct pollfd *fds = self_data->fds;
-
-	int poll_time;
-	if(time < 0)
-		poll_time = 5000;
-	else
+	uint64_t now = timer_now();
+	int poll_time = timer_wheel_timeout(&self_data->timers, now);
+	if (time >= 0 && (poll_time < 0 || time < poll_time))
 		poll_time = time;
 
-	// Poll for incoming data
-	ret = poll(fds, 4, poll_time);
-	if (ret < 0)
-	{
-		if (errno == EINTR)
-		{
-			// Interrupted by signal, check shutdown flag
-			if (shutdown_requested)
-			{ // If shutdown is requested, return into Q6 which will run shutdown procedure
-				return;
-			}
-		}
+	// Busy polling spins without a timeout until input stops coming for a while, then sleeps as usual
+	bool busy_poll = self_data->config.busy_poll_cpu >= 0;
+	bool spinning = busy_poll && now - self_data->busy_poll.last_input < self_data->config.busy_poll_idle;
+	uint64_t started = busy_poll ? clock_ns() : 0;
+
+	// Interrupted by signal, Q6 checks the shutdown and memory report flags
+	int events = reactor_wait(&self_data->reactor, self_data, spinning ? 0 : poll_time);
+	if (events < 0 && errno != EINTR)
 		exit_with_error("Poll failed", self_data);
+	if (busy_poll)
+		account_poll(&self_data->busy_poll, spinning, events > 0, started);
+	timer_wheel_run(&self_data->timers, self_data, timer_now());
+
+	// Everything the batch queued goes out together, the rest when the sockets are writable
+	flush_output(self_data);
+}
+
+/**
+ * @brief Handles a NET_JOIN that had to wait once the ring has settled.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+static void ring_tick(struct self_data *self_data)
+{
+	if (self_data->join_deferred && ring_settled(self_data))
+	{
+		self_data->join_deferred = false;
+		handle_net_wide_join(self_data->deferred_join, self_data);
 	}
+}
+
+/**
+ * @brief Timer of a handshake step that has to complete in time.
+ */
+static void deadline_passed(struct self_data *self_data, struct timer *timer)
+{
+	*(bool *)timer->arg = true;
+}
+
+/**
+ * @brief Logs where the busy-polling loop spent its time since the last report.
+ */
+static void report_busy_poll(struct self_data *self_data)
+{
+	struct busy_poll_stats *now = &self_data->busy_poll, *then = &self_data->busy_poll_reported;
+	uint64_t spin = now->spin - then->spin, work = now->work - then->work, sleep = now->sleep - then->sleep;
+	uint64_t total = spin + work + sleep;
+	if (total > 0)
+		log_info("\tBusy poll: spin %.1f%%  work %.1f%%  sleep %.1f%%  wakeups %" PRIu64,
+			 100.0 * spin / total, 100.0 * work / total, 100.0 * sleep / total, now->wakeups - then->wakeups);
+	*then = *now;
+}
+
+/**
+ * @brief Timer of the NET_ALIVE heartbeat, the tracker hears from the node at the same rate whatever the load.
+ */
+static void send_heartbeat(struct self_data *self_data, struct timer *timer)
+{
+	log_info("[Q6]    Range[%d-%d]  entries[%d]  memory[%zu KiB]", self_data->range_start, self_data->range_end, get_num_entries(self_data->hash_table), self_data->memory.used / 1024);
+	if (self_data->config.busy_poll_cpu >= 0)
+		report_busy_poll(self_data);
+	// SEND NET ALIVE
+	struct NET_ALIVE_PDU alive_pdu = {.type = NET_ALIVE};
+	if (send_udp_pdu(self_data->udp_socket, self_data->tracker_addr, &alive_pdu, sizeof(alive_pdu)) < 0)
+		exit_with_error("Failed to send NET_ALIVE", self_data);
+
+	// a fixed rate, unless the loop was held up for longer than an interval
+	uint64_t now = timer_now();
+	uint64_t next = timer->expires + self_data->config.alive_interval;
+	timer_add(&self_data->timers, timer, next > now ? next : now + self_data->config.alive_interval);
+}
+
+/**
+ * @brief Keeps serving requests until a step of a handshake has completed.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param done Tells whether the step has completed.
+ * @param timeout Milliseconds to wait at most, negative to wait until a shutdown is requested.
+ * @return bool true if the step completed.
+ */
+static bool serve_until(struct self_data *self_data, bool (*done)(const struct self_data *), int timeout)
+{
+	bool expired = false;
+	struct timer deadline = {.fire = deadline_passed, .arg = &expired};
+	if (timeout >= 0)
+		timer_add(&self_data->timers, &deadline, timer_now() + timeout);
 
-	// Iterate through the file descriptors
-	for (int i = 0; i < 3; i++)
+	while (!done(self_data) && !expired && !(timeout < 0 && shutdown_requested))
 	{
-		if (fds[i].revents & POLLIN)
-		{
-			ssize_t bytes_received = recv(fds[i].fd, buffer, sizeof(buffer), 0);
-			if (bytes_received < 0)
-			{
-				perror("Recv failed");
-				// Set socket to 0 to indicate that it is closed
-				if (i == PREDECESSOR_FDS)
-				{
-					printf("\tClosing connection to predecessor\n");
-					close(self_data->predecessor.socket);
-					self_data->predecessor.socket = 0;
-				}
-				else if (i == SUCCESSOR_FDS)
-				{
-					printf("\tClosing connection to successor\n");
-					close(self_data->successor.socket);
-					self_data->successor.socket = 0;
-				}
-
-				continue;
-			}
-
-			if (bytes_received == 0) // fds[i] closed its connection
-			{
-				printf("Connection closed on socket %d\n", fds[i].fd);
-				close(fds[i].fd);
-				fds[i].fd = -1; // Mark as closed
-				continue;
-			}
-
-			// Process each PDU sequentially
-			size_t offset = 0;
-			while (offset < bytes_received)
-			{
-				uint8_t packet_type = buffer[offset];
-
-				switch (packet_type)
-				{
-				case VAL_INSERT:
-				{
-					// Handle dynamic size fields (name, email) properly
-					int size = handle_val_insert(buffer + offset, bytes_received - offset, self_data);
-					if (size < 0)
-					{
-						printf("\033[31m\tFailed to handle VAL_INSERT_PDU\033[0m\n");
-						offset = -1;
-						break;
-					}
-
-					// After handling VAL_INSERT, we need to move the offset based on variable-length fields
-					offset += size;
-				}
-				break;
-					break;
-				case VAL_LOOKUP:
-				{
-					struct VAL_LOOKUP_PDU pdu;
-					memcpy(&pdu, buffer + offset, sizeof(pdu));
-					handle_val_lookup(pdu, self_data);
-					offset += sizeof(struct VAL_LOOKUP_PDU); // Adjust for PDU size
-				}
-				break;
-				case VAL_REMOVE:
-				{
-					struct VAL_REMOVE_PDU pdu;
-					memcpy(&pdu, buffer + offset, sizeof(pdu));
-					handle_val_remove(pdu, self_data);
-					offset += sizeof(struct VAL_REMOVE_PDU); // Adjust for PDU size
-				}
-				break;
-				case NET_JOIN:
-				{
-					struct NET_JOIN_PDU pdu;
-					memcpy(&pdu, buffer + offset, sizeof(pdu));
-					handle_net_join(pdu, self_data);
-					offset += sizeof(struct NET_JOIN_PDU); // Adjust for PDU size
-				}
-				break;
-				case NET_NEW_RANGE:
-				{
-					struct NET_NEW_RANGE_PDU pdu;
-					memcpy(&pdu, buffer + offset, sizeof(pdu));
-					handle_net_new_range(pdu, self_data);
-					offset += sizeof(struct NET_NEW_RANGE_PDU); // Adjust for PDU size
-				}
-				break;
-				case NET_LEAVING:
-				{
-					struct NET_LEAVING_PDU pdu;
-					memcpy(&pdu, buffer + offset, sizeof(pdu));
-					handle_net_leaving_pdu(pdu, self_data);
-					offset += sizeof(struct NET_LEAVING_PDU); // Adjust for PDU size
-				}
-				break;
-				case NET_CLOSE_CONNECTION:
-					handle_net_close_connection(self_data);
-					offset++; // Move to next byte (no need to process further)
-					break;
-				default:
-					printf("\033[31m\tInvalid PDU type: %u\033[0m\n", packet_type);
-					offset = -1;
-					break;
-				}
-				if (offset < 0)
-				{
-					printf("\033[31m\tError occured, in buffer cleared\033[0m\n");
-					break;
-				}
-			}
-		}
+		poll_for_incoming_data(self_data, -1);
+		persistence_commit(&self_data->persistence);
+		ring_tick(self_data);
 	}
+	timer_cancel(&self_data->timers, &deadline);
+	return done(self_data);
+}
+
+static bool joined(const struct self_data *self_data)
+{
+	return self_data->ring_state != RING_JOINING;
+}
+
+static bool range_taken_over(const struct self_data *self_data)
+{
+	return self_data->ring_state == RING_HANDING_OVER;
+}
+
+static bool predecessor_gone(const struct self_data *self_data)
+{
+	return self_data->predecessor.socket <= 0;
 }
 
 /**
@@ -425,9 +926,8 @@ void q1(struct self_data *my_data, const char *tracker_address, int tracker_port
 
 	// Create dest_addr for tracker
 	my_data->tracker_addr = create_destination_addr(tracker_address, tracker_port, my_data);
-	my_data->fds[UDP_FDS].fd = my_data->udp_socket;
 
-	printf("\tNode started, Sending STUN_LOOKUP to tracker %s:%d\n", inet_ntoa(my_data->tracker_addr.sin_addr), htons(my_data->tracker_addr.sin_port));
+	log_info("\tNode started, Sending STUN_LOOKUP to tracker %s:%d", inet_ntoa(my_data->tracker_addr.sin_addr), htons(my_data->tracker_addr.sin_port));
 
 	struct STUN_LOOKUP_PDU lookup_pdu = {.type = STUN_LOOKUP};
 	if (send_udp_pdu(my_data->udp_socket, my_data->tracker_addr, &lookup_pdu, sizeof(lookup_pdu)))
@@ -444,7 +944,7 @@ void q2(struct self_data *my_data)
 	print_state(2);
 	// Stun lookup sent in [Q1] expecting lookup response
 	uint8_t in_buffer[5];
-	if (receive_from(my_data->fds, UDP_FDS, my_data->udp_socket, in_buffer, sizeof(in_buffer)) >= 0)
+	if (receive_from(my_data->udp_socket, in_buffer, sizeof(in_buffer)) >= 0)
 	{
 		if (in_buffer[0] != STUN_RESPONSE)
 			exit_with_error("Unexpected response type", my_data);
@@ -454,7 +954,7 @@ void q2(struct self_data *my_data)
 		my_data->my_ip_addr.s_addr = address;
 
 		// Print the received address
-		printf("\tReceived STUN_RESPONSE, my adress is: %s\n", inet_ntoa(my_data->my_ip_addr));
+		log_info("\tReceived STUN_RESPONSE, my adress is: %s", inet_ntoa(my_data->my_ip_addr));
 	}
 	else
 		exit_with_error("Failed to receive STUN_RESPONSE_PDU", my_data);
@@ -469,7 +969,7 @@ void q2(struct self_data *my_data)
 int q3(struct self_data *self_data)
 {
 	print_state(3);
-	printf("\tSending NET_GET_NODE_PDU to %s:%d\n", inet_ntoa(self_data->tracker_addr.sin_addr), htons(self_data->tracker_addr.sin_port));
+	log_info("\tSending NET_GET_NODE_PDU to %s:%d", inet_ntoa(self_data->tracker_addr.sin_addr), htons(self_data->tracker_addr.sin_port));
 
 	// Set struct
 	struct NET_GET_NODE_PDU get_node_pdu = {.type = NET_GET_NODE};
@@ -480,7 +980,7 @@ int q3(struct self_data *self_data)
 
 	// Wait for a response using poll
 	uint8_t in_buffer[7];
-	if (receive_from(self_data->fds, UDP_FDS, self_data->udp_socket, in_buffer, sizeof(in_buffer)) < 0)
+	if (receive_from(self_data->udp_socket, in_buffer, sizeof(in_buffer)) < 0)
 		exit_with_error("Failed to receive NET_GET_NODE_RESPONSE_PDU", self_data);
 
 	if (in_buffer[0] != NET_GET_NODE_RESPONSE)
@@ -494,7 +994,7 @@ int q3(struct self_data *self_data)
 
 	if (address == 0) // Response is empty -> Q4
 	{
-		printf("\tReceived NET_GET_NODE_RESPONSE_PDU: address = 0\n");
+		log_info("\tReceived NET_GET_NODE_RESPONSE_PDU: address = 0");
 		return 0;
 	}
 	else
@@ -503,7 +1003,7 @@ int q3(struct self_data *self_data)
 		self_data->predecessor.dest_addr.sin_addr.s_addr = address;
 		self_data->predecessor.dest_addr.sin_port = port;
 		self_data->predecessor.dest_addr.sin_family = AF_INET;
-		printf("\tReceived NET_GET_NODE_RESPONSE_PDU: address=%s, port=%u\n", inet_ntoa(self_data->predecessor.dest_addr.sin_addr), ntohs(self_data->predecessor.dest_addr.sin_port));
+		log_info("\tReceived NET_GET_NODE_RESPONSE_PDU: address=%s, port=%u", inet_ntoa(self_data->predecessor.dest_addr.sin_addr), ntohs(self_data->predecessor.dest_addr.sin_port));
 		return 1;
 	}
 }
@@ -517,19 +1017,21 @@ int q3(struct self_data *self_data)
 void q4(struct self_data *self_data)
 {
 	print_state(4);
-	printf("\tAlone in network\n");
+	log_info("\tAlone in network");
 	// Create hash table
-	self_data->hash_table = ht_create(NULL);
-	if (self_data->hash_table == NULL)
-		exit_with_error("Failed to create hash table", self_data);
+	create_store(self_data);
 	self_data->range_start = 0;
-	self_data->range_end = 255;
+	self_data->range_end = RING_SLOTS - 1;
+	if (self_data->config.load_file)
+		persistence_adopt(self_data, self_data->config.load_file);
+	persistence_recover(self_data);
+	self_data->ring_state = RING_CONNECTED;
 }
 
 /**
  * @brief Handles the process of joining the network by sending a NET_JOIN_PDU
- *        and accepting a connection from the predecessor. Updates the successor
- *        information based on the response.
+ *        and accepting a connection from the predecessor. The NET_JOIN_RESPONSE
+ *        it sends on that connection moves the node on to Q8.
  *
  * @param self_data Pointer to the self_data structure containing node information.
  */
@@ -546,32 +1048,23 @@ void q7(struct self_data *self_data)
 	    .max_span = 0,
 	    .max_address = 0,
 	    .max_port = 0};
+	struct NET_WIDE_JOIN_PDU wide_join_pdu = {
+	    .type = NET_WIDE_JOIN,
+	    .src_address = join_pdu.src_address,
+	    .src_port = join_pdu.src_port,
+	};
 
-	if (send_udp_pdu(self_data->udp_socket, self_data->predecessor.dest_addr, &join_pdu, sizeof(join_pdu)) < 0)
+	self_data->ring_state = RING_JOINING;
+	int sent = self_data->config.ring_extensions
+		       ? send_udp_pdu(self_data->udp_socket, self_data->predecessor.dest_addr, &wide_join_pdu, sizeof(wide_join_pdu))
+		       : send_udp_pdu(self_data->udp_socket, self_data->predecessor.dest_addr, &join_pdu, sizeof(join_pdu));
+	if (sent < 0)
 		exit_with_error("Failed to send NET_JOIN_PDU", self_data);
 
-	accept_predecessor_connection(self_data);
 	// Should listen for incomming response from any node
-	uint8_t in_buffer[9];
-	receive_tcp_data(self_data, "predecessor", (char *)in_buffer, sizeof(in_buffer));
-	if (in_buffer[0] != NET_JOIN_RESPONSE)
-		exit_with_error("Unexpected response type", self_data);
-
-	uint32_t address;
-	uint16_t port;
-	memcpy(&address, in_buffer + 1, 4);
-	memcpy(&port, in_buffer + 5, 2);
-	// SHOULD this  BE HTONSS AND HTONL ?!?!?!
-	memset(&self_data->successor.dest_addr, 0, sizeof(self_data->successor.dest_addr));
-	self_data->successor.dest_addr.sin_addr.s_addr = address;
-	self_data->successor.dest_addr.sin_port = port;
-	self_data->successor.dest_addr.sin_family = AF_INET;
-	self_data->range_start = in_buffer[7];
-	self_data->range_end = in_buffer[8];
-
-	printf("\tGot NET_JOIN_RESPONSE_PDU: address=%s, port=%u\n", inet_ntoa(self_data->successor.dest_addr.sin_addr), ntohs(self_data->successor.dest_addr.sin_port));
-	printf("\trange start: %d\n", in_buffer[7]);
-	printf("\trange end: %d\n", in_buffer[8]);
+	await_predecessor_connection(self_data);
+	if (!serve_until(self_data, joined, -1))
+		exit_with_error("Shutdown requested before joining the network", self_data);
 }
 
 /**
@@ -583,31 +1076,44 @@ void q8(struct self_data *self_data)
 {
 	print_state(8);
 	connect_to_tcp(self_data);
-	self_data->hash_table = ht_create(NULL);
-	if (self_data->hash_table == NULL)
-		exit_with_error("Failed to create hash table", self_data);
+	create_store(self_data);
+	if (self_data->config.load_file)
+		persistence_adopt(self_data, self_data->config.load_file);
+	persistence_recover(self_data);
+	self_data->ring_state = RING_CONNECTED;
 }
 
 /**
- * @brief Continuously runs the node's main loop, sending NET_ALIVE PDUs and
- *        polling for incoming data until a shutdown is requested.
+ * @brief Continuously runs the node's main loop, sending NET_ALIVE PDUs on a
+ *        timer and polling for incoming data until a shutdown is requested.
  *
  * @param self_data Pointer to the self_data structure containing node information.
  */
 void q6(struct self_data *self_data)
 {
+	memory_refresh(self_data);
+	self_data->heartbeat.fire = send_heartbeat;
+	timer_add(&self_data->timers, &self_data->heartbeat, timer_now()); // the first one right away
+	routing_start(self_data);
+	load_start(self_data);
 	while (!shutdown_requested)
 	{
-		printf("\n");
-		printf("\033[32m[Q6]\033[0m    Range[%d-%d]  entries[%d]\n", self_data->range_start, self_data->range_end, get_num_entries(self_data->hash_table));
-		// SEND NET ALIVE
-		struct NET_ALIVE_PDU alive_pdu = {.type = NET_ALIVE};
-		if (send_udp_pdu(self_data->udp_socket, self_data->tracker_addr, &alive_pdu, sizeof(alive_pdu)) < 0)
-			exit_with_error("Failed to send NET_ALIVE", self_data);
-
-		// Poll for incomming data
-		poll_for_incoming_data(self_data, -1);
+		// Poll for incomming data, without waiting while recovered entries are handed over and the successor keeps up
+		bool handing_over = persistence_busy(&self_data->persistence) && send_queue_depth(&self_data->successor) <= SEND_QUEUE_LOW;
+		poll_for_incoming_data(self_data, handing_over ? 0 : -1);
 		// Check type of data and handle accordingly
+		ring_tick(self_data);
+
+		// Group commit everything logged while handling this batch
+		persistence_commit(&self_data->persistence);
+		persistence_tick(self_data);
+		tiering_tick(self_data);
+		memory_refresh(self_data);
+		if (memory_report_requested)
+		{
+			memory_report_requested = false;
+			memory_report(self_data);
+		}
 	}
 }
 
@@ -620,52 +1126,46 @@ void q6(struct self_data *self_data)
  */
 void shutdown_proceedure(struct self_data *self_data)
 {
-	printf("\033[32m\nShutting down\033[0m\n");
+	log_info("Shutting down");
 	print_state(10);
+	timer_cancel(&self_data->timers, &self_data->heartbeat); // the table goes away while leaving
+	routing_stop(self_data);				 // requests this node forwards take the ring from now on
+	persistence_commit(&self_data->persistence);
+	// A connect or accept in progress completes first
+	if (!serve_until(self_data, ring_settled, SHUTDOWN_DRAIN_TIMEOUT))
+		exit_with_error("Ring connections did not settle, cannot leave", self_data);
 	if ((self_data->predecessor.socket == 0) && (self_data->successor.socket == 0))
-		exit(EXIT_SUCCESS); // Not connected
-	printf("\t");
+		exit(EXIT_SUCCESS); // Not connected, the store stays on disk
 	print_state(11);
 	// Send NET_NEW_RANGE to predecessor or sucessor
 	struct NET_NEW_RANGE_PDU new_range_pdu = {
 	    .type = NET_NEW_RANGE,
-	    .range_start = self_data->range_start,
-	    .range_end = self_data->range_end,
+	    .range_start = HASH_SLOT_OF(self_data->range_start),
+	    .range_end = HASH_SLOT_OF(self_data->range_end),
 	};
-	struct NET_NEW_RANGE_RESPONSE_PDU new_range_response_pdu = {
-	    .type = NET_NEW_RANGE_RESPONSE,
+	struct NET_WIDE_NEW_RANGE_PDU wide_new_range_pdu = {
+	    .type = NET_WIDE_NEW_RANGE,
+	    .range_start = htons(self_data->range_start),
+	    .range_end = htons(self_data->range_end),
+	    .version = htonl(self_data->routing.map_version), // above the release routing_stop() announced
 	};
+	struct connection_point *neighbour = self_data->range_start == 0 ? &self_data->successor : &self_data->predecessor;
+	const char *name = neighbour == &self_data->successor ? "successor" : "predecessor";
 
-	if (self_data->range_start == 0)
-	{ // send to successor
-		printf("\tSending new range to successor\n");
-		send_tcp_pdu(self_data->successor.socket, &new_range_pdu, sizeof(new_range_pdu));
-		// receive NET_NEW_RANGE_RESPONSE
-		receive_tcp_data(self_data, "successor", (char *)&new_range_response_pdu, sizeof(new_range_response_pdu));
-		printf("\t");
-		print_state(18);
-		print_state(18);
-		printf("\tGot response -> Transfering entries to successor\n");
-		send_all_entries(self_data, SUCCESSOR_FDS);
-	}
+	log_info("\tSending new range to %s", name);
+	self_data->ring_state = RING_LEAVING;
+	if (self_data->config.ring_extensions)
+		send_tcp_pdu(neighbour, &wide_new_range_pdu, sizeof(wide_new_range_pdu));
 	else
-	{ // Send to predecessor
-		printf("\tSending new range to predecessor\n");
-		send_tcp_pdu(self_data->predecessor.socket, &new_range_pdu, sizeof(new_range_pdu));
-		// receive NET_NEW_RANGE_RESPONSE
-		receive_tcp_data(self_data, "predecessor", (char *)&new_range_response_pdu, sizeof(new_range_response_pdu));
-		printf("\t");
-		print_state(18);
-		print_state(18);
-		printf("\tGot response -> Transfering entries to predecessor\n");
-		send_all_entries(self_data, PREDECESSOR_FDS);
-	}
-
-	// Get response
-
-	// Get response
-	if (new_range_response_pdu.type != NET_NEW_RANGE_RESPONSE)
-		exit_with_error("Unexpected response type", self_data);
+		send_tcp_pdu(neighbour, &new_range_pdu, sizeof(new_range_pdu));
+
+	// Requests keep being served until NET_NEW_RANGE_RESPONSE comes back
+	if (!serve_until(self_data, range_taken_over, SHUTDOWN_DRAIN_TIMEOUT))
+		exit_with_error("Failed to receive NET_NEW_RANGE_RESPONSE", self_data);
+	print_state(18);
+	log_info("\tGot response -> Transfering entries to %s", name);
+	send_all_entries(self_data, neighbour);
+
 	// Prepare leaving messages
 	struct NET_CLOSE_CONNECTION_PDU close_pdu = {
 	    .type = NET_CLOSE_CONNECTION,
@@ -679,20 +1179,24 @@ void shutdown_proceedure(struct self_data *self_data)
 	// Exiting, dont have range -> set values to continue forwarding messages until exit is complete.
 	self_data->range_end = -1;
 	self_data->range_start = -1;
-	poll_for_incoming_data(self_data, 300);// POll to forward messages for a second while all inserts are sent.
-	//Without this poll() or a sleep() and with alarge amount of Inserts "Send_all()" to a Rust node only picks the -
-	// first insert up then closes socket
 
-	printf("\tSending NET_CLOSE to successor\n");
-	send_tcp_pdu(self_data->successor.socket, &close_pdu, sizeof(close_pdu));
-	printf("\tSending NET_LEAVING to predecessor\n");
-	send_tcp_pdu(self_data->predecessor.socket, &leaving_pdu, sizeof(leaving_pdu));
+	// The predecessor closes its connection when it gets NET_LEAVING, until then PDUs it sent are forwarded
+	log_info("\tSending NET_LEAVING to predecessor");
+	send_tcp_pdu(&self_data->predecessor, &leaving_pdu, sizeof(leaving_pdu));
+	serve_until(self_data, predecessor_gone, SHUTDOWN_DRAIN_TIMEOUT);
+
+	log_info("\tSending NET_CLOSE to successor");
+	send_tcp_pdu(&self_data->successor, &close_pdu, sizeof(close_pdu));
+	flush_all_connections(self_data);
+
+	// Entries were handed over, record that their slots are gone
+	persistence_commit(&self_data->persistence);
 
 	// Close sockets
 	close_all_sockets(self_data);
 	// Free hash table
 
-	printf("\033[32mGOODBYE ;)\033[0m\n");
+	log_info("GOODBYE ;)");
 	exit(EXIT_SUCCESS);
 }
 /**
@@ -703,34 +1207,63 @@ void shutdown_proceedure(struct self_data *self_data)
  *  listening port(UDP - PDU´s) - to get "net join"
  *
  * @param argc
- * @param argv (Tracker adress) (Tracker port) (Listining Port)
+ * @param argv (Tracker adress) (Tracker port) [options], see print_usage()
  * @return int
  * 				0 - Success
  * 				1 - Failure
  */
 
+/**
+ * @brief Pins the thread of the event loop to the busy-poll CPU, it has the core to itself.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+static void pin_event_loop(struct self_data *self_data)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(self_data->config.busy_poll_cpu, &cpus);
+	if (self_data->config.busy_poll_cpu >= CPU_SETSIZE || pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+		exit_with_error("Failed to pin the event loop to the busy-poll CPU", self_data);
+	log_info("\tBusy polling on CPU %d, sleeping after %u ms without input", self_data->config.busy_poll_cpu, self_data->config.busy_poll_idle);
+}
+
 int main(int argc, char *argv[])
 {
+	// ------ start writing the log from a thread of its own ------
+	log_init();
+
+	// ------ allocate memory for data struct ------
+	struct self_data *my_data = calloc(1, sizeof(struct self_data)); // sockets start out as 0, meaning not connected
+	if (!my_data)
+		exit_with_error("Failed to allocate memory", my_data);
+
 	// ------ Check input arguments ------
-	if (argc != 3)
+	if (parse_config(argc, argv, &my_data->config) < 0)
 	{
-		printf("Usage: %s <tracker_address> <tracker_port>\n", argv[0]);
+		print_usage(argv[0]);
 		return 1;
 	}
-	// ------ allocate memory for data struct ------
 	// This is validated in function below
-	const char *tracker_address = argv[1];
-	const int tracker_port = atoi(argv[2]);
-	struct self_data *my_data = malloc(sizeof(struct self_data));
-	if (!my_data)
-		exit_with_error("Failed to allocate memory", my_data);
+	const char *tracker_address = my_data->config.tracker_address;
+	const int tracker_port = my_data->config.tracker_port;
+	value_codec_enable(my_data->config.compress_values);
+	ht_set_partitioning(my_data->config.ordered ? HT_PARTITION_ORDERED : HT_PARTITION_HASH);
+	persistence_init(&my_data->persistence, my_data->config.data_dir, my_data->config.snapshot_every);
+	memory_init(&my_data->memory, my_data->config.memory_limit);
+	tiering_init(&my_data->tiering, my_data->config.memory_budget, my_data->config.data_dir ? my_data->config.data_dir : "/tmp");
+
+	if (my_data->config.busy_poll_cpu >= 0)
+		pin_event_loop(my_data);
 
 	// Set up sockets and self_data
 	setup_data(my_data);
+	register_handlers(my_data);
 
 	// Set up signalr handelers to catch shutdown request
 	signal(SIGINT, set_shutdown);
 	signal(SIGTERM, set_shutdown);
+	signal(SIGUSR1, set_memory_report);
 
 	// ------ Initialize the node ------
 	q1(my_data, tracker_address, tracker_port);
@@ -739,17 +1272,16 @@ int main(int argc, char *argv[])
 	switch (q3(my_data))
 	{
 	case 0: // no nodes on network
-		printf("\tNo nodes on network start\n");
+		log_info("\tNo nodes on network start");
 		q4(my_data);
 		// Q4
 		break;
 	case 1: // connect to nodes, Predeccesor adress (not socket) is set in my_data
-		printf("\tnodes are on network\n");
-		printf("\tPredecessor adress is: %s:%d\n", inet_ntoa(my_data->predecessor.dest_addr.sin_addr), ntohs(my_data->predecessor.dest_addr.sin_port));
+		log_info("\tnodes are on network");
+		log_info("\tPredecessor adress is: %s:%d", inet_ntoa(my_data->predecessor.dest_addr.sin_addr), ntohs(my_data->predecessor.dest_addr.sin_port));
 		// NET JOIN
 		q7(my_data);
-		q8(my_data);
-		// Q7 -> Q8
+		// Q7 -> Q8 once the predecessor responds
 		break;
 	default:
 		exit_with_error("Failed to initialize node network", my_data);
@@ -2,6 +2,7 @@
 #define NODE_H
 
 #include "sockets.h"
+#include "routing.h"
 #include "hash_handling.h"
 #include "pdu.h"
 #include "util.h"
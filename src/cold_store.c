@@ -0,0 +1,177 @@
+#define _GNU_SOURCE // mremap
+#include "cold_store.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define COLD_INITIAL_SIZE (1 << 20)
+#define COLD_MAX_GROWTH (1 << 30)
+#define COLD_COMPACT_MIN (64 << 20) // dead bytes before compaction is worth it
+#define COLD_RECORD_HEADER 2	    // value size in front of every record
+
+/**
+ * @brief An append-only value file mapped into memory. Values are never overwritten, a removed
+ *        or promoted value only counts as dead until the file is compacted.
+ */
+struct cold_file
+{
+	int fd;
+	uint8_t *map;
+	size_t size; // file and mapping size
+	size_t used; // append offset
+	size_t dead;
+};
+
+static struct
+{
+	char dir[512];
+	struct cold_file file;
+} cold = {.file = {.fd = -1}};
+
+static int file_create(struct cold_file *file, const char *dir)
+{
+	char path[sizeof(cold.dir) + 32];
+	snprintf(path, sizeof(path), "%s/cold-values.XXXXXX", dir);
+
+	file->fd = mkstemp(path);
+	if (file->fd < 0)
+		return -1;
+	unlink(path);
+
+	if (ftruncate(file->fd, COLD_INITIAL_SIZE) < 0)
+	{
+		close(file->fd);
+		return -1;
+	}
+	file->map = mmap(NULL, COLD_INITIAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+	if (file->map == MAP_FAILED)
+	{
+		close(file->fd);
+		return -1;
+	}
+	file->size = COLD_INITIAL_SIZE;
+	file->used = 0;
+	file->dead = 0;
+	return 0;
+}
+
+static void file_close(struct cold_file *file)
+{
+	munmap(file->map, file->size);
+	close(file->fd);
+	file->fd = -1;
+}
+
+static bool file_reserve(struct cold_file *file, size_t bytes)
+{
+	if (file->used + bytes <= file->size)
+		return true;
+
+	size_t size = file->size;
+	while (file->used + bytes > size)
+		size += size < COLD_MAX_GROWTH ? size : COLD_MAX_GROWTH;
+	if (ftruncate(file->fd, size) < 0)
+		return false;
+	uint8_t *map = mremap(file->map, file->size, size, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED)
+		return false;
+	file->map = map;
+	file->size = size;
+	return true;
+}
+
+static void *file_put(struct cold_file *file, const struct value_pair *pair)
+{
+	size_t size = value_size(pair);
+	if (!file_reserve(file, COLD_RECORD_HEADER + size))
+		return NULL;
+
+	uint8_t *record = file->map + file->used;
+	record[0] = size & 0xff;
+	record[1] = size >> 8;
+	memcpy(record + COLD_RECORD_HEADER, pair, size);
+
+	void *ref = (void *)(((uintptr_t)file->used << 1) | COLD_TAG);
+	file->used += COLD_RECORD_HEADER + size;
+	return ref;
+}
+
+static const uint8_t *record_of(const struct cold_file *file, const void *ref)
+{
+	return file->map + ((uintptr_t)ref >> 1);
+}
+
+int cold_store_open(const char *dir)
+{
+	snprintf(cold.dir, sizeof(cold.dir), "%s", dir);
+	return file_create(&cold.file, dir);
+}
+
+void *cold_store_put(const struct value_pair *pair)
+{
+	if (cold.file.fd < 0)
+		return NULL;
+	return file_put(&cold.file, pair);
+}
+
+const struct value_pair *cold_store_get(const void *ref)
+{
+	return (const struct value_pair *)(record_of(&cold.file, ref) + COLD_RECORD_HEADER);
+}
+
+void cold_store_discard(const void *ref)
+{
+	const uint8_t *record = record_of(&cold.file, ref);
+	cold.file.dead += COLD_RECORD_HEADER + (record[0] | record[1] << 8);
+}
+
+static void *move_value(void *value, void *arg)
+{
+	if (!value_is_cold(value))
+		return value;
+
+	return file_put(arg, cold_store_get(value)); // cannot fail, the space was reserved up front
+}
+
+void cold_store_compact(struct ht *table)
+{
+	if (cold.file.fd < 0 || cold.file.dead < COLD_COMPACT_MIN || cold.file.dead * 2 < cold.file.used)
+		return;
+
+	struct cold_file compacted;
+	if (file_create(&compacted, cold.dir) < 0)
+	{
+		log_warn("cold store compaction: %s", strerror(errno));
+		return;
+	}
+
+	// once references start moving there is no way back, so the whole file is sized first
+	if (!file_reserve(&compacted, cold.file.used - cold.file.dead))
+	{
+		log_warn("cold store compaction: %s, keeping the old file", strerror(errno));
+		file_close(&compacted);
+		return;
+	}
+
+	size_t before = cold.file.used;
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+		ht_update_in_slot(table, slot, move_value, &compacted);
+
+	file_close(&cold.file);
+	cold.file = compacted;
+	log_info("\tCompacted the cold store from %zu to %zu bytes", before, cold.file.used);
+}
+
+size_t cold_store_live_bytes(void)
+{
+	return cold.file.used - cold.file.dead;
+}
+
+size_t cold_store_dead_bytes(void)
+{
+	return cold.file.dead;
+}
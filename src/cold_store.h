@@ -0,0 +1,70 @@
+#ifndef COLD_STORE_H
+#define COLD_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "hashtable.h"
+#include "value_codec.h"
+
+// hash table values with this bit set are cold store references, slab objects are never odd
+#define COLD_TAG 0x1
+
+/**
+ * @brief Whether a hash table value is a reference into the cold store instead of a value_pair in RAM.
+ */
+static inline bool value_is_cold(const void *value)
+{
+	return ((uintptr_t)value & COLD_TAG) != 0;
+}
+
+/**
+ * @brief Creates the node's cold value file in dir. The file is unlinked right away, it only
+ *        extends RAM and is rebuilt from the log and snapshot after a restart.
+ *
+ * @param dir Directory for the file.
+ * @return int 0 on success, -1 on failure.
+ */
+int cold_store_open(const char *dir);
+
+/**
+ * @brief Appends a copy of a value_pair to the file. Dictionary references move with the copy.
+ *
+ * @param pair The value to copy.
+ * @return void* A tagged reference to store in the hash table, or NULL if the file cannot grow.
+ */
+void *cold_store_put(const struct value_pair *pair);
+
+/**
+ * @brief The value_pair a reference points to. Valid until the next cold_store_put() or compaction.
+ */
+const struct value_pair *cold_store_get(const void *ref);
+
+/**
+ * @brief Marks a value in the file as dead, its dictionary references must be released by the caller.
+ */
+void cold_store_discard(const void *ref);
+
+/**
+ * @brief Rewrites the file without dead values when they take up more than half of it,
+ *        updating the references in the table.
+ *
+ * @param table The hash table holding the references.
+ */
+void cold_store_compact(struct ht *table);
+
+/**
+ * @brief A hash table value as a readable value_pair, wherever it is stored.
+ */
+static inline const struct value_pair *value_resolve(const void *value)
+{
+	return value_is_cold(value) ? cold_store_get(value) : (const struct value_pair *)value;
+}
+
+/**
+ * @brief Bytes of live values in the file and bytes taken by dead ones.
+ */
+size_t cold_store_live_bytes(void);
+size_t cold_store_dead_bytes(void);
+
+#endif // COLD_STORE_H
@@ -0,0 +1,148 @@
+#include "config.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Parses a byte count with an optional K, M or G suffix.
+ *
+ * @return int 0 on success, -1 if text is not a size.
+ */
+static int parse_size(const char *text, size_t *size)
+{
+	char *end;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (end == text)
+		return -1;
+
+	switch (*end)
+	{
+	case 'G':
+	case 'g':
+		value <<= 10;
+		/* fall through */
+	case 'M':
+	case 'm':
+		value <<= 10;
+		/* fall through */
+	case 'K':
+	case 'k':
+		value <<= 10;
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		return -1;
+
+	*size = value;
+	return 0;
+}
+
+void print_usage(const char *program)
+{
+	printf("Usage: %s <tracker_address> <tracker_port> [options]\n", program);
+	printf("Options:\n");
+	printf("  -z, --compress-values   store names and email domains through a shared dictionary\n");
+	printf("  -o, --ordered           map SSNs to slots by birth date, for range scans (every node must use it)\n");
+	printf("  -x, --ring-extensions   forward requests by fingers and a slot owner map (every node must use it)\n");
+	printf("  -d, --data-dir DIR      log changes to DIR and recover the store from it on restart\n");
+	printf("  -m, --memory-budget N   keep at most N bytes of values in RAM (K, M and G suffixes), spill the rest\n");
+	printf("  -M, --memory-limit N    refuse inserts of new keys once the node uses N bytes (K, M and G suffixes)\n");
+	printf("  -l, --load FILE         store the entries of FILE, made by bulk_load, that fall in the node's range\n");
+	printf("  -s, --snapshot-every N  write a snapshot after N logged changes (default %d)\n", DEFAULT_SNAPSHOT_EVERY);
+	printf("  -a, --alive-interval MS send NET_ALIVE to the tracker every MS milliseconds (default %d)\n", DEFAULT_ALIVE_INTERVAL);
+	printf("  -b, --busy-poll CPU     pin the event loop to CPU and spin on the sockets instead of sleeping\n");
+	printf("  -i, --busy-poll-idle MS with --busy-poll, sleep after MS milliseconds without input (default %d)\n", DEFAULT_BUSY_POLL_IDLE);
+}
+
+int parse_config(int argc, char *argv[], struct node_config *config)
+{
+	static const struct option options[] = {
+	    {"compress-values", no_argument, NULL, 'z'},
+	    {"ordered", no_argument, NULL, 'o'},
+	    {"ring-extensions", no_argument, NULL, 'x'},
+	    {"data-dir", required_argument, NULL, 'd'},
+	    {"snapshot-every", required_argument, NULL, 's'},
+	    {"load", required_argument, NULL, 'l'},
+	    {"memory-budget", required_argument, NULL, 'm'},
+	    {"memory-limit", required_argument, NULL, 'M'},
+	    {"alive-interval", required_argument, NULL, 'a'},
+	    {"busy-poll", required_argument, NULL, 'b'},
+	    {"busy-poll-idle", required_argument, NULL, 'i'},
+	    {NULL, 0, NULL, 0},
+	};
+
+	config->compress_values = false;
+	config->ordered = false;
+	config->ring_extensions = false;
+	config->data_dir = NULL;
+	config->snapshot_every = DEFAULT_SNAPSHOT_EVERY;
+	config->load_file = NULL;
+	config->memory_budget = 0;
+	config->memory_limit = 0;
+	config->alive_interval = DEFAULT_ALIVE_INTERVAL;
+	config->busy_poll_cpu = -1;
+	config->busy_poll_idle = DEFAULT_BUSY_POLL_IDLE;
+
+	int option;
+	while ((option = getopt_long(argc, argv, "zoxd:s:l:m:M:a:b:i:", options, NULL)) != -1)
+	{
+		switch (option)
+		{
+		case 'z':
+			config->compress_values = true;
+			break;
+		case 'o':
+			config->ordered = true;
+			break;
+		case 'x':
+			config->ring_extensions = true;
+			break;
+		case 'd':
+			config->data_dir = optarg;
+			break;
+		case 'm':
+			if (parse_size(optarg, &config->memory_budget) < 0)
+				return -1;
+			break;
+		case 'M':
+			if (parse_size(optarg, &config->memory_limit) < 0)
+				return -1;
+			break;
+		case 'l':
+			config->load_file = optarg;
+			break;
+		case 's':
+			config->snapshot_every = strtoull(optarg, NULL, 10);
+			if (config->snapshot_every == 0)
+				return -1;
+			break;
+		case 'a':
+			config->alive_interval = strtoul(optarg, NULL, 10);
+			if (config->alive_interval == 0)
+				return -1;
+			break;
+		case 'b':
+		{
+			char *end;
+			long cpu = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || cpu < 0)
+				return -1;
+			config->busy_poll_cpu = cpu;
+			break;
+		}
+		case 'i':
+			config->busy_poll_idle = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (argc - optind != 2)
+		return -1;
+
+	config->tracker_address = argv[optind];
+	config->tracker_port = atoi(argv[optind + 1]);
+	return 0;
+}
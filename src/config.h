@@ -0,0 +1,49 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEFAULT_SNAPSHOT_EVERY 1000000
+#define DEFAULT_ALIVE_INTERVAL 5000 // milliseconds, well within the tracker's timeout
+#define DEFAULT_BUSY_POLL_IDLE 200  // milliseconds without input before a busy-polling node sleeps
+
+/**
+ * @brief Settings given on the command line.
+ */
+struct node_config
+{
+	const char *tracker_address;
+	int tracker_port;
+	bool compress_values; // intern names and email domains in a shared dictionary
+	bool ordered;	      // order-preserving partitioning, must match the rest of the ring
+	bool ring_extensions; // finger routing and the PDUs it needs, every node of the ring must use it
+	const char *data_dir; // write-ahead log and snapshot directory, NULL to keep nothing on disk
+	uint64_t snapshot_every; // logged changes between snapshots
+	size_t memory_limit; // refuse inserts of new keys once the node uses this many bytes, 0 for no limit
+	size_t memory_budget; // bytes of values kept in RAM before cold ones move to a file, 0 for no limit
+	const char *load_file; // snapshot file written by bin/bulk_load to take the node's range from, or NULL
+	uint32_t alive_interval; // milliseconds between NET_ALIVE PDUs to the tracker
+	int busy_poll_cpu; // CPU the event loop is pinned to while it spins on its sockets, -1 to sleep in the reactor
+	uint32_t busy_poll_idle; // milliseconds without input before busy polling sleeps until the next input
+};
+
+/**
+ * @brief Parses the command line into config. Options not given keep their defaults.
+ *
+ * @param argc Argument count from main.
+ * @param argv Arguments from main: <tracker_address> <tracker_port> [options].
+ * @param config Filled in with the settings.
+ * @return int 0 on success, -1 if the arguments are invalid.
+ */
+int parse_config(int argc, char *argv[], struct node_config *config);
+
+/**
+ * @brief Prints how to start the node.
+ *
+ * @param program argv[0].
+ */
+void print_usage(const char *program);
+
+#endif // CONFIG_H
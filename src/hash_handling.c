@@ -1,39 +1,40 @@
 #include "hash_handling.h"
 
+/**
+ * @brief Checks that a received SSN is 12 digits, the only keys the table can store.
+ */
+static bool valid_ssn(const uint8_t *ssn)
+{
+	ssn_key_t key;
+	if (ssn_pack((const char *)ssn, &key))
+		return true;
+
+	log_warn("\tInvalid SSN {%.12s}, PDU dropped", ssn);
+	return false;
+}
+
 int handle_ht_remove(struct self_data *self_data, struct VAL_REMOVE_PDU remove_pdu)
 {
 	char *ssn_string = (char *)remove_pdu.ssn;
+	if (!valid_ssn(remove_pdu.ssn))
+		return -1;
+
 	int range_val = check_range(self_data, ssn_string);
 
 	if (range_val == 0)
 	{
-		int num_entries = get_num_entries(self_data->hash_table);
-		printf("\tRemoving SSN: {%s}\n", ssn_string);
-
-
-		for (size_t i = 0; i < num_entries; i++)
-		{
-			if (strncmp(self_data->ssns[i], ssn_string, 12) == 0)	//check if value exists, in that case remove corresponding key from array
-			{
-				self_data->hash_table = ht_remove(self_data->hash_table, ssn_string);
-
-				free(self_data->ssns[i]);		//
-				for (size_t j = i; j < num_entries - 1; j++)
-				{
-					self_data->ssns[j] = self_data->ssns[j + 1];
-				}
-				self_data->ssns[num_entries - 1] = NULL;
-				break;		//value is found, exit
-			}
-		}
+		log_debug("\tRemoving SSN: {%.12s}", ssn_string);
+		load_count(self_data, ssn_string);
+		if (delete_value(self_data, ssn_string))
+			persistence_log_remove(&self_data->persistence, ssn_string);
 		return 0;
 	}
 	else // val is not in nodes range, forward message
 	{
-		printf("\tSSN is not in range\n");
-		if (send_tcp_pdu(self_data->fds[SUCCESSOR_FDS].fd, &remove_pdu, sizeof(remove_pdu)) < 0)
+		log_debug("\tSSN is not in range");
+		if (forward_request(self_data, ring_slot(ssn_string), &remove_pdu, sizeof(remove_pdu)) < 0)
 		{
-			exit_with_error("Failed to send VAL_REMOVE_PDU to successor", self_data);
+			exit_with_error("Failed to forward VAL_REMOVE_PDU", self_data);
 		}
 		return 0;
 	}
@@ -41,87 +42,109 @@ int handle_ht_remove(struct self_data *self_data, struct VAL_REMOVE_PDU remove_p
 	return 0;
 }
 
-void handle_ht_insert(struct self_data *self_data, struct VAL_INSERT_PDU insert_pdu)
+void handle_ht_insert(struct self_data *self_data, struct VAL_INSERT_PDU insert_pdu, const uint8_t *raw, size_t raw_length)
 {
-	char *ssn_string = malloc(SSN_LENGTH);
-	if (!ssn_string)
-	{
-		exit_with_error("Failed to allocate memory for SSN", self_data);
-	}
-
-	memcpy(ssn_string, insert_pdu.ssn, SSN_LENGTH);
+	char *ssn_string = (char *)insert_pdu.ssn;
+	if (!valid_ssn(insert_pdu.ssn))
+		return;
 
-	struct value_pair *pair;
 	int range_val = check_range(self_data, ssn_string);
 
 	if (range_val == 0) // val is in range
 	{
 
-		printf("\tInserting SSN: {%.12s}\n", ssn_string);
-		printf("\tName: {%s}", insert_pdu.name);
-		printf(" Email: {%s}\n", insert_pdu.email);
-		size_t num_entries = get_num_entries(self_data->hash_table);
-
-		pair = create_value_pair(insert_pdu.name_length, insert_pdu.email_length, insert_pdu.name, insert_pdu.email);
-		if (!pair)
-		{
-			free(ssn_string);
-			exit_with_error("Failed to create value pair", self_data);
-		}
-
-		self_data->hash_table = ht_insert(self_data->hash_table, ssn_string, pair);
+		log_debug("\tInserting SSN: {%.12s}", ssn_string);
+		load_count(self_data, ssn_string);
+		log_debug("\tName: {%.*s} Email: {%.*s}", insert_pdu.name_length, insert_pdu.name, insert_pdu.email_length, insert_pdu.email);
 
-		if (num_entries != get_num_entries(self_data->hash_table)) // if duplicate is inserted a new element wont be made so skip adding ssn
+		if (!memory_admit(self_data, ssn_string, insert_pdu.name_length, insert_pdu.email_length))
 		{
-			char *new_ssn = malloc(SSN_LENGTH);
-			if (!new_ssn)
-			{
-				free(ssn_string);
-				exit_with_error("Failed to allocate memory for SSN entry", self_data);
-			}
-			memcpy(new_ssn, ssn_string, SSN_LENGTH);
-			self_data->ssns[num_entries] = new_ssn;
+			log_warn("\tMemory limit reached, VAL_INSERT for {%.12s} refused", ssn_string);
+			return;
 		}
+		store_value(self_data, ssn_string, insert_pdu.name_length, insert_pdu.email_length, insert_pdu.name, insert_pdu.email);
+		persistence_log_insert(&self_data->persistence, ssn_string, insert_pdu.name_length, insert_pdu.email_length, insert_pdu.name, insert_pdu.email);
 		return;
 	}
 	else
 	{
-		send_insert_pdu_tcp(insert_pdu, self_data, SUCCESSOR_FDS);
-		free(ssn_string);
+		// passed on as received, there is nothing to encode again
+		log_debug("\tForwarding insert pdu\t :: SSN: {%.12s}", ssn_string);
+		if (forward_request(self_data, ring_slot(ssn_string), raw, raw_length) < 0)
+			log_warn("Failed to forward VAL_INSERT_PDU");
 		return;
 	}
 }
 
-struct value_pair *create_value_pair(uint8_t name_length, uint8_t email_length, uint8_t *name, uint8_t *email)
+void store_value(struct self_data *self_data, char *ssn, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
 {
-	struct value_pair *pair = malloc(sizeof(struct value_pair));
+	flush_udp_views(self_data); // a replaced value may be in a queued lookup response
+	struct value_pair *pair = create_value_pair(&self_data->record_arenas[hash_ssn(ssn)], name_length, email_length, name, email);
 	if (!pair)
 	{
-		exit_with_error("Failed to allocate memory for value pair", NULL);
+		exit_with_error("Failed to create value pair", self_data);
 	}
 
-	pair->name = malloc(name_length * sizeof(uint8_t));
-	if (!pair->name)
+	// the table copies the key, and frees the old pair if the SSN is a duplicate
+	self_data->hash_table = ht_insert(self_data->hash_table, ssn, pair);
+}
+
+bool delete_value(struct self_data *self_data, char *ssn)
+{
+	if (ht_lookup(self_data->hash_table, ssn) == NULL) // check if value exists, the table frees the value pair
+		return false;
+
+	flush_udp_views(self_data);
+	self_data->hash_table = ht_remove(self_data->hash_table, ssn);
+	return true;
+}
+
+struct value_pair *create_value_pair(struct slab_arena *arena, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
+{
+	struct value_pair *pair;
+
+	if (value_codec_enabled())
 	{
-		free(pair);
-		exit_with_error("Failed to allocate memory for pair name", NULL);
-	}
+		uint8_t encoded[VALUE_MAX_ENCODED];
+		uint8_t flags;
+		size_t encoded_length = value_encode(encoded, &flags, name_length, email_length, name, email);
 
-	pair->email = malloc(email_length * sizeof(uint8_t));
-	if (!pair->email)
+		pair = slab_alloc(arena, sizeof(struct value_pair) + encoded_length);
+		if (!pair)
+		{
+			exit_with_error("Failed to allocate memory for value pair", NULL);
+		}
+		pair->flags = flags;
+		memcpy(pair->data, encoded, encoded_length);
+	}
+	else
 	{
-		free(pair->name);
-		free(pair);
-		exit_with_error("Failed to allocate memory for pair email", NULL);
+		pair = slab_alloc(arena, sizeof(struct value_pair) + name_length + email_length);
+		if (!pair)
+		{
+			exit_with_error("Failed to allocate memory for value pair", NULL);
+		}
+		pair->flags = 0;
+		memcpy(pair->data, name, name_length);
+		memcpy(pair->data + name_length, email, email_length);
 	}
 
-	memcpy(pair->name, name, name_length);
-	memcpy(pair->email, email, email_length);
-	pair->email_length = email_length;
 	pair->name_length = name_length;
+	pair->email_length = email_length;
+	pair->access = TIERING_ACCESS_ON_INSERT;
 	return pair;
 }
 
+void create_store(struct self_data *self_data)
+{
+	self_data->hash_table = ht_create(free_value_pair);
+	if (self_data->hash_table == NULL)
+		exit_with_error("Failed to create hash table", self_data);
+
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+		slab_arena_init(&self_data->record_arenas[slot]);
+}
+
 int handle_ht_lookup(struct self_data *self_data, struct VAL_LOOKUP_PDU lookup_pdu)
 {
 
@@ -133,166 +156,334 @@ int handle_ht_lookup(struct self_data *self_data, struct VAL_LOOKUP_PDU lookup_p
 
 	char *ssn_string = (char *)lookup_pdu.ssn;
 	struct VAL_LOOKUP_RESPONSE_PDU response_pdu;
+	if (!valid_ssn(lookup_pdu.ssn))
+		return -1;
 
 	memset(&response_pdu, 0, sizeof(struct VAL_LOOKUP_RESPONSE_PDU)); // set response to 0 in case no val is fouund
 	response_pdu.type = VAL_LOOKUP_RESPONSE;
 	int range_val = check_range(self_data, ssn_string);
 
-	printf("\tLooking up SSN: {%.12s}\n", ssn_string);
+	log_debug("\tLooking up SSN: {%.12s}", ssn_string);
 	if (range_val == 0)
 	{
-		printf("\tSSN is in range\n");
+		log_debug("\tSSN is in range");
+		load_count(self_data, ssn_string);
 		void *res = ht_lookup(self_data->hash_table, ssn_string);
 
 		if (res != NULL)
 		{
-			printf("\tSSN found\n");
-			struct value_pair *pair = (struct value_pair *)res;
-			response_pdu.email = pair->email;
-			response_pdu.name = pair->name;
+			log_debug("\tSSN found");
+			const struct value_pair *pair = value_resolve(res);
+			struct value_fields fields;
+			value_fields(pair, &fields);
+			response_pdu.email = (uint8_t *)fields.email;
+			response_pdu.name = (uint8_t *)fields.name;
 			response_pdu.email_length = pair->email_length;
 			response_pdu.name_length = pair->name_length;
 			memcpy(response_pdu.ssn, lookup_pdu.ssn, SSN_LENGTH);
-			send_lookup_response_pdu_udp(response_pdu, self_data, sender_addr);
+			send_lookup_response_pdu_udp(response_pdu, self_data, sender_addr, fields.email != fields.email_scratch);
+			tiering_touch(self_data, ssn_string, res);
 		}
 		else
-			printf("\tSSN not found\n");
+			log_debug("\tSSN not found");
 
 		return 0;
 	}
 	else
 	{
-		printf("\tSSN is not in range\n");
-		if (send_tcp_pdu(self_data->fds[SUCCESSOR_FDS].fd, &lookup_pdu, sizeof(lookup_pdu)) < 0)
+		log_debug("\tSSN is not in range");
+		if (forward_request(self_data, ring_slot(ssn_string), &lookup_pdu, sizeof(lookup_pdu)) < 0)
 		{
-			exit_with_error("Failed to send VAL_LOOKUP_PDU to successor", self_data);
+			exit_with_error("Failed to forward VAL_LOOKUP_PDU", self_data);
 		}
 		return 0;
 	}
 }
 
+struct scan_reply
+{
+	struct self_data *self_data;
+	struct sockaddr_in sender_addr;
+	uint32_t entries;
+};
+
+/**
+ * @brief ht_visit_function that sends one entry to the requester of a range scan. Entries of the
+ *        neighbours sharing a hash slot at the ends of the range are skipped.
+ */
+static void send_scan_entry(const char *key, void *value, void *arg)
+{
+	struct scan_reply *reply = arg;
+	const struct value_pair *pair = value_resolve(value);
+	struct value_fields fields;
+	struct VAL_LOOKUP_RESPONSE_PDU response_pdu;
+
+	if (check_range(reply->self_data, (char *)key) != 0)
+		return;
+	reply->entries++;
+	value_fields(pair, &fields);
+	response_pdu.type = VAL_LOOKUP_RESPONSE;
+	response_pdu.name_length = pair->name_length;
+	response_pdu.email_length = pair->email_length;
+	response_pdu.name = (uint8_t *)fields.name;
+	response_pdu.email = (uint8_t *)fields.email;
+	memcpy(response_pdu.ssn, key, SSN_LENGTH);
+	send_lookup_response_pdu_udp(response_pdu, reply->self_data, reply->sender_addr, fields.email != fields.email_scratch);
+}
+
+int handle_range_scan(struct self_data *self_data, struct VAL_RANGE_SCAN_PDU scan_pdu)
+{
+	ssn_key_t from, to;
+	if (!valid_ssn(scan_pdu.ssn_from) || !valid_ssn(scan_pdu.ssn_to))
+		return -1;
+	ssn_pack((const char *)scan_pdu.ssn_from, &from);
+	ssn_pack((const char *)scan_pdu.ssn_to, &to);
+	if (from > to)
+	{
+		log_warn("\tRange scan from {%.12s} to {%.12s} is empty, PDU dropped", scan_pdu.ssn_from, scan_pdu.ssn_to);
+		return -1;
+	}
+
+	int first_slot = 0, last_slot = RING_SLOTS - 1;
+	if (ht_get_partitioning() == HT_PARTITION_ORDERED)
+	{
+		first_slot = ring_slot((char *)scan_pdu.ssn_from);
+		last_slot = ring_slot((char *)scan_pdu.ssn_to);
+	}
+
+	log_debug("\tRange scan {%.12s}-{%.12s}, slots %d-%d", scan_pdu.ssn_from, scan_pdu.ssn_to, first_slot, last_slot);
+	if (!scan_pdu.started && (first_slot < self_data->range_start || first_slot > self_data->range_end))
+	{
+		log_debug("\tFirst slot is not in range");
+		if (forward_request(self_data, first_slot, &scan_pdu, sizeof(scan_pdu)) < 0)
+			exit_with_error("Failed to forward VAL_RANGE_SCAN_PDU", self_data);
+		return 0;
+	}
+
+	struct scan_reply reply = {.self_data = self_data};
+	reply.sender_addr.sin_addr.s_addr = scan_pdu.sender_address;
+	reply.sender_addr.sin_port = scan_pdu.sender_port;
+	reply.sender_addr.sin_family = AF_INET;
+
+	int start = first_slot > self_data->range_start ? first_slot : self_data->range_start;
+	int end = last_slot < self_data->range_end ? last_slot : self_data->range_end;
+	for (int slot = HASH_SLOT_OF(start); start <= end && slot <= HASH_SLOT_OF(end); slot++)
+		ht_foreach_sorted_in_slot(self_data->hash_table, slot, from, to, send_scan_entry, &reply);
+
+	if (start <= end)
+	{
+		struct VAL_RANGE_SCAN_DONE_PDU done_pdu = {
+		    .type = VAL_RANGE_SCAN_DONE,
+		    .slot_start = htons(start),
+		    .slot_end = htons(end),
+		    .entries = htonl(reply.entries),
+		};
+		log_debug("\tRange scan sent %u entries from slots %d-%d", reply.entries, start, end);
+		if (queue_udp_pdu(self_data, reply.sender_addr, &done_pdu, sizeof(done_pdu)) < 0) // after the entries
+			log_warn("Failed to send VAL_RANGE_SCAN_DONE_PDU");
+	}
+
+	if (last_slot > self_data->range_end && self_data->successor.socket > 0)
+	{
+		scan_pdu.started = 1;
+		if (send_tcp_pdu(&self_data->successor, &scan_pdu, sizeof(scan_pdu)) < 0)
+			exit_with_error("Failed to send VAL_RANGE_SCAN_PDU to successor", self_data);
+	}
+	return 0;
+}
+
 int check_range(struct self_data *self_data, char *ssn)
 {
-	hash_t val = hash_ssn(ssn);
+	slot_t val = ring_slot(ssn);
 	if (val >= self_data->range_start && val <= self_data->range_end) // check hash if range is withing range
 		return 0;
 
 	return 1;
 }
 
-void update_range(struct NET_NEW_RANGE_PDU range_pdu, struct self_data *self_data)
+void update_range(struct NET_WIDE_NEW_RANGE_PDU range_pdu, struct self_data *self_data)
 {
 	struct NET_NEW_RANGE_RESPONSE_PDU response_pdu;
 	response_pdu.type = NET_NEW_RANGE_RESPONSE;
-	int reciever = 0;
+	struct connection_point *reciever = NULL;
+	slot_t range_start = ntohs(range_pdu.range_start);
+	slot_t range_end = ntohs(range_pdu.range_end);
 
-	if (range_pdu.range_start < self_data->range_start) // if the range start is less than current range, send to predes
+	if (range_start < self_data->range_start) // if the range start is less than current range, send to predes
 	{
-		self_data->range_start = range_pdu.range_start;
-		reciever = PREDECESSOR_FDS;
+		self_data->range_start = range_start;
+		reciever = &self_data->predecessor;
 	}
-	else if (range_pdu.range_end > self_data->range_end)
+	else if (range_end > self_data->range_end)
 	{
-		self_data->range_end = range_pdu.range_end;
-		reciever = SUCCESSOR_FDS;
+		self_data->range_end = range_end;
+		reciever = &self_data->successor;
 	}
-	if (send_tcp_pdu(self_data->fds[reciever].fd, &response_pdu, sizeof(response_pdu)) < 0)
+	if (reciever == NULL)
+		return; // the range did not grow
+	if (send_tcp_pdu(reciever, &response_pdu, sizeof(response_pdu)) < 0)
 	{
 		exit_with_error("Failed to send NET_NEW_RANGE_RESPONSE_PDU", self_data);
 		return;
 	}
+	routing_range_changed(self_data);
 }
-void send_new_range_and_entries(struct self_data *self_data, uint32_t old_succ_adr, uint16_t old_succ_port)
+struct entry_transfer
 {
-	struct NET_JOIN_RESPONSE_PDU response;
-	uint8_t middle_point;
-
-	middle_point = (self_data->range_end - self_data->range_start) / 2 + self_data->range_start; // Calculate new range
-	response.range_start = middle_point + 1;
-	response.range_end = self_data->range_end;
-	response.next_address = old_succ_adr;
-	response.next_port = old_succ_port;
-	response.type = NET_JOIN_RESPONSE;
+	struct self_data *self_data;
+	struct connection_point *connection;
+	ssn_key_t *sent; // keys sent from a hash slot the own range shares, removed after the walk
+	size_t sent_count;
+	size_t sent_capacity;
+};
 
-	self_data->range_end = middle_point;
+/**
+ * @brief ht_visit_function that sends one table entry as a VAL_INSERT_PDU.
+ */
+static void send_entry(const char *key, void *value, void *arg)
+{
+	struct entry_transfer *transfer = arg;
+	const struct value_pair *pair = value_resolve(value);
+	struct value_fields fields;
+	struct VAL_INSERT_PDU insert_pdu;
 
-	if (send_tcp_pdu(self_data->fds[SUCCESSOR_FDS].fd, &response, sizeof(response)) < 0) // send response
-	{
-		exit_with_error("Failed to send NET_JOIN_RESPONSE_PDU", self_data);
-	}
+	value_fields(pair, &fields);
 
-	int num_entries = get_num_entries(self_data->hash_table);
-	struct VAL_INSERT_PDU insert_pdu;
 	insert_pdu.type = VAL_INSERT;
+	insert_pdu.email_length = pair->email_length; // create pdu
+	insert_pdu.name_length = pair->name_length;
+	insert_pdu.email = (uint8_t *)fields.email;
+	insert_pdu.name = (uint8_t *)fields.name;
+	memcpy(insert_pdu.ssn, key, SSN_LENGTH);
+
+	send_insert_pdu_tcp(insert_pdu, transfer->self_data, transfer->connection);
+}
+
+/**
+ * @brief free_function that only drops a record's dictionary references, the slab memory is released with the arena.
+ *        Cold records are marked dead in the cold store.
+ */
+static void release_value_pair(void *value)
+{
+	value_release(value_resolve(value));
+	if (value_is_cold(value))
+		cold_store_discard(value);
+}
+
+void drop_slot(struct self_data *self_data, hash_t slot)
+{
+	flush_udp_views(self_data);
+	ht_partition *partition = ht_detach_slot(self_data->hash_table, slot);
+	ht_partition_destroy(partition, release_value_pair);
+	slab_arena_release(&self_data->record_arenas[slot]);
+}
 
-	for (int i = 0; i < num_entries;)
+/**
+ * @brief ht_visit_function that sends an entry outside the own range and keeps its key, the table
+ *        cannot change while it is walked.
+ */
+static void send_foreign_entry(const char *key, void *value, void *arg)
+{
+	struct entry_transfer *transfer = arg;
+	if (check_range(transfer->self_data, (char *)key) == 0)
+		return;
+	if (transfer->sent_count == transfer->sent_capacity)
 	{
-		if (check_range(self_data, self_data->ssns[i]) != 0) // see if current elements are in new range, if not send them
-		{
-			void *res = ht_lookup(self_data->hash_table, self_data->ssns[i]);
-			if (res == NULL)
-			{
-				fprintf(stderr, "Failed to find value for key %s when it should exist\n", self_data->ssns[i]);
-				return;
-			}
-
-			struct value_pair *pair = (struct value_pair *)res;
-			insert_pdu.email_length = pair->email_length; // create pdu
-			insert_pdu.name_length = pair->name_length;
-			insert_pdu.email = pair->email;
-			insert_pdu.name = pair->name;
-			memcpy(insert_pdu.ssn, self_data->ssns[i], SSN_LENGTH);
-
-			send_insert_pdu_tcp(insert_pdu, self_data, SUCCESSOR_FDS); // send it
-
-			self_data->hash_table = ht_remove(self_data->hash_table, self_data->ssns[i]); // remove value from current table
-			free(self_data->ssns[i]);						      // and free the key
-
-			for (size_t j = i; j < num_entries - 1; j++) // fix gaps in array
-			{
-				self_data->ssns[j] = self_data->ssns[j + 1];
-			}
-
-			self_data->ssns[num_entries - 1] = NULL;
-			num_entries--;
-		}
-		else
-			i++;
+		transfer->sent_capacity = transfer->sent_capacity ? transfer->sent_capacity * 2 : 64;
+		transfer->sent = realloc(transfer->sent, transfer->sent_capacity * sizeof(*transfer->sent));
+		if (!transfer->sent)
+			exit_with_error("Failed to allocate memory for the keys handed over", transfer->self_data);
 	}
+	ssn_pack(key, &transfer->sent[transfer->sent_count++]);
+	send_entry(key, value, arg);
+}
+
+/**
+ * @brief Detaches a whole hash slot, sends its entries and frees them with the slot's arena.
+ */
+static void hand_over_slot(struct self_data *self_data, hash_t slot, struct connection_point *connection)
+{
+	struct entry_transfer transfer = {.self_data = self_data, .connection = connection};
+
+	flush_udp_views(self_data);
+	ht_partition *partition = ht_detach_slot(self_data->hash_table, slot);
+	ht_partition_foreach(partition, send_entry, &transfer);
+	ht_partition_destroy(partition, release_value_pair);
+	slab_arena_release(&self_data->record_arenas[slot]);
+	persistence_log_drop_slot(&self_data->persistence, slot);
 }
 
-void send_all_entries(struct self_data *self_data, int fd)
+void send_slot_entries(struct self_data *self_data, hash_t slot, struct connection_point *connection)
 {
-	int num_entries = get_num_entries(self_data->hash_table);
+	if (LAST_RING_SLOT(slot) < self_data->range_start || FIRST_RING_SLOT(slot) > self_data->range_end)
+	{
+		hand_over_slot(self_data, slot, connection);
+		return;
+	}
 
-	for (int i = 0; i < num_entries; i++)
+	// the own range ends inside the slot, its entries go one by one
+	struct entry_transfer transfer = {.self_data = self_data, .connection = connection};
+	ht_foreach_in_slot(self_data->hash_table, slot, send_foreign_entry, &transfer);
+	for (size_t i = 0; i < transfer.sent_count; i++)
 	{
-		struct VAL_INSERT_PDU insert_pdu;
-		insert_pdu.type = VAL_INSERT;
+		char ssn[SSN_DIGITS];
+		ssn_unpack(transfer.sent[i], ssn);
+		if (delete_value(self_data, ssn))
+			persistence_log_remove(&self_data->persistence, ssn);
+	}
+	free(transfer.sent);
+}
 
-		void *res = ht_lookup(self_data->hash_table, self_data->ssns[i]);
-		if (res == NULL)
-		{
-			fprintf(stderr, "Failed to find value for key %s when it should exist\n", self_data->ssns[i]);
-			continue;
-		}
+void send_new_range_and_entries(struct self_data *self_data, uint32_t old_succ_adr, uint16_t old_succ_port)
+{
+	struct NET_JOIN_RESPONSE_PDU response;
+	struct NET_WIDE_JOIN_RESPONSE_PDU wide_response;
+	slot_t middle_point;
+	slot_t old_range_end = self_data->range_end;
+	int sent;
+
+	middle_point = load_split_point(self_data); // Calculate new range
+	if (middle_point >= self_data->range_end) // handle_net_wide_join() does not choose a range of one slot
+		exit_with_error("Range of one slot cannot be split for a joining node", self_data);
+	log_info("\tSplitting range %d-%d after slot %d", self_data->range_start, self_data->range_end, middle_point);
+	response.range_start = HASH_SLOT_OF(middle_point + 1);
+	response.range_end = HASH_SLOT_OF(self_data->range_end);
+	response.next_address = old_succ_adr;
+	response.next_port = old_succ_port;
+	response.type = NET_JOIN_RESPONSE;
+	wide_response.range_start = htons(middle_point + 1);
+	wide_response.range_end = htons(self_data->range_end);
+	wide_response.next_address = old_succ_adr;
+	wide_response.next_port = old_succ_port;
+	wide_response.type = NET_WIDE_JOIN_RESPONSE;
+	wide_response.version = htonl(self_data->routing.map_version);
 
-		struct value_pair *pair = (struct value_pair *)res;
-		insert_pdu.email_length = pair->email_length;
-		insert_pdu.name_length = pair->name_length;
-		insert_pdu.email = pair->email;
-		insert_pdu.name = pair->name;
-		memcpy(insert_pdu.ssn, self_data->ssns[i], SSN_LENGTH);
+	self_data->range_end = middle_point;
 
-		send_insert_pdu_tcp(insert_pdu, self_data, fd);
+	if (self_data->config.ring_extensions)
+		sent = send_tcp_pdu(&self_data->successor, &wide_response, sizeof(wide_response));
+	else
+		sent = send_tcp_pdu(&self_data->successor, &response, sizeof(response));
+	if (sent < 0) // send response
+	{
+		exit_with_error("Failed to send NET_JOIN_RESPONSE_PDU", self_data);
 	}
-	printf("\tFreeing memory\n");
-	for (int i = 0; i < num_entries; i++)
+
+	for (int slot = (middle_point + 1) / SLOTS_PER_HASH_SLOT; slot <= HASH_SLOT_OF(old_range_end); slot++) // only the slots handed over are visited
 	{
-		self_data->hash_table = ht_remove(self_data->hash_table, self_data->ssns[i]);
-		free(self_data->ssns[i]);
+		send_slot_entries(self_data, slot, &self_data->successor);
 	}
+	routing_range_changed(self_data);
+}
 
+void send_all_entries(struct self_data *self_data, struct connection_point *connection)
+{
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+	{
+		if (ht_slot_entries(self_data->hash_table, slot) > 0)
+			hand_over_slot(self_data, slot, connection);
+	}
+	log_info("\tFreeing memory");
 	ht_destroy(self_data->hash_table);
 }
 
@@ -314,95 +505,57 @@ void free_value_pair(void *value)
 	if (!value)
 		return; // Nothing to free if the pointer is NULL
 
-	struct value_pair *pair = (struct value_pair *)value;
-
-	if (pair->name)
-		free(pair->name);
-
-	if (pair->email)
-		free(pair->email);
-
-	free(pair);
+	value_release(value_resolve(value));
+	if (value_is_cold(value))
+		cold_store_discard(value);
+	else
+		slab_free(value);
 }
 
-void send_insert_pdu_tcp(const struct VAL_INSERT_PDU pdu, struct self_data *self_data, int fd)
+void send_insert_pdu_tcp(const struct VAL_INSERT_PDU pdu, struct self_data *self_data, struct connection_point *connection)
 {
-
-	size_t pdu_size = 1 + SSN_LENGTH + 1 + pdu.name_length + 1 + pdu.email_length; // Get the size of the buffer
-
-	uint8_t *send_buffer = malloc(pdu_size);
-	if (!send_buffer)
+	// name and email go from the store straight into the send queue
+	uint8_t header[1 + SSN_LENGTH + 1];
+	header[0] = pdu.type;
+	memcpy(&header[1], pdu.ssn, SSN_LENGTH);
+	header[1 + SSN_LENGTH] = pdu.name_length;
+	struct iovec iov[4] = {
+	    {.iov_base = header, .iov_len = sizeof(header)},
+	    {.iov_base = pdu.name, .iov_len = pdu.name_length},
+	    {.iov_base = (void *)&pdu.email_length, .iov_len = 1},
+	    {.iov_base = pdu.email, .iov_len = pdu.email_length},
+	};
+
+	log_debug("\tSending insert pdu to %s\t :: SSN: {%.12s}",
+		  connection == &self_data->successor ? "successor" : connection == &self_data->predecessor ? "predecessor" : "unknown", pdu.ssn);
+	if (send_tcp_pdu_iov(connection, iov, 4) < 0)
 	{
-		perror("malloc");
-		free(pdu.name);
-		free(pdu.email);
-		return;
+		log_warn("Failed to send VAL_INSERT_PDU to successor");
 	}
-
-	size_t send_offset = 0;
-	send_buffer[send_offset++] = pdu.type;
-	memcpy(&send_buffer[send_offset], pdu.ssn, SSN_LENGTH);
-
-	send_offset += SSN_LENGTH;
-	send_buffer[send_offset++] = pdu.name_length;
-	memcpy(&send_buffer[send_offset], pdu.name, pdu.name_length);
-
-	send_offset += pdu.name_length;
-	send_buffer[send_offset++] = pdu.email_length;
-	memcpy(&send_buffer[send_offset], pdu.email, pdu.email_length);
-
-	printf("\tSending insert pdu to");
-	if (fd == SUCCESSOR_FDS)
-		printf(" successor");
-	else if (fd == PREDECESSOR_FDS)
-		printf(" predecessor");
-	else
-		printf(" unknown");
-	printf("\t :: SSN: {%.12s}\n", pdu.ssn);
-	if (send_tcp_pdu(self_data->fds[fd].fd, send_buffer, pdu_size) < 0)
-	{
-		fprintf(stderr, "Failed to send VAL_INSERT_PDU to successor\n");
-	}
-
-	// Free the send buffer
-	free(send_buffer);
 }
 
-void send_lookup_response_pdu_udp(const struct VAL_LOOKUP_RESPONSE_PDU pdu, struct self_data *self_data, struct sockaddr_in send_addr)
+void send_lookup_response_pdu_udp(const struct VAL_LOOKUP_RESPONSE_PDU pdu, struct self_data *self_data, struct sockaddr_in send_addr, bool email_stored)
 {
-
-	size_t pdu_size = 1 + SSN_LENGTH + 1 + pdu.name_length + 1 + pdu.email_length; // Get the size of the buffer
-
-	uint8_t *send_buffer = malloc(pdu_size);
-
-	if (!send_buffer)
-	{
-		perror("malloc");
-		free(pdu.name);
-		free(pdu.email);
-		return;
-	}
-
-	size_t send_offset = 0; // insert elements into buffer
-
-	send_buffer[send_offset++] = pdu.type;
-	memcpy(&send_buffer[send_offset], pdu.ssn, SSN_LENGTH);
-	printf("\tSending lookup response pdu to {%.12s}\n", pdu.ssn);
-
-	send_offset += SSN_LENGTH;
-	send_buffer[send_offset++] = pdu.name_length;
-	memcpy(&send_buffer[send_offset], pdu.name, pdu.name_length);
-	printf("\tName: %s\n", pdu.name);
-
-	send_offset += pdu.name_length;
-	send_buffer[send_offset++] = pdu.email_length;
-	memcpy(&send_buffer[send_offset], pdu.email, pdu.email_length);
-	printf("\tEmail: %s\n", pdu.email);
-
-	if (send_udp_pdu(self_data->fds[UDP_FDS].fd, send_addr, send_buffer, pdu_size) < 0) // send
+	uint8_t header[1 + SSN_LENGTH + 1];
+	header[0] = pdu.type;
+	memcpy(&header[1], pdu.ssn, SSN_LENGTH);
+	header[1 + SSN_LENGTH] = pdu.name_length;
+	struct iovec iov[4] = {
+	    {.iov_base = header, .iov_len = sizeof(header)},
+	    {.iov_base = pdu.name, .iov_len = pdu.name_length},
+	    {.iov_base = (void *)&pdu.email_length, .iov_len = 1},
+	    {.iov_base = pdu.email, .iov_len = pdu.email_length},
+	};
+	log_debug("\tSending lookup response pdu to {%.12s}", pdu.ssn);
+	log_debug("\tName: %.*s", pdu.name_length, pdu.name);
+	log_debug("\tEmail: %.*s", pdu.email_length, pdu.email);
+
+	// the name and a stored email are sent from the store, only the small fields are copied
+	unsigned stored = 1u << 1;
+	if (email_stored)
+		stored |= 1u << 3;
+	if (queue_udp_pdu_iov(self_data, send_addr, iov, 4, stored) < 0) // sent with the rest of the batch
 	{
-		exit_with_error("Failed to send VAL_LOOKUP_PDU to tracker", self_data);
+		log_warn("Failed to send VAL_LOOKUP_RESPONSE_PDU");
 	}
-
-	free(send_buffer);
 }
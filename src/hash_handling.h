@@ -8,15 +8,13 @@
 #include <poll.h>
 #include "c_node.h"
 #include "hashtable.h"
+#include "slab.h"
+#include "value_codec.h"
+#include "persistence.h"
+#include "tiering.h"
+#include "cold_store.h"
+#include "memory.h"
 
-// Struct Definitions
-struct value_pair
-{
-	uint8_t *name;
-	uint8_t name_length;
-	uint8_t *email;
-	uint8_t email_length;
-};
 
 // Function Prototypes
 
@@ -24,7 +22,6 @@ struct value_pair
  * @brief Handles removal of a value from the hash table.
  *
  * @param self_data Pointer to the self_data structure.
- * @param fds Array of pollfd structures.
  * @param remove_pdu The VAL_REMOVE_PDU structure containing the removal request.
  *
  * @return 0 on success, -1 on failure.
@@ -35,16 +32,41 @@ int handle_ht_remove(struct self_data *self_data, struct VAL_REMOVE_PDU remove_p
  * @brief Handles insertion of a value into the hash table.
  *
  * @param self_data Pointer to the self_data structure.
- * @param fds Array of pollfd structures.
- * @param insert_pdu The VAL_INSERT_PDU structure containing the insertion data.
+ * @param insert_pdu The VAL_INSERT_PDU structure containing the insertion data, name and email point into raw.
+ * @param raw The PDU as received, forwarded unchanged if the SSN is not in range.
+ * @param raw_length Size of the PDU.
  *
  * @return 0 on success, -1 on failure.
  */
-void handle_ht_insert(struct self_data *self_data, struct VAL_INSERT_PDU insert_pdu);
+void handle_ht_insert(struct self_data *self_data, struct VAL_INSERT_PDU insert_pdu, const uint8_t *raw, size_t raw_length);
 
 /**
- * @brief Creates a value_pair structure with the given name and email.
+ * @brief Stores a value in the hash table without range checks or logging, replacing an existing entry.
  *
+ * @param self_data Pointer to the self_data structure.
+ * @param ssn The 12 digit SSN.
+ * @param name_length Length of the name.
+ * @param email_length Length of the email.
+ * @param name Pointer to the name data.
+ * @param email Pointer to the email data.
+ */
+void store_value(struct self_data *self_data, char *ssn, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email);
+
+/**
+ * @brief Removes a value from the hash table without range checks or logging.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param ssn The 12 digit SSN.
+ *
+ * @return true if the SSN was stored.
+ */
+bool delete_value(struct self_data *self_data, char *ssn);
+
+/**
+ * @brief Creates a value_pair record with the given name and email in a single slab allocation.
+ *        The values are dictionary compressed if compression is enabled.
+ *
+ * @param arena Slab arena of the hash slot the key belongs to.
  * @param name_length Length of the name.
  * @param email_length Length of the email.
  * @param name Pointer to the name data.
@@ -52,7 +74,14 @@ void handle_ht_insert(struct self_data *self_data, struct VAL_INSERT_PDU insert_
  *
  * @return Pointer to the newly created value_pair structure, or NULL on failure.
  */
-struct value_pair *create_value_pair(uint8_t name_length, uint8_t email_length, uint8_t *name, uint8_t *email);
+struct value_pair *create_value_pair(struct slab_arena *arena, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email);
+
+/**
+ * @brief Creates the node's hash table and the per hash slot record arenas.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+void create_store(struct self_data *self_data);
 
 /**
  * @brief Handles lookup of a value in the hash table.
@@ -65,7 +94,22 @@ struct value_pair *create_value_pair(uint8_t name_length, uint8_t email_length,
 int handle_ht_lookup(struct self_data *self_data, struct VAL_LOOKUP_PDU lookup_pdu);
 
 /**
- * @brief Checks if the hash value of a given SSN is within a specified range.
+ * @brief Handles a range scan: sends the matching entries of the node's slots to the requester in
+ *        SSN order, followed by a VAL_RANGE_SCAN_DONE, and forwards the scan to the successor if
+ *        later slots are involved.
+ *
+ * With the ordered partitioning only the slots between the slots of ssn_from and ssn_to are
+ * visited, with the hash partitioning every slot is.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param scan_pdu The VAL_RANGE_SCAN_PDU.
+ *
+ * @return 0 on success, -1 if the PDU is invalid.
+ */
+int handle_range_scan(struct self_data *self_data, struct VAL_RANGE_SCAN_PDU scan_pdu);
+
+/**
+ * @brief Checks if the ring slot of a given SSN is within the node's range.
  *
  * @param self_data A pointer to the `self_data` structure that holds the range
  *                  information (`range_start` and `range_end`).
@@ -79,13 +123,13 @@ int handle_ht_lookup(struct self_data *self_data, struct VAL_LOOKUP_PDU lookup_p
 int check_range(struct self_data *self_data, char *ssn);
 
 /**
- * @brief Updates the range of the current node based on the received range in the NET_NEW_RANGE_PDU.
+ * @brief Updates the range of the current node based on the received range in the NET_WIDE_NEW_RANGE_PDU.
  *
  * This function processes the range information received from another node, and updates the range of the current node accordingly.
  * It will adjust the range start or end of the current node if the received range is smaller or larger than the node's current range, respectively.
  * After updating the range, it sends a NET_NEW_RANGE_RESPONSE_PDU back to the appropriate node (predecessor or successor).
  *
- * @param range_pdu The NET_NEW_RANGE_PDU containing the new range information to be applied to the current node.
+ * @param range_pdu The NET_WIDE_NEW_RANGE_PDU, or the NET_NEW_RANGE_PDU taken into one, containing the new range information to be applied to the current node.
  * @param self_data Pointer to the current node's data, including the current range and communication file descriptors.
  *
  * @return void
@@ -93,78 +137,95 @@ int check_range(struct self_data *self_data, char *ssn);
  * @note This function assumes that the range adjustments and communication are handled with a valid successor or predecessor.
  */
 
-void update_range(struct NET_NEW_RANGE_PDU range_pdu, struct self_data *self_data);
+void update_range(struct NET_WIDE_NEW_RANGE_PDU range_pdu, struct self_data *self_data);
 
 /**
  * @brief Sends range and hash table entries to the new successor node after receiving a NET_JOIN_PDU.
  *
  * This function is responsible for handling the process of transferring hash table entries and range information
- * to the new successor node after a successful join operation. The function calculates the midpoint of the current
- * range and updates the range for the new node. It also sends a `NET_JOIN_RESPONSE_PDU` to the new successor to notify
- * it of the updated range. Then, it iterates through the current hash table and sends any entries that fall outside
- * the current node's range to the new successor node. After sending an entry, it removes the entry from the local hash
- * table and shifts the corresponding SSN array to maintain its integrity.
+ * to the new successor node after a successful join operation. The function splits the current range where
+ * both parts carry about the same load, see load_split_point(), and updates the range for the new node. It also sends a `NET_JOIN_RESPONSE_PDU`,
+ * or a `NET_WIDE_JOIN_RESPONSE_PDU` with ring extensions, to the new successor to notify it of the updated range. Then, it iterates through the current hash table and sends any entries that fall outside
+ * the current node's range to the new successor node. Only the hash slots handed over are visited, each one is detached
+ * from the local hash table as a unit, sent and then freed.
  *
- * @param self_data A pointer to the current node's data, which includes the range, SSNs, hash table, and file descriptors.
+ * @param self_data A pointer to the current node's data, which includes the range, hash table, and file descriptors.
  * @param old_succ_adr A 32 bit value corresponding to the address of the old successor node
  * @param old_succ_port a 16 bit value corresponding to the port of the old successor node
  * @note This function assumes that the new successor is already set and the appropriate file descriptor for communication
- *       with the new successor is available in `self_data->fds[SUCCESSOR_FDS]`.
+ *       with the new successor is available in `self_data->successor`.
  *
- * @note The range update is done by calculating the midpoint of the current range, and entries outside the current
- *       node's range are forwarded to the new successor node. This function also handles the removal and shifting
- *       of entries from the local hash table and SSN array.
+ * @note The range update is done by calculating the split point of the current range, and entries outside the current
+ *       node's range are forwarded to the new successor node.
  */
 void send_new_range_and_entries(struct self_data *self_data, uint32_t old_succ_adr, uint16_t old_succ_port);
 
+/**
+ * @brief Hands over the entries of one hash slot that are outside the node's range, as VAL_INSERT_PDUs.
+ *
+ * A slot the range does not reach is detached from the table as a whole and its records are not freed
+ * one by one, the slot's whole arena is released afterwards. If the range ends inside the slot the
+ * entries are sent and removed one by one, the rest stay.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param slot The hash slot to hand over.
+ * @param connection The connection to send to, successor or predecessor.
+ */
+void send_slot_entries(struct self_data *self_data, hash_t slot, struct connection_point *connection);
+
+/**
+ * @brief Frees all entries of a hash slot without sending them.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param slot The hash slot to clear.
+ */
+void drop_slot(struct self_data *self_data, hash_t slot);
+
 /**
  * send_all_entries - Sends all hash table entries to a specified TCP connection. Used when exiting network and sending all entries is needed.
  * Destroys hashtable in process.
  *
  * @self_data: Pointer to the structure holding the hash table and metadata.
- * @fd: Index of the file descriptor in self_data->fds to send data to.
+ * @connection: The connection to send to, successor or predecessor.
  *
- * This function iterates through the hash table, formats each entry into a
- * VAL_INSERT_PDU, and sends it over the specified TCP connection. After
- * successfully sending an entry, it removes the entry from the hash table and
- * frees the associated memory.
+ * This function walks the hash table one hash slot at a time, formats each entry
+ * into a VAL_INSERT_PDU, and sends it over the specified TCP connection. Each
+ * slot is freed as a unit once its entries are sent.
  */
-void send_all_entries(struct self_data *self_data, int fd);
+void send_all_entries(struct self_data *self_data, struct connection_point *connection);
 
 /**
  * @brief Sends an insert PDU (Protocol Data Unit) using TCP.
  * 
- * This function creates a buffer containing the data from the VAL_INSERT_PDU structure,
- * formats it according to the required protocol, and sends it to a successor node over
- * a TCP connection.
+ * The fixed fields and the name and email the PDU points to are queued on the successor
+ * or predecessor connection as pieces, without building the PDU in a buffer first.
  * 
  * @param pdu The VAL_INSERT_PDU structure containing the data to be sent.
  * @param self_data A pointer to the self_data structure, which contains information about
  *        the current node, including file descriptors for TCP/UDP connections.
- * @param fd The file descriptor which says where to send data, successor or predecessor
+ * @param connection The connection to send to, successor or predecessor.
  */
-void send_insert_pdu_tcp(const struct VAL_INSERT_PDU pdu, struct self_data *self_data, int fd);
+void send_insert_pdu_tcp(const struct VAL_INSERT_PDU pdu, struct self_data *self_data, struct connection_point *connection);
 
 /**
  * @brief Sends a lookup response PDU using UDP.
  * 
- * This function creates a buffer containing the data from the VAL_LOOKUP_RESPONSE_PDU structure,
- * formats it according to the required protocol, and sends it to a specified address over
- * a UDP connection.
+ * The response is queued with the next UDP batch as pieces. The name and email are sent from
+ * the store they point into, the store flushes the batch before it changes.
  * 
  * @param pdu The VAL_LOOKUP_RESPONSE_PDU structure containing the response data to be sent.
  * @param self_data A pointer to the self_data structure, which contains information about
  *        the current node, including file descriptors for TCP/UDP connections.
  * @param send_addr The address to which the PDU should be sent over UDP.
+ * @param email_stored false if the email was decoded into a scratch buffer, it is copied then.
  */
-void send_lookup_response_pdu_udp(const struct VAL_LOOKUP_RESPONSE_PDU pdu, struct self_data *self_data, struct sockaddr_in send_addr);
+void send_lookup_response_pdu_udp(const struct VAL_LOOKUP_RESPONSE_PDU pdu, struct self_data *self_data, struct sockaddr_in send_addr, bool email_stored);
 
 /**
  * @brief Frees the memory allocated for a value pair.
  *
- * This function deallocates the memory used by a value pair, including its `name` and `email` fields.
- * If either of these fields is non-NULL, the corresponding memory is freed.
- * Finally, the memory for the `value_pair` structure itself is freed.
+ * This function drops the record's dictionary references and returns it to the slab it was allocated from,
+ * or marks it dead in the cold store if it was demoted.
  *
  * @param value A pointer to the value pair that needs to be freed. This pointer must point to a valid memory block previously allocated.
  *
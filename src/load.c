@@ -0,0 +1,104 @@
+#include "load.h"
+#include "hash_handling.h"
+
+static void decay_timer_fired(struct self_data *self_data, struct timer *timer)
+{
+	for (int slot = 0; slot < RING_SLOTS; slot++)
+		self_data->load.requests[slot] /= 2;
+	timer_add(&self_data->timers, timer, timer_now() + LOAD_HALF_LIFE);
+}
+
+void load_start(struct self_data *self_data)
+{
+	self_data->load.decay_timer.fire = decay_timer_fired;
+	timer_add(&self_data->timers, &self_data->load.decay_timer, timer_now() + LOAD_HALF_LIFE);
+}
+
+void load_count(struct self_data *self_data, char *ssn)
+{
+	self_data->load.requests[ring_slot(ssn)]++;
+}
+
+/**
+ * @brief The ring slots of a hash slot that are in the node's range.
+ */
+static void range_in_slot(const struct self_data *self_data, hash_t slot, int *first, int *last)
+{
+	*first = FIRST_RING_SLOT(slot) > self_data->range_start ? FIRST_RING_SLOT(slot) : self_data->range_start;
+	*last = LAST_RING_SLOT(slot) < self_data->range_end ? LAST_RING_SLOT(slot) : self_data->range_end;
+}
+
+/**
+ * @brief Load of the part of a hash slot in the range. Entries are counted for the whole hash slot,
+ *        the node holds none outside its range but recovered ones not handed over yet.
+ */
+static uint64_t slot_load(const struct self_data *self_data, hash_t slot)
+{
+	int first, last;
+	range_in_slot(self_data, slot, &first, &last);
+	uint64_t load = ht_slot_entries(self_data->hash_table, slot);
+	for (int at = first; at <= last; at++)
+		load += self_data->load.requests[at];
+	return load;
+}
+
+/**
+ * @brief ht_visit_function that counts an entry for its ring slot within the hash slot.
+ */
+static void count_entry(const char *key, void *value, void *arg)
+{
+	uint32_t *entries = arg;
+	entries[ring_slot((char *)key) % SLOTS_PER_HASH_SLOT]++;
+}
+
+uint32_t load_of_range(struct self_data *self_data)
+{
+	uint64_t load = 0;
+	if (!self_data->hash_table)
+		return 0; // not part of the ring yet
+	for (int slot = HASH_SLOT_OF(self_data->range_start); slot <= HASH_SLOT_OF(self_data->range_end); slot++)
+		load += slot_load(self_data, slot);
+	return load > UINT32_MAX ? UINT32_MAX : (uint32_t)load;
+}
+
+slot_t load_split_point(struct self_data *self_data)
+{
+	int start = self_data->range_start, end = self_data->range_end;
+	slot_t midpoint = (end - start) / 2 + start;
+	bool classic = !self_data->config.ring_extensions; // the classic PDUs carry hash slots, a split falls between two
+	if (classic)
+		midpoint = LAST_RING_SLOT((HASH_SLOT_OF(end) - HASH_SLOT_OF(start)) / 2 + HASH_SLOT_OF(start));
+	if (start == end || (classic && HASH_SLOT_OF(start) == HASH_SLOT_OF(end)))
+		return end; // nothing left to split
+
+	uint64_t total = 0, kept = 0;
+	for (int slot = HASH_SLOT_OF(start); slot <= HASH_SLOT_OF(end); slot++)
+		total += slot_load(self_data, slot);
+	if (total == 0)
+		return midpoint;
+
+	for (int slot = HASH_SLOT_OF(start); slot <= HASH_SLOT_OF(end); slot++)
+	{
+		uint64_t load = slot_load(self_data, slot);
+		if (2 * (kept + load) < total)
+		{
+			kept += load;
+			continue;
+		}
+		if (classic)
+			return slot < HASH_SLOT_OF(end) ? LAST_RING_SLOT(slot) : LAST_RING_SLOT(slot - 1);
+
+		// half the load is reached inside this hash slot, its entries are counted per ring slot
+		uint32_t entries[SLOTS_PER_HASH_SLOT] = {0};
+		int first, last;
+		ht_foreach_in_slot(self_data->hash_table, slot, count_entry, entries);
+		range_in_slot(self_data, slot, &first, &last);
+		for (int at = first; at <= last; at++)
+		{
+			kept += entries[at % SLOTS_PER_HASH_SLOT] + self_data->load.requests[at];
+			if (2 * kept >= total)
+				return at < end ? at : end - 1; // the joining node gets at least one slot
+		}
+	}
+	return midpoint; // recovered entries outside the range were part of the total
+}
@@ -0,0 +1,59 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hashtable.h"
+#include "timer_wheel.h"
+
+#define LOAD_HALF_LIFE 10000 // milliseconds after which a served request counts half
+
+struct self_data;
+
+/**
+ * @brief What the node serves, for placing a joining node and choosing where to split for it.
+ *
+ * The load of a ring slot is the entries stored in it plus the requests served for it, the
+ * request counts are halved every LOAD_HALF_LIFE so they follow the recent rate.
+ */
+struct load
+{
+	uint32_t requests[RING_SLOTS]; // inserts, removes and lookups served per ring slot
+	struct timer decay_timer;
+};
+
+/**
+ * @brief Starts halving the request counts every LOAD_HALF_LIFE.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+void load_start(struct self_data *self_data);
+
+/**
+ * @brief Counts a request for a key in the node's range.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param ssn The key of the request.
+ */
+void load_count(struct self_data *self_data, char *ssn);
+
+/**
+ * @brief The load of the node's range: its entries plus its recent requests.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @return uint32_t The load, saturated at UINT32_MAX.
+ */
+uint32_t load_of_range(struct self_data *self_data);
+
+/**
+ * @brief The last ring slot to keep when handing the upper part of the range to a joining node,
+ *        so both sides carry about half the load. The numeric midpoint while there is no load.
+ *        Without ring extensions it is the last ring slot of a hash slot, the classic PDUs carry those.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @return slot_t The split point, below the end of the range unless the range is a single slot,
+ *         then the end: there is nothing to hand over.
+ */
+slot_t load_split_point(struct self_data *self_data);
+
+#endif // LOAD_H
@@ -0,0 +1,592 @@
+#include "log.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_MASK (LOG_RING_SIZE - 1)
+#define LINE_MAX_LENGTH 4096 // a formatted line, longer ones are cut
+
+// how an argument is passed, what va_arg() takes and what snprintf() is given again
+enum arg_kind
+{
+	ARG_INT, // also a * width or precision
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_INTMAX,
+	ARG_SIZE,
+	ARG_PTRDIFF,
+	ARG_DOUBLE,
+	ARG_POINTER,
+	ARG_STRING,
+};
+
+/**
+ * @brief Header of a record in a ring, followed by the arguments. An argument takes 8 bytes, a string
+ *        2 bytes of length and its bytes rounded up to 8. A record never wraps around the end of
+ *        the ring, the space left there is taken by one without a site.
+ */
+struct log_record
+{
+	uint32_t size; // with the arguments, a multiple of 16
+	uint32_t level;
+	const struct log_site *site;
+};
+
+/**
+ * @brief Records of one thread. Only the thread moves head and only the drainer moves tail.
+ */
+struct log_ring
+{
+	uint64_t head;
+	uint8_t padding[56]; // head and tail in different cache lines
+	uint64_t tail;
+	uint64_t dropped; // records that did not fit, counted by the thread
+	uint64_t reported; // dropped records the drainer has told about
+	uint8_t data[LOG_RING_SIZE];
+};
+
+/**
+ * @brief A conversion of a format.
+ */
+struct conversion
+{
+	size_t length; // from the % to the conversion character
+	uint8_t kind;
+	uint8_t stars;	       // widths and precisions given as arguments
+	bool star_precision;   // the last star is the precision
+	int precision;	       // written in the format, -1 if none
+};
+
+static __thread struct log_ring *thread_ring;
+static struct log_ring *rings[LOG_MAX_THREADS];
+static int ring_count;
+static uint64_t unregistered_dropped; // records of threads beyond LOG_MAX_THREADS
+static uint64_t unregistered_reported;
+
+static pthread_t drainer;
+static bool draining;
+static bool stopping;
+
+// only used by the drainer, and by log_shutdown() once it stopped
+static char output[LOG_OUTPUT_BUFFER];
+static size_t output_length;
+static int output_fd = STDOUT_FILENO;
+
+/**
+ * @brief Reads the conversion at a %. A %% is not one, the caller writes it as a %.
+ *
+ * @return bool false if the format ends inside it or the conversion is not supported.
+ */
+static bool parse_conversion(const char *spec, struct conversion *conversion)
+{
+	const char *p = spec + 1;
+	conversion->stars = 0;
+	conversion->star_precision = false;
+	conversion->precision = -1;
+
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	if (*p == '*')
+	{
+		conversion->stars++;
+		p++;
+	}
+	else
+	{
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			conversion->stars++;
+			conversion->star_precision = true;
+			p++;
+		}
+		else
+		{
+			conversion->precision = 0;
+			while (*p >= '0' && *p <= '9')
+				conversion->precision = conversion->precision * 10 + (*p++ - '0');
+		}
+	}
+
+	uint8_t kind = ARG_INT;
+	if (p[0] == 'h')
+		p += p[1] == 'h' ? 2 : 1; // promoted to int
+	else if (p[0] == 'l' && p[1] == 'l')
+	{
+		kind = ARG_LLONG;
+		p += 2;
+	}
+	else if (p[0] == 'l')
+	{
+		kind = ARG_LONG;
+		p++;
+	}
+	else if (p[0] == 'j')
+	{
+		kind = ARG_INTMAX;
+		p++;
+	}
+	else if (p[0] == 'z')
+	{
+		kind = ARG_SIZE;
+		p++;
+	}
+	else if (p[0] == 't')
+	{
+		kind = ARG_PTRDIFF;
+		p++;
+	}
+
+	switch (*p)
+	{
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+	case 'c':
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		kind = ARG_DOUBLE;
+		break;
+	case 'p':
+		kind = ARG_POINTER;
+		break;
+	case 's':
+		kind = ARG_STRING;
+		break;
+	default:
+		return false; // %n, %ls, %Lf and the like are not logged
+	}
+	conversion->kind = kind;
+	conversion->length = p + 1 - spec;
+	return true;
+}
+
+/**
+ * @brief Finds the arguments a format takes, once per site.
+ */
+static void parse_site(struct log_site *site)
+{
+	uint8_t count = 0;
+	for (const char *p = site->format; *p && count < LOG_MAX_ARGS; p++)
+	{
+		if (*p != '%')
+			continue;
+		if (p[1] == '%')
+		{
+			p++;
+			continue;
+		}
+		struct conversion conversion;
+		if (!parse_conversion(p, &conversion) || count + conversion.stars >= LOG_MAX_ARGS)
+			break; // the rest of the format is written as it is
+		for (int i = 0; i < conversion.stars; i++)
+		{
+			site->precision[count] = -1;
+			site->args[count++] = ARG_INT;
+		}
+		site->precision[count] = conversion.star_precision ? -2 : conversion.precision;
+		site->args[count++] = conversion.kind;
+		p += conversion.length - 1;
+	}
+	site->arg_count = count;
+	__atomic_store_n(&site->parsed, true, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *register_thread(void)
+{
+	if (__atomic_load_n(&ring_count, __ATOMIC_RELAXED) >= LOG_MAX_THREADS)
+		return NULL;
+	int index = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+	if (index >= LOG_MAX_THREADS)
+		return NULL;
+	struct log_ring *ring = aligned_alloc(64, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	memset(ring, 0, offsetof(struct log_ring, data));
+	__atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+	thread_ring = ring;
+	return ring;
+}
+
+/**
+ * @brief Copies a record into the ring, behind a record without a site if it does not fit before the end.
+ */
+static void push(struct log_ring *ring, const struct log_record *record)
+{
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	size_t offset = head & RING_MASK;
+	size_t skip = LOG_RING_SIZE - offset < record->size ? LOG_RING_SIZE - offset : 0;
+	if (head + skip + record->size - tail > LOG_RING_SIZE)
+	{
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (skip)
+	{
+		struct log_record *filler = (struct log_record *)(ring->data + offset);
+		filler->size = skip;
+		filler->site = NULL;
+	}
+	memcpy(ring->data + ((head + skip) & RING_MASK), record, record->size);
+	__atomic_store_n(&ring->head, head + skip + record->size, __ATOMIC_RELEASE);
+}
+
+void log_write(struct log_site *site, const char *format, ...)
+{
+	if (!__atomic_load_n(&site->parsed, __ATOMIC_ACQUIRE))
+		parse_site(site);
+	struct log_ring *ring = thread_ring ? thread_ring : register_thread();
+	if (!ring)
+	{
+		__atomic_fetch_add(&unregistered_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	_Alignas(16) uint8_t buffer[LOG_RECORD_MAX];
+	struct log_record *record = (struct log_record *)buffer;
+	record->level = site->level;
+	record->site = site;
+	size_t used = sizeof(*record);
+
+	va_list ap;
+	va_start(ap, format);
+	int star = -1; // the argument before, a precision given for a string
+	for (int i = 0; i < site->arg_count; i++)
+	{
+		uint8_t *arg = buffer + used;
+		switch (site->args[i])
+		{
+		case ARG_INT:
+		{
+			int value = va_arg(ap, int);
+			star = value;
+			int64_t stored = value;
+			memcpy(arg, &stored, 8);
+			used += 8;
+			break;
+		}
+		case ARG_LONG:
+		{
+			long value = va_arg(ap, long);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_LLONG:
+		{
+			long long value = va_arg(ap, long long);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_INTMAX:
+		{
+			intmax_t value = va_arg(ap, intmax_t);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_SIZE:
+		{
+			size_t value = va_arg(ap, size_t);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_PTRDIFF:
+		{
+			ptrdiff_t value = va_arg(ap, ptrdiff_t);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_DOUBLE:
+		{
+			double value = va_arg(ap, double);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_POINTER:
+		{
+			void *value = va_arg(ap, void *);
+			memcpy(arg, &value, sizeof(value));
+			used += 8;
+			break;
+		}
+		case ARG_STRING:
+		{
+			const char *value = va_arg(ap, const char *);
+			if (!value)
+				value = "(null)";
+			// the bytes are copied, only as many as the precision allows, so a buffer without
+			// a terminator is fine as long as the precision covers it
+			size_t limit = LOG_RECORD_MAX - used - 2 - 8 * (site->arg_count - i - 1);
+			int precision = site->precision[i] == -2 ? star : site->precision[i];
+			if (precision >= 0 && (size_t)precision < limit)
+				limit = precision;
+			uint16_t length = strnlen(value, limit);
+			memcpy(arg, &length, 2);
+			memcpy(arg + 2, value, length);
+			used += (2 + length + 7) & ~(size_t)7;
+			break;
+		}
+		}
+	}
+	va_end(ap);
+
+	record->size = (used + 15) & ~(size_t)15;
+	push(ring, record);
+}
+
+static void write_output(void)
+{
+	size_t written = 0;
+	while (written < output_length)
+	{
+		ssize_t ret = write(output_fd, output + written, output_length - written);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break; // nowhere to write to, the lines are lost
+		written += ret;
+	}
+	output_length = 0;
+}
+
+/**
+ * @brief Makes room for a line going to the stream of the level.
+ */
+static void start_line(uint32_t level)
+{
+	int fd = level >= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO;
+	if (fd != output_fd || LOG_OUTPUT_BUFFER - output_length < LINE_MAX_LENGTH + 16)
+	{
+		write_output(); // keeps the order when both go to the same file
+		output_fd = fd;
+	}
+	if (level >= LOG_LEVEL_WARN && isatty(fd))
+		output_length += sprintf(output + output_length, level == LOG_LEVEL_ERROR ? "\033[1;31m" : "\033[1;33m");
+}
+
+static void end_line(uint32_t level)
+{
+	if (level >= LOG_LEVEL_WARN && isatty(output_fd))
+		output_length += sprintf(output + output_length, "\033[0m");
+	output[output_length++] = '\n';
+}
+
+/**
+ * @brief Formats a record, one conversion at a time with snprintf().
+ */
+static void format_record(const struct log_record *record)
+{
+	const struct log_site *site = record->site;
+	const uint8_t *arg = (const uint8_t *)(record + 1);
+	size_t length = 0;
+	int next = 0;
+
+	start_line(record->level);
+	char *line = output + output_length;
+	for (const char *p = site->format; *p && length < LINE_MAX_LENGTH - 1;)
+	{
+		if (*p != '%' || p[1] == '%')
+		{
+			if (*p == '\n' && !p[1])
+				break; // the line ends anyway
+			line[length++] = *p;
+			p += *p == '%' ? 2 : 1;
+			continue;
+		}
+		struct conversion conversion;
+		if (next >= site->arg_count || !parse_conversion(p, &conversion) || next + conversion.stars >= site->arg_count)
+		{
+			line[length++] = *p++; // not stored, written as it is
+			continue;
+		}
+
+		// a * is replaced by the number it was given
+		char spec[64];
+		size_t spec_length = 0;
+		for (size_t i = 0; i < conversion.length && spec_length < sizeof(spec) - 16; i++)
+		{
+			if (p[i] == '*')
+			{
+				int64_t value;
+				memcpy(&value, arg, 8);
+				arg += 8;
+				next++;
+				spec_length += sprintf(spec + spec_length, "%d", (int)value);
+			}
+			else
+				spec[spec_length++] = p[i];
+		}
+		spec[spec_length] = '\0';
+		p += conversion.length;
+
+		size_t room = LINE_MAX_LENGTH - length;
+		int n = 0;
+		union
+		{
+			int64_t i;
+			double d;
+			void *p;
+		} value;
+		if (site->args[next] != ARG_STRING)
+		{
+			memcpy(&value, arg, 8);
+			arg += 8;
+		}
+		switch (site->args[next])
+		{
+		case ARG_INT:
+			n = snprintf(line + length, room, spec, (int)value.i);
+			break;
+		case ARG_LONG:
+			n = snprintf(line + length, room, spec, (long)value.i);
+			break;
+		case ARG_LLONG:
+			n = snprintf(line + length, room, spec, (long long)value.i);
+			break;
+		case ARG_INTMAX:
+			n = snprintf(line + length, room, spec, (intmax_t)value.i);
+			break;
+		case ARG_SIZE:
+			n = snprintf(line + length, room, spec, (size_t)value.i);
+			break;
+		case ARG_PTRDIFF:
+			n = snprintf(line + length, room, spec, (ptrdiff_t)value.i);
+			break;
+		case ARG_DOUBLE:
+			n = snprintf(line + length, room, spec, value.d);
+			break;
+		case ARG_POINTER:
+			n = snprintf(line + length, room, spec, value.p);
+			break;
+		case ARG_STRING:
+		{
+			char string[LOG_RECORD_MAX];
+			uint16_t string_length;
+			memcpy(&string_length, arg, 2);
+			memcpy(string, arg + 2, string_length);
+			string[string_length] = '\0';
+			arg += (2 + string_length + 7) & ~(size_t)7;
+			n = snprintf(line + length, room, spec, string);
+			break;
+		}
+		}
+		next++;
+		if (n > 0)
+			length += (size_t)n < room ? (size_t)n : room - 1;
+	}
+	output_length += length;
+	end_line(record->level);
+}
+
+static void report_dropped(uint64_t dropped, uint64_t *reported)
+{
+	if (dropped == *reported)
+		return;
+	start_line(LOG_LEVEL_WARN);
+	output_length += sprintf(output + output_length, "\t%" PRIu64 " log records dropped", dropped - *reported);
+	end_line(LOG_LEVEL_WARN);
+	*reported = dropped;
+}
+
+/**
+ * @brief Formats the records of a ring up to what was there when it started.
+ *
+ * @return bool Whether there were any.
+ */
+static bool drain_ring(struct log_ring *ring)
+{
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	bool any = tail != head;
+	while (tail != head)
+	{
+		const struct log_record *record = (const struct log_record *)(ring->data + (tail & RING_MASK));
+		if (record->site)
+			format_record(record);
+		tail += record->size;
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	report_dropped(__atomic_load_n(&ring->dropped, __ATOMIC_RELAXED), &ring->reported);
+	return any;
+}
+
+static bool drain(void)
+{
+	bool any = false;
+	int count = __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+	for (int i = 0; i < count && i < LOG_MAX_THREADS; i++)
+	{
+		struct log_ring *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		if (ring && drain_ring(ring))
+			any = true;
+	}
+	report_dropped(__atomic_load_n(&unregistered_dropped, __ATOMIC_RELAXED), &unregistered_reported);
+	write_output();
+	return any;
+}
+
+static void *drainer_main(void *arg)
+{
+	struct timespec interval = {.tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL * 1000};
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+	{
+		if (!drain())
+			nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+void log_init(void)
+{
+	static bool started;
+	if (started)
+		return;
+	started = true;
+	atexit(log_shutdown);
+	if (pthread_create(&drainer, NULL, drainer_main, NULL) != 0)
+		perror("pthread_create"); // the records are written when the program exits
+	else
+		draining = true;
+}
+
+void log_shutdown(void)
+{
+	if (draining)
+	{
+		__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+		pthread_join(drainer, NULL);
+		draining = false;
+	}
+	drain();
+}
@@ -0,0 +1,103 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_LEVEL_DEBUG 0 // state trace and every request
+#define LOG_LEVEL_INFO 1  // ring changes, startup, persistence
+#define LOG_LEVEL_WARN 2  // something went wrong and was handled
+#define LOG_LEVEL_ERROR 3 // something went wrong and was not
+#define LOG_LEVEL_NONE 4
+
+// lowest level compiled in, set with make LOG_LEVEL=DEBUG
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE (1 << 20)	 // bytes of records per thread, a power of two
+#define LOG_RECORD_MAX 2048	 // a record with its arguments, longer strings are cut
+#define LOG_MAX_ARGS 16		 // conversions of a format, a * counts as one
+#define LOG_MAX_THREADS 16	 // threads that may log
+#define LOG_DRAIN_INTERVAL 1000	 // microseconds the drainer sleeps when every ring is empty
+#define LOG_OUTPUT_BUFFER 65536	 // bytes formatted before a write
+
+/**
+ * @brief A place in the code that logs. The macros keep one per call, its format is looked through
+ *        the first time it logs and the argument types are kept for the later calls.
+ */
+struct log_site
+{
+	const char *format;
+	uint8_t level;
+	bool parsed;
+	uint8_t arg_count;
+	uint8_t args[LOG_MAX_ARGS];	 // how each argument is passed and stored
+	int16_t precision[LOG_MAX_ARGS]; // of a string, -1 for none, -2 if given by the argument before
+};
+
+/**
+ * @brief Starts the drainer thread that formats and writes the records, stdout for debug and info,
+ *        stderr for warnings and errors. Records logged before are kept until then.
+ */
+void log_init(void);
+
+/**
+ * @brief Stops the drainer and writes every record logged so far. Registered by log_init() to run
+ *        when the program exits, records logged after it are written by the next call.
+ */
+void log_shutdown(void);
+
+/**
+ * @brief Copies the arguments into a record in the ring of the calling thread. Does not format
+ *        anything and never blocks, if the ring is full the record is dropped and counted.
+ */
+void log_write(struct log_site *site, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Never called, it has the compiler check the format of a call that is compiled out.
+ */
+static inline __attribute__((format(printf, 1, 2))) void log_check(const char *format, ...)
+{
+}
+
+#define log_at(log_level, log_format, ...)                                                    \
+	do                                                                                    \
+	{                                                                                     \
+		static struct log_site log_site_ = {.format = log_format, .level = log_level}; \
+		log_write(&log_site_, log_format, ##__VA_ARGS__);                             \
+	} while (0)
+
+// the arguments of a level below LOG_LEVEL are not even evaluated
+#define log_skip(log_format, ...)                             \
+	do                                                    \
+	{                                                     \
+		if (0)                                        \
+			log_check(log_format, ##__VA_ARGS__); \
+	} while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) log_skip(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define log_info(...) log_skip(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define log_warn(...) log_skip(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define log_error(...) log_skip(__VA_ARGS__)
+#endif
+
+#endif // LOG_H
@@ -0,0 +1,135 @@
+#include "memory.h"
+#include "hash_handling.h"
+
+#define REPORT_TOP_SLOTS 5
+
+// an inserted entry takes a slab object and a table slot, a packed key, control byte and value pointer
+#define INSERT_ESTIMATE(name_length, email_length) \
+	(sizeof(struct value_pair) + (name_length) + (email_length) + SSN_KEY_BYTES + sizeof(int8_t) + sizeof(void *))
+
+static const char *const category_names[MEM_CATEGORIES] = {
+    [MEM_TABLE] = "table",
+    [MEM_KEYS] = "keys",
+    [MEM_VALUES] = "values",
+    [MEM_DICTIONARY] = "dictionary",
+    [MEM_IO] = "io buffers",
+    [MEM_LOG] = "log buffer",
+};
+
+// buffers outside the store, shared by every module that allocates them
+static size_t tracked[MEM_CATEGORIES];
+static size_t peak[MEM_CATEGORIES];
+
+void memory_init(struct memory_account *account, size_t limit)
+{
+	account->limit = limit;
+	account->used = 0;
+	account->refused_inserts = 0;
+}
+
+void memory_track(enum memory_category category, ssize_t delta)
+{
+	tracked[category] += delta;
+	if (tracked[category] > peak[category])
+		peak[category] = tracked[category];
+}
+
+void memory_collect(const struct self_data *self_data, size_t *totals, size_t *slots)
+{
+	for (int category = 0; category < MEM_CATEGORIES; category++)
+		totals[category] = tracked[category];
+
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+	{
+		struct ht_memory table = {0, 0};
+		if (self_data->hash_table)
+			ht_slot_memory(self_data->hash_table, slot, &table);
+		size_t values = slab_arena_bytes(&self_data->record_arenas[slot]);
+
+		totals[MEM_TABLE] += table.table;
+		totals[MEM_KEYS] += table.keys;
+		totals[MEM_VALUES] += values;
+		if (slots)
+			slots[slot] = table.table + table.keys + values;
+	}
+	totals[MEM_DICTIONARY] += value_dictionary_memory();
+}
+
+void memory_refresh(struct self_data *self_data)
+{
+	size_t totals[MEM_CATEGORIES];
+	memory_collect(self_data, totals, NULL);
+
+	self_data->memory.used = 0;
+	for (int category = 0; category < MEM_CATEGORIES; category++)
+		self_data->memory.used += totals[category];
+}
+
+bool memory_admit(struct self_data *self_data, char *ssn, uint8_t name_length, uint8_t email_length)
+{
+	struct memory_account *account = &self_data->memory;
+	size_t bytes = INSERT_ESTIMATE(name_length, email_length);
+	if (account->limit == 0)
+		return true;
+
+	if (account->used + bytes > account->limit && self_data->tiering.budget > 0)
+	{
+		tiering_tick(self_data); // demoting may free enough slabs
+		memory_refresh(self_data);
+	}
+	if (account->used + bytes <= account->limit)
+	{
+		account->used += bytes;
+		return true;
+	}
+	if (ht_lookup(self_data->hash_table, ssn) != NULL)
+		return true; // replacing a value does not grow the table
+
+	account->refused_inserts++;
+	return false;
+}
+
+void memory_report(const struct self_data *self_data)
+{
+	size_t totals[MEM_CATEGORIES];
+	size_t slots[HT_SLOTS];
+	memory_collect(self_data, totals, slots);
+
+	size_t total = 0;
+	log_info("\tMemory use:");
+	for (int category = 0; category < MEM_CATEGORIES; category++)
+	{
+		total += totals[category];
+		if (category == MEM_IO || category == MEM_LOG)
+			log_info("\t  %-12s %10zu bytes  (peak %zu)", category_names[category], totals[category], peak[category]);
+		else
+			log_info("\t  %-12s %10zu bytes", category_names[category], totals[category]);
+	}
+	if (self_data->memory.limit > 0)
+		log_info("\t  %-12s %10zu bytes  of %zu, %" PRIu64 " inserts refused", "total", total, self_data->memory.limit, self_data->memory.refused_inserts);
+	else
+		log_info("\t  %-12s %10zu bytes", "total", total);
+	log_info("\t  cold store   %10zu bytes on disk", cold_store_live_bytes());
+
+	// selection of the largest slots, the list is short
+	bool shown[HT_SLOTS] = {false};
+	char list[REPORT_TOP_SLOTS * 64] = "";
+	size_t length = 0;
+	for (int i = 0; i < REPORT_TOP_SLOTS; i++)
+	{
+		int largest = -1;
+		for (int slot = 0; slot < HT_SLOTS; slot++)
+		{
+			if (!shown[slot] && slots[slot] > 0 && (largest < 0 || slots[slot] > slots[largest]))
+				largest = slot;
+		}
+		if (largest < 0)
+			break;
+		shown[largest] = true;
+		length += snprintf(list + length, sizeof(list) - length, " %d[%zu entries, %zu bytes]",
+				   largest, (size_t)ht_slot_entries(self_data->hash_table, largest), slots[largest]);
+		if (length >= sizeof(list))
+			break;
+	}
+	log_info("\t  largest slots:%s", list);
+}
@@ -0,0 +1,80 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "hashtable.h"
+
+enum memory_category
+{
+	MEM_TABLE,	// hash table control bytes and value pointers
+	MEM_KEYS,	// packed keys stored in the table
+	MEM_VALUES,	// slabs holding value_pair records
+	MEM_DICTIONARY, // shared name and domain dictionary
+	MEM_IO,		// PDU send buffers
+	MEM_LOG,	// write-ahead log and snapshot buffers
+	MEM_CATEGORIES
+};
+
+struct self_data;
+
+/**
+ * @brief Memory use of the node and the optional hard limit.
+ *
+ * Store memory is collected from the table, the slab arenas and the dictionary once per main
+ * loop iteration, inserts in between add an estimate of what they allocate. Buffers outside
+ * the store are tracked as they are allocated and freed.
+ */
+struct memory_account
+{
+	size_t limit; // refuse VAL_INSERTs of new keys at this many bytes, 0 for no limit
+	size_t used;  // total as of the last refresh plus the estimate since
+	uint64_t refused_inserts;
+};
+
+/**
+ * @brief Sets the hard limit.
+ */
+void memory_init(struct memory_account *account, size_t limit);
+
+/**
+ * @brief Records the allocation (positive delta) or release (negative delta) of a buffer
+ *        that is not part of the store.
+ */
+void memory_track(enum memory_category category, ssize_t delta);
+
+/**
+ * @brief Bytes in use per category, and for the store categories per hash slot.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param totals MEM_CATEGORIES totals.
+ * @param slots HT_SLOTS totals of the table, key and value bytes of each slot, or NULL.
+ */
+void memory_collect(const struct self_data *self_data, size_t *totals, size_t *slots);
+
+/**
+ * @brief Recomputes the total the limit is checked against.
+ */
+void memory_refresh(struct self_data *self_data);
+
+/**
+ * @brief Checks whether an insert fits under the limit. Replacing a stored key is always allowed.
+ *        If values can be demoted to the cold store that is tried before refusing.
+ *        Accepted inserts are added to the running total, refused ones are counted.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param ssn The key to insert.
+ * @param name_length Length of the name.
+ * @param email_length Length of the email.
+ * @return true if the insert may be stored.
+ */
+bool memory_admit(struct self_data *self_data, char *ssn, uint8_t name_length, uint8_t email_length);
+
+/**
+ * @brief Prints the use per category and the largest hash slots.
+ */
+void memory_report(const struct self_data *self_data);
+
+#endif // MEMORY_H
@@ -0,0 +1,584 @@
+#include "persistence.h"
+#include "hash_handling.h"
+#include "snapshot.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// log record types
+#define WAL_INSERT 1	// key, name length, email length, name, email
+#define WAL_REMOVE 2	// key
+#define WAL_DROP_SLOT 3 // slot, its entries left the node
+
+#define WAL_CHECKSUM_SIZE 4
+#define WAL_MAX_RECORD (WAL_CHECKSUM_SIZE + 1 + SSN_KEY_BYTES + 2 + 2 * UINT8_MAX)
+
+static void path_in_dir(const struct persistence *persistence, char *path, size_t size, const char *name)
+{
+	snprintf(path, size, "%s/%s", persistence->dir, name);
+}
+
+static void segment_path(const struct persistence *persistence, char *path, size_t size, uint64_t sequence)
+{
+	snprintf(path, size, "%s/wal.%020" PRIu64, persistence->dir, sequence);
+}
+
+static uint32_t checksum(const uint8_t *bytes, size_t length)
+{
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		out[i] = value >> (8 * i);
+}
+
+static uint32_t get_u32(const uint8_t *in)
+{
+	return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static void write_buffer(struct persistence *persistence)
+{
+	size_t written = 0;
+	while (written < persistence->buffered)
+	{
+		ssize_t n = write(persistence->wal_fd, persistence->buffer + written, persistence->buffered - written);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			exit_with_error("Failed to write to the log", NULL);
+		}
+		written += n;
+	}
+	persistence->buffered = 0;
+	persistence->unsynced = true;
+}
+
+/**
+ * @brief Reserves room for a record in the log buffer, writing the buffer out if it is full.
+ *
+ * @return uint8_t* Where the record body goes, after the checksum and type.
+ */
+static uint8_t *begin_record(struct persistence *persistence, uint8_t type)
+{
+	if (persistence->buffered + WAL_MAX_RECORD > WAL_BUFFER_SIZE)
+		write_buffer(persistence);
+
+	uint8_t *record = persistence->buffer + persistence->buffered;
+	record[WAL_CHECKSUM_SIZE] = type;
+	return record + WAL_CHECKSUM_SIZE + 1;
+}
+
+static void end_record(struct persistence *persistence, const uint8_t *end)
+{
+	uint8_t *record = persistence->buffer + persistence->buffered;
+	size_t length = end - record;
+	put_u32(record, checksum(record + WAL_CHECKSUM_SIZE, length - WAL_CHECKSUM_SIZE));
+	persistence->buffered += length;
+	persistence->changes_since_snapshot++;
+}
+
+void persistence_log_insert(struct persistence *persistence, const char *ssn, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
+{
+	ssn_key_t key;
+	if (!persistence->enabled || persistence->replaying || !ssn_pack(ssn, &key))
+		return;
+
+	uint8_t *p = begin_record(persistence, WAL_INSERT);
+	ssn_key_store(p, key);
+	p += SSN_KEY_BYTES;
+	*p++ = name_length;
+	*p++ = email_length;
+	memcpy(p, name, name_length);
+	p += name_length;
+	memcpy(p, email, email_length);
+	end_record(persistence, p + email_length);
+}
+
+void persistence_log_remove(struct persistence *persistence, const char *ssn)
+{
+	ssn_key_t key;
+	if (!persistence->enabled || persistence->replaying || !ssn_pack(ssn, &key))
+		return;
+
+	uint8_t *p = begin_record(persistence, WAL_REMOVE);
+	ssn_key_store(p, key);
+	end_record(persistence, p + SSN_KEY_BYTES);
+}
+
+void persistence_log_drop_slot(struct persistence *persistence, hash_t slot)
+{
+	if (!persistence->enabled || persistence->replaying)
+		return;
+
+	uint8_t *p = begin_record(persistence, WAL_DROP_SLOT);
+	*p++ = slot;
+	end_record(persistence, p);
+}
+
+void persistence_commit(struct persistence *persistence)
+{
+	if (!persistence->enabled)
+		return;
+
+	if (persistence->buffered > 0)
+		write_buffer(persistence);
+	if (persistence->unsynced)
+	{
+		if (fdatasync(persistence->wal_fd) < 0)
+			exit_with_error("Failed to sync the log", NULL);
+		persistence->unsynced = false;
+	}
+}
+
+/**
+ * @brief Syncs the data directory, so files created or renamed in it are found after a crash.
+ *
+ * @return int 0 on success, -1 with errno set on error.
+ */
+static int sync_directory(const struct persistence *persistence)
+{
+	int fd = open(persistence->dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+	int result = fsync(fd);
+	int error = errno;
+	close(fd);
+	errno = error;
+	return result;
+}
+
+static void open_segment(struct persistence *persistence, uint64_t sequence)
+{
+	char path[512];
+	segment_path(persistence, path, sizeof(path), sequence);
+	persistence->wal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (persistence->wal_fd < 0)
+	{
+		log_warn("%s: %s", path, strerror(errno));
+		exit_with_error("Failed to open the log", NULL);
+	}
+	// records synced to the segment are lost with it if its directory entry is not on disk
+	if (sync_directory(persistence) < 0)
+	{
+		log_warn("%s: %s", persistence->dir, strerror(errno));
+		exit_with_error("Failed to sync the data directory", NULL);
+	}
+	persistence->wal_sequence = sequence;
+}
+
+void persistence_init(struct persistence *persistence, const char *dir, uint64_t snapshot_every)
+{
+	memset(persistence, 0, sizeof(*persistence));
+	persistence->wal_fd = -1;
+	if (!dir)
+		return;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	{
+		log_warn("%s: %s", dir, strerror(errno));
+		exit_with_error("Failed to create the data directory", NULL);
+	}
+
+	persistence->buffer = malloc(WAL_BUFFER_SIZE);
+	if (!persistence->buffer)
+		exit_with_error("Failed to allocate the log buffer", NULL);
+	memory_track(MEM_LOG, WAL_BUFFER_SIZE);
+
+	// the child of a multithreaded process must not allocate, it may wait for a lock forever
+	persistence->snapshot_buffer = malloc(SNAPSHOT_BUFFER_SIZE);
+	if (!persistence->snapshot_buffer)
+		exit_with_error("Failed to allocate the snapshot buffer", NULL);
+	memory_track(MEM_LOG, SNAPSHOT_BUFFER_SIZE);
+
+	persistence->enabled = true;
+	persistence->dir = dir;
+	persistence->snapshot_every = snapshot_every;
+}
+
+// ---------------------------------------------------------------- recovery
+
+static int compare_sequences(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Lists the log segments in the data directory in ascending order.
+ *
+ * @return size_t Number of segments, the array is malloc'd.
+ */
+static size_t list_segments(const struct persistence *persistence, uint64_t **sequences)
+{
+	size_t count = 0, capacity = 16;
+	*sequences = malloc(capacity * sizeof(uint64_t));
+	DIR *dir = opendir(persistence->dir);
+	if (!dir || !*sequences)
+		exit_with_error("Failed to read the data directory", NULL);
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		uint64_t sequence;
+		char end;
+		if (sscanf(entry->d_name, "wal.%" SCNu64 "%c", &sequence, &end) != 1)
+			continue;
+		if (count == capacity)
+		{
+			capacity *= 2;
+			*sequences = realloc(*sequences, capacity * sizeof(uint64_t));
+			if (!*sequences)
+				exit_with_error("Failed to read the data directory", NULL);
+		}
+		(*sequences)[count++] = sequence;
+	}
+	closedir(dir);
+
+	qsort(*sequences, count, sizeof(uint64_t), compare_sequences);
+	return count;
+}
+
+static void restore_entry(ssn_key_t key, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email, void *arg)
+{
+	char ssn[SSN_DIGITS];
+	ssn_unpack(key, ssn);
+	store_value(arg, ssn, name_length, email_length, name, email);
+}
+
+/**
+ * @brief snapshot_visit_function that stores an entry only if its ring slot is in the node's range,
+ *        the hash slots at the ends of the range also hold entries of the neighbours.
+ */
+static void restore_owned_entry(ssn_key_t key, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email, void *arg)
+{
+	char ssn[SSN_DIGITS];
+	ssn_unpack(key, ssn);
+	if (check_range(arg, ssn) == 0)
+		store_value(arg, ssn, name_length, email_length, name, email);
+}
+
+/**
+ * @brief Applies the valid records of one log segment to the store.
+ *
+ * @return size_t Number of records applied. Replay stops at the first torn or corrupt record.
+ */
+static size_t replay_segment(struct self_data *self_data, uint64_t sequence)
+{
+	char path[512];
+	segment_path(&self_data->persistence, path, sizeof(path), sequence);
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		log_warn("%s: %s", path, strerror(errno));
+		exit_with_error("Failed to open a log segment", self_data);
+	}
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		exit_with_error("Failed to map a log segment", self_data);
+
+	size_t size = st.st_size, offset = 0, applied = 0;
+	while (offset + WAL_CHECKSUM_SIZE + 1 < size)
+	{
+		const uint8_t *record = map + offset;
+		const uint8_t *body = record + WAL_CHECKSUM_SIZE + 1;
+		size_t available = size - offset - WAL_CHECKSUM_SIZE - 1;
+		size_t length;
+
+		switch (record[WAL_CHECKSUM_SIZE])
+		{
+		case WAL_INSERT:
+			length = SSN_KEY_BYTES + 2;
+			if (available >= length)
+				length += body[SSN_KEY_BYTES] + body[SSN_KEY_BYTES + 1];
+			break;
+		case WAL_REMOVE:
+			length = SSN_KEY_BYTES;
+			break;
+		case WAL_DROP_SLOT:
+			length = 1;
+			break;
+		default:
+			length = SIZE_MAX;
+			break;
+		}
+		if (length > available || get_u32(record) != checksum(record + WAL_CHECKSUM_SIZE, length + 1))
+		{
+			log_warn("\tLog segment %" PRIu64 " ends with a torn record at offset %zu, ignoring the rest", sequence, offset);
+			break;
+		}
+
+		char ssn[SSN_DIGITS];
+		switch (record[WAL_CHECKSUM_SIZE])
+		{
+		case WAL_INSERT:
+			ssn_unpack(ssn_key_load(body), ssn);
+			store_value(self_data, ssn, body[SSN_KEY_BYTES], body[SSN_KEY_BYTES + 1],
+				    body + SSN_KEY_BYTES + 2, body + SSN_KEY_BYTES + 2 + body[SSN_KEY_BYTES]);
+			break;
+		case WAL_REMOVE:
+			ssn_unpack(ssn_key_load(body), ssn);
+			delete_value(self_data, ssn);
+			break;
+		case WAL_DROP_SLOT:
+			drop_slot(self_data, body[0]);
+			break;
+		}
+		offset += WAL_CHECKSUM_SIZE + 1 + length;
+		applied++;
+	}
+
+	munmap(map, size);
+	return applied;
+}
+
+void persistence_recover(struct self_data *self_data)
+{
+	struct persistence *persistence = &self_data->persistence;
+	if (!persistence->enabled)
+		return;
+
+	char path[512];
+	path_in_dir(persistence, path, sizeof(path), SNAPSHOT_FILE);
+	persistence->replaying = true;
+
+	uint64_t snapshot_sequence = 0;
+	struct snapshot snapshot;
+	if (snapshot_open(&snapshot, path) == 0)
+	{
+		if (snapshot.header->partitioning != ht_get_partitioning())
+			exit_with_error("The snapshot was written with another partitioning, check --ordered", self_data);
+		snapshot_sequence = snapshot.header->wal_sequence;
+		for (int slot = 0; slot < HT_SLOTS; slot++)
+		{
+			if (snapshot_foreach_in_slot(&snapshot, slot, restore_entry, self_data) < 0)
+				log_warn("\tSnapshot slot %d is truncated", slot);
+		}
+		log_info("\tLoaded snapshot with %" PRIu64 " entries", snapshot.header->entries);
+		snapshot_close(&snapshot);
+	}
+
+	uint64_t *sequences;
+	size_t segments = list_segments(persistence, &sequences);
+	size_t replayed = 0;
+	uint64_t last_sequence = snapshot_sequence;
+	for (size_t i = 0; i < segments; i++)
+	{
+		if (sequences[i] <= snapshot_sequence)
+		{
+			segment_path(persistence, path, sizeof(path), sequences[i]); // left behind by a crash after the snapshot was taken
+			unlink(path);
+			continue;
+		}
+		replayed += replay_segment(self_data, sequences[i]);
+		last_sequence = sequences[i];
+	}
+	persistence->oldest_sequence = segments > 0 && sequences[0] > snapshot_sequence ? sequences[0] : snapshot_sequence + 1;
+	free(sequences);
+
+	persistence->replaying = false;
+	open_segment(persistence, last_sequence + 1);
+	// fold a replayed log into a new snapshot right away
+	if (replayed > 0)
+		persistence->changes_since_snapshot = persistence->snapshot_every;
+
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+	{
+		if (ht_slot_entries(self_data->hash_table, slot) > 0 && (FIRST_RING_SLOT(slot) < self_data->range_start || LAST_RING_SLOT(slot) > self_data->range_end))
+		{
+			persistence->foreign[slot] = true;
+			persistence->foreign_count++;
+		}
+	}
+	log_info("\tRecovered %d entries, replayed %zu log records, %d slots to hand over",
+		 get_num_entries(self_data->hash_table), replayed, persistence->foreign_count);
+}
+
+void persistence_adopt(struct self_data *self_data, const char *path)
+{
+	struct snapshot snapshot;
+	if (snapshot_open(&snapshot, path) < 0)
+	{
+		log_warn("%s: %s", path, strerror(errno));
+		exit_with_error("Failed to open the file to load", self_data);
+	}
+	if (snapshot.header->partitioning != ht_get_partitioning())
+		exit_with_error("The file to load was written with another partitioning, check --ordered", self_data);
+
+	int before = get_num_entries(self_data->hash_table);
+	for (int slot = HASH_SLOT_OF(self_data->range_start); slot <= HASH_SLOT_OF(self_data->range_end); slot++)
+	{
+		if (snapshot_foreach_in_slot(&snapshot, slot, restore_owned_entry, self_data) < 0)
+			log_warn("\tSlot %d of %s is truncated", slot, path);
+	}
+	snapshot_close(&snapshot);
+	log_info("\tLoaded %d entries for range %d-%d from %s", get_num_entries(self_data->hash_table) - before,
+		 self_data->range_start, self_data->range_end, path);
+
+	// the loaded entries are not in the log, get them into the next snapshot
+	self_data->persistence.changes_since_snapshot = self_data->persistence.snapshot_every;
+}
+
+// ---------------------------------------------------------------- snapshots
+
+struct snapshot_context
+{
+	struct snapshot_writer *writer;
+	bool failed;
+};
+
+static void write_entry(const char *key, void *value, void *arg)
+{
+	struct snapshot_context *context = arg;
+	const struct value_pair *pair = value_resolve(value);
+	struct value_fields fields;
+	ssn_key_t packed;
+
+	ssn_pack(key, &packed);
+	value_fields(pair, &fields);
+	if (snapshot_writer_add(context->writer, packed, pair->name_length, pair->email_length, fields.name, fields.email) < 0)
+		context->failed = true;
+}
+
+/**
+ * @brief Runs in the forked child, writes the store as it was at fork time. Only async-signal-safe
+ *        calls are made, other threads of the parent may have held locks when it forked.
+ */
+static int write_snapshot(struct self_data *self_data, const char *path, uint64_t wal_sequence)
+{
+	struct snapshot_writer writer;
+	if (snapshot_writer_open(&writer, path, self_data->persistence.snapshot_buffer) < 0)
+		return -1;
+
+	struct snapshot_context context = {.writer = &writer, .failed = false};
+	for (int slot = 0; slot < HT_SLOTS && !context.failed; slot++)
+	{
+		snapshot_writer_begin_slot(&writer, slot);
+		ht_foreach_in_slot(self_data->hash_table, slot, write_entry, &context);
+	}
+	if (context.failed)
+	{
+		snapshot_writer_abort(&writer);
+		return -1;
+	}
+	return snapshot_writer_close(&writer, wal_sequence, HASH_SLOT_OF(self_data->range_start), HASH_SLOT_OF(self_data->range_end));
+}
+
+/**
+ * @brief Starts a new log segment and forks a child that snapshots everything logged before it.
+ */
+static void start_snapshot(struct self_data *self_data)
+{
+	struct persistence *persistence = &self_data->persistence;
+
+	persistence_commit(persistence);
+	close(persistence->wal_fd);
+	uint64_t covered = persistence->wal_sequence;
+	open_segment(persistence, covered + 1);
+
+	char path[512];
+	path_in_dir(persistence, path, sizeof(path), SNAPSHOT_FILE);
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		log_warn("fork: %s", strerror(errno));
+		return; // the log keeps growing, the next tick tries again
+	}
+	if (pid == 0)
+		_exit(write_snapshot(self_data, path, covered) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+	persistence->snapshot_pid = pid;
+	persistence->snapshot_sequence = covered;
+	persistence->changes_since_snapshot = 0;
+}
+
+static void collect_snapshot(struct persistence *persistence)
+{
+	int status;
+	pid_t pid = waitpid(persistence->snapshot_pid, &status, WNOHANG);
+	if (pid == 0)
+		return; // still writing
+	persistence->snapshot_pid = 0;
+
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+	{
+		log_warn("\tWriting a snapshot failed, keeping the log");
+		return;
+	}
+	// the snapshot has to be in place on disk before the segments it contains are gone
+	if (sync_directory(persistence) < 0)
+	{
+		log_warn("\t%s: %s, keeping the log", persistence->dir, strerror(errno));
+		return;
+	}
+
+	char path[512];
+	for (uint64_t sequence = persistence->oldest_sequence; sequence <= persistence->snapshot_sequence; sequence++)
+	{
+		segment_path(persistence, path, sizeof(path), sequence);
+		unlink(path);
+	}
+	persistence->oldest_sequence = persistence->snapshot_sequence + 1;
+	log_info("\tSnapshot of log segment %" PRIu64 " written", persistence->snapshot_sequence);
+}
+
+void persistence_tick(struct self_data *self_data)
+{
+	struct persistence *persistence = &self_data->persistence;
+	if (!persistence->enabled)
+		return;
+
+	if (persistence->snapshot_pid > 0)
+		collect_snapshot(persistence);
+	else if (persistence->changes_since_snapshot >= persistence->snapshot_every)
+		start_snapshot(self_data);
+
+	// one slot per iteration so incoming traffic is still served while a large recovery is handed over
+	for (int slot = 0; slot < HT_SLOTS && persistence->foreign_count > 0; slot++)
+	{
+		if (!persistence->foreign[slot])
+			continue;
+		persistence->foreign[slot] = false;
+		persistence->foreign_count--;
+		if (FIRST_RING_SLOT(slot) >= self_data->range_start && LAST_RING_SLOT(slot) <= self_data->range_end)
+			continue; // the range grew to include it meanwhile
+		if (self_data->successor.socket <= 0)
+			continue; // alone again, everything is in range once the range is updated
+		if (send_queue_depth(&self_data->successor) > SEND_QUEUE_LOW)
+		{
+			// the successor has not caught up with the previous slot yet
+			persistence->foreign[slot] = true;
+			persistence->foreign_count++;
+			break;
+		}
+		log_info("\tHanding over recovered slot %d", slot);
+		send_slot_entries(self_data, slot, &self_data->successor);
+		break;
+	}
+}
+
+bool persistence_busy(const struct persistence *persistence)
+{
+	return persistence->foreign_count > 0;
+}
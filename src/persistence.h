@@ -0,0 +1,100 @@
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "hashtable.h"
+
+#define WAL_BUFFER_SIZE (1 << 20)
+
+struct self_data;
+
+/**
+ * @brief Write-ahead log and snapshot state of a node.
+ *
+ * Every change to the store is appended to the current log segment. Records are buffered and
+ * written and synced once per main loop iteration (group commit). A snapshot of the whole store
+ * is written by a forked child from time to time, after which the log segments it contains are
+ * deleted. Recovery maps the snapshot and replays the newer segments.
+ */
+struct persistence
+{
+	bool enabled;
+	bool replaying; // changes applied during recovery are not logged again
+	const char *dir;
+	uint64_t snapshot_every; // logged changes between snapshots
+
+	int wal_fd;
+	uint64_t wal_sequence;	 // number of the segment being written
+	uint64_t oldest_sequence; // oldest segment that may still exist on disk
+	uint8_t *buffer;	 // records not yet written
+	size_t buffered;
+	bool unsynced; // data written since the last fdatasync
+
+	uint64_t changes_since_snapshot;
+	uint8_t *snapshot_buffer;      // used by the snapshot child, allocated before it is forked
+	pid_t snapshot_pid;	       // child writing a snapshot, 0 if none
+	uint64_t snapshot_sequence;    // last segment contained in the running snapshot
+
+	bool foreign[HT_SLOTS]; // recovered hash slots with entries outside the node's range, handed over to the successor
+	int foreign_count;
+};
+
+/**
+ * @brief Sets up persistence. Nothing is logged if dir is NULL.
+ *
+ * @param persistence State to initialize.
+ * @param dir Directory for the log and snapshot, created if missing.
+ * @param snapshot_every Number of logged changes after which a new snapshot is taken.
+ */
+void persistence_init(struct persistence *persistence, const char *dir, uint64_t snapshot_every);
+
+/**
+ * @brief Loads the latest snapshot and replays the log into the store, then opens a new log segment.
+ *        Must be called once the store exists and the node's range is known.
+ *
+ * Recovered slots outside the range are kept and handed over to the successor one by one from
+ * persistence_tick(), entries the predecessor transfers afterwards replace recovered ones.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+void persistence_recover(struct self_data *self_data);
+
+/**
+ * @brief Stores the entries of a snapshot file that fall in the node's range, typically one written
+ *        by bin/bulk_load. Slots outside the range are left for the nodes that own them.
+ *        Call before persistence_recover() so recovered entries take precedence.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param path The snapshot file.
+ */
+void persistence_adopt(struct self_data *self_data, const char *path);
+
+/**
+ * @brief Appends a change to the log buffer.
+ */
+void persistence_log_insert(struct persistence *persistence, const char *ssn, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email);
+void persistence_log_remove(struct persistence *persistence, const char *ssn);
+void persistence_log_drop_slot(struct persistence *persistence, hash_t slot);
+
+/**
+ * @brief Writes the buffered records and syncs the log.
+ */
+void persistence_commit(struct persistence *persistence);
+
+/**
+ * @brief Main loop housekeeping: collects a finished snapshot, starts a new one when enough
+ *        changes were logged and hands over one recovered foreign slot.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+void persistence_tick(struct self_data *self_data);
+
+/**
+ * @brief Whether persistence_tick() has work left and the main loop should not block.
+ */
+bool persistence_busy(const struct persistence *persistence);
+
+#endif // PERSISTENCE_H
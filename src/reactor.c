@@ -0,0 +1,223 @@
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+
+#ifndef USE_IO_URING
+
+#include "reactor.h"
+#include "log.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int reactor_init(struct reactor *reactor)
+{
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	reactor->pending_count = 0;
+	return reactor->epoll_fd < 0 ? -1 : 0;
+}
+
+int reactor_add(struct reactor *reactor, struct reactor_source *source, int fd, uint32_t events)
+{
+	struct epoll_event event = {.events = events | EPOLLET, .data.ptr = source};
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		return -1;
+	source->fd = fd;
+	return 0;
+}
+
+void reactor_remove(struct reactor *reactor, struct reactor_source *source)
+{
+	if (source->fd < 0)
+		return;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL) < 0)
+		log_warn("epoll_ctl: %s", strerror(errno));
+	source->fd = -1;
+
+	// a scheduled call would go to a socket that is gone
+	for (int i = 0; i < reactor->pending_count; i++)
+	{
+		if (reactor->pending[i] == source)
+			reactor->pending[i] = reactor->pending[--reactor->pending_count];
+	}
+	source->scheduled = false;
+}
+
+void reactor_schedule(struct reactor *reactor, struct reactor_source *source)
+{
+	if (source->scheduled || source->fd < 0)
+		return;
+	if (reactor->pending_count == REACTOR_MAX_PENDING)
+	{
+		log_warn("\tToo many scheduled sources, input may wait for the next event");
+		return;
+	}
+	source->scheduled = true;
+	reactor->pending[reactor->pending_count++] = source;
+}
+
+void reactor_want_write(struct reactor *reactor, struct reactor_source *source)
+{
+	// registered with EPOLLOUT, the edge comes when the socket drains
+}
+
+/**
+ * @brief Reads a stream source until the socket would block, calling its handler after every read.
+ */
+static void read_stream(struct reactor *reactor, struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	if (events & EPOLLOUT)
+		source->handler(self_data, source, EPOLLOUT);
+	if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) || source->fd < 0)
+		return;
+
+	// bytes read outside the reactor come first, a handler may also replace the socket meanwhile
+	if (source->inbox->length > 0)
+		source->handler(self_data, source, EPOLLIN);
+	for (int reads = 0; source->fd >= 0; reads++)
+	{
+		if (reads == REACTOR_READS_PER_EVENT)
+		{
+			// let the other sockets have a turn, the rest is read on the next wait
+			reactor_schedule(reactor, source);
+			return;
+		}
+		ssize_t bytes_received = byte_ring_read(source->inbox, source->fd);
+		if (bytes_received < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if (errno == EINTR)
+				continue;
+			log_warn("Recv failed: %s", strerror(errno));
+			source->handler(self_data, source, EPOLLERR);
+			return;
+		}
+		source->handler(self_data, source, bytes_received > 0 ? EPOLLIN : EPOLLRDHUP);
+		if (bytes_received == 0)
+			return;
+	}
+}
+
+/**
+ * @brief Receives datagrams REACTOR_DATAGRAM_BATCH per recvmmsg call until none are left.
+ */
+static void read_datagrams(struct self_data *self_data, struct reactor_source *source)
+{
+	static uint8_t buffers[REACTOR_DATAGRAM_BATCH][REACTOR_DATAGRAM_MAX];
+	struct mmsghdr msgs[REACTOR_DATAGRAM_BATCH];
+	struct iovec iov[REACTOR_DATAGRAM_BATCH];
+
+	while (source->fd >= 0)
+	{
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < REACTOR_DATAGRAM_BATCH; i++)
+		{
+			iov[i].iov_base = buffers[i];
+			iov[i].iov_len = REACTOR_DATAGRAM_MAX;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int count = recvmmsg(source->fd, msgs, REACTOR_DATAGRAM_BATCH, MSG_DONTWAIT, NULL);
+		if (count < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				log_warn("Recv failed: %s", strerror(errno));
+			if (errno != EINTR)
+				return;
+			continue;
+		}
+
+		for (int i = 0; i < count; i++)
+			source->datagram(self_data, source, buffers[i], msgs[i].msg_len, msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
+		if (count < REACTOR_DATAGRAM_BATCH)
+			return; // drained, a datagram arriving later is a new edge
+	}
+}
+
+/**
+ * @brief Reads a source that has input.
+ */
+static void read_source(struct reactor *reactor, struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	if (source->datagram)
+		read_datagrams(self_data, source);
+	else if (!source->inbox)
+		source->handler(self_data, source, EPOLLIN); // a listening socket, the handler accepts
+	else
+		read_stream(reactor, self_data, source, events);
+}
+
+int reactor_wait(struct reactor *reactor, struct self_data *self_data, int timeout)
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	int count = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, reactor->pending_count > 0 ? 0 : timeout);
+	if (count < 0)
+		return -1;
+
+	// a handler may unregister a source that has an event later in the batch, that event is skipped
+	while (reactor->pending_count > 0)
+	{
+		struct reactor_source *source = reactor->pending[--reactor->pending_count];
+		source->scheduled = false;
+		read_source(reactor, self_data, source, EPOLLIN);
+	}
+	for (int i = 0; i < count; i++)
+	{
+		struct reactor_source *source = events[i].data.ptr;
+		if (source->fd >= 0)
+			read_source(reactor, self_data, source, events[i].events);
+	}
+	return count;
+}
+
+int reactor_accept(struct reactor *reactor, int fd, struct sockaddr_in *addr, int timeout)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	int ret = poll(&pfd, 1, timeout);
+	if (ret == 0)
+		errno = ETIMEDOUT;
+	if (ret <= 0)
+		return -1;
+
+	socklen_t addr_len = sizeof(*addr);
+	return accept(fd, (struct sockaddr *)addr, &addr_len);
+}
+
+void reactor_send(struct reactor *reactor, struct reactor_send *sends, int count)
+{
+	struct mmsghdr msgs[REACTOR_MAX_EVENTS];
+	int i = 0;
+	while (i < count)
+	{
+		// consecutive messages to one socket go in one sendmmsg call
+		int run = i + 1;
+		while (run < count && sends[run].fd == sends[i].fd)
+			run++;
+		for (int j = i; j < run; j++)
+		{
+			msgs[j].msg_hdr = *sends[j].msg;
+			msgs[j].msg_len = 0;
+		}
+
+		int sent = sendmmsg(sends[i].fd, msgs + i, run - i, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			sends[i].result = -errno;
+			for (int j = i + 1; j < run; j++)
+				sends[j].result = -ECANCELED;
+			i = run;
+			continue;
+		}
+
+		// a short count stops at the message that failed, the next call reports why
+		for (int j = i; j < i + sent; j++)
+			sends[j].result = msgs[j].msg_len;
+		i += sent;
+	}
+}
+
+#endif // USE_IO_URING
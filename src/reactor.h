@@ -0,0 +1,196 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "byte_ring.h"
+#ifdef USE_IO_URING
+#include "uring.h"
+#endif
+
+#define REACTOR_MAX_EVENTS 256	   // events taken per wait
+#define REACTOR_MAX_PENDING 16	   // sources scheduled without a new event
+#define REACTOR_READS_PER_EVENT 16 // reads from one stream before the other sockets are served
+#define REACTOR_DATAGRAM_BATCH 32  // datagrams per recvmmsg call
+#define REACTOR_DATAGRAM_MAX 4096  // larger than any PDU, a power of two so a datagram can be read as a ring
+
+#ifdef USE_IO_URING
+#define REACTOR_DATAGRAM_BUFFERS 256		// provided buffers for datagrams, held until handled
+#define REACTOR_STREAM_BUFFERS 32		// provided buffers for streams, copied into the inbox right away
+#define REACTOR_STREAM_BUFFER_SIZE (64 * 1024)
+#define REACTOR_MAX_SOURCES 64
+#define REACTOR_MAX_ACCEPTED 8
+#define REACTOR_MAX_LISTENERS 2
+#endif
+
+struct self_data;
+struct reactor_source;
+
+/**
+ * @brief Called for a stream source with EPOLLIN once new bytes are in its inbox, EPOLLOUT when the
+ *        socket takes writes again, EPOLLRDHUP when the peer closed the connection and EPOLLERR when
+ *        receiving failed. The reactor does the reading, the handler only handles the inbox.
+ *        A listening source is called with EPOLLIN when a connection may be waiting for reactor_accept().
+ */
+typedef void (*reactor_handler)(struct self_data *self_data, struct reactor_source *source, uint32_t events);
+
+/**
+ * @brief Called for every datagram a datagram source receives. The data is only valid during the call.
+ */
+typedef void (*reactor_datagram_handler)(struct self_data *self_data, struct reactor_source *source, uint8_t *data, size_t length, bool truncated);
+
+/**
+ * @brief A socket registered with the reactor. The structure is what the kernel reports back,
+ *        so it has to stay in place while registered.
+ */
+struct reactor_source
+{
+	int fd; // -1 while not registered
+	reactor_handler handler;	   // stream and listening sockets
+	struct byte_ring *inbox;	   // stream sockets, received bytes are appended here, NULL for a listening socket
+	reactor_datagram_handler datagram; // datagram sockets, set instead of handler and inbox
+	void *arg;			   // for the handler
+	bool scheduled;
+	uint32_t events; // for the handler call of a scheduled source
+#ifdef USE_IO_URING
+	uint16_t generation; // tells completions for an earlier socket apart
+	bool receiving;	     // a multishot receive is armed
+	bool want_write;     // a poll for POLLOUT is armed
+#endif
+};
+
+#ifdef USE_IO_URING
+/**
+ * @brief A listening socket with its multishot accept, set up by reactor_add() or the first reactor_accept().
+ */
+struct reactor_listener
+{
+	int fd;				// -1 for a free entry
+	struct reactor_source *source;	// told about accepted sockets, NULL if not registered
+	bool accepting;
+	int accepted[REACTOR_MAX_ACCEPTED];
+	int accepted_count;
+};
+#endif
+
+/**
+ * @brief A message for reactor_send().
+ */
+struct reactor_send
+{
+	int fd;
+	struct msghdr *msg;
+	ssize_t result; // bytes sent or -errno, -ECANCELED if an earlier message to the same socket failed
+};
+
+/**
+ * @brief Event loop that dispatches the input of any number of sockets to their handlers.
+ *
+ * The backend is picked at build time: edge-triggered epoll by default, or io_uring with
+ * multishot receives into provided buffers when built with USE_IO_URING.
+ */
+struct reactor
+{
+#ifdef USE_IO_URING
+	struct uring uring;
+	struct uring_buffers datagram_buffers;
+	struct uring_buffers stream_buffers;
+	struct reactor_source *sources[REACTOR_MAX_SOURCES]; // registered, armed on the next wait
+	int source_count;
+
+	// completions taken while sending, handled by the next wait
+	struct io_uring_cqe stashed[URING_CQ_ENTRIES];
+	int stashed_count;
+
+	// datagrams received outside a wait, their buffers stay taken until they are handled
+	struct
+	{
+		struct reactor_source *source;
+		uint16_t buffer;
+		uint32_t length;
+		bool truncated;
+	} datagrams[REACTOR_DATAGRAM_BUFFERS];
+	int datagram_count;
+
+	struct reactor_listener listeners[REACTOR_MAX_LISTENERS];
+
+	struct reactor_send *sending; // messages of the reactor_send() call in progress
+	int sends_left;
+#else
+	int epoll_fd;
+#endif
+	struct reactor_source *pending[REACTOR_MAX_PENDING];
+	int pending_count;
+};
+
+/**
+ * @brief Creates the epoll or io_uring instance.
+ *
+ * @return int 0 on success, -1 on failure.
+ */
+int reactor_init(struct reactor *reactor);
+
+/**
+ * @brief Registers a socket. With io_uring its receive is armed on the next wait, until then the
+ *        socket may still be read directly.
+ *
+ * @param reactor The reactor.
+ * @param source Source with handler and inbox, datagram, or only handler for a listening socket. Stays owned by the caller.
+ * @param fd The socket, non-blocking.
+ * @param events EPOLLIN, EPOLLOUT or both, EPOLLET is added. The io_uring backend always receives.
+ * @return int 0 on success, -1 on failure.
+ */
+int reactor_add(struct reactor *reactor, struct reactor_source *source, int fd, uint32_t events);
+
+/**
+ * @brief Unregisters a source before its socket is closed. Does nothing if it is not registered.
+ */
+void reactor_remove(struct reactor *reactor, struct reactor_source *source);
+
+/**
+ * @brief Has the handler of a stream source called with EPOLLIN on the next reactor_wait() even if
+ *        the socket reports nothing new, for bytes a handler left in the inbox.
+ */
+void reactor_schedule(struct reactor *reactor, struct reactor_source *source);
+
+/**
+ * @brief Has the handler of a stream source called with EPOLLOUT once the socket takes writes again.
+ *        Edge-triggered epoll reports that anyway.
+ */
+void reactor_want_write(struct reactor *reactor, struct reactor_source *source);
+
+/**
+ * @brief Waits for input and calls the handlers.
+ *
+ * @param reactor The reactor.
+ * @param self_data Passed to the handlers.
+ * @param timeout Milliseconds to wait, 0 if sources are scheduled.
+ * @return int Number of events handled, -1 on failure, errno EINTR if interrupted by a signal.
+ */
+int reactor_wait(struct reactor *reactor, struct self_data *self_data, int timeout);
+
+/**
+ * @brief Accepts a connection on a listening socket without calling any handler.
+ *
+ * @param reactor The reactor.
+ * @param fd The listening socket.
+ * @param addr Set to the address of the peer.
+ * @param timeout Milliseconds to wait, 0 to only take a connection that is already waiting, negative to wait without limit.
+ * @return int The connected socket, -1 on failure, errno ETIMEDOUT if nobody connected.
+ */
+int reactor_accept(struct reactor *reactor, int fd, struct sockaddr_in *addr, int timeout);
+
+/**
+ * @brief Sends messages without blocking, in one submission where the backend allows. Consecutive
+ *        messages to the same socket go out in order, after one fails the rest of them are not sent.
+ *
+ * @param reactor The reactor.
+ * @param sends The messages, their results are set.
+ * @param count Number of messages, at most REACTOR_MAX_EVENTS.
+ */
+void reactor_send(struct reactor *reactor, struct reactor_send *sends, int count);
+
+#endif // REACTOR_H
@@ -0,0 +1,548 @@
+#ifdef USE_IO_URING
+
+#include "reactor.h"
+#include "log.h"
+#include "memory.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATAGRAM_GROUP 0
+#define STREAM_GROUP 1
+
+// user_data of a request: generation of the source, the source and the operation in the low bits
+enum request
+{
+	REQUEST_RECEIVE = 1,
+	REQUEST_WRITABLE,
+	REQUEST_ACCEPT,
+	REQUEST_SEND, // the message index instead of a source
+	REQUEST_CANCEL,
+};
+#define REQUEST_BITS 3
+#define REQUEST_MASK ((1u << REQUEST_BITS) - 1)
+#define SOURCE_MASK 0x0000fffffffffff8ull // user space pointers fit in 48 bits
+
+static uint64_t request_data(const struct reactor_source *source, enum request request)
+{
+	return (uint64_t)source->generation << 48 | (uint64_t)(uintptr_t)source | request;
+}
+
+static struct uring_buffers *source_buffers(struct reactor *reactor, const struct reactor_source *source)
+{
+	return source->datagram ? &reactor->datagram_buffers : &reactor->stream_buffers;
+}
+
+int reactor_init(struct reactor *reactor)
+{
+	reactor->source_count = 0;
+	reactor->stashed_count = 0;
+	reactor->datagram_count = 0;
+	for (int i = 0; i < REACTOR_MAX_LISTENERS; i++)
+		reactor->listeners[i].fd = -1;
+	reactor->sending = NULL;
+	reactor->sends_left = 0;
+	reactor->pending_count = 0;
+
+	if (uring_init(&reactor->uring) < 0)
+		return -1;
+	// a multishot recvmsg puts a header in front of the datagram
+	if (uring_buffers_init(&reactor->uring, &reactor->datagram_buffers, DATAGRAM_GROUP, REACTOR_DATAGRAM_BUFFERS,
+			       sizeof(struct io_uring_recvmsg_out) + REACTOR_DATAGRAM_MAX) < 0)
+		return -1;
+	if (uring_buffers_init(&reactor->uring, &reactor->stream_buffers, STREAM_GROUP, REACTOR_STREAM_BUFFERS, REACTOR_STREAM_BUFFER_SIZE) < 0)
+		return -1;
+	memory_track(MEM_IO, (size_t)REACTOR_DATAGRAM_BUFFERS * reactor->datagram_buffers.size +
+				     (size_t)REACTOR_STREAM_BUFFERS * REACTOR_STREAM_BUFFER_SIZE);
+	return 0;
+}
+
+/**
+ * @brief The entry of a listening socket, taken on first use.
+ *
+ * @return struct reactor_listener* NULL if every entry is taken by another socket.
+ */
+static struct reactor_listener *listener_for(struct reactor *reactor, int fd)
+{
+	struct reactor_listener *free_entry = NULL;
+	for (int i = 0; i < REACTOR_MAX_LISTENERS; i++)
+	{
+		if (reactor->listeners[i].fd == fd)
+			return &reactor->listeners[i];
+		if (reactor->listeners[i].fd < 0 && !free_entry)
+			free_entry = &reactor->listeners[i];
+	}
+	if (free_entry)
+	{
+		free_entry->fd = fd;
+		free_entry->source = NULL;
+		free_entry->accepting = false;
+		free_entry->accepted_count = 0;
+	}
+	return free_entry;
+}
+
+int reactor_add(struct reactor *reactor, struct reactor_source *source, int fd, uint32_t events)
+{
+	if (reactor->source_count == REACTOR_MAX_SOURCES || ((uintptr_t)source & ~SOURCE_MASK))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	source->fd = fd;
+	source->events = 0;
+	source->receiving = false;
+	source->want_write = false;
+	if (!source->inbox && !source->datagram)
+	{
+		// a listening socket gets the multishot accept instead of a receive
+		struct reactor_listener *listener = listener_for(reactor, fd);
+		if (!listener)
+		{
+			source->fd = -1;
+			errno = EINVAL;
+			return -1;
+		}
+		listener->source = source;
+		return 0;
+	}
+	reactor->sources[reactor->source_count++] = source;
+	return 0;
+}
+
+void reactor_remove(struct reactor *reactor, struct reactor_source *source)
+{
+	if (source->fd < 0)
+		return;
+
+	// armed requests hold the socket open, they are canceled while the descriptor still names it
+	struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+	if (sqe)
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = source->fd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = REQUEST_CANCEL;
+	}
+	if (!sqe || uring_enter(&reactor->uring, 0, 0) < 0)
+		log_warn("io_uring cancel: %s", strerror(errno));
+
+	// what is still in flight for the socket completes with the old generation and is dropped
+	source->generation++;
+	source->fd = -1;
+	source->events = 0;
+	source->receiving = false;
+	source->want_write = false;
+	for (int i = 0; i < REACTOR_MAX_LISTENERS; i++)
+	{
+		struct reactor_listener *listener = &reactor->listeners[i];
+		if (listener->fd < 0 || listener->source != source)
+			continue;
+		while (listener->accepted_count > 0)
+			close(listener->accepted[--listener->accepted_count]);
+		listener->fd = -1;
+	}
+	for (int i = 0; i < reactor->source_count; i++)
+	{
+		if (reactor->sources[i] == source)
+			reactor->sources[i] = reactor->sources[--reactor->source_count];
+	}
+	for (int i = 0; i < reactor->pending_count; i++)
+	{
+		if (reactor->pending[i] == source)
+			reactor->pending[i] = reactor->pending[--reactor->pending_count];
+	}
+	source->scheduled = false;
+	for (int i = 0; i < reactor->datagram_count; i++)
+	{
+		if (reactor->datagrams[i].source == source)
+		{
+			uring_buffer_recycle(&reactor->datagram_buffers, reactor->datagrams[i].buffer);
+			reactor->datagrams[i].source = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Adds events for the next handler call of a source.
+ */
+static void mark(struct reactor *reactor, struct reactor_source *source, uint32_t events)
+{
+	source->events |= events;
+	if (source->scheduled)
+		return;
+	if (reactor->pending_count == REACTOR_MAX_PENDING)
+	{
+		log_warn("\tToo many scheduled sources, input may wait for the next event");
+		return;
+	}
+	source->scheduled = true;
+	reactor->pending[reactor->pending_count++] = source;
+}
+
+void reactor_schedule(struct reactor *reactor, struct reactor_source *source)
+{
+	if (source->fd >= 0)
+		mark(reactor, source, EPOLLIN);
+}
+
+void reactor_want_write(struct reactor *reactor, struct reactor_source *source)
+{
+	if (source->fd < 0 || source->want_write)
+		return;
+	struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = source->fd;
+	sqe->poll32_events = POLLOUT;
+	sqe->user_data = request_data(source, REQUEST_WRITABLE);
+	source->want_write = true;
+}
+
+/**
+ * @brief Queues a multishot receive for every source without one, and the multishot accepts.
+ */
+static void arm(struct reactor *reactor)
+{
+	// header of the multishot recvmsg, no address and no control data in front of the payload
+	static const struct msghdr datagram_header;
+
+	for (int i = 0; i < reactor->source_count; i++)
+	{
+		struct reactor_source *source = reactor->sources[i];
+		if (source->receiving || (source->events & (EPOLLRDHUP | EPOLLERR)))
+			continue;
+		// with every datagram buffer held the receive would end right away, it waits for the next wait
+		if (source->datagram && reactor->datagram_count + reactor->stashed_count >= REACTOR_DATAGRAM_BUFFERS)
+			continue;
+
+		struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+		if (!sqe)
+			return;
+		sqe->fd = source->fd;
+		if (source->datagram)
+		{
+			sqe->opcode = IORING_OP_RECVMSG;
+			sqe->addr = (uint64_t)(uintptr_t)&datagram_header;
+			sqe->len = 1;
+		}
+		else
+			sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = source_buffers(reactor, source)->group;
+		sqe->user_data = request_data(source, REQUEST_RECEIVE);
+		source->receiving = true;
+	}
+
+	for (int i = 0; i < REACTOR_MAX_LISTENERS; i++)
+	{
+		struct reactor_listener *listener = &reactor->listeners[i];
+		if (listener->fd < 0 || listener->accepting)
+			continue;
+		struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+		if (!sqe)
+			return;
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = listener->fd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->user_data = (uint64_t)i << REQUEST_BITS | REQUEST_ACCEPT;
+		listener->accepting = true;
+	}
+}
+
+/**
+ * @brief Records a completion: the bytes of a stream go into its inbox, datagrams are kept for the
+ *        next dispatch and accepted sockets for reactor_accept(). No handler is called.
+ */
+static void complete(struct reactor *reactor, const struct io_uring_cqe *cqe)
+{
+	enum request request = cqe->user_data & REQUEST_MASK;
+	if (request == REQUEST_CANCEL)
+		return;
+	if (request == REQUEST_SEND)
+	{
+		// a send of an earlier call that gave up waiting has nowhere to go
+		if (reactor->sending)
+		{
+			reactor->sending[cqe->user_data >> REQUEST_BITS].result = cqe->res;
+			reactor->sends_left--;
+		}
+		return;
+	}
+	if (request == REQUEST_ACCEPT)
+	{
+		struct reactor_listener *listener = &reactor->listeners[cqe->user_data >> REQUEST_BITS];
+		if (listener->fd < 0)
+		{
+			// for a listening socket that has been removed
+			if (cqe->res >= 0)
+				close(cqe->res);
+			return;
+		}
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			listener->accepting = false;
+		if (cqe->res < 0)
+			log_warn("Accept failed: %s", strerror(-cqe->res));
+		else if (listener->accepted_count == REACTOR_MAX_ACCEPTED)
+		{
+			log_warn("Too many connections waiting to be accepted, closing one");
+			close(cqe->res);
+		}
+		else
+		{
+			listener->accepted[listener->accepted_count++] = cqe->res;
+			if (listener->source)
+				mark(reactor, listener->source, EPOLLIN);
+		}
+		return;
+	}
+
+	struct reactor_source *source = (struct reactor_source *)(uintptr_t)(cqe->user_data & SOURCE_MASK);
+	struct uring_buffers *buffers = source_buffers(reactor, source);
+	uint16_t buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	bool buffered = cqe->flags & IORING_CQE_F_BUFFER;
+	if (source->fd < 0 || cqe->user_data >> 48 != source->generation)
+	{
+		// for a socket that has been closed
+		if (buffered)
+			uring_buffer_recycle(buffers, buffer);
+		return;
+	}
+
+	if (request == REQUEST_WRITABLE)
+	{
+		source->want_write = false;
+		mark(reactor, source, EPOLLOUT);
+		return;
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		source->receiving = false; // armed again on the next wait
+	if (cqe->res == -ENOBUFS)
+		return; // every buffer is taken, the handled ones come back before the next wait
+	if (cqe->res < 0)
+	{
+		log_warn("Recv failed: %s", strerror(-cqe->res));
+		if (!source->datagram)
+			mark(reactor, source, EPOLLERR);
+		return;
+	}
+
+	if (source->datagram)
+	{
+		struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)uring_buffer(buffers, buffer);
+		reactor->datagrams[reactor->datagram_count].source = source;
+		reactor->datagrams[reactor->datagram_count].buffer = buffer;
+		reactor->datagrams[reactor->datagram_count].length = cqe->res - sizeof(*out);
+		reactor->datagrams[reactor->datagram_count].truncated = out->flags & MSG_TRUNC;
+		reactor->datagram_count++;
+		return;
+	}
+
+	if (cqe->res == 0)
+		mark(reactor, source, EPOLLRDHUP);
+	else
+	{
+		byte_ring_append(source->inbox, uring_buffer(buffers, buffer), cqe->res);
+		mark(reactor, source, EPOLLIN);
+	}
+	if (buffered)
+		uring_buffer_recycle(buffers, buffer);
+}
+
+/**
+ * @brief Takes the completions the kernel has posted. During a reactor_send() only the sends are
+ *        recorded, a handler may be in the middle of an inbox, the rest waits in the stash.
+ */
+static void reap(struct reactor *reactor)
+{
+	struct io_uring_cqe *cqe;
+	while ((cqe = uring_peek_cqe(&reactor->uring)))
+	{
+		if (reactor->sending && (cqe->user_data & REQUEST_MASK) != REQUEST_SEND && reactor->stashed_count < URING_CQ_ENTRIES)
+			reactor->stashed[reactor->stashed_count++] = *cqe;
+		else
+			complete(reactor, cqe);
+		uring_cqe_seen(&reactor->uring);
+	}
+}
+
+/**
+ * @brief Records the completions stashed during sends.
+ */
+static void unstash(struct reactor *reactor)
+{
+	for (int i = 0; i < reactor->stashed_count; i++)
+		complete(reactor, &reactor->stashed[i]);
+	reactor->stashed_count = 0;
+}
+
+/**
+ * @brief Milliseconds until the deadline, at least 0.
+ */
+static int remaining(const struct timespec *deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	return ms > 0 ? ms : 0;
+}
+
+static struct timespec deadline_in(int timeout)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	return deadline;
+}
+
+/**
+ * @brief Calls the handlers for what has been recorded. Sources marked by the handlers themselves
+ *        are left for the next wait.
+ */
+static int dispatch(struct reactor *reactor, struct self_data *self_data)
+{
+	int handled = 0;
+
+	// a handler that waits for a peer may record more datagrams, they are handled in this loop too
+	for (int i = 0; i < reactor->datagram_count; i++)
+	{
+		struct reactor_source *source = reactor->datagrams[i].source;
+		if (!source)
+			continue;
+		uint8_t *buffer = uring_buffer(&reactor->datagram_buffers, reactor->datagrams[i].buffer);
+		source->datagram(self_data, source, buffer + sizeof(struct io_uring_recvmsg_out), reactor->datagrams[i].length,
+				 reactor->datagrams[i].truncated);
+		uring_buffer_recycle(&reactor->datagram_buffers, reactor->datagrams[i].buffer);
+		handled++;
+	}
+	reactor->datagram_count = 0;
+
+	struct reactor_source *pending[REACTOR_MAX_PENDING];
+	int count = reactor->pending_count;
+	memcpy(pending, reactor->pending, sizeof(pending[0]) * count);
+	reactor->pending_count = 0;
+	for (int i = 0; i < count; i++)
+	{
+		struct reactor_source *source = pending[i];
+		if (!source->scheduled)
+			continue; // removed, or handled already after being marked again
+		uint32_t events = source->events;
+		uint16_t generation = source->generation;
+		source->scheduled = false;
+		source->events = 0;
+
+		// the bytes before the end of the stream first, the end only reaches the socket it belongs to
+		if (events & ~(EPOLLRDHUP | EPOLLERR))
+			source->handler(self_data, source, events & ~(EPOLLRDHUP | EPOLLERR));
+		if ((events & (EPOLLRDHUP | EPOLLERR)) && source->generation == generation)
+			source->handler(self_data, source, events & (EPOLLRDHUP | EPOLLERR));
+		handled++;
+	}
+	return handled;
+}
+
+int reactor_wait(struct reactor *reactor, struct self_data *self_data, int timeout)
+{
+	unstash(reactor);
+	arm(reactor);
+
+	bool ready = reactor->pending_count > 0 || reactor->datagram_count > 0 || uring_peek_cqe(&reactor->uring);
+	if (uring_enter(&reactor->uring, ready ? 0 : 1, timeout) < 0 && errno != ETIME)
+		return -1;
+	reap(reactor);
+	return dispatch(reactor, self_data);
+}
+
+int reactor_accept(struct reactor *reactor, int fd, struct sockaddr_in *addr, int timeout)
+{
+	struct timespec deadline = deadline_in(timeout);
+	struct reactor_listener *listener = listener_for(reactor, fd);
+	if (!listener)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	unstash(reactor);
+	while (listener->accepted_count == 0)
+	{
+		arm(reactor);
+		if (uring_enter(&reactor->uring, 1, timeout < 0 ? -1 : remaining(&deadline)) < 0)
+		{
+			if (errno == ETIME)
+			{
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			if (errno != EINTR)
+				return -1;
+		}
+		reap(reactor);
+	}
+
+	int client = listener->accepted[0];
+	memmove(listener->accepted, listener->accepted + 1, sizeof(listener->accepted[0]) * --listener->accepted_count);
+	socklen_t addr_len = sizeof(*addr);
+	if (getpeername(client, (struct sockaddr *)addr, &addr_len) < 0)
+	{
+		close(client);
+		return -1;
+	}
+	return client;
+}
+
+void reactor_send(struct reactor *reactor, struct reactor_send *sends, int count)
+{
+	// a chain must not be split across two submissions
+	if (reactor->uring.to_submit + count > reactor->uring.sq_entries && uring_enter(&reactor->uring, 0, 0) < 0)
+		log_warn("io_uring_enter: %s", strerror(errno));
+
+	reactor->sending = sends;
+	reactor->sends_left = 0;
+	for (int i = 0; i < count; i++)
+		sends[i].result = -ECANCELED; // until the completion says otherwise
+	for (int i = 0; i < count; i++)
+	{
+		struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+		if (!sqe)
+		{
+			sends[i].result = -errno;
+			continue;
+		}
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = sends[i].fd;
+		sqe->addr = (uint64_t)(uintptr_t)sends[i].msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL; // completes right away, a full socket fails with EAGAIN
+		// consecutive messages to one socket are linked, so they keep their order and a failure cancels the rest
+		if (i + 1 < count && sends[i + 1].fd == sends[i].fd)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = (uint64_t)i << REQUEST_BITS | REQUEST_SEND;
+		reactor->sends_left++;
+	}
+
+	while (reactor->sends_left > 0)
+	{
+		if (uring_enter(&reactor->uring, 1, -1) < 0 && errno != EINTR)
+		{
+			log_warn("io_uring_enter: %s", strerror(errno));
+			break;
+		}
+		reap(reactor);
+	}
+	reactor->sending = NULL;
+}
+
+#endif // USE_IO_URING
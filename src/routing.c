@@ -0,0 +1,572 @@
+#include "routing.h"
+#include "sockets.h"
+
+/**
+ * @brief The slot finger i leads to, 2^i past the end of the own range.
+ */
+static slot_t finger_target(const struct self_data *self_data, int i)
+{
+	return (slot_t)(self_data->range_end + (1 << i));
+}
+
+static bool in_range(slot_t range_start, slot_t range_end, slot_t slot)
+{
+	return slot >= range_start && slot <= range_end;
+}
+
+/**
+ * @brief Takes what an announce says about a node into the fingers it leads to. Fingers that led to
+ *        it for slots it no longer holds are forgotten.
+ */
+static void learn(struct self_data *self_data, const struct finger *node)
+{
+	for (int i = 0; i < FINGER_COUNT; i++)
+	{
+		struct finger *finger = &self_data->routing.fingers[i];
+		slot_t target = finger_target(self_data, i);
+		if (in_range(self_data->range_start, self_data->range_end, target))
+			memset(finger, 0, sizeof(*finger)); // the own range reaches past it
+		else if (in_range(node->range_start, node->range_end, target))
+			*finger = *node;
+		else if (finger->address == node->address && finger->port == node->port)
+			memset(finger, 0, sizeof(*finger));
+	}
+}
+
+/**
+ * @brief The entry of a node in the known nodes, by its peer address. A node not known yet takes a
+ *        free entry or the one of the node that has been silent longest.
+ *
+ * @return struct known_node* The entry, its address is 0 if the node was not known.
+ */
+static struct known_node *known_node(struct routing *routing, uint32_t address, uint16_t port)
+{
+	struct known_node *replaced = NULL;
+	for (int i = 0; i < KNOWN_NODES; i++)
+	{
+		struct known_node *known = &routing->nodes[i];
+		if (known->node.address == address && known->node.port == port)
+			return known;
+		if (!replaced || (replaced->node.address != 0 && (known->node.address == 0 || known->seen < replaced->seen)))
+			replaced = known;
+	}
+	memset(replaced, 0, sizeof(*replaced)); // the slots of the node replaced are trusted until OWNER_TTL runs out
+	return replaced;
+}
+
+/**
+ * @brief Sets the hop limit to twice the nodes known to hold a range, the own one included, and at
+ *        least MIN_HOP_LIMIT. A request goes around the ring once in as many hops as there are nodes.
+ */
+static void update_hop_limit(struct routing *routing)
+{
+	int nodes = 1;
+	for (int i = 0; i < KNOWN_NODES; i++)
+	{
+		if (routing->nodes[i].node.address != 0 && routing->nodes[i].node.range_start <= routing->nodes[i].node.range_end)
+			nodes++;
+	}
+	routing->hop_limit = 2 * nodes > MIN_HOP_LIMIT ? 2 * nodes : MIN_HOP_LIMIT;
+}
+
+/**
+ * @brief Takes an announced range into the slot owner map. A claim replaces one with a lower
+ *        version, or one that has not been announced again for OWNER_TTL. The slots the node
+ *        announced last and no longer does are unknown until another node claims them with a
+ *        higher version. Only those slots and the announced ones are visited.
+ */
+static void learn_owner(struct self_data *self_data, const struct NET_ANNOUNCE_PDU *pdu, const struct finger *node)
+{
+	struct routing *routing = &self_data->routing;
+	struct known_node *known = known_node(routing, pdu->address, pdu->port);
+	uint64_t now = timer_now();
+	for (int slot = node->range_start; node->range_start <= node->range_end && slot <= node->range_end; slot++)
+	{
+		struct slot_owner *owner = &routing->owners[slot];
+		bool same = owner->address == pdu->address && owner->port == pdu->udp_port;
+		if (same || owner->address == 0 ? pdu->version < owner->version : (pdu->version <= owner->version && now - owner->seen < OWNER_TTL))
+			continue; // a slot given up goes to a claim as recent as the release, a joining node's ties with it
+		owner->address = pdu->address;
+		owner->port = pdu->udp_port;
+		owner->version = pdu->version;
+		owner->seen = now;
+	}
+	if (known->node.address != 0 && pdu->version < known->version)
+		return; // overtaken by a later announce of the node
+	for (int slot = known->node.range_start; known->node.address != 0 && slot <= known->node.range_end; slot++)
+	{
+		struct slot_owner *owner = &routing->owners[slot];
+		if (in_range(node->range_start, node->range_end, slot))
+			continue;
+		if (owner->address == pdu->address && owner->port == pdu->udp_port && pdu->version >= owner->version)
+		{
+			owner->address = 0;
+			owner->version = pdu->version;
+		}
+	}
+	known->node = *node;
+	known->udp_port = pdu->udp_port;
+	known->version = pdu->version;
+	known->seen = now;
+	update_hop_limit(routing);
+	if (pdu->version > routing->map_version)
+		routing->map_version = pdu->version;
+}
+
+/**
+ * @brief Forgets every finger that leads to a node, its connection is gone, and the slots the map
+ *        has it own. Requests for them take the ring until the node announces itself again.
+ */
+static void forget(struct self_data *self_data, const struct sockaddr_in *addr)
+{
+	struct routing *routing = &self_data->routing;
+	for (int i = 0; i < FINGER_COUNT; i++)
+	{
+		struct finger *finger = &routing->fingers[i];
+		if (finger->address == addr->sin_addr.s_addr && finger->port == addr->sin_port)
+			memset(finger, 0, sizeof(*finger));
+	}
+	for (int i = 0; i < KNOWN_NODES; i++)
+	{
+		const struct known_node *known = &routing->nodes[i];
+		if (known->node.address != addr->sin_addr.s_addr || known->node.port != addr->sin_port)
+			continue;
+		for (int slot = known->node.range_start; slot <= known->node.range_end; slot++)
+		{
+			if (routing->owners[slot].address == known->node.address && routing->owners[slot].port == known->udp_port)
+				routing->owners[slot].address = 0;
+		}
+	}
+}
+
+/**
+ * @brief Sends NET_ANNOUNCE with a range of the own node to the successor.
+ */
+static void send_announce(struct self_data *self_data, slot_t range_start, slot_t range_end, uint32_t version)
+{
+	if (self_data->successor.socket <= 0 && !self_data->successor.connecting)
+		return; // alone, nobody to tell
+	struct NET_ANNOUNCE_PDU pdu = {
+	    .type = NET_ANNOUNCE,
+	    .address = self_data->my_ip_addr.s_addr,
+	    .port = self_data->routing.listening.dest_addr.sin_port,
+	    .range_start = htons(range_start),
+	    .range_end = htons(range_end),
+	    .hops = 0,
+	    .udp_port = self_data->routing.udp_port,
+	    .version = version,
+	};
+	if (send_tcp_pdu(&self_data->successor, &pdu, sizeof(pdu)) < 0)
+		log_warn("Failed to send NET_ANNOUNCE_PDU");
+}
+
+/**
+ * @brief Sends NET_ANNOUNCE with the own range to the successor.
+ */
+static void announce(struct self_data *self_data)
+{
+	send_announce(self_data, self_data->range_start, self_data->range_end, self_data->routing.range_version);
+}
+
+static void announce_timer_fired(struct self_data *self_data, struct timer *timer)
+{
+	announce(self_data);
+	timer_add(&self_data->timers, timer, timer_now() + ANNOUNCE_INTERVAL);
+}
+
+/**
+ * @brief Unregisters and closes a peer connection and drops what it had buffered.
+ */
+static void close_peer(struct self_data *self_data, struct connection_point *peer)
+{
+	timer_cancel(&self_data->timers, &self_data->routing.peer_timers[peer - self_data->routing.peers]);
+	self_data->routing.peer_closing[peer - self_data->routing.peers] = false;
+	if (peer->socket > 0)
+	{
+		reactor_remove(&self_data->reactor, &peer->source);
+		close(peer->socket);
+	}
+	peer->socket = 0;
+	peer->connecting = false;
+	byte_ring_clear(&peer->inbox);
+	byte_ring_clear(&peer->outbox);
+}
+
+/**
+ * @brief Gives up a peer connection and the fingers that lead to it. Requests still waiting for the
+ *        connect go around the ring instead, once connected the queue may end inside a PDU and is dropped.
+ */
+static void peer_failed(struct self_data *self_data, struct connection_point *peer)
+{
+	log_warn("\tPeer %s:%u is gone, its requests take the ring", inet_ntoa(peer->dest_addr.sin_addr), ntohs(peer->dest_addr.sin_port));
+	forget(self_data, &peer->dest_addr);
+	if (peer->connecting && peer->outbox.length > 0)
+	{
+		struct iovec iov[2];
+		int spans = byte_ring_spans(&peer->outbox, iov);
+		if (send_tcp_pdu_iov(&self_data->successor, iov, spans) < 0)
+			log_warn("Dropping %zu queued bytes", peer->outbox.length);
+	}
+	else if (peer->outbox.length > 0)
+		log_warn("Dropping %zu queued bytes", peer->outbox.length);
+	close_peer(self_data, peer);
+}
+
+/**
+ * @brief Closes a peer connection once what it has queued is written. The handler writes the queue
+ *        when the socket takes more and closes it, requests meanwhile open another connection.
+ */
+static void evict_peer(struct self_data *self_data, struct connection_point *peer)
+{
+	int i = peer - self_data->routing.peers;
+	if (peer->connecting)
+	{
+		peer_failed(self_data, peer); // its requests take the ring
+		return;
+	}
+	if (write_queued(peer) < 0 || peer->outbox.length == 0)
+	{
+		close_peer(self_data, peer);
+		return;
+	}
+	self_data->routing.peer_closing[i] = true;
+	reactor_want_write(&self_data->reactor, &peer->source);
+	timer_add(&self_data->timers, &self_data->routing.peer_timers[i], timer_now() + SEND_TIMEOUT);
+}
+
+/**
+ * @brief Timer of a peer connect, or of the writing of an evicted peer's queue, that takes too long.
+ */
+static void peer_timer_fired(struct self_data *self_data, struct timer *timer)
+{
+	struct connection_point *peer = timer->arg;
+	if (peer->connecting)
+	{
+		log_warn("Connection timed out.");
+		peer_failed(self_data, peer);
+	}
+	else if (self_data->routing.peer_closing[peer - self_data->routing.peers])
+	{
+		log_warn("Socket write timeout");
+		log_warn("Dropping %zu queued bytes", peer->outbox.length);
+		close_peer(self_data, peer);
+	}
+}
+
+/**
+ * @brief reactor_handler of the pooled peer connections. Completes the connect, writes the queue
+ *        when the socket is writable and gives the peer up once its connection is gone. An evicted
+ *        peer is closed once its queue is written. Nothing is sent back on them, received bytes are
+ *        dropped.
+ */
+static void handle_peer_event(struct self_data *self_data, struct reactor_source *source, uint32_t events)
+{
+	struct connection_point *peer = source->arg;
+	if (peer->connecting)
+	{
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (events & (EPOLLERR | EPOLLRDHUP))
+		{
+			peer_failed(self_data, peer);
+			return;
+		}
+		if (!(events & EPOLLOUT))
+			return;
+		if (getsockopt(peer->socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+		{
+			log_warn("Connect failed: %s", strerror(error ? error : errno));
+			peer_failed(self_data, peer);
+			return;
+		}
+		timer_cancel(&self_data->timers, &self_data->routing.peer_timers[peer - self_data->routing.peers]);
+		peer->connecting = false;
+		log_debug("\tConnected peer %s:%u", inet_ntoa(peer->dest_addr.sin_addr), ntohs(peer->dest_addr.sin_port));
+	}
+
+	if ((events & EPOLLOUT) && write_queued(peer) < 0)
+		events |= EPOLLERR;
+	if (events & EPOLLIN)
+		byte_ring_clear(&peer->inbox);
+	if (events & (EPOLLERR | EPOLLRDHUP))
+		peer_failed(self_data, peer);
+	else if (self_data->routing.peer_closing[peer - self_data->routing.peers] && peer->outbox.length == 0)
+		close_peer(self_data, peer);
+}
+
+/**
+ * @brief The pooled connection to a finger, opened if there is none. The least recently used
+ *        connection makes room for it once the pool is full.
+ *
+ * @return struct connection_point* The connection, NULL if it could not be opened.
+ */
+static struct connection_point *peer_for(struct self_data *self_data, const struct finger *finger)
+{
+	struct routing *routing = &self_data->routing;
+	int slot = -1;
+	for (int i = 0; i < PEER_POOL; i++)
+	{
+		struct connection_point *peer = &routing->peers[i];
+		if (routing->peer_closing[i])
+			continue; // still writing what it had queued
+		if (peer->socket > 0 && peer->dest_addr.sin_addr.s_addr == finger->address && peer->dest_addr.sin_port == finger->port)
+		{
+			routing->peer_used[i] = ++routing->uses;
+			return peer;
+		}
+		if (slot < 0 || (routing->peers[slot].socket > 0 && (peer->socket <= 0 || routing->peer_used[i] < routing->peer_used[slot])))
+			slot = i;
+	}
+	if (slot < 0)
+		return NULL; // every connection is being closed, the request takes the ring
+
+	struct connection_point *peer = &routing->peers[slot];
+	if (peer->socket > 0)
+	{
+		evict_peer(self_data, peer);
+		if (routing->peer_closing[slot])
+			return NULL; // the slot is free once the handler has written its queue
+	}
+
+	memset(&peer->dest_addr, 0, sizeof(peer->dest_addr));
+	peer->dest_addr.sin_family = AF_INET;
+	peer->dest_addr.sin_addr.s_addr = finger->address;
+	peer->dest_addr.sin_port = finger->port;
+	peer->socket = create_socket(AF_INET, SOCK_STREAM, 0, self_data);
+	if (set_nonblocking(peer->socket, self_data) < 0)
+		exit_with_error("Failed to set socket to non-blocking", self_data);
+	if (connect(peer->socket, (struct sockaddr *)&peer->dest_addr, sizeof(peer->dest_addr)) < 0 && errno != EINPROGRESS)
+	{
+		log_warn("Connect failed immediately: %s", strerror(errno));
+		close(peer->socket);
+		peer->socket = 0;
+		forget(self_data, &peer->dest_addr);
+		return NULL;
+	}
+
+	// requests are queued until the handler sees the connect complete
+	peer->connecting = true;
+	register_connection(self_data, peer);
+	reactor_want_write(&self_data->reactor, &peer->source);
+	timer_add(&self_data->timers, &routing->peer_timers[slot], timer_now() + CONNECT_TIMEOUT);
+	routing->peer_used[slot] = ++routing->uses;
+	return peer;
+}
+
+/**
+ * @brief The finger a request for a slot outside the own range goes to: the one holding the slot,
+ *        else the one whose range ends closest before it. Distances are counted successor-wise
+ *        from the end of the own range.
+ *
+ * @return const struct finger* NULL if the successor is as close as any finger.
+ */
+static const struct finger *closest_finger(const struct self_data *self_data, slot_t slot)
+{
+	const struct finger *best = NULL;
+	slot_t slot_distance = slot - self_data->range_end;
+	slot_t best_distance = 0;
+	for (int i = 0; i < FINGER_COUNT; i++)
+	{
+		const struct finger *finger = &self_data->routing.fingers[i];
+		bool successor = (slot_t)(finger->range_start - 1) == self_data->range_end;
+		if (finger->address == 0)
+			continue;
+		if (in_range(finger->range_start, finger->range_end, slot))
+			return successor ? NULL : finger; // the ring connection leads there already
+		if (successor)
+			continue;
+		slot_t distance = finger->range_end - self_data->range_end;
+		if (distance > best_distance && distance < slot_distance)
+		{
+			best = finger;
+			best_distance = distance;
+		}
+	}
+	return best;
+}
+
+int forward_request(struct self_data *self_data, slot_t slot, const void *pdu, size_t pdu_size)
+{
+	if (!self_data->config.ring_extensions)
+	{
+		log_debug("\tForwarding to successor for slot %u", slot);
+		return send_tcp_pdu(&self_data->successor, pdu, pdu_size); // classic ring, as received
+	}
+
+	struct routing *routing = &self_data->routing;
+	uint16_t hops = routing->hops + 1;
+	uint8_t header[NET_FORWARD_HEADER] = {NET_FORWARD, hops >> 8, hops & 0xff};
+	struct iovec iov[2] = {
+	    {.iov_base = header, .iov_len = sizeof(header)},
+	    {.iov_base = (void *)pdu, .iov_len = pdu_size},
+	};
+	if (hops >= routing->hop_limit)
+	{
+		log_warn("\tRequest for slot %u has been around the ring, dropped", slot);
+		return 0;
+	}
+
+	const struct slot_owner *owner = &routing->owners[slot];
+	if (routing->heading == ROUTE_ANY && owner->address != 0 && timer_now() - owner->seen < OWNER_TTL)
+	{
+		struct sockaddr_in dest = {.sin_family = AF_INET, .sin_port = owner->port, .sin_addr.s_addr = owner->address};
+		if (queue_udp_pdu_iov(self_data, dest, iov, 2, 0) == 0)
+		{
+			log_debug("\tForwarding straight to %s:%u for slot %u", inet_ntoa(dest.sin_addr), ntohs(dest.sin_port), slot);
+			return 0;
+		}
+	}
+
+	// slots left to cover either way, successor-wise from where the best finger ends
+	const struct finger *finger = closest_finger(self_data, slot);
+	slot_t ahead = slot - (finger ? finger->range_end : self_data->range_end);
+	slot_t behind = self_data->range_start - slot;
+	if (finger && in_range(finger->range_start, finger->range_end, slot))
+		ahead = 0;
+	if (routing->heading == ROUTE_BACKWARD || (routing->heading == ROUTE_ANY && behind < ahead && self_data->predecessor.socket > 0))
+	{
+		header[0] = NET_BACKWARD;
+		log_debug("\tForwarding to predecessor for slot %u", slot);
+		if (send_tcp_pdu_iov(&self_data->predecessor, iov, 2) < 0)
+			log_warn("\tRequest for slot %u dropped, no predecessor to pass it to", slot); // it must not turn around
+		return 0;
+	}
+
+	if (finger)
+	{
+		struct connection_point *peer = peer_for(self_data, finger);
+		if (peer && send_tcp_pdu_iov(peer, iov, 2) == 0)
+		{
+			log_debug("\tForwarding to finger %s:%u for slot %u", inet_ntoa(peer->dest_addr.sin_addr), ntohs(peer->dest_addr.sin_port), slot);
+			return 0;
+		}
+	}
+	log_debug("\tForwarding to successor for slot %u", slot);
+	return send_tcp_pdu_iov(&self_data->successor, iov, 2);
+}
+
+void handle_net_announce(struct NET_ANNOUNCE_PDU pdu, struct self_data *self_data)
+{
+	if (!self_data->config.ring_extensions)
+		return; // a node that uses them joined a classic ring, its map is not passed on
+	if (pdu.address == self_data->my_ip_addr.s_addr && pdu.port == self_data->routing.listening.dest_addr.sin_port)
+		return; // around the ring and back
+	struct finger node = {.address = pdu.address, .port = pdu.port, .range_start = ntohs(pdu.range_start), .range_end = ntohs(pdu.range_end)};
+	if (self_data->ring_state == RING_CONNECTED)
+		learn(self_data, &node);
+	learn_owner(self_data, &pdu, &node);
+	if (++pdu.hops >= self_data->routing.hop_limit)
+		return; // its origin has left the ring
+	if (self_data->successor.socket > 0 || self_data->successor.connecting)
+		send_tcp_pdu(&self_data->successor, &pdu, sizeof(pdu));
+}
+
+void routing_range_changed(struct self_data *self_data)
+{
+	if (!self_data->config.ring_extensions)
+		return;
+	struct finger known[FINGER_COUNT];
+	memcpy(known, self_data->routing.fingers, sizeof(known));
+	memset(self_data->routing.fingers, 0, sizeof(known));
+	for (int i = 0; i < FINGER_COUNT; i++)
+	{
+		if (known[i].address != 0)
+			learn(self_data, &known[i]);
+	}
+	self_data->routing.range_version = ++self_data->routing.map_version; // above the claims it replaces
+	announce(self_data);
+}
+
+void routing_start(struct self_data *self_data)
+{
+	if (!self_data->config.ring_extensions)
+		return; // the other nodes may not know NET_ANNOUNCE
+	self_data->routing.range_version = ++self_data->routing.map_version;
+	announce(self_data);
+	timer_add(&self_data->timers, &self_data->routing.announce_timer, timer_now() + ANNOUNCE_INTERVAL);
+}
+
+void routing_announce(struct self_data *self_data)
+{
+	if (self_data->config.ring_extensions)
+		announce(self_data);
+}
+
+void routing_seen_version(struct self_data *self_data, uint32_t version)
+{
+	if (version > self_data->routing.map_version)
+		self_data->routing.map_version = version;
+}
+
+void routing_stop(struct self_data *self_data)
+{
+	struct routing *routing = &self_data->routing;
+	timer_cancel(&self_data->timers, &routing->announce_timer);
+	if (self_data->config.ring_extensions)
+		send_announce(self_data, 1, 0, ++routing->map_version); // gives the range up, the neighbour's claim follows
+	memset(routing->fingers, 0, sizeof(routing->fingers));
+	memset(routing->nodes, 0, sizeof(routing->nodes));
+	update_hop_limit(routing);
+	for (int slot = 0; slot < RING_SLOTS; slot++)
+		routing->owners[slot].address = 0;
+	for (int i = 0; i < PEER_POOL; i++)
+	{
+		if (routing->peers[i].socket > 0 && !routing->peer_closing[i])
+			evict_peer(self_data, &routing->peers[i]);
+	}
+}
+
+void accept_peer_connections(struct self_data *self_data)
+{
+	struct routing *routing = &self_data->routing;
+	for (int i = 0; i < PEER_INBOUND; i++)
+	{
+		struct connection_point *connection = &routing->inbound[i];
+		if (connection->socket > 0)
+			continue;
+		int client_socket = reactor_accept(&self_data->reactor, routing->listening.socket, &connection->dest_addr, 0);
+		if (client_socket < 0)
+		{
+			if (errno != ETIMEDOUT && errno != EAGAIN && errno != EWOULDBLOCK)
+				log_warn("Accept failed: %s", strerror(errno));
+			return;
+		}
+		connection->socket = client_socket;
+		if (set_nonblocking(client_socket, self_data) < 0)
+			exit_with_error("Failed to set socket to non-blocking", self_data);
+		register_connection(self_data, connection);
+	}
+	// the rest wait in the backlog until a connection closes
+}
+
+void routing_init(struct self_data *self_data)
+{
+	struct routing *routing = &self_data->routing;
+	for (int i = 0; i < PEER_POOL; i++)
+	{
+		struct connection_point *peer = &routing->peers[i];
+		peer->source.fd = -1;
+		peer->source.handler = handle_peer_event;
+		peer->source.inbox = &peer->inbox;
+		peer->source.arg = peer;
+		peer->reactor = &self_data->reactor;
+		routing->peer_timers[i].fire = peer_timer_fired;
+		routing->peer_timers[i].arg = peer;
+	}
+	for (int i = 0; i < PEER_INBOUND; i++)
+	{
+		routing->inbound[i].source.fd = -1;
+		routing->inbound[i].source.inbox = &routing->inbound[i].inbox;
+		routing->inbound[i].source.arg = &routing->inbound[i];
+		routing->inbound[i].reactor = &self_data->reactor;
+	}
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	if (getsockname(self_data->udp_socket, (struct sockaddr *)&addr, &addr_len) < 0)
+		exit_with_error("Failed to retrieve socket name", self_data);
+	routing->udp_port = addr.sin_port;
+	routing->announce_timer.fire = announce_timer_fired;
+	update_hop_limit(routing);
+	routing->listening.source.fd = -1;
+	routing->listening.socket = create_listening_tcp_sock(self_data, &routing->listening, PEER_INBOUND);
+}
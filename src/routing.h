@@ -0,0 +1,85 @@
+#ifndef ROUTING_H
+#define ROUTING_H
+
+#include "util.h"
+
+#define ANNOUNCE_INTERVAL 5000		  // milliseconds between two NET_ANNOUNCE of the own range
+#define OWNER_TTL (3 * ANNOUNCE_INTERVAL) // milliseconds a slot owner is trusted without hearing from it
+#define MIN_HOP_LIMIT (2 * FINGER_COUNT)	  // hops a request or announce may take however few nodes are known
+
+/**
+ * @brief Sets up the slot owner map and the finger table and opens the peer listening socket, other
+ *        nodes send forwarded requests there. Called by setup_data().
+ * @param self_data Pointer to the self_data structure.
+ */
+void routing_init(struct self_data *self_data);
+
+/**
+ * @brief Announces the own range with a new version and keeps announcing it every ANNOUNCE_INTERVAL.
+ *        Without --ring-extensions nothing is announced and requests take the classic ring.
+ * @param self_data Pointer to the self_data structure.
+ */
+void routing_start(struct self_data *self_data);
+
+/**
+ * @brief Announces that the node gives its range up, stops announcing, forgets the map and closes
+ *        the peer connections. What they have queued is written by their handler first, within
+ *        SEND_TIMEOUT.
+ * @param self_data Pointer to the self_data structure.
+ */
+void routing_stop(struct self_data *self_data);
+
+/**
+ * @brief Announces the own range again right away, after the ring has changed around the node.
+ *        Does nothing without --ring-extensions.
+ * @param self_data Pointer to the self_data structure.
+ */
+void routing_announce(struct self_data *self_data);
+
+/**
+ * @brief Takes in the map version a neighbour had when it handed a range over, so the claim the node
+ *        announces for it is above the release of the node that held it before.
+ * @param self_data Pointer to the self_data structure.
+ * @param version The version from NET_WIDE_JOIN_RESPONSE or NET_WIDE_NEW_RANGE.
+ */
+void routing_seen_version(struct self_data *self_data, uint32_t version);
+
+/**
+ * @brief Places the fingers again for a new own range and announces it with a new version.
+ *        Does nothing without --ring-extensions.
+ * @param self_data Pointer to the self_data structure.
+ */
+void routing_range_changed(struct self_data *self_data);
+
+/**
+ * @brief Handles a NET_ANNOUNCE from the predecessor: learns the slot owners and fingers it
+ *        describes and passes it on to the successor, unless it is back at its origin.
+ * @param pdu The NET_ANNOUNCE_PDU structure.
+ * @param self_data Pointer to the self_data structure.
+ */
+void handle_net_announce(struct NET_ANNOUNCE_PDU pdu, struct self_data *self_data);
+
+/**
+ * @brief Forwards a request for a slot outside the own range, in a NET_FORWARD or NET_BACKWARD
+ *        that counts its hops. A request from a client goes by UDP straight to the owner if the map
+ *        knows one. Otherwise it goes the way that leaves fewer slots to cover: to the predecessor,
+ *        or to the finger closest before the slot, or to the successor if no finger gets it
+ *        further. A request another node passed on keeps its direction. A finger whose connection
+ *        is gone is forgotten and the request takes the successor. Without --ring-extensions the
+ *        request goes to the successor as received, like every node of a classic ring does.
+ * @param self_data Pointer to the self_data structure.
+ * @param slot The ring slot of the key.
+ * @param pdu The PDU as received.
+ * @param pdu_size Size of the PDU.
+ * @return int 0 on success, -1 if it could not be sent.
+ */
+int forward_request(struct self_data *self_data, slot_t slot, const void *pdu, size_t pdu_size);
+
+/**
+ * @brief Accepts the connections waiting on the peer listening socket while an inbound entry is
+ *        free. Their handler is set by the caller.
+ * @param self_data Pointer to the self_data structure.
+ */
+void accept_peer_connections(struct self_data *self_data);
+
+#endif // ROUTING_H
@@ -0,0 +1,189 @@
+#include "slab.h"
+#include <stdlib.h>
+
+static const uint16_t class_sizes[SLAB_CLASSES] = {32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 448, SLAB_MAX_OBJECT};
+
+struct slab
+{
+	struct slab_arena *arena;
+	struct slab *next; // list of all slabs in the arena
+	struct slab *prev;
+	struct slab *available_next; // list of slabs of this class with free objects
+	struct slab *available_prev;
+	void *free_list;	     // objects returned by slab_free()
+	uint32_t object_size;
+	uint32_t capacity;
+	uint32_t live;
+	uint32_t bump; // objects never handed out start at this index
+	uint8_t size_class;
+	bool is_available;
+};
+
+// objects start after the header, rounded up so they stay 16-byte aligned
+#define SLAB_HEADER_SIZE ((sizeof(struct slab) + 15) & ~(size_t)15)
+
+static int size_class_of(size_t size)
+{
+	for (int i = 0; i < SLAB_CLASSES; i++)
+	{
+		if (size <= class_sizes[i])
+			return i;
+	}
+	return -1;
+}
+
+static struct slab *slab_of(void *object)
+{
+	return (struct slab *)((uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static const struct slab *const_slab_of(const void *object)
+{
+	return (const struct slab *)((uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static void make_available(struct slab *slab)
+{
+	struct slab **head = &slab->arena->available[slab->size_class];
+
+	slab->available_prev = NULL;
+	slab->available_next = *head;
+	if (*head)
+		(*head)->available_prev = slab;
+	*head = slab;
+	slab->is_available = true;
+}
+
+static void make_unavailable(struct slab *slab)
+{
+	if (slab->available_prev)
+		slab->available_prev->available_next = slab->available_next;
+	else
+		slab->arena->available[slab->size_class] = slab->available_next;
+	if (slab->available_next)
+		slab->available_next->available_prev = slab->available_prev;
+	slab->is_available = false;
+}
+
+static struct slab *new_slab(struct slab_arena *arena, int size_class)
+{
+	struct slab *slab = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+	if (!slab)
+		return NULL;
+
+	slab->arena = arena;
+	slab->free_list = NULL;
+	slab->object_size = class_sizes[size_class];
+	slab->capacity = (SLAB_SIZE - SLAB_HEADER_SIZE) / slab->object_size;
+	slab->live = 0;
+	slab->bump = 0;
+	slab->size_class = size_class;
+
+	slab->prev = NULL;
+	slab->next = arena->slabs;
+	if (arena->slabs)
+		arena->slabs->prev = slab;
+	arena->slabs = slab;
+	arena->slab_count++;
+
+	make_available(slab);
+	return slab;
+}
+
+void slab_arena_init(struct slab_arena *arena)
+{
+	arena->slabs = NULL;
+	for (int i = 0; i < SLAB_CLASSES; i++)
+		arena->available[i] = NULL;
+	arena->slab_count = 0;
+	arena->live_objects = 0;
+	arena->live_bytes = 0;
+}
+
+void *slab_alloc(struct slab_arena *arena, size_t size)
+{
+	int size_class = size_class_of(size);
+	if (size_class < 0)
+		return NULL;
+
+	struct slab *slab = arena->available[size_class];
+	if (!slab)
+	{
+		slab = new_slab(arena, size_class);
+		if (!slab)
+			return NULL;
+	}
+
+	void *object;
+	if (slab->free_list)
+	{
+		object = slab->free_list;
+		slab->free_list = *(void **)object;
+	}
+	else
+	{
+		object = (uint8_t *)slab + SLAB_HEADER_SIZE + (size_t)slab->bump * slab->object_size;
+		slab->bump++;
+	}
+
+	slab->live++;
+	arena->live_objects++;
+	arena->live_bytes += slab->object_size;
+	if (!slab->free_list && slab->bump == slab->capacity)
+		make_unavailable(slab);
+
+	return object;
+}
+
+void slab_free(void *object)
+{
+	if (!object)
+		return;
+
+	struct slab *slab = slab_of(object);
+	struct slab_arena *arena = slab->arena;
+
+	*(void **)object = slab->free_list;
+	slab->free_list = object;
+	slab->live--;
+	arena->live_objects--;
+	arena->live_bytes -= slab->object_size;
+	if (!slab->is_available)
+		make_available(slab);
+
+	// an empty slab is given back unless it is the last one with room in its class
+	if (slab->live == 0 && (slab->available_next || slab->available_prev))
+	{
+		make_unavailable(slab);
+		if (slab->prev)
+			slab->prev->next = slab->next;
+		else
+			arena->slabs = slab->next;
+		if (slab->next)
+			slab->next->prev = slab->prev;
+		arena->slab_count--;
+		free(slab);
+	}
+}
+
+size_t slab_object_size(const void *object)
+{
+	return const_slab_of(object)->object_size;
+}
+
+void slab_arena_release(struct slab_arena *arena)
+{
+	struct slab *slab = arena->slabs;
+	while (slab)
+	{
+		struct slab *next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	slab_arena_init(arena);
+}
+
+size_t slab_arena_bytes(const struct slab_arena *arena)
+{
+	return arena->slab_count * SLAB_SIZE;
+}
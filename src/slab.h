@@ -0,0 +1,77 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SLAB_SIZE (16 * 1024) // slabs are aligned to their size so an object finds its slab by masking
+#define SLAB_CLASSES 13
+#define SLAB_MAX_OBJECT 544
+
+struct slab;
+
+/**
+ * @brief A set of slabs that is released as one unit.
+ *
+ * Objects are grouped in size classes, each slab only holds objects of one class.
+ * The node keeps one arena per hash slot so a slot that is handed over to another
+ * node is freed slab by slab instead of object by object.
+ */
+struct slab_arena
+{
+	struct slab *slabs;		       // every slab owned by the arena
+	struct slab *available[SLAB_CLASSES]; // slabs with at least one free object, per class
+	size_t slab_count;
+	size_t live_objects;
+	size_t live_bytes; // size class bytes of the live objects
+};
+
+/**
+ * @brief Initializes an empty arena, no memory is allocated until the first slab_alloc().
+ *
+ * @param arena The arena to initialize.
+ */
+void slab_arena_init(struct slab_arena *arena);
+
+/**
+ * @brief Allocates an object of at least size bytes from the arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param size Object size, at most SLAB_MAX_OBJECT.
+ * @return void* The object, or NULL if size is too large or memory ran out.
+ */
+void *slab_alloc(struct slab_arena *arena, size_t size);
+
+/**
+ * @brief Returns an object to the slab it came from. A slab that becomes empty is freed.
+ *
+ * @param object Object returned by slab_alloc(), NULL is ignored.
+ */
+void slab_free(void *object);
+
+/**
+ * @brief Size of the class an object was allocated from, the bytes it really occupies.
+ *
+ * @param object Object returned by slab_alloc().
+ */
+size_t slab_object_size(const void *object);
+
+/**
+ * @brief Frees every slab of the arena at once, all objects allocated from it become invalid.
+ *
+ * The arena is left empty and can be used again.
+ *
+ * @param arena The arena to release.
+ */
+void slab_arena_release(struct slab_arena *arena);
+
+/**
+ * @brief Number of bytes the arena holds in slabs.
+ *
+ * @param arena The arena.
+ * @return size_t slab_count * SLAB_SIZE.
+ */
+size_t slab_arena_bytes(const struct slab_arena *arena);
+
+#endif // SLAB_H
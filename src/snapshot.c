@@ -0,0 +1,206 @@
+#include "snapshot.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RECORD_HEADER_SIZE (SSN_KEY_BYTES + 2)
+
+/**
+ * @brief Writes path followed by suffix without snprintf(), which is not async-signal-safe.
+ *
+ * @return int 0 on success, -1 if it does not fit.
+ */
+static int copy_path(char *dst, size_t size, const char *path, const char *suffix)
+{
+	size_t path_length = strlen(path), suffix_length = strlen(suffix);
+	if (path_length + suffix_length >= size)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(dst, path, path_length);
+	memcpy(dst + path_length, suffix, suffix_length + 1);
+	return 0;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(fd, data, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		data += n;
+		length -= n;
+	}
+	return 0;
+}
+
+static int flush_buffer(struct snapshot_writer *writer)
+{
+	if (write_all(writer->fd, writer->buffer, writer->buffered) < 0)
+		return -1;
+	writer->buffered = 0;
+	return 0;
+}
+
+static int append(struct snapshot_writer *writer, const void *data, size_t length)
+{
+	if (writer->buffered + length > SNAPSHOT_BUFFER_SIZE && flush_buffer(writer) < 0)
+		return -1;
+	memcpy(writer->buffer + writer->buffered, data, length);
+	writer->buffered += length;
+	writer->offset += length;
+	return 0;
+}
+
+int snapshot_writer_open(struct snapshot_writer *writer, const char *path, uint8_t *buffer)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->fd = -1;
+	writer->buffer = buffer;
+	if (copy_path(writer->path, sizeof(writer->path), path, "") < 0 ||
+	    copy_path(writer->tmp_path, sizeof(writer->tmp_path), path, ".tmp") < 0)
+		return -1;
+
+	writer->fd = open(writer->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (writer->fd < 0)
+		return -1;
+
+	memcpy(writer->header.magic, SNAPSHOT_MAGIC, sizeof(writer->header.magic));
+	return append(writer, &writer->header, sizeof(writer->header)); // placeholder, rewritten on close
+}
+
+void snapshot_writer_begin_slot(struct snapshot_writer *writer, hash_t slot)
+{
+	while (writer->next_slot <= slot)
+		writer->header.slot_offsets[writer->next_slot++] = writer->offset;
+}
+
+int snapshot_writer_add(struct snapshot_writer *writer, ssn_key_t key, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
+{
+	uint8_t header[RECORD_HEADER_SIZE];
+	ssn_key_store(header, key);
+	header[SSN_KEY_BYTES] = name_length;
+	header[SSN_KEY_BYTES + 1] = email_length;
+
+	if (append(writer, header, sizeof(header)) < 0 ||
+	    append(writer, name, name_length) < 0 ||
+	    append(writer, email, email_length) < 0)
+		return -1;
+
+	writer->header.entries++;
+	return 0;
+}
+
+int snapshot_writer_close(struct snapshot_writer *writer, uint64_t wal_sequence, uint8_t range_start, uint8_t range_end)
+{
+	while (writer->next_slot <= HT_SLOTS)
+		writer->header.slot_offsets[writer->next_slot++] = writer->offset;
+
+	writer->header.wal_sequence = wal_sequence;
+	writer->header.range_start = range_start;
+	writer->header.range_end = range_end;
+	writer->header.partitioning = ht_get_partitioning();
+
+	if (flush_buffer(writer) < 0 ||
+	    lseek(writer->fd, 0, SEEK_SET) != 0 ||
+	    write_all(writer->fd, (const uint8_t *)&writer->header, sizeof(writer->header)) < 0 ||
+	    fsync(writer->fd) != 0)
+	{
+		snapshot_writer_abort(writer);
+		return -1;
+	}
+	close(writer->fd);
+	writer->fd = -1;
+
+	if (rename(writer->tmp_path, writer->path) != 0)
+	{
+		snapshot_writer_abort(writer);
+		return -1;
+	}
+	return 0;
+}
+
+void snapshot_writer_abort(struct snapshot_writer *writer)
+{
+	int saved_errno = errno;
+	if (writer->fd >= 0)
+		close(writer->fd);
+	writer->fd = -1;
+	unlink(writer->tmp_path);
+	errno = saved_errno;
+}
+
+int snapshot_open(struct snapshot *snapshot, const char *path)
+{
+	memset(snapshot, 0, sizeof(*snapshot));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct snapshot_header))
+	{
+		close(fd);
+		return -1;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	const struct snapshot_header *header = map;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->slot_offsets[HT_SLOTS] != (uint64_t)st.st_size)
+	{
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	snapshot->map = map;
+	snapshot->size = st.st_size;
+	snapshot->header = header;
+	return 0;
+}
+
+int snapshot_foreach_in_slot(const struct snapshot *snapshot, hash_t slot, snapshot_visit_function visit, void *arg)
+{
+	uint64_t offset = snapshot->header->slot_offsets[slot];
+	uint64_t end = snapshot->header->slot_offsets[slot + 1];
+	if (offset < sizeof(struct snapshot_header) || end < offset || end > snapshot->size)
+		return -1;
+
+	while (offset < end)
+	{
+		const uint8_t *record = snapshot->map + offset;
+		if (offset + RECORD_HEADER_SIZE > end)
+			return -1;
+
+		uint8_t name_length = record[SSN_KEY_BYTES];
+		uint8_t email_length = record[SSN_KEY_BYTES + 1];
+		if (offset + RECORD_HEADER_SIZE + name_length + email_length > end)
+			return -1;
+
+		const uint8_t *name = record + RECORD_HEADER_SIZE;
+		visit(ssn_key_load(record), name_length, email_length, name, name + name_length, arg);
+		offset += RECORD_HEADER_SIZE + name_length + email_length;
+	}
+	return 0;
+}
+
+void snapshot_close(struct snapshot *snapshot)
+{
+	if (snapshot->map)
+		munmap(snapshot->map, snapshot->size);
+	memset(snapshot, 0, sizeof(*snapshot));
+}
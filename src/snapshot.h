@@ -0,0 +1,117 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "hashtable.h"
+
+#define SNAPSHOT_MAGIC "DHTSNAP1"
+#define SNAPSHOT_FILE "snapshot"
+#define SNAPSHOT_BUFFER_SIZE (1 << 20) // records gathered before a write
+
+/**
+ * @brief On-disk header of a snapshot file.
+ *
+ * The header is followed by the records of hash slot 0, then slot 1 and so on, so the
+ * entries of one slot are one contiguous byte range. A record is the 5 byte packed key,
+ * name length, email length, name and email. All integers are little endian.
+ */
+struct snapshot_header
+{
+	char magic[8];
+	uint64_t wal_sequence; // log segments up to and including this one are contained in the snapshot
+	uint64_t entries;
+	uint8_t range_start; // first hash slot of the node's range when the snapshot was taken, not a ring slot
+	uint8_t range_end;   // last hash slot of that range
+	uint8_t partitioning; // enum ht_partitioning the slots were computed with
+	uint8_t reserved[5];
+	uint64_t slot_offsets[HT_SLOTS + 1]; // file offset of each slot's records, the last one is the file size
+};
+
+/**
+ * @brief Writes a snapshot to <path>.tmp and renames it into place when closed, so a crash
+ *        never leaves a half written snapshot behind.
+ *
+ * Only system calls are used and nothing is allocated, so a writer can run in the forked child
+ * of a multithreaded process, where stdio and malloc may wait for a lock held by another thread.
+ */
+struct snapshot_writer
+{
+	int fd;
+	uint8_t *buffer; // SNAPSHOT_BUFFER_SIZE bytes given by the caller
+	size_t buffered;
+	uint64_t offset; // file offset of the next record
+	char path[512];
+	char tmp_path[512];
+	int next_slot; // slots are written in ascending order
+	struct snapshot_header header;
+};
+
+/**
+ * @brief A snapshot mapped into memory.
+ */
+struct snapshot
+{
+	uint8_t *map;
+	size_t size;
+	const struct snapshot_header *header;
+};
+
+typedef void (*snapshot_visit_function)(ssn_key_t key, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email, void *arg);
+
+/**
+ * @brief Creates the temporary file and reserves room for the header.
+ *
+ * @param buffer SNAPSHOT_BUFFER_SIZE bytes for the writer to gather records in, allocated before
+ *               a fork() the writer runs after.
+ * @return int 0 on success, -1 on failure.
+ */
+int snapshot_writer_open(struct snapshot_writer *writer, const char *path, uint8_t *buffer);
+
+/**
+ * @brief Starts the records of a slot. Slots must be started in ascending order, slots that
+ *        are skipped are recorded as empty.
+ */
+void snapshot_writer_begin_slot(struct snapshot_writer *writer, hash_t slot);
+
+/**
+ * @brief Appends a record to the current slot.
+ *
+ * @return int 0 on success, -1 on write failure.
+ */
+int snapshot_writer_add(struct snapshot_writer *writer, ssn_key_t key, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email);
+
+/**
+ * @brief Fills in the header, syncs the file and renames it to its final path. range_start and
+ *        range_end are the first and last hash slot of the node's range, see HASH_SLOT_OF().
+ *
+ * @return int 0 on success, -1 on failure in which case the temporary file is removed.
+ */
+int snapshot_writer_close(struct snapshot_writer *writer, uint64_t wal_sequence, uint8_t range_start, uint8_t range_end);
+
+/**
+ * @brief Closes and removes the temporary file of a snapshot that is given up. errno is kept.
+ */
+void snapshot_writer_abort(struct snapshot_writer *writer);
+
+/**
+ * @brief Maps a snapshot read-only and validates its header.
+ *
+ * @return int 0 on success, -1 if the file is missing or invalid.
+ */
+int snapshot_open(struct snapshot *snapshot, const char *path);
+
+/**
+ * @brief Calls visit for every record of a slot.
+ *
+ * @return int 0 on success, -1 if the slot's records are truncated.
+ */
+int snapshot_foreach_in_slot(const struct snapshot *snapshot, hash_t slot, snapshot_visit_function visit, void *arg);
+
+/**
+ * @brief Unmaps a snapshot.
+ */
+void snapshot_close(struct snapshot *snapshot);
+
+#endif // SNAPSHOT_H
@@ -1,4 +1,3 @@
-
 #include "sockets.h"
 
 int send_udp_pdu(int socket, struct sockaddr_in dest, const void *pdu, size_t pdu_size)
@@ -8,7 +7,7 @@ int send_udp_pdu(int socket, struct sockaddr_in dest, const void *pdu, size_t pd
 				    (struct sockaddr *)&dest, sizeof(dest));
 	if (bytes_sent < 0)
 	{
-		perror("Failed to send PDU");
+		log_warn("Failed to send PDU: %s", strerror(errno));
 		return -1;
 	}
 
@@ -17,122 +16,329 @@ int send_udp_pdu(int socket, struct sockaddr_in dest, const void *pdu, size_t pd
 	return 0;
 }
 
-int send_tcp_pdu(int sockfd, const void *pdu, size_t pdu_size)
+int queue_udp_pdu(struct self_data *self_data, struct sockaddr_in dest, const void *pdu, size_t pdu_size)
 {
-	struct pollfd fd;
-	fd.fd = sockfd;
-	fd.events = POLLOUT;
+	struct iovec iov = {.iov_base = (void *)pdu, .iov_len = pdu_size};
+	return queue_udp_pdu_iov(self_data, dest, &iov, 1, 0);
+}
 
-	int ret = poll(&fd, 1, 5000); // poll
-	if (ret <= 0)
+int queue_udp_pdu_iov(struct self_data *self_data, struct sockaddr_in dest, const struct iovec *iov, int iovcnt, unsigned stored)
+{
+	struct udp_batch *batch = &self_data->udp_out;
+	size_t pdu_size = 0;
+	for (int i = 0; i < iovcnt; i++)
+		pdu_size += iov[i].iov_len;
+	if (pdu_size > UDP_DATAGRAM_MAX || iovcnt > UDP_PDU_PIECES)
 	{
-		if (ret == 0)
-			fprintf(stderr, "Socket write timeout\n");
-		else
-			perror("Poll failed");
+		log_warn("Failed to send PDU: %zu bytes do not fit a datagram", pdu_size);
 		return -1;
 	}
+	if (batch->count == UDP_BATCH && flush_udp_batch(self_data) < 0)
+		return -1;
 
-	if (!(fd.revents & POLLOUT))
+	// stored pieces are sent from where they are, the rest is copied behind each other
+	uint8_t *copy = batch->data[batch->count];
+	struct iovec *pieces = batch->iov[batch->count];
+	for (int i = 0; i < iovcnt; i++)
 	{
-		fprintf(stderr, "Socket not ready for writing\n");
-		return -1;
+		pieces[i] = iov[i];
+		if (stored & (1u << i))
+			continue;
+		memcpy(copy, iov[i].iov_base, iov[i].iov_len);
+		pieces[i].iov_base = copy;
+		copy += iov[i].iov_len;
 	}
+	batch->pieces[batch->count] = iovcnt;
+	batch->addrs[batch->count] = dest;
+	batch->count++;
+	if (stored)
+		batch->views++;
+	return 0;
+}
 
-	ssize_t bytes_sent = send(sockfd, pdu, pdu_size, 0);
-	if (bytes_sent < 0)
+void flush_udp_views(struct self_data *self_data)
+{
+	if (self_data->udp_out.views > 0)
+		flush_udp_batch(self_data);
+}
+
+/**
+ * @brief Describes what is queued on a connection as one message.
+ */
+static void queued_message(struct connection_point *connection, struct reactor_send *send, struct msghdr *msg, struct iovec iov[2])
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_iov = iov;
+	msg->msg_iovlen = byte_ring_spans(&connection->outbox, iov);
+	send->fd = connection->socket;
+	send->msg = msg;
+}
+
+/**
+ * @brief Takes what a send wrote off the queue of a connection.
+ * @return int 1 if the socket took what it was given, 0 if it is full, -1 if the connection is broken and the queue was dropped.
+ */
+static int settle_queue(struct connection_point *connection, ssize_t result)
+{
+	if (result >= 0)
 	{
-		if (errno == EPIPE)
-		{
-			fprintf(stderr, "Connection broken (EPIPE)\n");
-		}
-		else
-		{
-			perror("Failed to send PDU");
-		}
-		return -1; // Error in sending PDU
+		byte_ring_consume(&connection->outbox, result);
+		return 1;
 	}
-
-	if (bytes_sent != pdu_size)
+	if (result == -EINTR)
+		return 1;
+	if (result == -EAGAIN || result == -EWOULDBLOCK || result == -ECANCELED)
 	{
-		fprintf(stderr, "Warning: Not all bytes were sent. Sent %ld out of %zu bytes\n", bytes_sent, pdu_size);
+		// the rest goes when the socket is writable again
+		reactor_want_write(connection->reactor, &connection->source);
+		return 0;
 	}
-	return 0;
+	if (result == -EPIPE)
+		log_warn("Connection broken (EPIPE)");
+	else
+		log_warn("Failed to send PDU: %s", strerror(-result));
+	log_warn("Dropping %zu queued bytes", connection->outbox.length);
+	byte_ring_clear(&connection->outbox);
+	return -1;
 }
 
-int receive_from(struct pollfd *fds, int fd, int sockfd, void *pdu, size_t pdu_size)
+/**
+ * @brief Sends the queued datagrams from first on in one reactor_send() call, together with what is
+ *        queued on the ring and peer connections if asked to.
+ * @param self_data Pointer to the self_data structure.
+ * @param first Index of the first datagram to send.
+ * @param connections Whether to write the connection queues as well.
+ * @return int Index of the first datagram that still has to be sent, the batch count once all are
+ *             done, -1 if the rest had to be dropped.
+ */
+static int send_queued(struct self_data *self_data, int first, bool connections)
 {
-	int poll_response = poll(fds, 1, 10000);
-	if (poll_response <= 0)
+	struct udp_batch *batch = &self_data->udp_out;
+	struct connection_point *queues[2 + PEER_POOL] = {&self_data->successor, &self_data->predecessor};
+	struct reactor_send sends[UDP_BATCH + 2 + PEER_POOL];
+	struct msghdr msgs[UDP_BATCH + 2 + PEER_POOL];
+	struct iovec queue_iov[2 + PEER_POOL][2];
+	int queue_count = 0;
+
+	for (int i = 0; i < PEER_POOL; i++)
+		queues[2 + i] = &self_data->routing.peers[i];
+	for (int i = 0; connections && i < 2 + PEER_POOL; i++)
 	{
-		perror("poll timeout or fail");
-		exit(1);
+		// a peer still connecting writes its queue once the handler sees it connected
+		if (queues[i]->socket <= 0 || queues[i]->outbox.length == 0 || (i >= 2 && queues[i]->connecting))
+			continue;
+		queued_message(queues[i], &sends[queue_count], &msgs[queue_count], queue_iov[queue_count]);
+		queues[queue_count++] = queues[i];
 	}
-	if (fds[fd].revents & POLLIN)
+
+	int count = queue_count;
+	for (int i = first; i < batch->count; i++, count++)
 	{
-		struct sockaddr_in src_addr;
-		socklen_t addr_len = sizeof(src_addr);
-		ssize_t bytes_received = recvfrom(sockfd, pdu, pdu_size, 0, (struct sockaddr *)&src_addr, &addr_len);
-		if (bytes_received < 0)
-		{
-			printf("Failed to receive PDU\n");
-			return -1;
-		}
-		if (bytes_received < pdu_size)
-		{
-			fprintf(stderr, "Warning: Received fewer bytes than expected. Received %ld out of %zu bytes\n", bytes_received, pdu_size);
-		}
-		return 0;
+		memset(&msgs[count], 0, sizeof(msgs[count]));
+		msgs[count].msg_name = &batch->addrs[i];
+		msgs[count].msg_namelen = sizeof(batch->addrs[i]);
+		msgs[count].msg_iov = batch->iov[i];
+		msgs[count].msg_iovlen = batch->pieces[i];
+		sends[count].fd = self_data->udp_socket;
+		sends[count].msg = &msgs[count];
 	}
-	else
+	if (count == 0)
+		return batch->count;
+	reactor_send(&self_data->reactor, sends, count);
+
+	for (int i = 0; i < queue_count; i++)
+		settle_queue(queues[i], sends[i].result);
+	for (int i = queue_count; i < count; i++)
 	{
+		ssize_t result = sends[i].result;
+		if (result >= 0 || result == -ECONNREFUSED || result == -EHOSTUNREACH || result == -ENETUNREACH)
+			continue; // sent, or that client is gone and the others still get theirs
+		int unsent = first + i - queue_count;
+		if (result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR || result == -ECANCELED)
+			return unsent;
+		log_warn("Failed to send PDU: %s", strerror(-result));
+		log_warn("Dropping %d queued datagrams", batch->count - unsent);
 		return -1;
 	}
+	return batch->count;
 }
 
-void receive_tcp_data(struct self_data *my_data, char *node_to_receive, char *buffer, size_t buffer_size)
+/**
+ * @brief Sends the whole UDP batch, waiting for the socket if its buffer is full.
+ */
+static int flush_batch(struct self_data *self_data, bool connections)
 {
+	struct udp_batch *batch = &self_data->udp_out;
+	int first = 0;
+	for (;;)
+	{
+		first = send_queued(self_data, first, connections);
+		connections = false; // what the connections did not take waits for them to be writable
+		if (first < 0 || first == batch->count)
+			break;
+
+		// the socket buffer is full, clients are slower than the answers
+		struct pollfd fd = {.fd = self_data->udp_socket, .events = POLLOUT};
+		int ret = poll(&fd, 1, DATAGRAM_SEND_TIMEOUT);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+		{
+			log_warn("Socket write timeout, dropping %d queued datagrams", batch->count - first);
+			first = -1;
+			break;
+		}
+	}
+	batch->count = 0;
+	batch->views = 0;
+	return first < 0 ? -1 : 0;
+}
 
-	int socket_fd = 0; // Choose the correct socket based on the node to receive data from
-	if (strcmp(node_to_receive, "predecessor") == 0)
+int flush_udp_batch(struct self_data *self_data)
+{
+	return flush_batch(self_data, false);
+}
+
+void flush_output(struct self_data *self_data)
+{
+	flush_batch(self_data, true);
+}
+
+int send_tcp_pdu(struct connection_point *connection, const void *pdu, size_t pdu_size)
+{
+	struct iovec iov = {.iov_base = (void *)pdu, .iov_len = pdu_size};
+	return send_tcp_pdu_iov(connection, &iov, 1);
+}
+
+int send_tcp_pdu_iov(struct connection_point *connection, const struct iovec *iov, int iovcnt)
+{
+	if (connection->socket <= 0 && !connection->connecting)
 	{
-		socket_fd = my_data->predecessor.socket;
+		log_warn("Failed to send PDU: not connected");
+		return -1;
 	}
-	else if (strcmp(node_to_receive, "successor") == 0)
+
+	for (int i = 0; i < iovcnt; i++)
+		byte_ring_append(&connection->outbox, iov[i].iov_base, iov[i].iov_len);
+	if (connection->outbox.length > SEND_QUEUE_HIGH)
+		return flush_connection(connection, SEND_QUEUE_LOW); // backpressure, the peer reads slower than we queue
+	return 0;
+}
+
+int write_queued(struct connection_point *connection)
+{
+	while (connection->outbox.length > 0)
 	{
-		socket_fd = my_data->successor.socket;
+		struct reactor_send send;
+		struct msghdr msg;
+		struct iovec iov[2];
+		queued_message(connection, &send, &msg, iov);
+		reactor_send(connection->reactor, &send, 1);
+
+		int ret = settle_queue(connection, send.result);
+		if (ret <= 0)
+			return ret;
 	}
-	else
+	return 0;
+}
+
+int flush_connection(struct connection_point *connection, size_t target)
+{
+	if (connection->socket <= 0)
+		return 0; // between two attempts to connect, the queue waits for the next one
+	while (connection->outbox.length > target)
 	{
-		exit_with_error("Incorrect node specified for receiving data", my_data);
+		if (write_queued(connection) < 0)
+			return -1;
+		if (connection->outbox.length <= target)
+			break;
+
+		struct pollfd fd;
+		fd.fd = connection->socket;
+		fd.events = POLLOUT;
+
+		int ret = poll(&fd, 1, SEND_TIMEOUT); // wait for the peer to read
+		if (ret <= 0)
+		{
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret == 0)
+				log_warn("Socket write timeout");
+			else
+				log_warn("Poll failed: %s", strerror(errno));
+			return -1;
+		}
 	}
+	return 0;
+}
 
-	// Set up pollfd structure to monitor the socket for readability
-	struct pollfd fds[1];
-	fds[0].fd = socket_fd;
-	fds[0].events = POLLIN; // We want to check for incoming data
+void flush_all_connections(struct self_data *self_data)
+{
+	if (self_data->successor.socket > 0)
+		flush_connection(&self_data->successor, 0);
+	if (self_data->predecessor.socket > 0)
+		flush_connection(&self_data->predecessor, 0);
+}
 
-	int timeout = 5000;
+size_t send_queue_depth(const struct connection_point *connection)
+{
+	return connection->outbox.length;
+}
+
+void close_connection(struct self_data *self_data, struct connection_point *connection)
+{
+	if (connection->connecting)
+		timer_cancel(&self_data->timers, &self_data->connect_timer);
+	else if (connection->socket <= 0)
+		return;
+	if (connection->socket > 0)
+	{
+		reactor_remove(&self_data->reactor, &connection->source);
+		close(connection->socket);
+	}
+	connection->socket = 0;
+	connection->connecting = false;
+	byte_ring_clear(&connection->inbox);
+	byte_ring_clear(&connection->outbox);
+}
+
+void register_connection(struct self_data *self_data, struct connection_point *connection)
+{
+	if (reactor_add(&self_data->reactor, &connection->source, connection->socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP) < 0)
+		exit_with_error("Failed to register connection", self_data);
+}
 
-	if (poll(fds, 1, timeout) <= 0) // Poll the socket to see if data is available to read
-		exit_with_error("Failed to received data", my_data);
+int receive_from(int sockfd, void *pdu, size_t pdu_size)
+{
+	struct pollfd fds[1];
+	fds[0].fd = sockfd;
+	fds[0].events = POLLIN;
 
-	// If the socket is ready for reading, read the data
+	int poll_response = poll(fds, 1, TRACKER_TIMEOUT);
+	if (poll_response <= 0)
+	{
+		log_warn("poll timeout or fail: %s", strerror(errno));
+		exit(1);
+	}
 	if (fds[0].revents & POLLIN)
 	{
-		ssize_t bytes_received = recv(socket_fd, buffer, buffer_size, 0);
-
+		struct sockaddr_in src_addr;
+		socklen_t addr_len = sizeof(src_addr);
+		ssize_t bytes_received = recvfrom(sockfd, pdu, pdu_size, 0, (struct sockaddr *)&src_addr, &addr_len);
 		if (bytes_received < 0)
 		{
-			perror("Receive failed");
-			exit_with_error("Failed to receive data", my_data);
+			log_warn("Failed to receive PDU");
+			return -1;
 		}
-		else if (bytes_received == 0)
+		if (bytes_received < pdu_size)
 		{
-			// Connection closed by the peer
-			printf("Connection closed by %s\n", node_to_receive);
-			return;
+			log_warn("Warning: Received fewer bytes than expected. Received %ld out of %zu bytes", bytes_received, pdu_size);
 		}
+		return 0;
+	}
+	else
+	{
+		return -1;
 	}
 }
 
@@ -176,10 +382,10 @@ int create_udp_sock(struct self_data *self_data)
 	if (set_nonblocking(socket, self_data) < 0)
 		exit_with_error("Failed to set socket to non-blocking", self_data);
 
-	printf("\tListening on UDP on port %d\n", ntohs(addr.sin_port));
+	log_info("\tListening on UDP on port %d", ntohs(addr.sin_port));
 	return socket;
 }
-int create_listening_tcp_sock(struct self_data *self_data)
+int create_listening_tcp_sock(struct self_data *self_data, struct connection_point *listening, int backlog)
 {
 	int socket;
 	struct sockaddr_in addr;
@@ -205,137 +411,163 @@ int create_listening_tcp_sock(struct self_data *self_data)
 		exit_with_error("Failed to retrieve socket name", self_data);
 	}
 
-	printf("\tListening on TCP port %d\n", ntohs(addr.sin_port));
-	if (listen(socket, 1) < 0)
+	log_info("\tListening on TCP port %d", ntohs(addr.sin_port));
+	if (listen(socket, backlog) < 0)
 	{
 		exit_with_error("Failed to listen on socket", self_data);
 	}
-	self_data->listening.dest_addr.sin_port = addr.sin_port;
-	self_data->listening.dest_addr.sin_addr = self_data->my_ip_addr;
-	self_data->listening.dest_addr.sin_family = AF_INET;
+	listening->dest_addr.sin_port = addr.sin_port;
+	listening->dest_addr.sin_addr = self_data->my_ip_addr;
+	listening->dest_addr.sin_family = AF_INET;
 
 	return socket;
 }
 
-void accept_predecessor_connection(struct self_data *my_data)
+void await_predecessor_connection(struct self_data *my_data)
 {
-	socklen_t addr_len = sizeof(my_data->predecessor.dest_addr);
-	int client_socket = -1;
+	my_data->awaiting_predecessor = true;
+	accept_predecessor_connection(my_data); // it may have connected already
+}
 
-	struct pollfd *pfd = &my_data->fds[LISTENING_FDS];
-	pfd->events = POLLIN;
+void accept_predecessor_connection(struct self_data *my_data)
+{
+	if (!my_data->awaiting_predecessor)
+		return; // kept in the backlog until the current predecessor has let go
 
-	// Poll the listening socket for incoming connections
-	int poll_result = poll(pfd, 1, -1); // Blocking indefinitely
-	if (poll_result < 0)
-	{
-		perror("Poll failed");
-		exit_with_error("Failed to poll listening socket", my_data);
-	}
-	else if (poll_result == 0)
+	int client_socket = reactor_accept(&my_data->reactor, my_data->listening.socket, &my_data->predecessor.dest_addr, 0);
+	if (client_socket < 0)
 	{
-		printf("No events occurred, retrying...\n");
-		return; // No events happened, return and retry later
-	}
-
-	// If poll indicates readiness (POLLIN event)
-	if (pfd->revents & POLLIN)
-	{
-		// Accept the connection for the predecessor
-		client_socket = accept(my_data->listening.socket,
-				       (struct sockaddr *)&my_data->predecessor.dest_addr,
-				       &addr_len);
-
-		// Check if accept() succeeded
-		if (client_socket < 0)
-		{
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
-			{
-				printf("No attempted connection from supposed predecessor\n");
-				return;
-			}
-			else
-			{
-				perror("Accept failed");
-				exit_with_error("Failed to accept connection", my_data);
-			}
-		}
-		printf("\tAccepted TCP connection from predecessor\n");
-		my_data->predecessor.socket = client_socket; // Accept worked! Assign the accepted socket to the predecessor field
-
-		my_data->fds[PREDECESSOR_FDS].fd = client_socket; // Update the poll file descriptor
-
-		my_data->fds[PREDECESSOR_FDS].events = POLLIN;
+		if (errno == ETIMEDOUT || errno == EAGAIN || errno == EWOULDBLOCK)
+			return; // not yet, the listening socket reports it
+		log_warn("Accept failed: %s", strerror(errno));
+		exit_with_error("Failed to accept connection", my_data);
 	}
+	log_info("\tAccepted TCP connection from predecessor");
+	my_data->awaiting_predecessor = false;
+	close_connection(my_data, &my_data->predecessor);
+	my_data->predecessor.socket = client_socket; // Accept worked! Assign the accepted socket to the predecessor field
+
+	// The reactor reads the socket until it would block
+	if (set_nonblocking(client_socket, my_data) < 0)
+		exit_with_error("Failed to set socket to non-blocking", my_data);
+	register_connection(my_data, &my_data->predecessor);
 }
 
-void connect_to_tcp(struct self_data *self_data)
+/**
+ * @brief Opens a socket and starts connecting it to the successor's address.
+ */
+static void start_connect(struct self_data *self_data)
 {
-	self_data->successor.socket = create_socket(AF_INET, SOCK_STREAM, 0, self_data);
-	if (self_data->successor.socket < 0)
+	struct connection_point *successor = &self_data->successor;
+	successor->socket = create_socket(AF_INET, SOCK_STREAM, 0, self_data);
+	if (successor->socket < 0)
 		exit_with_error("Failed to create socket", self_data);
 
-	if (set_nonblocking(self_data->successor.socket, self_data) < 0)
+	if (set_nonblocking(successor->socket, self_data) < 0)
 		exit_with_error("Failed to set socket to non-blocking", self_data);
 
-	self_data->fds[SUCCESSOR_FDS].fd = self_data->successor.socket;
-	self_data->fds[SUCCESSOR_FDS].events = POLLOUT;
-
-	int ret = connect(self_data->successor.socket, (struct sockaddr *)&self_data->successor.dest_addr, sizeof(self_data->successor.dest_addr)); // set up connection
+	int ret = connect(successor->socket, (struct sockaddr *)&successor->dest_addr, sizeof(successor->dest_addr)); // set up connection
 	if (ret < 0 && errno != EINPROGRESS)
 	{
-		perror("Connect failed immediately");
-		close(self_data->successor.socket);
-		self_data->successor.socket = -1;
-		exit_with_error("Failed to connect to successor", self_data);
+		log_warn("Connect failed immediately: %s", strerror(errno));
+		close(successor->socket);
+		successor->socket = 0;
+		connect_failed(self_data);
+		return;
 	}
 
-	// Poll the socket for connection completion
-	int ret2 = poll(self_data->fds, 4, 5000);
-	if (ret2 > 0 && (self_data->fds[SUCCESSOR_FDS].revents & POLLOUT))
+	// The handler is called with EPOLLOUT once the connection is up
+	register_connection(self_data, successor);
+	reactor_want_write(&self_data->reactor, &successor->source);
+	timer_add(&self_data->timers, &self_data->connect_timer, timer_now() + CONNECT_TIMEOUT);
+}
+
+/**
+ * @brief Timer of a connect: the attempt took too long, or the pause after a failed one is over.
+ */
+static void connect_timer_fired(struct self_data *self_data, struct timer *timer)
+{
+	struct sockaddr_in peer;
+	socklen_t len = sizeof(peer);
+	if (self_data->successor.socket <= 0)
+		start_connect(self_data);
+	else if (getpeername(self_data->successor.socket, (struct sockaddr *)&peer, &len) == 0)
+		finish_connect(self_data); // connected while a long transfer kept the loop from seeing it
+	else
 	{
-		int error = 0;
-		socklen_t len = sizeof(error);
-		if (getsockopt(self_data->successor.socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
-		{
-			fprintf(stderr, "Connect failed: %s\n", strerror(error));
-			close(self_data->successor.socket);
-			self_data->successor.socket = -1;
-			exit_with_error("Connection failed", self_data);
-		}
+		log_warn("Connection timed out.");
+		connect_failed(self_data);
 	}
-	else if (ret2 == 0)
+}
+
+void connect_to_tcp(struct self_data *self_data)
+{
+	// What is queued for the previous successor goes out before its socket is replaced
+	flush_all_connections(self_data);
+	close_connection(self_data, &self_data->successor);
+
+	self_data->successor.connecting = true;
+	self_data->connect_attempts = 0;
+	start_connect(self_data);
+}
+
+void connect_failed(struct self_data *self_data)
+{
+	struct connection_point *successor = &self_data->successor;
+	if (successor->socket > 0)
 	{
-		fprintf(stderr, "Connection timed out.\n");
-		close(self_data->successor.socket);
-		self_data->successor.socket = -1;
-		exit_with_error("Connection timed out", self_data);
+		reactor_remove(&self_data->reactor, &successor->source);
+		close(successor->socket);
+		successor->socket = 0;
 	}
-	else
+	byte_ring_clear(&successor->inbox);
+
+	if (++self_data->connect_attempts == CONNECT_ATTEMPTS)
+		exit_with_error("Failed to connect to successor", self_data);
+	int delay = CONNECT_RETRY_DELAY << (self_data->connect_attempts - 1);
+	log_warn("\tConnecting the successor again in %d ms", delay);
+	timer_add(&self_data->timers, &self_data->connect_timer, timer_now() + delay);
+}
+
+int finish_connect(struct self_data *self_data)
+{
+	struct connection_point *connection = &self_data->successor;
+	int error = 0;
+	socklen_t len = sizeof(error);
+	if (getsockopt(connection->socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
 	{
-		perror("Poll failed");
-		close(self_data->successor.socket);
-		self_data->successor.socket = -1;
-		exit_with_error("Poll failed", self_data);
+		log_warn("Connect failed: %s", strerror(error ? error : errno));
+		return -1;
 	}
+	timer_cancel(&self_data->timers, &self_data->connect_timer);
+	connection->connecting = false;
+	log_info("\tSuccessfully connected successor at %s:%u", inet_ntoa(connection->dest_addr.sin_addr), ntohs(connection->dest_addr.sin_port));
+	return 0;
+}
 
-	printf("\tSuccessfully connected successor at %s:%u\n", inet_ntoa(self_data->successor.dest_addr.sin_addr), ntohs(self_data->successor.dest_addr.sin_port));
-
-	self_data->fds[SUCCESSOR_FDS].events = POLLIN; // Update events to listen for input
+bool ring_settled(const struct self_data *self_data)
+{
+	return self_data->ring_state == RING_CONNECTED && !self_data->awaiting_predecessor && !self_data->successor.connecting;
 }
 
 void setup_data(struct self_data *my_data)
 {
-	printf("\033[0;32m[SETUP]\033[0m\n");
-	for (int i = UDP_FDS; i < LISTENING_FDS; i++)
-	{
-		my_data->fds[i].events = POLLIN;
-	}
-	my_data->udp_socket = create_udp_sock(my_data);
-	my_data->listening.socket = create_listening_tcp_sock(my_data);
+	log_info("[SETUP]");
+	if (reactor_init(&my_data->reactor) < 0)
+		exit_with_error("Failed to create the reactor", my_data);
+	timer_wheel_init(&my_data->timers);
+	my_data->connect_timer.fire = connect_timer_fired;
+	my_data->udp_source.fd = -1; // nothing is registered until the handlers are set
+	my_data->successor.source.fd = -1;
+	my_data->predecessor.source.fd = -1;
+	my_data->listening.source.fd = -1;
+	my_data->successor.reactor = &my_data->reactor;
+	my_data->predecessor.reactor = &my_data->reactor;
 
-	my_data->fds[UDP_FDS].fd = my_data->udp_socket;
-	my_data->fds[LISTENING_FDS].fd = my_data->listening.socket;
+	my_data->udp_socket = create_udp_sock(my_data);
+	memory_track(MEM_IO, sizeof(my_data->udp_out));
+	my_data->listening.socket = create_listening_tcp_sock(my_data, &my_data->listening, 1);
+	routing_init(my_data);
 
 	my_data->alive = true;
 }
@@ -345,6 +577,17 @@ int create_socket(int domain, int type, int protocol, struct self_data *self_dat
 	int sockfd = socket(domain, type, protocol);
 	if (sockfd < 0)
 		exit_with_error("Failed to create socket", self_data);
+
+	// accepted sockets take it over from the listening one
+	static bool busy_poll_refused;
+	int busy_poll = BUSY_POLL_SOCKET;
+	if (self_data->config.busy_poll_cpu >= 0 && !busy_poll_refused &&
+	    setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0)
+	{
+		// raising it above net.core.busy_read takes CAP_NET_ADMIN, the loop still spins in user space
+		log_warn("\tSO_BUSY_POLL not set: %s", strerror(errno));
+		busy_poll_refused = true;
+	}
 	return sockfd;
 }
 
@@ -3,6 +3,7 @@
 
 #include "util.h"
 #include "pdu.h"
+#include "routing.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <arpa/inet.h>
@@ -22,15 +23,20 @@
 // Forward declarations of required structures
 struct connection_point;
 struct self_data;
-// FD indixes
-#define UDP_FDS 0
-#define SUCCESSOR_FDS 1
-#define PREDECESSOR_FDS 2
-#define LISTENING_FDS 3
+// Send queue depths of a ring connection
+#define SEND_QUEUE_HIGH (4 * 1024 * 1024) // send_tcp_pdu() blocks and writes above this
+#define SEND_QUEUE_LOW (1024 * 1024)	  // down to this, and bulk producers wait while above it
+#define SEND_TIMEOUT 5000		  // milliseconds a flush waits for a full connection
+#define DATAGRAM_SEND_TIMEOUT 1000	  // milliseconds a flush waits for a full UDP socket
+#define TRACKER_TIMEOUT 10000		  // milliseconds to wait for the tracker to answer
+#define CONNECT_TIMEOUT 5000		  // milliseconds one attempt to connect the successor may take
+#define CONNECT_ATTEMPTS 3
+#define CONNECT_RETRY_DELAY 250 // milliseconds before the next attempt, doubled every time
+#define BUSY_POLL_SOCKET 50	// microseconds the kernel polls the device queue for an empty socket, with --busy-poll
 // Function Declarations
 
 /**
- *  @brief Creates a TCP or UDP socket.
+ *  @brief Creates a TCP or UDP socket, with SO_BUSY_POLL set when the node busy polls.
  * @param type The socket type (e.g., SOCK_STREAM for TCP).
  * @param protocol The protocol (usually 0).
  * @return int Socket file descriptor on success, exits on failure.
@@ -54,24 +60,117 @@ int set_nonblocking(int sockfd, struct self_data *self_data);
 int send_udp_pdu(int socket, struct sockaddr_in dest, const void *pdu, size_t pdu_size);
 
 /**
- * @brief Sends a TCP Protocol Data Unit (PDU).
- * @param sockfd The socket file descriptor.
+ * @brief Queues a UDP PDU for the next flush_udp_batch(), which the main loop does after every
+ *        batch of events. A full batch is flushed first. Queued PDUs keep their order.
+ * @param self_data Pointer to the self_data structure.
+ * @param dest The address to send to.
  * @param pdu Pointer to the data to be sent.
- * @param pdu_size Size of the data to be sent.
+ * @param pdu_size Size of the data to be sent, at most UDP_DATAGRAM_MAX.
  * @return int 0 on success, -1 on failure.
  */
-int send_tcp_pdu(int sockfd, const void *pdu, size_t pdu_size);
+int queue_udp_pdu(struct self_data *self_data, struct sockaddr_in dest, const void *pdu, size_t pdu_size);
+
+/**
+ * @brief Queues a UDP PDU given in pieces, like queue_udp_pdu().
+ *        Pieces flagged in stored are sent from where they are instead of being copied. They point
+ *        into the store, which has to call flush_udp_views() before it changes.
+ * @param self_data Pointer to the self_data structure.
+ * @param dest The address to send to.
+ * @param iov The pieces, at most UDP_PDU_PIECES and UDP_DATAGRAM_MAX bytes together.
+ * @param iovcnt Number of pieces.
+ * @param stored Bit i set if piece i is kept by reference.
+ * @return int 0 on success, -1 on failure.
+ */
+int queue_udp_pdu_iov(struct self_data *self_data, struct sockaddr_in dest, const struct iovec *iov, int iovcnt, unsigned stored);
+
+/**
+ * @brief Sends the queued UDP PDUs if any of them points into the store, before the store changes.
+ * @param self_data Pointer to the self_data structure.
+ */
+void flush_udp_views(struct self_data *self_data);
+
+/**
+ * @brief Sends the queued UDP PDUs with reactor_send(), waiting for the socket if its buffer is full.
+ * @param self_data Pointer to the self_data structure.
+ * @return int 0 on success, -1 if PDUs had to be dropped.
+ */
+int flush_udp_batch(struct self_data *self_data);
+
+/**
+ * @brief Sends the queued UDP PDUs and writes what the ring connections take of their queues, all
+ *        in one reactor_send() call. The main loop does this after every batch of events.
+ * @param self_data Pointer to the self_data structure.
+ */
+void flush_output(struct self_data *self_data);
+
+/**
+ * @brief Queues a TCP Protocol Data Unit (PDU) on a ring connection.
+ *        The queue is written out by the main loop, many PDUs per call. If it holds more than
+ *        SEND_QUEUE_HIGH bytes it is written down to SEND_QUEUE_LOW before returning.
+ * @param connection The successor or predecessor connection.
+ * @param pdu Pointer to the data to be sent.
+ * @param pdu_size Size of the data to be sent.
+ * @return int 0 on success, -1 if the connection is closed or broken.
+ */
+int send_tcp_pdu(struct connection_point *connection, const void *pdu, size_t pdu_size);
+
+/**
+ * @brief Queues a TCP PDU given in pieces, like send_tcp_pdu(). The pieces are copied into the send queue.
+ * @param connection The successor or predecessor connection.
+ * @param iov The pieces of the PDU.
+ * @param iovcnt Number of pieces.
+ * @return int 0 on success, -1 if the connection is closed or broken.
+ */
+int send_tcp_pdu_iov(struct connection_point *connection, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Writes queued PDUs until at most target bytes are left, waiting for the socket if needed.
+ * @param connection The successor or predecessor connection.
+ * @param target Bytes that may stay queued, 0 to write everything.
+ * @return int 0 on success, -1 on failure or if the socket stays full for 5 seconds.
+ */
+int flush_connection(struct connection_point *connection, size_t target);
+
+/**
+ * @brief Writes everything queued on both ring connections, used before blocking on a peer.
+ * @param self_data Pointer to the self_data structure.
+ */
+void flush_all_connections(struct self_data *self_data);
+
+/**
+ * @brief Writes as much of the send queue as the socket takes without blocking.
+ * @param connection The successor or predecessor connection.
+ * @return int 0 on success, -1 if the connection is broken, the queue is dropped then.
+ */
+int write_queued(struct connection_point *connection);
+
+/**
+ * @brief Bytes queued on a connection and not yet written to its socket.
+ */
+size_t send_queue_depth(const struct connection_point *connection);
+
+/**
+ * @brief Registers a connected successor or predecessor socket with the reactor.
+ * @param self_data Pointer to the self_data structure.
+ * @param connection The connection, its source handler must be set.
+ */
+void register_connection(struct self_data *self_data, struct connection_point *connection);
+
+/**
+ * @brief Unregisters and closes a connection and drops what it had buffered. Does nothing if it is not connected.
+ * @param self_data Pointer to the self_data structure.
+ * @param connection The successor or predecessor connection.
+ */
+void close_connection(struct self_data *self_data, struct connection_point *connection);
 
 /**
  * @brief Receives data from a socket using poll to wait for input readiness.
- * @param fds Pointer to an array of pollfd structures.
- * @param fd Index of the file descriptor in the poll array.
  * @param sockfd The socket file descriptor.
  * @param pdu Pointer to buffer where received data will be stored.
  * @param pdu_size Size of the buffer.
  * @return int 0 on success, -1 on failure.
  */
-int receive_from(struct pollfd *fds, int fd, int sockfd, void *pdu, size_t pdu_size);
+int receive_from(int sockfd, void *pdu, size_t pdu_size);
 
 /**
  * @brief Creates a UDP socket and binds it.
@@ -96,33 +195,54 @@ struct sockaddr_in create_destination_addr(const char *ip, uint16_t port, struct
 void setup_data(struct self_data *my_data);
 
 /**
- * @brief Accepts an incoming TCP connection.
+ * @brief Takes the next connection on the listening socket as the new predecessor. Returns right
+ *        away, the handler of the listening socket calls accept_predecessor_connection() once it connects.
+ * @param my_data Pointer to the self_data structure.
+ */
+void await_predecessor_connection(struct self_data *my_data);
+
+/**
+ * @brief Accepts the new predecessor if it is awaited and has connected, replacing the previous one.
  * @param my_data Pointer to the self_data structure.
- * @param node_to_accept The type of node to accept (e.g., "predecessor" or "successor").
  */
 void accept_predecessor_connection(struct self_data *my_data);
 
 /**
  * @brief Creates a listening TCP socket.
  * @param self_data Pointer to the self_data structure for error handling.
+ * @param listening Its address is set to the one of the node with the port taken.
+ * @param backlog Connections that may wait to be accepted.
  * @return int Socket file descriptor on success, exits on failure.
  */
-int create_listening_tcp_sock(struct self_data *self_data);
+int create_listening_tcp_sock(struct self_data *self_data, struct connection_point *listening, int backlog);
 
 /**
- * @brief Receives data from a TCP connection.
- * @param my_data Pointer to the self_data structure.
- * @param node_to_receive The type of node to receive data from (e.g., "predecessor" or "successor").
- * @param buffer Pointer to buffer where received data will be stored.
- * @param buffer_size Size of the buffer.
+ * @brief Starts connecting to the successor node via TCP without waiting. PDUs sent meanwhile are
+ *        queued, finish_connect() is called once the socket is writable. An attempt that fails or
+ *        takes longer than CONNECT_TIMEOUT is repeated up to CONNECT_ATTEMPTS times.
+ * @param self_data Pointer to the self_data structure.
  */
-void receive_tcp_data(struct self_data *my_data, char *node_to_receive, char *buffer, size_t buffer_size);
+void connect_to_tcp(struct self_data *self_data);
 
 /**
- * @brief Connects to the successor node via TCP.
+ * @brief Completes a connect to the successor started by connect_to_tcp().
  * @param self_data Pointer to the self_data structure.
+ * @return int 0 if it is connected, -1 if the attempt failed.
  */
-void connect_to_tcp(struct self_data *self_data);
+int finish_connect(struct self_data *self_data);
+
+/**
+ * @brief Gives up the current attempt to connect the successor. The next one starts after a pause,
+ *        what is queued is kept for it. Exits once every attempt has failed.
+ * @param self_data Pointer to the self_data structure.
+ */
+void connect_failed(struct self_data *self_data);
+
+/**
+ * @brief Whether the ring connections are in place, no connect or accept is outstanding.
+ * @param self_data Pointer to the self_data structure.
+ */
+bool ring_settled(const struct self_data *self_data);
 
 #endif // SOCKET_FUNCTIONS_H
 
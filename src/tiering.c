@@ -0,0 +1,110 @@
+#include "tiering.h"
+#include "cold_store.h"
+#include "hash_handling.h"
+
+#define SWEEP_LOW_WATERMARK(budget) ((budget) - (budget) / 10) // demote a bit more than needed so sweeps are rare
+
+struct sweep
+{
+	size_t hot_bytes;
+	size_t target;
+	uint64_t demoted;
+	bool failed;
+};
+
+void tiering_init(struct tiering *tiering, size_t budget, const char *dir)
+{
+	tiering->budget = budget;
+	tiering->clock_hand = 0;
+	tiering->demoted = 0;
+	tiering->promoted = 0;
+
+	if (budget > 0 && cold_store_open(dir) < 0)
+	{
+		log_warn("%s: %s", dir, strerror(errno));
+		exit_with_error("Failed to create the cold value file", NULL);
+	}
+}
+
+size_t tiering_hot_bytes(const struct self_data *self_data)
+{
+	size_t bytes = 0;
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+		bytes += self_data->record_arenas[slot].live_bytes;
+	return bytes;
+}
+
+void tiering_touch(struct self_data *self_data, char *ssn, void *value)
+{
+	if (!value_is_cold(value))
+	{
+		struct value_pair *pair = value;
+		if (pair->access < UINT8_MAX)
+			pair->access++;
+		return;
+	}
+
+	// the new record is created before the table frees the cold one, so fields stay valid
+	const struct value_pair *pair = cold_store_get(value);
+	struct value_fields fields;
+	value_fields(pair, &fields);
+	store_value(self_data, ssn, pair->name_length, pair->email_length, fields.name, fields.email);
+	self_data->tiering.promoted++;
+}
+
+/**
+ * @brief ht_update_function for the clock sweep, ages a value or moves it to the cold store.
+ */
+static void *sweep_value(void *value, void *arg)
+{
+	struct sweep *sweep = arg;
+	if (value_is_cold(value) || sweep->failed || sweep->hot_bytes <= sweep->target)
+		return value;
+
+	struct value_pair *pair = value;
+	if (pair->access > 0)
+	{
+		pair->access >>= 1;
+		return value;
+	}
+
+	void *ref = cold_store_put(pair);
+	if (!ref)
+	{
+		sweep->failed = true;
+		return value;
+	}
+	sweep->hot_bytes -= slab_object_size(pair);
+	sweep->demoted++;
+	slab_free(pair); // the dictionary references now belong to the cold copy
+	return ref;
+}
+
+void tiering_tick(struct self_data *self_data)
+{
+	struct tiering *tiering = &self_data->tiering;
+	if (tiering->budget == 0)
+		return;
+	flush_udp_views(self_data); // demoting frees records and moving the cold file invalidates references
+
+	struct sweep sweep = {
+	    .hot_bytes = tiering_hot_bytes(self_data),
+	    .target = SWEEP_LOW_WATERMARK(tiering->budget),
+	};
+	if (sweep.hot_bytes > tiering->budget)
+	{
+		// two turns of the clock age every counter enough to find something to demote
+		for (int i = 0; i < 2 * HT_SLOTS && sweep.hot_bytes > sweep.target && !sweep.failed; i++)
+		{
+			ht_update_in_slot(self_data->hash_table, tiering->clock_hand, sweep_value, &sweep);
+			tiering->clock_hand = (tiering->clock_hand + 1) % HT_SLOTS;
+		}
+		tiering->demoted += sweep.demoted;
+		log_info("\tDemoted %" PRIu64 " values, %zu bytes in RAM, %zu in the cold store",
+			 sweep.demoted, sweep.hot_bytes, cold_store_live_bytes());
+		if (sweep.failed)
+			log_warn("\tThe cold value file cannot grow, staying over the memory budget");
+	}
+
+	cold_store_compact(self_data->hash_table);
+}
@@ -0,0 +1,62 @@
+#ifndef TIERING_H
+#define TIERING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "hashtable.h"
+#include "value_codec.h"
+
+#define TIERING_ACCESS_ON_INSERT 1 // a new value survives one sweep before it can be demoted
+
+struct self_data;
+
+/**
+ * @brief Keeps the values held in RAM under a budget by moving cold ones to the cold store.
+ *
+ * Every value_pair counts its lookups. A clock hand walks the hash slots while the node is over
+ * budget, halving the counters of the values it passes and demoting those that reached zero.
+ * Looking up a demoted value brings it back into RAM.
+ */
+struct tiering
+{
+	size_t budget; // bytes of value_pairs kept in RAM, 0 for no limit
+	int clock_hand; // next hash slot to sweep
+	uint64_t demoted;
+	uint64_t promoted;
+};
+
+/**
+ * @brief Sets up tiering and opens the cold store if a budget is given.
+ *
+ * @param tiering State to initialize.
+ * @param budget Bytes of values to keep in RAM, 0 to keep everything in RAM.
+ * @param dir Directory for the cold value file.
+ */
+void tiering_init(struct tiering *tiering, size_t budget, const char *dir);
+
+/**
+ * @brief Bytes the value_pairs held in RAM occupy in their slabs.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+size_t tiering_hot_bytes(const struct self_data *self_data);
+
+/**
+ * @brief Records a lookup of a stored value, promoting it into RAM if it was cold.
+ *
+ * @param self_data Pointer to the self_data structure.
+ * @param ssn The key the value is stored under.
+ * @param value The value as returned by ht_lookup().
+ */
+void tiering_touch(struct self_data *self_data, char *ssn, void *value);
+
+/**
+ * @brief Main loop housekeeping: demotes values until the node is back under its budget
+ *        and compacts the cold store.
+ *
+ * @param self_data Pointer to the self_data structure.
+ */
+void tiering_tick(struct self_data *self_data);
+
+#endif // TIERING_H
@@ -0,0 +1,163 @@
+#include "timer_wheel.h"
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_SLOT_BITS * TIMER_LEVELS)) // furthest ahead a timer can be placed
+#define DUE TIMER_LEVELS						       // level of a timer taken off the wheel to be fired
+
+uint64_t timer_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void timer_wheel_init(struct timer_wheel *wheel)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = timer_now();
+	wheel->next = UINT64_MAX;
+}
+
+static void link_timer(struct timer **head, struct timer *timer)
+{
+	timer->next = *head;
+	if (*head)
+		(*head)->prev = &timer->next;
+	*head = timer;
+	timer->prev = head;
+}
+
+static void unlink_timer(struct timer *timer)
+{
+	*timer->prev = timer->next;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	timer->prev = NULL;
+}
+
+/**
+ * @brief Puts a timer in the lowest level that reaches its expiry. The slot is never the one the
+ *        level is at, so it is passed no later than the timer is due.
+ */
+static void place(struct timer_wheel *wheel, struct timer *timer)
+{
+	uint64_t expires = timer->expires > wheel->now ? timer->expires : wheel->now + 1;
+	if (expires - wheel->now >= WHEEL_SPAN)
+		expires = wheel->now + WHEEL_SPAN - 1; // placed again when its slot comes up
+
+	uint64_t delta = expires - wheel->now;
+	int level = 0;
+	while (level < TIMER_LEVELS - 1 && delta >= (uint64_t)1 << (TIMER_SLOT_BITS * (level + 1)))
+		level++;
+	int slot = (expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+
+	link_timer(&wheel->slots[level][slot], timer);
+	timer->level = level;
+	timer->slot = slot;
+	wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+void timer_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires)
+{
+	timer_cancel(wheel, timer);
+	timer->expires = expires;
+	place(wheel, timer);
+	if (expires < wheel->next)
+		wheel->next = expires;
+}
+
+void timer_cancel(struct timer_wheel *wheel, struct timer *timer)
+{
+	if (!timer_armed(timer))
+		return;
+	unlink_timer(timer);
+	// the next expiry stays as it is, at worst the wheel wakes up once for nothing
+	if (timer->level != DUE && !wheel->slots[timer->level][timer->slot])
+		wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+}
+
+/**
+ * @brief Expiry of the first timer, found in the first occupied slot after the current one of every level.
+ */
+static uint64_t earliest(const struct timer_wheel *wheel)
+{
+	uint64_t next = UINT64_MAX;
+	for (int level = 0; level < TIMER_LEVELS; level++)
+	{
+		uint64_t bits = wheel->occupied[level];
+		if (!bits)
+			continue;
+		int start = ((wheel->now >> (TIMER_SLOT_BITS * level)) + 1) & SLOT_MASK;
+		uint64_t rotated = start ? bits >> start | bits << (TIMER_SLOTS - start) : bits;
+		int slot = (start + __builtin_ctzll(rotated)) & SLOT_MASK;
+		for (struct timer *timer = wheel->slots[level][slot]; timer; timer = timer->next)
+		{
+			if (timer->expires < next)
+				next = timer->expires;
+		}
+	}
+	return next;
+}
+
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now)
+{
+	if (wheel->next == UINT64_MAX)
+		return -1;
+	if (wheel->next <= now)
+		return 0;
+	return wheel->next - now > INT_MAX ? INT_MAX : (int)(wheel->next - now);
+}
+
+void timer_wheel_run(struct timer_wheel *wheel, struct self_data *self_data, uint64_t now)
+{
+	if (now < wheel->next)
+		return;
+
+	// every slot passed since the last run is emptied, its timers fire or move down a level
+	struct timer *due = NULL;
+	uint64_t before = wheel->now;
+	if (now > before)
+	{
+		wheel->now = now;
+		for (int level = 0; level < TIMER_LEVELS; level++)
+		{
+			int shift = TIMER_SLOT_BITS * level;
+			uint64_t from = (before >> shift) + 1;
+			uint64_t to = now >> shift;
+			if (to < from)
+				break; // the levels above have not moved either
+			uint64_t count = to - from + 1 < TIMER_SLOTS ? to - from + 1 : TIMER_SLOTS;
+			for (uint64_t i = 0; i < count; i++)
+			{
+				int slot = (from + i) & SLOT_MASK;
+				struct timer *timer = wheel->slots[level][slot];
+				wheel->slots[level][slot] = NULL;
+				wheel->occupied[level] &= ~((uint64_t)1 << slot);
+				while (timer)
+				{
+					struct timer *next = timer->next;
+					if (timer->expires <= now)
+					{
+						link_timer(&due, timer);
+						timer->level = DUE;
+					}
+					else
+						place(wheel, timer);
+					timer = next;
+				}
+			}
+		}
+	}
+
+	// a function may add or cancel timers, the due ones among them too
+	while (due)
+	{
+		struct timer *timer = due;
+		unlink_timer(timer);
+		timer->fire(self_data, timer);
+	}
+	wheel->next = earliest(wheel);
+}
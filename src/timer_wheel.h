@@ -0,0 +1,94 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TIMER_LEVELS 4	   // a turn is 64 ms, 4 s, 4.4 min and 4.7 h
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+struct self_data;
+struct timer;
+
+/**
+ * @brief Called from the main loop once the timer is due. The timer is no longer armed and may be added again.
+ */
+typedef void (*timer_function)(struct self_data *self_data, struct timer *timer);
+
+/**
+ * @brief A timer, owned by the caller. It has to stay in place while armed.
+ */
+struct timer
+{
+	uint64_t expires; // milliseconds on the timer_now() clock
+	timer_function fire;
+	void *arg; // for the function
+	struct timer *next;
+	struct timer **prev; // what points here, NULL while not armed
+	uint8_t level;
+	uint8_t slot;
+};
+
+/**
+ * @brief Hierarchical timer wheel with millisecond ticks.
+ *
+ * Every level has 64 slots, a slot of a level covers a whole turn of the level below. A timer goes
+ * in the lowest level that reaches its expiry and moves down a level whenever the wheel passes
+ * its slot, so adding and cancelling take constant time. A bitmap of the occupied slots per level
+ * finds the next expiry without walking empty slots.
+ */
+struct timer_wheel
+{
+	uint64_t now;  // where the slots have been handled up to
+	uint64_t next; // no timer expires before this, UINT64_MAX if none is armed
+	struct timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+	uint64_t occupied[TIMER_LEVELS];
+};
+
+/**
+ * @brief Milliseconds of the monotonic clock.
+ */
+uint64_t timer_now(void);
+
+/**
+ * @brief Starts an empty wheel at the current time.
+ */
+void timer_wheel_init(struct timer_wheel *wheel);
+
+/**
+ * @brief Arms a timer, one that is armed already is moved.
+ *
+ * @param wheel The wheel.
+ * @param timer Timer with fire set.
+ * @param expires When it is due on the timer_now() clock. A time that has passed is due on the next run.
+ */
+void timer_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires);
+
+/**
+ * @brief Disarms a timer. Does nothing if it is not armed.
+ */
+void timer_cancel(struct timer_wheel *wheel, struct timer *timer);
+
+/**
+ * @brief Whether the timer is armed.
+ */
+static inline bool timer_armed(const struct timer *timer)
+{
+	return timer->prev != NULL;
+}
+
+/**
+ * @brief Milliseconds until the next timer is due, for the poll timeout.
+ *
+ * @return int 0 if one is due, -1 if none is armed.
+ */
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now);
+
+/**
+ * @brief Calls the functions of the timers due by now. Returns right away if none is.
+ */
+void timer_wheel_run(struct timer_wheel *wheel, struct self_data *self_data, uint64_t now);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,155 @@
+#ifdef USE_IO_URING
+
+#include "uring.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *uring)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	uring->fd = io_uring_setup(URING_ENTRIES, &params);
+	if (uring->fd < 0)
+		return -1;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+	{
+		close(uring->fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	// with a single mmap the completion queue shares the mapping of the submission queue
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_size > uring->sq_ring_size)
+		uring->sq_ring_size = cq_size;
+	uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->sq_ring == MAP_FAILED)
+	{
+		close(uring->fd);
+		return -1;
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED)
+	{
+		munmap(uring->sq_ring, uring->sq_ring_size);
+		close(uring->fd);
+		return -1;
+	}
+
+	uint8_t *sq = uring->sq_ring;
+	uring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	uring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	uring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	uring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	uring->sq_entries = params.sq_entries;
+	uring->to_submit = 0;
+
+	uint8_t *cq = uring->sq_ring;
+	uring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	uring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	uring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *uring)
+{
+	if (uring->to_submit == uring->sq_entries && uring_enter(uring, 0, 0) < 0)
+		return NULL;
+
+	unsigned tail = *uring->sq_tail;
+	unsigned index = tail & uring->sq_mask;
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->to_submit++;
+	return sqe;
+}
+
+int uring_enter(struct uring *uring, unsigned wait_for, int timeout)
+{
+	struct __kernel_timespec ts = {.tv_sec = timeout / 1000, .tv_nsec = (timeout % 1000) * 1000000L};
+	struct io_uring_getevents_arg arg = {.sigmask = 0, .sigmask_sz = _NSIG / 8, .ts = (uint64_t)(uintptr_t)&ts};
+	unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+	if (wait_for > 0 && timeout >= 0)
+		flags |= IORING_ENTER_EXT_ARG;
+
+	// with SUBMIT_ALL every queued entry is taken unless the call fails before submitting any
+	int ret = io_uring_enter(uring->fd, uring->to_submit, wait_for, flags, flags & IORING_ENTER_EXT_ARG ? &arg : NULL, sizeof(arg));
+	if (ret < 0)
+		return -1;
+	uring->to_submit -= ret;
+	return 0;
+}
+
+int uring_buffers_init(struct uring *uring, struct uring_buffers *buffers, uint16_t group, unsigned count, unsigned size)
+{
+	buffers->ring_size = count * sizeof(struct io_uring_buf);
+	buffers->ring = mmap(NULL, buffers->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffers->ring == MAP_FAILED)
+		return -1;
+	buffers->data = malloc((size_t)count * size);
+	if (!buffers->data)
+	{
+		munmap(buffers->ring, buffers->ring_size);
+		errno = ENOMEM;
+		return -1;
+	}
+	buffers->count = count;
+	buffers->size = size;
+	buffers->group = group;
+
+	struct io_uring_buf_reg reg = {.ring_addr = (uint64_t)(uintptr_t)buffers->ring, .ring_entries = count, .bgid = group};
+	if (io_uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		free(buffers->data);
+		munmap(buffers->ring, buffers->ring_size);
+		return -1;
+	}
+
+	for (unsigned id = 0; id < count; id++)
+		uring_buffer_recycle(buffers, id);
+	return 0;
+}
+
+void uring_buffer_recycle(struct uring_buffers *buffers, uint16_t id)
+{
+	uint16_t tail = buffers->ring->tail;
+	struct io_uring_buf *buf = &buffers->ring->bufs[tail & (buffers->count - 1)];
+
+	// the tail shares its place with the reserved field of the first entry, set the fields one by one
+	buf->addr = (uint64_t)(uintptr_t)uring_buffer(buffers, id);
+	buf->len = buffers->size;
+	buf->bid = id;
+	__atomic_store_n(&buffers->ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif // USE_IO_URING
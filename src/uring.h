@@ -0,0 +1,115 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256	// submission queue entries
+#define URING_CQ_ENTRIES 1024 // completions, room for multishot receives between two waits
+
+/**
+ * @brief Minimal io_uring instance on the raw system calls, the node does not link liburing.
+ *
+ * One thread submits and reaps. Submissions are collected with uring_get_sqe() and passed to
+ * the kernel by the next uring_enter().
+ */
+struct uring
+{
+	int fd;
+	void *sq_ring; // also holds the completion queue
+	size_t sq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned to_submit; // taken with uring_get_sqe() and not yet entered
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/**
+ * @brief A ring of provided buffers, the kernel picks one per receive completion.
+ */
+struct uring_buffers
+{
+	struct io_uring_buf_ring *ring;
+	size_t ring_size;
+	uint8_t *data;
+	unsigned count; // power of two
+	unsigned size;	// bytes per buffer
+	uint16_t group;
+};
+
+/**
+ * @brief Creates the instance and maps its rings.
+ *
+ * @return int 0 on success, -1 with errno set on failure.
+ */
+int uring_init(struct uring *uring);
+
+/**
+ * @brief Returns a cleared submission queue entry, entering what is queued first if the queue is full.
+ *
+ * @return struct io_uring_sqe* The entry, NULL if the queue could not be entered.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *uring);
+
+/**
+ * @brief Submits the queued entries and waits for completions.
+ *
+ * @param uring The instance.
+ * @param wait_for Completions to wait for, 0 to only submit.
+ * @param timeout Milliseconds to wait at most, negative to wait without limit.
+ * @return int 0 on success, -1 with errno set on failure, ETIME if the timeout passed first.
+ */
+int uring_enter(struct uring *uring, unsigned wait_for, int timeout);
+
+/**
+ * @brief The oldest completion not yet seen, NULL if there is none.
+ */
+static inline struct io_uring_cqe *uring_peek_cqe(struct uring *uring)
+{
+	unsigned head = *uring->cq_head;
+	if (head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &uring->cqes[head & uring->cq_mask];
+}
+
+/**
+ * @brief Hands the completion returned by uring_peek_cqe() back to the kernel.
+ */
+static inline void uring_cqe_seen(struct uring *uring)
+{
+	__atomic_store_n(uring->cq_head, *uring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Allocates count buffers of size bytes, registers them as a provided buffer group and hands them all to the kernel.
+ *
+ * @return int 0 on success, -1 with errno set on failure.
+ */
+int uring_buffers_init(struct uring *uring, struct uring_buffers *buffers, uint16_t group, unsigned count, unsigned size);
+
+/**
+ * @brief Start of a buffer picked by the kernel.
+ */
+static inline uint8_t *uring_buffer(const struct uring_buffers *buffers, uint16_t id)
+{
+	return buffers->data + (size_t)id * buffers->size;
+}
+
+/**
+ * @brief Gives a buffer back to the kernel once its data has been handled.
+ */
+void uring_buffer_recycle(struct uring_buffers *buffers, uint16_t id);
+
+#endif // URING_H
@@ -2,50 +2,41 @@
 
 void exit_with_error(const char *msg, struct self_data *my_data)
 {
-	// Print the error message in red
-	fprintf(stderr, "\t\033[1;31m%s\033[0m\n", msg);
-	close_all_sockets(my_data);
+	log_error("\t%s", msg);
+	if (my_data)
+		close_all_sockets(my_data);
 
-	// Exit the program with an error code
+	// Exit the program with an error code, the log is written out on the way
 	exit(1);
 }
 
-void print_state(int state_number) // prints the state to easily see where program is
+const char *state_label(int state_number)
 {
-	printf("\033[32m[Q%d]", state_number);
 	switch (state_number)
 	{
 	case 12:
-		printf("[NET_JOIN]");
-		break;
+		return "[NET_JOIN]";
 	case 15:
-		printf("[NET_NEW_RANGE]");
-		break;
+		return "[NET_NEW_RANGE]";
 	case 16:
-		printf("[NET_LEAVING]");
-		break;
+		return "[NET_LEAVING]";
 	case 17:
-		printf("[NET_CLOSE_CONNECTION]");
-		break;
+		return "[NET_CLOSE_CONNECTION]";
 	case 5:
-		printf("[Not connected]");
-		break;
+		return "[Not connected]";
 	case 13:
-		printf("[I have the largest span]");
-		break;
+		return "[I have the largest span]";
 	case 14:
-		printf("[Forwarding net_join]");
-		break;
+		return "[Forwarding net_join]";
 	default:
-		break;
+		return "";
 	}
-
-	printf("\033[0m\n");
 }
 
 void close_all_sockets(struct self_data *self_data) // close all sockets
 {
 	close(self_data->listening.socket);
+	close(self_data->routing.listening.socket);
 	close(self_data->udp_socket);
 	close(self_data->successor.socket);
 	close(self_data->predecessor.socket);
@@ -9,23 +9,167 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <time.h>
 #include "hashtable.h"
+#include "slab.h"
+#include "config.h"
+#include "persistence.h"
+#include "tiering.h"
+#include "memory.h"
+#include "load.h"
+#include "byte_ring.h"
+#include "reactor.h"
+#include "timer_wheel.h"
+#include "pdu.h"
+#include "log.h"
 
-#define MAX_SIZE 256
 struct connection_point
 {
 	int socket;
 	struct sockaddr_in dest_addr;
+	struct byte_ring inbox;	 // received bytes not yet handled, ring connections only
+	struct byte_ring outbox; // queued PDUs not yet written, ring connections only
+	struct reactor_source source;
+	struct reactor *reactor; // sends go through it, ring connections only
+	bool connecting;	 // connect() in progress, PDUs are queued until it completes
 };
+
+// Datagrams per send call
+#define UDP_BATCH 32
+#define UDP_DATAGRAM_MAX REACTOR_DATAGRAM_MAX
+#define UDP_PDU_PIECES 4 // header, name, email length and email of a lookup response
+
+/**
+ * @brief Datagrams queued for one send call.
+ */
+struct udp_batch
+{
+	int count;
+	int views; // datagrams with pieces that point into the store
+	struct sockaddr_in addrs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH][UDP_PDU_PIECES];
+	uint8_t pieces[UDP_BATCH];
+	uint8_t data[UDP_BATCH][UDP_DATAGRAM_MAX]; // the pieces that are copied
+};
+
+#define FINGER_COUNT SLOT_BITS // finger i leads to the node holding the slot 2^i past the own range
+#define PEER_POOL 8	       // connections to fingers kept open, the least recently used one is replaced
+#define PEER_INBOUND 32	       // connections from the pools of other nodes
+#define KNOWN_NODES 256	       // nodes whose last announced range is kept, the longest silent one is replaced
+
+/**
+ * @brief A node further along the ring, as its last NET_ANNOUNCE described it.
+ */
+struct finger
+{
+	uint32_t address; // network byte order, 0 while unknown
+	uint16_t port;	  // its peer port, network byte order
+	slot_t range_start;
+	slot_t range_end;
+};
+
+/**
+ * @brief Where the request being handled may still be passed on.
+ */
+enum route_heading
+{
+	ROUTE_ANY,	// from a client, it may go any way
+	ROUTE_FORWARD,	// came in a NET_FORWARD, it keeps going successor-wise
+	ROUTE_BACKWARD, // came in a NET_BACKWARD, it keeps going predecessor-wise
+};
+
+/**
+ * @brief Who holds a slot, as far as the announces tell.
+ */
+struct slot_owner
+{
+	uint32_t address; // network byte order, 0 while unknown
+	uint16_t port;	  // its UDP port, network byte order
+	uint32_t version; // of the claim, kept when the owner gives the slot up
+	uint64_t seen;	  // timer_now() of the last announce of the claim
+};
+
+/**
+ * @brief A node that announced itself, with the range it announced last. What it announces next
+ *        only changes the owner map for that range and the new one.
+ */
+struct known_node
+{
+	struct finger node; // address 0 for a free entry, range_start > range_end once it gave its range up
+	uint16_t udp_port;  // network byte order
+	uint32_t version;   // of the announce
+	uint64_t seen;	    // timer_now() of its last announce
+};
+
+/**
+ * @brief Slot owner map, finger table and the connections that let a request skip ahead on the ring.
+ */
+struct routing
+{
+	struct slot_owner owners[RING_SLOTS]; // requests for a known owner go straight to it
+	uint32_t map_version;		    // highest version announced or seen
+	uint32_t range_version;		    // of the own range
+	uint16_t udp_port;		    // network byte order
+	enum route_heading heading;	    // of the request being handled
+	uint16_t hops;			    // nodes the request being handled has been passed through
+	uint16_t hop_limit;		    // a request or announce passed on this often has been around the ring
+	struct finger fingers[FINGER_COUNT];
+	struct known_node nodes[KNOWN_NODES];
+	struct connection_point listening; // other nodes connect their pools here
+	struct connection_point peers[PEER_POOL];
+	uint64_t peer_used[PEER_POOL]; // when a request last went out on the connection
+	uint64_t uses;
+	bool peer_closing[PEER_POOL];	     // evicted, closed by the handler once its queue is written
+	struct timer peer_timers[PEER_POOL]; // ends a connect, or the writing of an evicted queue, that takes too long
+	struct connection_point inbound[PEER_INBOUND];
+	struct timer announce_timer;
+};
+
+/**
+ * @brief Where the node is in joining or leaving the ring. The handshakes run inside the main loop,
+ *        requests keep being served while a step waits for its peer.
+ */
+enum ring_state
+{
+	RING_JOINING,	   // NET_JOIN sent, waiting for the predecessor to connect and send NET_JOIN_RESPONSE
+	RING_CONNECTED,	   // serving its range
+	RING_LEAVING,	   // NET_NEW_RANGE sent, waiting for NET_NEW_RANGE_RESPONSE
+	RING_HANDING_OVER, // the range was taken over, the entries follow
+};
+
+/**
+ * @brief Where the event loop spent its time while busy polling, in nanoseconds.
+ */
+struct busy_poll_stats
+{
+	uint64_t spin;	     // polls that found no input
+	uint64_t work;	     // polls that found input, with its handling
+	uint64_t sleep;	     // blocking waits once idle, with what they handled
+	uint64_t wakeups;    // blocking waits that ended with input, each one paid for a wakeup
+	uint64_t last_input; // timer_now() of the last poll that found input
+};
+
 struct self_data
 {
+	struct node_config config;
 	struct ht *hash_table;
-	uint8_t range_start;
-	uint8_t range_end;
+	struct slab_arena record_arenas[HT_SLOTS]; // value_pair records, one arena per hash slot
+	struct persistence persistence;
+	struct tiering tiering;
+	struct memory_account memory;
+	struct load load;
+	slot_t range_start; // ring slots, see ring_slot()
+	slot_t range_end;
 
-	struct pollfd fds[4];
+	struct reactor reactor;
+	struct timer_wheel timers;
+	struct reactor_source udp_source;
+	struct udp_batch udp_out; // lookup responses waiting to be sent
+	struct busy_poll_stats busy_poll;
+	struct busy_poll_stats busy_poll_reported; // as of the last report
 
 	bool alive;
+	struct timer heartbeat; // NET_ALIVE to the tracker
 	struct in_addr my_ip_addr;
 	struct sockaddr_in tracker_addr;
 
@@ -33,11 +177,25 @@ struct self_data
 	struct connection_point successor;
 	struct connection_point predecessor;
 	struct connection_point listening;
-	char *ssns[MAX_SIZE];
+	struct routing routing;
+
+	enum ring_state ring_state;
+	bool awaiting_predecessor; // the next connection on the listening socket is the new predecessor
+	struct timer connect_timer; // ends an attempt to connect the successor, or the pause before the next one
+	int connect_attempts;
+	struct NET_WIDE_JOIN_PDU deferred_join; // arrived while the ring was changing, handled once it settles
+	bool join_deferred;
 };
 
 void exit_with_error(const char *msg, struct self_data *my_data);
 
-void print_state(int state_number);
+/**
+ * @brief What a state is waiting for or doing, empty for most of them.
+ */
+const char *state_label(int state_number);
+
+// traces the state machine at debug level, compiled out with the level
+#define print_state(state_number) log_debug("[Q%d]%s", (state_number), state_label(state_number))
+
 void close_all_sockets(struct self_data *self_data);
 #endif
\ No newline at end of file
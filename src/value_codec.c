@@ -0,0 +1,346 @@
+#include "value_codec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DICT_MAX_ENTRIES UINT16_MAX // ids are stored in 2 bytes
+#define DICT_MIN_LENGTH 4	    // shorter strings stay literal, a reference is 2 bytes
+#define INDEX_EMPTY 0
+#define INDEX_DELETED UINT32_MAX
+
+struct dict_entry
+{
+	uint32_t refcount; // 0 for ids on the free list
+	uint32_t hash;
+	uint8_t length;
+	uint8_t *bytes;
+};
+
+/**
+ * @brief Dictionary shared by every stored value of the node. Entries are looked up
+ *        by content through an open-addressing index of id + 1 and freed when the
+ *        last value referencing them is released.
+ */
+static struct
+{
+	bool enabled;
+	struct dict_entry *entries; // indexed by id
+	size_t entry_capacity;
+	size_t next_id;		    // ids below this have been handed out at least once
+	uint16_t *free_ids;
+	size_t free_count;
+	uint32_t *index;
+	size_t index_capacity; // power of two
+	size_t index_used;     // live and deleted index slots
+	size_t live;
+	size_t bytes;
+} dict;
+
+static uint32_t string_hash(const uint8_t *bytes, uint8_t length)
+{
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (uint8_t i = 0; i < length; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+static void put_u16(uint8_t *out, uint16_t value)
+{
+	out[0] = value & 0xff;
+	out[1] = value >> 8;
+}
+
+static uint16_t get_u16(const uint8_t *in)
+{
+	return (uint16_t)(in[0] | in[1] << 8);
+}
+
+static void index_insert(uint32_t hash, uint16_t id)
+{
+	size_t mask = dict.index_capacity - 1;
+	size_t i = hash & mask;
+	while (dict.index[i] != INDEX_EMPTY && dict.index[i] != INDEX_DELETED)
+		i = (i + 1) & mask;
+	if (dict.index[i] == INDEX_EMPTY)
+		dict.index_used++;
+	dict.index[i] = (uint32_t)id + 1;
+}
+
+static bool index_rebuild(size_t capacity)
+{
+	uint32_t *index = calloc(capacity, sizeof(uint32_t));
+	if (!index)
+		return false;
+
+	free(dict.index);
+	dict.index = index;
+	dict.index_capacity = capacity;
+	dict.index_used = 0;
+	for (size_t id = 0; id < dict.next_id; id++)
+	{
+		if (dict.entries[id].refcount > 0)
+			index_insert(dict.entries[id].hash, (uint16_t)id);
+	}
+	return true;
+}
+
+/**
+ * @brief Finds or adds a string and takes a reference to it.
+ *
+ * @return int The id, or -1 if the string is too short or the dictionary is full.
+ */
+static int intern(const uint8_t *bytes, uint8_t length)
+{
+	if (length < DICT_MIN_LENGTH)
+		return -1;
+
+	// keep the index at most 3/4 full, counting deleted slots
+	if ((dict.index_used + 1) * 4 > dict.index_capacity * 3)
+	{
+		size_t capacity = dict.index_capacity ? dict.index_capacity : 256;
+		if ((dict.live + 1) * 2 > capacity)
+			capacity *= 2;
+		if (!index_rebuild(capacity))
+			return -1;
+	}
+
+	uint32_t hash = string_hash(bytes, length);
+	size_t mask = dict.index_capacity - 1;
+	for (size_t i = hash & mask; dict.index[i] != INDEX_EMPTY; i = (i + 1) & mask)
+	{
+		if (dict.index[i] == INDEX_DELETED)
+			continue;
+		struct dict_entry *entry = &dict.entries[dict.index[i] - 1];
+		if (entry->hash == hash && entry->length == length && memcmp(entry->bytes, bytes, length) == 0)
+		{
+			entry->refcount++;
+			return dict.index[i] - 1;
+		}
+	}
+
+	uint16_t id;
+	if (dict.free_count > 0)
+		id = dict.free_ids[--dict.free_count];
+	else if (dict.next_id < DICT_MAX_ENTRIES)
+	{
+		if (dict.next_id == dict.entry_capacity)
+		{
+			size_t capacity = dict.entry_capacity ? dict.entry_capacity * 2 : 256;
+			struct dict_entry *entries = realloc(dict.entries, capacity * sizeof(struct dict_entry));
+			uint16_t *free_ids = realloc(dict.free_ids, capacity * sizeof(uint16_t));
+			if (entries)
+				dict.entries = entries;
+			if (free_ids)
+				dict.free_ids = free_ids;
+			if (!entries || !free_ids)
+				return -1;
+			dict.entry_capacity = capacity;
+		}
+		id = (uint16_t)dict.next_id++;
+	}
+	else
+		return -1;
+
+	struct dict_entry *entry = &dict.entries[id];
+	entry->bytes = malloc(length);
+	if (!entry->bytes)
+	{
+		dict.free_ids[dict.free_count++] = id;
+		entry->refcount = 0;
+		return -1;
+	}
+	memcpy(entry->bytes, bytes, length);
+	entry->length = length;
+	entry->hash = hash;
+	entry->refcount = 1;
+	index_insert(hash, id);
+	dict.live++;
+	dict.bytes += length;
+	return id;
+}
+
+static void release(uint16_t id)
+{
+	struct dict_entry *entry = &dict.entries[id];
+	if (--entry->refcount > 0)
+		return;
+
+	size_t mask = dict.index_capacity - 1;
+	for (size_t i = entry->hash & mask; dict.index[i] != INDEX_EMPTY; i = (i + 1) & mask)
+	{
+		if (dict.index[i] == (uint32_t)id + 1)
+		{
+			dict.index[i] = INDEX_DELETED;
+			break;
+		}
+	}
+	dict.live--;
+	dict.bytes -= entry->length;
+	free(entry->bytes);
+	entry->bytes = NULL;
+	dict.free_ids[dict.free_count++] = id;
+}
+
+void value_codec_enable(bool enabled)
+{
+	dict.enabled = enabled;
+}
+
+bool value_codec_enabled(void)
+{
+	return dict.enabled;
+}
+
+size_t value_encode(uint8_t *out, uint8_t *flags, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
+{
+	uint8_t *p = out;
+	*flags = VALUE_COMPRESSED;
+
+	int name_id = intern(name, name_length);
+	if (name_id >= 0)
+	{
+		*flags |= VALUE_NAME_REF;
+		put_u16(p, (uint16_t)name_id);
+		p += 2;
+	}
+	else
+	{
+		memcpy(p, name, name_length);
+		p += name_length;
+	}
+
+	// emails are commonly the name, a literal part and a shared domain
+	size_t literal_start = 0;
+	size_t literal_end = email_length;
+	if (name_length > 0 && email_length >= name_length && memcmp(email, name, name_length) == 0)
+	{
+		*flags |= VALUE_EMAIL_NAME_PREFIX;
+		literal_start = name_length;
+	}
+
+	const uint8_t *at = NULL;
+	for (size_t i = email_length; i > literal_start; i--)
+	{
+		if (email[i - 1] == '@')
+		{
+			at = &email[i - 1];
+			break;
+		}
+	}
+	int domain_id = -1;
+	if (at)
+	{
+		domain_id = intern(at + 1, (uint8_t)(email + email_length - at - 1));
+		if (domain_id >= 0)
+		{
+			*flags |= VALUE_EMAIL_DOMAIN_REF;
+			literal_end = at - email;
+		}
+	}
+
+	*p++ = (uint8_t)(literal_end - literal_start);
+	memcpy(p, email + literal_start, literal_end - literal_start);
+	p += literal_end - literal_start;
+	if (domain_id >= 0)
+	{
+		put_u16(p, (uint16_t)domain_id);
+		p += 2;
+	}
+
+	return p - out;
+}
+
+void value_fields(const struct value_pair *pair, struct value_fields *fields)
+{
+	if (!(pair->flags & VALUE_COMPRESSED))
+	{
+		fields->name = pair->data;
+		fields->email = pair->data + pair->name_length;
+		return;
+	}
+
+	const uint8_t *p = pair->data;
+	if (pair->flags & VALUE_NAME_REF)
+	{
+		fields->name = dict.entries[get_u16(p)].bytes;
+		p += 2;
+	}
+	else
+	{
+		fields->name = p;
+		p += pair->name_length;
+	}
+
+	uint8_t literal_length = *p++;
+	if (!(pair->flags & (VALUE_EMAIL_NAME_PREFIX | VALUE_EMAIL_DOMAIN_REF)))
+	{
+		fields->email = p;
+		return;
+	}
+
+	uint8_t *email = fields->email_scratch;
+	if (pair->flags & VALUE_EMAIL_NAME_PREFIX)
+	{
+		memcpy(email, fields->name, pair->name_length);
+		email += pair->name_length;
+	}
+	memcpy(email, p, literal_length);
+	email += literal_length;
+	p += literal_length;
+	if (pair->flags & VALUE_EMAIL_DOMAIN_REF)
+	{
+		struct dict_entry *domain = &dict.entries[get_u16(p)];
+		*email++ = '@';
+		memcpy(email, domain->bytes, domain->length);
+	}
+	fields->email = fields->email_scratch;
+}
+
+size_t value_size(const struct value_pair *pair)
+{
+	if (!(pair->flags & VALUE_COMPRESSED))
+		return sizeof(struct value_pair) + pair->name_length + pair->email_length;
+
+	const uint8_t *p = pair->data;
+	p += (pair->flags & VALUE_NAME_REF) ? 2 : pair->name_length;
+	p += 1 + *p;
+	if (pair->flags & VALUE_EMAIL_DOMAIN_REF)
+		p += 2;
+	return sizeof(struct value_pair) + (p - pair->data);
+}
+
+void value_release(const struct value_pair *pair)
+{
+	if (!(pair->flags & VALUE_COMPRESSED))
+		return;
+
+	const uint8_t *p = pair->data;
+	if (pair->flags & VALUE_NAME_REF)
+	{
+		release(get_u16(p));
+		p += 2;
+	}
+	else
+		p += pair->name_length;
+
+	if (pair->flags & VALUE_EMAIL_DOMAIN_REF)
+	{
+		uint8_t literal_length = *p++;
+		release(get_u16(p + literal_length));
+	}
+}
+
+size_t value_dictionary_entries(void)
+{
+	return dict.live;
+}
+
+size_t value_dictionary_bytes(void)
+{
+	return dict.bytes;
+}
+
+size_t value_dictionary_memory(void)
+{
+	return dict.bytes + dict.entry_capacity * (sizeof(struct dict_entry) + sizeof(uint16_t)) +
+	       dict.index_capacity * sizeof(uint32_t);
+}
@@ -0,0 +1,99 @@
+#ifndef VALUE_CODEC_H
+#define VALUE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// value_pair flags
+#define VALUE_COMPRESSED 0x01	     // data holds the encoded form below instead of name and email
+#define VALUE_NAME_REF 0x02	     // name is a dictionary reference
+#define VALUE_EMAIL_NAME_PREFIX 0x04 // email starts with the name
+#define VALUE_EMAIL_DOMAIN_REF 0x08  // email ends with '@' followed by a dictionary entry
+
+#define VALUE_MAX_ENCODED (2 * UINT8_MAX + 8)
+
+/**
+ * @brief A stored entry. One slab object holds both lengths and the name and email bytes back to back,
+ *        the key is kept packed in the hash table.
+ *
+ * A compressed entry stores, in order: the name as a 2 byte dictionary id or literal bytes, the length
+ * of the email literal, the literal, and the 2 byte dictionary id of the email domain if there is one.
+ * name_length and email_length are always the decoded lengths.
+ */
+struct value_pair
+{
+	uint8_t name_length;
+	uint8_t email_length;
+	uint8_t flags;
+	uint8_t access; // recent lookups, aged by the tiering clock sweep
+	uint8_t data[]; // name followed by email, no null-termination
+};
+
+/**
+ * @brief Decoded views of a value_pair. Points into the record or the dictionary, only a
+ *        compressed email is assembled in the scratch buffer.
+ */
+struct value_fields
+{
+	const uint8_t *name;
+	const uint8_t *email;
+	uint8_t email_scratch[UINT8_MAX];
+};
+
+/**
+ * @brief Turns dictionary compression of new values on or off. Stored values keep their encoding.
+ *
+ * @param enabled true to compress values created from now on.
+ */
+void value_codec_enable(bool enabled);
+
+/**
+ * @brief Whether new values are compressed.
+ */
+bool value_codec_enabled(void);
+
+/**
+ * @brief Encodes name and email into out, interning the name and the email domain in the shared
+ *        dictionary. Takes a dictionary reference for every id written.
+ *
+ * @param out At least VALUE_MAX_ENCODED bytes.
+ * @param flags Set to the VALUE_* flags describing the encoding.
+ * @return size_t Number of bytes written to out.
+ */
+size_t value_encode(uint8_t *out, uint8_t *flags, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email);
+
+/**
+ * @brief Makes name and email of a value_pair readable, decoding compressed emails into the scratch buffer.
+ *
+ * @param pair The stored entry.
+ * @param fields Filled in with pointers to name_length and email_length bytes.
+ */
+void value_fields(const struct value_pair *pair, struct value_fields *fields);
+
+/**
+ * @brief Number of bytes a value_pair occupies, header included.
+ *
+ * @param pair The stored entry.
+ */
+size_t value_size(const struct value_pair *pair);
+
+/**
+ * @brief Drops the dictionary references held by a value_pair without freeing the record itself.
+ *
+ * @param pair The stored entry, plain entries are ignored.
+ */
+void value_release(const struct value_pair *pair);
+
+/**
+ * @brief Number of live dictionary entries and the bytes their strings use.
+ */
+size_t value_dictionary_entries(void);
+size_t value_dictionary_bytes(void);
+
+/**
+ * @brief Bytes the dictionary allocates, its strings, entry table and index.
+ */
+size_t value_dictionary_memory(void);
+
+#endif // VALUE_CODEC_H
@@ -0,0 +1,41 @@
+/**
+ * File: check.h
+ * Checks shared by the unit tests under test/. A failed CHECK prints the condition
+ * and the test goes on, check_report() prints the outcome at the end of main.
+ */
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int check_failures;
+
+#define CHECK(condition)                                                              \
+	do                                                                            \
+	{                                                                             \
+		if (!(condition))                                                     \
+		{                                                                     \
+			fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+			check_failures++;                                             \
+		}                                                                     \
+	} while (0)
+
+/**
+ * @brief Prints whether every check of the test passed.
+ *
+ * @param test Name of the test.
+ * @return int The exit status for main, EXIT_FAILURE if a check failed.
+ */
+static inline int check_report(const char *test)
+{
+	if (check_failures > 0)
+	{
+		fprintf(stderr, "%s: %d checks failed\n", test, check_failures);
+		return EXIT_FAILURE;
+	}
+	printf("%s: ok\n", test);
+	return EXIT_SUCCESS;
+}
+
+#endif // CHECK_H
@@ -0,0 +1,184 @@
+/**
+ * File: test_byte_ring.c
+ * Tests of the stream buffers: bytes appended or read past the end of the buffer wrap
+ * around to the front and come out in order, also after the ring grows.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "byte_ring.h"
+#include "memory.h"
+#include "check.h"
+
+static ssize_t tracked; // bytes reported to memory_track()
+
+// the ring only needs these two from the node
+void memory_track(enum memory_category category, ssize_t delta)
+{
+	tracked += delta;
+}
+
+void exit_with_error(const char *msg, struct self_data *my_data)
+{
+	fprintf(stderr, "%s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Byte number i of the test stream.
+ */
+static uint8_t stream_byte(size_t i)
+{
+	return (uint8_t)(i * 7 + i / 251);
+}
+
+static void append_stream(struct byte_ring *ring, size_t *written, size_t length)
+{
+	uint8_t *bytes = malloc(length);
+	for (size_t i = 0; i < length; i++)
+		bytes[i] = stream_byte(*written + i);
+	byte_ring_append(ring, bytes, length);
+	*written += length;
+	free(bytes);
+}
+
+/**
+ * @brief Checks that the ring holds the stream from byte consumed on, by peeking and through its spans.
+ */
+static void check_stream(const struct byte_ring *ring, size_t consumed, size_t written)
+{
+	CHECK(ring->length == written - consumed);
+	bool in_order = true;
+	for (size_t i = 0; i < ring->length; i++)
+		in_order &= byte_ring_peek(ring, i) == stream_byte(consumed + i);
+	CHECK(in_order);
+
+	struct iovec iov[2];
+	int count = byte_ring_spans(ring, iov);
+	size_t at = consumed;
+	for (int span = 0; span < count; span++)
+	{
+		const uint8_t *bytes = iov[span].iov_base;
+		for (size_t i = 0; i < iov[span].iov_len; i++)
+			in_order &= bytes[i] == stream_byte(at++);
+	}
+	CHECK(in_order);
+	CHECK(at == written);
+}
+
+/**
+ * @brief Appends and consumes so the unread bytes wrap around the end of the buffer.
+ */
+static void test_append_wraparound(void)
+{
+	struct byte_ring ring = {0};
+	size_t written = 0, consumed = 0;
+	struct iovec iov[2];
+	CHECK(byte_ring_spans(&ring, iov) == 0);
+
+	append_stream(&ring, &written, BYTE_RING_INITIAL_CAPACITY - 100);
+	CHECK(ring.capacity == BYTE_RING_INITIAL_CAPACITY);
+	CHECK(tracked == BYTE_RING_INITIAL_CAPACITY);
+	byte_ring_consume(&ring, BYTE_RING_INITIAL_CAPACITY - 1000);
+	consumed += BYTE_RING_INITIAL_CAPACITY - 1000;
+
+	// 900 bytes fit before the end of the buffer, the rest goes to the front
+	append_stream(&ring, &written, 5000);
+	CHECK(ring.capacity == BYTE_RING_INITIAL_CAPACITY);
+	CHECK(byte_ring_spans(&ring, iov) == 2);
+	CHECK(iov[0].iov_len == 1000);
+	CHECK(iov[1].iov_len == 4900);
+	check_stream(&ring, consumed, written);
+
+	// a PDU across the end is made contiguous without changing the stream
+	uint8_t *pdu = byte_ring_contiguous(&ring, 3000);
+	bool in_order = true;
+	for (size_t i = 0; i < 3000; i++)
+		in_order &= pdu[i] == stream_byte(consumed + i);
+	CHECK(in_order);
+	check_stream(&ring, consumed, written);
+	byte_ring_consume(&ring, 3000);
+	consumed += 3000;
+	check_stream(&ring, consumed, written);
+
+	// consuming past the end of the buffer wraps the head
+	append_stream(&ring, &written, BYTE_RING_INITIAL_CAPACITY - ring.length - ring.head + 10);
+	size_t past_end = ring.capacity - ring.head + 5;
+	byte_ring_consume(&ring, past_end);
+	consumed += past_end;
+	CHECK(ring.head == 5);
+	check_stream(&ring, consumed, written);
+	byte_ring_free(&ring);
+	CHECK(tracked == 0);
+}
+
+/**
+ * @brief Grows a ring whose unread bytes wrap around, they must keep their order.
+ */
+static void test_grow_wrapped(void)
+{
+	struct byte_ring ring = {0};
+	size_t written = 0, consumed = 0;
+	append_stream(&ring, &written, BYTE_RING_INITIAL_CAPACITY - 10);
+	byte_ring_consume(&ring, 30000);
+	consumed += 30000;
+	append_stream(&ring, &written, 20000);
+	struct iovec iov[2];
+	CHECK(byte_ring_spans(&ring, iov) == 2);
+
+	append_stream(&ring, &written, 3 * BYTE_RING_INITIAL_CAPACITY);
+	CHECK(ring.capacity == 4 * BYTE_RING_INITIAL_CAPACITY);
+	CHECK(tracked == 4 * BYTE_RING_INITIAL_CAPACITY);
+	check_stream(&ring, consumed, written);
+	byte_ring_free(&ring);
+	CHECK(tracked == 0);
+}
+
+/**
+ * @brief Reads from a socket into free space that wraps around the end of the buffer.
+ */
+static void test_read_wraparound(void)
+{
+	struct byte_ring ring = {0};
+	size_t written = 0, consumed = 0, sent;
+	int fds[2];
+	CHECK(pipe(fds) == 0);
+
+	append_stream(&ring, &written, BYTE_RING_INITIAL_CAPACITY - 4000);
+	byte_ring_consume(&ring, BYTE_RING_INITIAL_CAPACITY - 20000);
+	consumed += BYTE_RING_INITIAL_CAPACITY - 20000;
+
+	uint8_t bytes[24000];
+	sent = sizeof(bytes);
+	for (size_t i = 0; i < sent; i++)
+		bytes[i] = stream_byte(written + i);
+	CHECK(write(fds[1], bytes, sent) == (ssize_t)sent);
+	size_t received = 0;
+	while (received < sent)
+	{
+		ssize_t bytes_read = byte_ring_read(&ring, fds[0]);
+		CHECK(bytes_read > 0);
+		if (bytes_read <= 0)
+			break;
+		received += bytes_read;
+	}
+	written += received;
+	CHECK(ring.capacity == BYTE_RING_INITIAL_CAPACITY); // there was room, the read wrapped instead of growing
+	struct iovec iov[2];
+	CHECK(byte_ring_spans(&ring, iov) == 2);
+	check_stream(&ring, consumed, written);
+
+	byte_ring_consume(&ring, ring.length);
+	byte_ring_free(&ring);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(void)
+{
+	test_append_wraparound();
+	test_grow_wrapped();
+	test_read_wraparound();
+	return check_report("test_byte_ring");
+}
@@ -0,0 +1,217 @@
+/**
+ * File: test_hashtable.c
+ * Tests of the open-addressing hashtable: entries across a resize, reuse of deleted
+ * slots and lookups while a resize is still moving entries to the new table.
+ * Every key of the tests hashes to one slot, so they fill a single slot's table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "hashtable.h"
+#include "check.h"
+
+#define TEST_SLOT 42
+#define SLOT_KEYS 20100 // the most keys a test uses
+
+static char slot_keys[SLOT_KEYS][KEY_LEN];
+
+/**
+ * @brief Collects the first SLOT_KEYS twelve digit numbers that hash to TEST_SLOT.
+ */
+static void find_slot_keys(void)
+{
+	char text[24];
+	for (long number = 0, found = 0; found < SLOT_KEYS; number++)
+	{
+		snprintf(text, sizeof(text), "%012ld", number);
+		if (hash_ssn(text) == TEST_SLOT)
+			memcpy(slot_keys[found++], text, KEY_LEN);
+	}
+}
+
+/**
+ * @brief Writes the i-th key of the test slot.
+ */
+static void make_key(int i, char key[KEY_LEN])
+{
+	memcpy(key, slot_keys[i], KEY_LEN);
+}
+
+/**
+ * @brief The value stored for the i-th key, distinct for every key.
+ */
+static void *value_of(int i)
+{
+	return (void *)(intptr_t)(i + 1);
+}
+
+/**
+ * @brief Slots allocated for the test slot, of the current table and of one being drained.
+ */
+static size_t slot_capacity(struct ht *table, hash_t slot)
+{
+	struct ht_memory memory;
+	ht_slot_memory(table, slot, &memory);
+	return memory.keys / SSN_KEY_BYTES;
+}
+
+static bool is_power_of_two(size_t n)
+{
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+static void count_entry(const char *key, void *value, void *arg)
+{
+	(*(int *)arg)++;
+}
+
+/**
+ * @brief Inserts enough keys into one slot to resize its table several times, then removes
+ *        every other key. Every key must be found with its value until it is removed.
+ */
+static void test_resize(void)
+{
+	const int count = 5000;
+	struct ht *table = ht_create(NULL);
+	char key[KEY_LEN];
+	make_key(0, key);
+	hash_t slot = hash_ssn(key);
+
+	for (int i = 0; i < count; i++)
+	{
+		make_key(i, key);
+		CHECK(hash_ssn(key) == slot);
+		ht_insert(table, key, value_of(i));
+	}
+	CHECK(get_num_entries(table) == count);
+	CHECK(ht_slot_entries(table, slot) == count);
+	CHECK(slot_capacity(table, slot) >= (size_t)count);
+
+	// inserting an existing key replaces its value
+	make_key(7, key);
+	ht_insert(table, key, value_of(70));
+	CHECK(ht_lookup(table, key) == value_of(70));
+	ht_insert(table, key, value_of(7));
+	CHECK(get_num_entries(table) == count);
+
+	for (int i = 0; i < count; i++)
+	{
+		make_key(i, key);
+		CHECK(ht_lookup(table, key) == value_of(i));
+	}
+	for (int i = 0; i < count; i += 2)
+	{
+		make_key(i, key);
+		ht_remove(table, key);
+	}
+	CHECK(get_num_entries(table) == count / 2);
+	for (int i = 0; i < count; i++)
+	{
+		make_key(i, key);
+		CHECK(ht_lookup(table, key) == (i % 2 ? value_of(i) : NULL));
+	}
+
+	int visited = 0;
+	ht_foreach_in_slot(table, slot, count_entry, &visited);
+	CHECK(visited == count / 2);
+	ht_destroy(table);
+}
+
+/**
+ * @brief Removes and inserts keys for many rounds while the number of entries stays the same.
+ *        Deleted slots have to be reused or cleared by a rehash, so the table must not grow.
+ */
+static void test_tombstone_reuse(void)
+{
+	const int live = 100, rounds = 20000;
+	struct ht *table = ht_create(NULL);
+	char key[KEY_LEN];
+	make_key(0, key);
+	hash_t slot = hash_ssn(key);
+
+	for (int i = 0; i < live; i++)
+	{
+		make_key(i, key);
+		ht_insert(table, key, value_of(i));
+	}
+	size_t capacity = slot_capacity(table, slot);
+
+	for (int i = live; i < live + rounds; i++)
+	{
+		make_key(i - live, key);
+		ht_remove(table, key);
+		make_key(i, key);
+		ht_insert(table, key, value_of(i));
+		CHECK(slot_capacity(table, slot) <= 4 * capacity); // one doubling, a rehash in progress holds two tables
+	}
+	CHECK(get_num_entries(table) == live);
+	CHECK(slot_capacity(table, slot) <= 4 * capacity);
+	for (int i = 0; i < live + rounds; i++)
+	{
+		make_key(i, key);
+		CHECK(ht_lookup(table, key) == (i < rounds ? NULL : value_of(i)));
+	}
+	ht_destroy(table);
+}
+
+/**
+ * @brief Stops inserting right after a resize has started, while most entries are still in the
+ *        old table. Lookups, iteration and removes must see entries in both tables.
+ */
+static void test_lookup_during_migration(void)
+{
+	struct ht *table = ht_create(NULL);
+	char key[KEY_LEN];
+	make_key(0, key);
+	hash_t slot = hash_ssn(key);
+	int inserted = 0;
+
+	// a table of 256 slots or more is drained over several operations
+	while (inserted < SLOT_KEYS / 2 && (slot_capacity(table, slot) < 256 || is_power_of_two(slot_capacity(table, slot))))
+	{
+		make_key(inserted, key);
+		ht_insert(table, key, value_of(inserted));
+		inserted++;
+	}
+	CHECK(!is_power_of_two(slot_capacity(table, slot)));
+
+	for (int i = 0; i < inserted; i++)
+	{
+		make_key(i, key);
+		CHECK(ht_lookup(table, key) == value_of(i));
+	}
+	int visited = 0;
+	ht_foreach_in_slot(table, slot, count_entry, &visited);
+	CHECK(visited == inserted);
+	CHECK(ht_slot_entries(table, slot) == inserted);
+
+	// the oldest keys are the least likely to have been moved yet
+	for (int i = 0; i < 8; i++)
+	{
+		make_key(i, key);
+		ht_remove(table, key);
+		CHECK(ht_lookup(table, key) == NULL);
+	}
+	CHECK(get_num_entries(table) == inserted - 8);
+
+	// the rest of the migration keeps every entry
+	for (int i = inserted; i < 2 * inserted; i++)
+	{
+		make_key(i, key);
+		ht_insert(table, key, value_of(i));
+	}
+	for (int i = 8; i < 2 * inserted; i++)
+	{
+		make_key(i, key);
+		CHECK(ht_lookup(table, key) == value_of(i));
+	}
+	ht_destroy(table);
+}
+
+int main(void)
+{
+	find_slot_keys();
+	test_resize();
+	test_tombstone_reuse();
+	test_lookup_during_migration();
+	return check_report("test_hashtable");
+}
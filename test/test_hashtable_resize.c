@@ -0,0 +1,91 @@
+/**
+ * File: test_hashtable_resize.c
+ * Tests a resize that starts while the previous one is still draining. Through the public
+ * API the new table cannot fill up before the old one is empty, so the test includes
+ * hashtable.c and marks free slots of the new table deleted, as removes would have.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "hashtable.c"
+#include "check.h"
+
+#define TEST_SLOT 42
+#define SLOT_KEYS 1000
+
+static char slot_keys[SLOT_KEYS][KEY_LEN];
+
+/**
+ * @brief Collects the first SLOT_KEYS twelve digit numbers that hash to TEST_SLOT.
+ */
+static void find_slot_keys(void)
+{
+	char text[24];
+	for (long number = 0, found = 0; found < SLOT_KEYS; number++)
+	{
+		snprintf(text, sizeof(text), "%012ld", number);
+		if (hash_ssn(text) == TEST_SLOT)
+			memcpy(slot_keys[found++], text, KEY_LEN);
+	}
+}
+
+static void *value_of(int i)
+{
+	return (void *)(intptr_t)(i + 1);
+}
+
+/**
+ * @brief Fills the current table with deleted slots right after a resize of a 256 slot table
+ *        has started, so the next insert resizes again with most groups of the old table left.
+ *        That resize must first move them all, no entry may be lost.
+ */
+static void test_resize_during_migration(void)
+{
+	struct ht *table = ht_create(NULL);
+	struct ht_partition *p = &table->partitions[TEST_SLOT];
+	int inserted = 0;
+
+	while (inserted < SLOT_KEYS && p->old.capacity < 256)
+	{
+		ht_insert(table, slot_keys[inserted], value_of(inserted));
+		inserted++;
+	}
+	CHECK(p->old.capacity == 256);
+	CHECK(p->migrate_group > 0);
+
+	for (size_t slot = 0; slot < p->cur.capacity && (p->cur.used + p->cur.tombstones + 1) * 8 <= p->cur.capacity * 7; slot++)
+	{
+		if (p->cur.ctrl[slot] == CTRL_EMPTY)
+		{
+			p->cur.ctrl[slot] = CTRL_DELETED;
+			p->cur.tombstones++;
+		}
+	}
+	size_t migrate_group = p->migrate_group;
+	size_t capacity = p->cur.capacity;
+
+	ht_insert(table, slot_keys[inserted], value_of(inserted));
+	inserted++;
+	CHECK(p->old.capacity == capacity); // the table full of deleted slots is drained next
+	CHECK(p->cur.capacity == 2 * capacity);
+	CHECK(p->migrate_group == MIGRATE_GROUPS);
+	CHECK(migrate_group + MIGRATE_GROUPS < 256 / GROUP_WIDTH); // the second resize did find groups left to move
+
+	CHECK(get_num_entries(table) == inserted);
+	CHECK(ht_slot_entries(table, TEST_SLOT) == inserted);
+	for (int i = 0; i < inserted; i++)
+		CHECK(ht_lookup(table, slot_keys[i]) == value_of(i));
+
+	for (; inserted < SLOT_KEYS; inserted++)
+		ht_insert(table, slot_keys[inserted], value_of(inserted));
+	for (int i = 0; i < SLOT_KEYS; i++)
+		CHECK(ht_lookup(table, slot_keys[i]) == value_of(i));
+	CHECK(ht_slot_entries(table, TEST_SLOT) == SLOT_KEYS);
+	ht_destroy(table);
+}
+
+int main(void)
+{
+	find_slot_keys();
+	test_resize_during_migration();
+	return check_report("test_hashtable_resize");
+}
@@ -0,0 +1,184 @@
+/**
+ * File: test_log.c
+ * Tests of the deferred logger: a record formatted by the drainer reads the same as
+ * snprintf() of its format and arguments. No drainer thread is started, log_shutdown()
+ * formats what was logged so far into a pipe that stands in for stdout and stderr.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "log.h"
+#include "check.h"
+
+#define OUTPUT_MAX 65536 // what the pipe holds without a reader
+
+static int pipe_fds[2];
+static char expected[OUTPUT_MAX];
+static size_t expected_length;
+
+/**
+ * @brief Adds a line the next drain must write.
+ */
+static void expect(const char *line)
+{
+	size_t length = strlen(line);
+	if (expected_length + length + 1 <= sizeof(expected))
+	{
+		memcpy(expected + expected_length, line, length);
+		expected[expected_length + length] = '\n';
+	}
+	expected_length += length + 1;
+}
+
+/**
+ * @brief Writes the records logged so far into the pipe and compares them with the expected lines.
+ */
+static void check_output(void)
+{
+	int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+	dup2(pipe_fds[1], STDOUT_FILENO);
+	dup2(pipe_fds[1], STDERR_FILENO);
+	log_shutdown();
+	dup2(saved_out, STDOUT_FILENO);
+	dup2(saved_err, STDERR_FILENO);
+	close(saved_out);
+	close(saved_err);
+
+	static char output[OUTPUT_MAX];
+	size_t length = 0;
+	ssize_t ret;
+	while (length < sizeof(output) && (ret = read(pipe_fds[0], output + length, sizeof(output) - length)) > 0)
+		length += ret;
+	CHECK(expected_length <= sizeof(expected));
+	CHECK(length == expected_length);
+	CHECK(memcmp(output, expected, length < expected_length ? length : expected_length) == 0);
+	expected_length = 0;
+}
+
+// logs a record and expects what snprintf() makes of the same format and arguments
+#define LOG_AND_EXPECT(...)                                          \
+	do                                                           \
+	{                                                            \
+		static char line_[LOG_RECORD_MAX + 64];              \
+		log_at(LOG_LEVEL_INFO, __VA_ARGS__);                 \
+		snprintf(line_, sizeof(line_), __VA_ARGS__);         \
+		expect(line_);                                       \
+	} while (0)
+
+static void test_conversions(void)
+{
+	LOG_AND_EXPECT("%d %u %x %ld %lld %zu %jd %td %c", -7, 7u, 255, -1L << 40, 1LL << 50, (size_t)42, (intmax_t)-3, (ptrdiff_t)9, 'q');
+	LOG_AND_EXPECT("%hd %hhu %08.3f %-6s| %e %g %p", (short)-5, (unsigned char)200, 3.14159, "ab", 1e-7, 2.5, (void *)0x1234);
+	LOG_AND_EXPECT("[%*d] [%-*d] [%.*f] [%*.*s]", 6, 42, 5, -1, 2, 2.71828, 8, 3, "abcdef");
+	LOG_AND_EXPECT("100%% of %s%%", "it");
+	LOG_AND_EXPECT("no arguments");
+	const char *volatile missing = NULL; // hidden from the compiler, which warns about a null %s
+	LOG_AND_EXPECT("%s and %s", "first", missing);
+	check_output();
+}
+
+/**
+ * @brief A precision read from the argument before the string bounds what is copied, the bytes
+ *        after it need not even be terminated.
+ */
+static void test_star_precision_string(void)
+{
+	const char unterminated[4] = {'w', 'x', 'y', 'z'};
+	LOG_AND_EXPECT("%.*s|", 3, unterminated);
+	LOG_AND_EXPECT("%.*s|%d", 0, unterminated, 5);
+	LOG_AND_EXPECT("%-*.*s|", 7, 4, unterminated);
+	check_output();
+
+	// copied whole, these records would not fit in the ring and some would be dropped
+	static char long_string[LOG_RECORD_MAX];
+	memset(long_string, 'l', sizeof(long_string) - 1);
+	for (int i = 0; i < 2 * LOG_RING_SIZE / LOG_RECORD_MAX; i++)
+		LOG_AND_EXPECT("%d %.*s", i, 2, long_string);
+	check_output();
+}
+
+/**
+ * @brief What snprintf() cannot be compared with: a trailing % and conversions the logger does
+ *        not store are written as they are, with the rest of the format.
+ */
+static void test_written_as_is(void)
+{
+	// built at run time, the compiler would reject them as literals
+	static char trailing[32], unsupported[32];
+	snprintf(trailing, sizeof(trailing), "%s %c", "at the end", '%');
+	snprintf(unsupported, sizeof(unsupported), "a %s b %cLf c %cd", "%d", '%', '%');
+
+	static struct log_site trailing_site = {.level = LOG_LEVEL_WARN}, unsupported_site = {.level = LOG_LEVEL_INFO};
+	trailing_site.format = trailing;
+	unsupported_site.format = unsupported;
+	log_write(&trailing_site, trailing, 0);
+	log_write(&unsupported_site, unsupported, 1, 1.5L, 2);
+	expect("at the end %");
+	expect("a 1 b %Lf c %d");
+	check_output();
+}
+
+/**
+ * @brief A string longer than a record is cut so the arguments after it still fit.
+ */
+static void test_truncation(void)
+{
+	static char long_string[2 * LOG_RECORD_MAX];
+	memset(long_string, 's', sizeof(long_string) - 1);
+
+	static struct log_site site = {.format = "%s|%d", .level = LOG_LEVEL_INFO};
+	log_write(&site, "%s|%d", long_string, 77);
+	int saved_out = dup(STDOUT_FILENO);
+	dup2(pipe_fds[1], STDOUT_FILENO);
+	log_shutdown();
+	dup2(saved_out, STDOUT_FILENO);
+	close(saved_out);
+
+	static char output[OUTPUT_MAX];
+	ssize_t length = read(pipe_fds[0], output, sizeof(output));
+	CHECK(length > LOG_RECORD_MAX - 64 && length < LOG_RECORD_MAX);
+	CHECK(length > 4 && memcmp(output + length - 4, "|77\n", 4) == 0);
+	CHECK(length > 4 && strspn(output, "s") == (size_t)length - 4);
+}
+
+/**
+ * @brief Logs several times the ring in records whose sizes do not divide it, draining between
+ *        batches. A record that does not fit before the end of the ring goes behind a filler
+ *        record, which must not show up in the output.
+ */
+static void test_wraparound(void)
+{
+	static char text[1200];
+	memset(text, 't', sizeof(text) - 1);
+	size_t logged = 0;
+	for (int batch = 0; logged < 3 * LOG_RING_SIZE; batch++)
+	{
+		for (int i = 0; i < 40; i++)
+		{
+			int length = 900 + (batch * 40 + i) % 97;
+			LOG_AND_EXPECT("record %d.%d %.*s", batch, i, length, text);
+			logged += length + 32;
+		}
+		check_output();
+	}
+}
+
+int main(void)
+{
+	if (pipe(pipe_fds) < 0)
+	{
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK); // everything is written before it is read
+	test_conversions();
+	test_star_precision_string();
+	test_written_as_is();
+	test_truncation();
+	test_wraparound();
+	return check_report("test_log");
+}
@@ -0,0 +1,338 @@
+/**
+ * File: test_persistence.c
+ * Tests of recovery from the data directory: replaying the log, stopping at a torn
+ * last record and loading a snapshot followed by the segments written after it.
+ * A node "crashes" by dropping its state without any shutdown, the next one recovers
+ * from what is on disk. The store is reduced to the hash table, the functions of the
+ * node that persistence.c calls are provided below.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hash_handling.h"
+#include "snapshot.h"
+#include "check.h"
+
+#define KEYS 3000
+#define DROPPED_SLOT 17
+
+static struct self_data node;
+static char dir[] = "/tmp/test_persistence.XXXXXX";
+static char names[KEYS][16]; // the expected name of every key, empty if it is not stored
+
+// ---------------------------------------------------------------- the node, reduced to its table
+
+void store_value(struct self_data *self_data, char *ssn, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
+{
+	struct value_pair *pair = calloc(1, sizeof(struct value_pair) + name_length + email_length);
+	pair->name_length = name_length;
+	pair->email_length = email_length;
+	memcpy(pair->data, name, name_length);
+	memcpy(pair->data + name_length, email, email_length);
+	self_data->hash_table = ht_insert(self_data->hash_table, ssn, pair);
+}
+
+bool delete_value(struct self_data *self_data, char *ssn)
+{
+	if (ht_lookup(self_data->hash_table, ssn) == NULL)
+		return false;
+	self_data->hash_table = ht_remove(self_data->hash_table, ssn);
+	return true;
+}
+
+void drop_slot(struct self_data *self_data, hash_t slot)
+{
+	ht_partition_destroy(ht_detach_slot(self_data->hash_table, slot), free);
+}
+
+int check_range(struct self_data *self_data, char *ssn)
+{
+	return 0;
+}
+
+void send_slot_entries(struct self_data *self_data, hash_t slot, struct connection_point *connection)
+{
+}
+
+size_t send_queue_depth(const struct connection_point *connection)
+{
+	return 0;
+}
+
+const struct value_pair *cold_store_get(const void *ref)
+{
+	return NULL;
+}
+
+void memory_track(enum memory_category category, ssize_t delta)
+{
+}
+
+void log_write(struct log_site *site, const char *format, ...)
+{
+}
+
+void exit_with_error(const char *msg, struct self_data *my_data)
+{
+	fprintf(stderr, "%s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+// ---------------------------------------------------------------- helpers
+
+static void key_of(int i, char ssn[SSN_DIGITS])
+{
+	char text[SSN_DIGITS + 1];
+	snprintf(text, sizeof(text), "%012d", i * 7919 + 1000);
+	memcpy(ssn, text, SSN_DIGITS);
+}
+
+/**
+ * @brief Starts a node on the data directory, recovering what an earlier one left there.
+ */
+static void start_node(uint64_t snapshot_every)
+{
+	memset(&node, 0, sizeof(node));
+	node.hash_table = ht_create(free);
+	node.range_start = 0;
+	node.range_end = RING_SLOTS - 1;
+	persistence_init(&node.persistence, dir, snapshot_every);
+	persistence_recover(&node);
+}
+
+/**
+ * @brief Drops the node without writing anything more, like a crash after the last commit.
+ */
+static void crash_node(void)
+{
+	close(node.persistence.wal_fd);
+	free(node.persistence.buffer);
+	ht_destroy(node.hash_table);
+}
+
+/**
+ * @brief Inserts or replaces a key the way the handlers do: stores it and logs the change.
+ */
+static void insert(int i, const char *name)
+{
+	char ssn[SSN_DIGITS];
+	const char *email = "someone@example.com";
+	key_of(i, ssn);
+	store_value(&node, ssn, strlen(name), strlen(email), (const uint8_t *)name, (const uint8_t *)email);
+	persistence_log_insert(&node.persistence, ssn, strlen(name), strlen(email), (const uint8_t *)name, (const uint8_t *)email);
+	snprintf(names[i], sizeof(names[i]), "%s", name);
+}
+
+static void remove_key(int i)
+{
+	char ssn[SSN_DIGITS];
+	key_of(i, ssn);
+	delete_value(&node, ssn);
+	persistence_log_remove(&node.persistence, ssn);
+	names[i][0] = '\0';
+}
+
+/**
+ * @brief Checks that the node holds exactly the expected entries.
+ */
+static void check_store(void)
+{
+	int expected = 0;
+	bool matches = true;
+	for (int i = 0; i < KEYS; i++)
+	{
+		char ssn[SSN_DIGITS];
+		key_of(i, ssn);
+		const struct value_pair *pair = ht_lookup(node.hash_table, ssn);
+		size_t length = strlen(names[i]);
+		if (length == 0)
+			matches &= pair == NULL;
+		else
+			matches &= pair != NULL && pair->name_length == length && memcmp(pair->data, names[i], length) == 0;
+		expected += length > 0;
+	}
+	CHECK(matches);
+	CHECK(get_num_entries(node.hash_table) == expected);
+}
+
+static void segment_path(uint64_t sequence, char *path, size_t size)
+{
+	snprintf(path, size, "%s/wal.%020" PRIu64, dir, sequence);
+}
+
+/**
+ * @brief Number of log segments in the data directory and the lowest sequence among them.
+ */
+static int count_segments(uint64_t *oldest)
+{
+	int count = 0;
+	*oldest = UINT64_MAX;
+	DIR *entries = opendir(dir);
+	struct dirent *entry;
+	while ((entry = readdir(entries)) != NULL)
+	{
+		uint64_t sequence;
+		if (sscanf(entry->d_name, "wal.%" SCNu64, &sequence) != 1)
+			continue;
+		count++;
+		if (sequence < *oldest)
+			*oldest = sequence;
+	}
+	closedir(entries);
+	return count;
+}
+
+// ---------------------------------------------------------------- tests
+
+/**
+ * @brief Inserts, replacements, removes and a dropped slot are all replayed from the log.
+ */
+static void test_replay(void)
+{
+	start_node(UINT64_MAX);
+	CHECK(get_num_entries(node.hash_table) == 0);
+
+	for (int i = 0; i < KEYS; i++)
+		insert(i, "first");
+	for (int i = 0; i < KEYS; i += 3)
+		insert(i, "replaced");
+	for (int i = 0; i < KEYS; i += 5)
+		remove_key(i);
+
+	drop_slot(&node, DROPPED_SLOT);
+	persistence_log_drop_slot(&node.persistence, DROPPED_SLOT);
+	for (int i = 0; i < KEYS; i++)
+	{
+		char ssn[SSN_DIGITS];
+		key_of(i, ssn);
+		if (hash_ssn(ssn) == DROPPED_SLOT)
+			names[i][0] = '\0';
+	}
+	persistence_commit(&node.persistence);
+	check_store();
+	crash_node();
+
+	start_node(UINT64_MAX);
+	check_store();
+	crash_node();
+}
+
+/**
+ * @brief A record cut short by a crash is ignored with everything after it, the records before it
+ *        are kept, and the node goes on logging in a new segment.
+ */
+static void test_torn_tail(void)
+{
+	start_node(UINT64_MAX);
+	uint64_t sequence = node.persistence.wal_sequence;
+	insert(1, "kept");
+	insert(2, "kept");
+	persistence_commit(&node.persistence);
+	char before_torn[16];
+	snprintf(before_torn, sizeof(before_torn), "%s", names[3]);
+	insert(3, "torn");
+	persistence_commit(&node.persistence);
+	crash_node();
+
+	char path[512];
+	struct stat st;
+	segment_path(sequence, path, sizeof(path));
+	CHECK(stat(path, &st) == 0);
+	CHECK(truncate(path, st.st_size - 3) == 0);
+	snprintf(names[3], sizeof(names[3]), "%s", before_torn);
+
+	start_node(UINT64_MAX);
+	check_store();
+	CHECK(node.persistence.wal_sequence > sequence);
+	insert(4, "after");
+	persistence_commit(&node.persistence);
+	crash_node();
+
+	start_node(UINT64_MAX);
+	check_store();
+	crash_node();
+}
+
+/**
+ * @brief A snapshot replaces the segments it contains. Recovery loads it, replays only the newer
+ *        segments and deletes older ones that a crash left behind.
+ */
+static void test_snapshot_recovery(void)
+{
+	// a replayed log is folded into a snapshot on the first tick
+	start_node(1000);
+	persistence_tick(&node);
+	CHECK(node.persistence.snapshot_pid > 0);
+	uint64_t covered = node.persistence.snapshot_sequence;
+	while (node.persistence.snapshot_pid > 0)
+	{
+		usleep(1000);
+		persistence_tick(&node);
+	}
+
+	char path[512];
+	uint64_t oldest;
+	snprintf(path, sizeof(path), "%s/%s", dir, SNAPSHOT_FILE);
+	struct snapshot snapshot;
+	CHECK(snapshot_open(&snapshot, path) == 0);
+	CHECK(snapshot.header->wal_sequence == covered);
+	CHECK((int)snapshot.header->entries == get_num_entries(node.hash_table));
+	snapshot_close(&snapshot);
+	CHECK(count_segments(&oldest) == 1);
+	CHECK(oldest == covered + 1);
+
+	// changes after the snapshot are in the log only
+	for (int i = 1; i < KEYS; i += 7)
+		insert(i, "late");
+	for (int i = 2; i < KEYS; i += 11)
+		remove_key(i);
+	persistence_commit(&node.persistence);
+	crash_node();
+
+	// a segment the snapshot contains, as if the crash came before the segments were deleted
+	segment_path(covered, path, sizeof(path));
+	FILE *stale = fopen(path, "wb");
+	CHECK(stale != NULL);
+	fputs("not a log record", stale);
+	fclose(stale);
+
+	start_node(1000);
+	check_store();
+	CHECK(count_segments(&oldest) == 2); // the replayed one and the new one
+	CHECK(oldest == covered + 1);
+	crash_node();
+}
+
+static void remove_dir(void)
+{
+	DIR *entries = opendir(dir);
+	struct dirent *entry;
+	char path[512];
+	while ((entry = readdir(entries)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		unlink(path);
+	}
+	closedir(entries);
+	rmdir(dir);
+}
+
+int main(void)
+{
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	test_replay();
+	test_torn_tail();
+	test_snapshot_recovery();
+	remove_dir();
+	return check_report("test_persistence");
+}
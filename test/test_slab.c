@@ -0,0 +1,102 @@
+/**
+ * File: test_slab.c
+ * Tests of the slab allocator: size classes, reuse of freed objects, giving back
+ * empty slabs and releasing a whole arena.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+#include "check.h"
+
+/**
+ * @brief Every size gets a class at least as large, 16-byte aligned objects and exact accounting.
+ */
+static void test_size_classes(void)
+{
+	struct slab_arena arena;
+	slab_arena_init(&arena);
+	CHECK(slab_arena_bytes(&arena) == 0);
+
+	size_t bytes = 0;
+	for (size_t size = 1; size <= SLAB_MAX_OBJECT; size++)
+	{
+		void *object = slab_alloc(&arena, size);
+		CHECK(object != NULL);
+		CHECK(((uintptr_t)object & 15) == 0);
+		CHECK(slab_object_size(object) >= size);
+		CHECK(slab_object_size(object) <= SLAB_MAX_OBJECT);
+		bytes += slab_object_size(object);
+		memset(object, 0xab, size);
+	}
+	CHECK(arena.live_objects == SLAB_MAX_OBJECT);
+	CHECK(arena.live_bytes == bytes);
+	CHECK(arena.slab_count >= SLAB_CLASSES); // every class has a slab
+	CHECK(slab_alloc(&arena, SLAB_MAX_OBJECT + 1) == NULL);
+
+	slab_arena_release(&arena);
+	CHECK(arena.slab_count == 0);
+	CHECK(arena.live_objects == 0);
+	CHECK(arena.live_bytes == 0);
+}
+
+/**
+ * @brief Fills several slabs of one class with distinct objects, frees them and checks that
+ *        freed objects are handed out again and that emptied slabs are given back.
+ */
+static void test_reuse(void)
+{
+	enum { COUNT = 2000, SIZE = 100 };
+	static unsigned char *objects[COUNT];
+	struct slab_arena arena;
+	slab_arena_init(&arena);
+
+	for (int i = 0; i < COUNT; i++)
+	{
+		objects[i] = slab_alloc(&arena, SIZE);
+		CHECK(objects[i] != NULL);
+		memset(objects[i], i & 0xff, SIZE);
+	}
+	size_t full_slabs = arena.slab_count;
+	CHECK(full_slabs > 1);
+	CHECK(slab_arena_bytes(&arena) == full_slabs * SLAB_SIZE);
+	for (int i = 0; i < COUNT; i++)
+	{
+		bool intact = true;
+		for (int at = 0; at < SIZE; at++)
+			intact &= objects[i][at] == (i & 0xff);
+		CHECK(intact); // no two objects overlap
+	}
+
+	// a freed object is the next one handed out
+	unsigned char *freed = objects[COUNT / 2];
+	slab_free(freed);
+	objects[COUNT / 2] = slab_alloc(&arena, SIZE);
+	CHECK(objects[COUNT / 2] == freed);
+	CHECK(arena.slab_count == full_slabs);
+
+	for (int i = 0; i < COUNT; i++)
+		slab_free(objects[i]);
+	CHECK(arena.live_objects == 0);
+	CHECK(arena.live_bytes == 0);
+	CHECK(arena.slab_count == 1); // the last slab with room in the class is kept
+
+	for (int i = 0; i < COUNT; i++)
+		objects[i] = slab_alloc(&arena, SIZE);
+	CHECK(arena.slab_count == full_slabs);
+	slab_free(NULL);
+	slab_arena_release(&arena);
+	CHECK(slab_arena_bytes(&arena) == 0);
+
+	// a released arena can be used again
+	CHECK(slab_alloc(&arena, SIZE) != NULL);
+	CHECK(arena.live_objects == 1);
+	slab_arena_release(&arena);
+}
+
+int main(void)
+{
+	test_size_classes();
+	test_reuse();
+	return check_report("test_slab");
+}
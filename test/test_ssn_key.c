@@ -0,0 +1,105 @@
+/**
+ * File: test_ssn_key.c
+ * Tests that ssn_pack() and ssn_pack_batch(), which use SSSE3 and AVX2 when the CPU
+ * has them, agree with a plain digit by digit conversion for valid and invalid keys.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ssn_key.h"
+#include "check.h"
+
+#define KEYS 4099 // odd, so the batch also ends with a key packed on its own
+#define STRIDE 13 // keys stored stride bytes apart, not aligned to anything
+
+/**
+ * @brief The packed key of ssn computed one digit at a time, SSN_KEY_INVALID if it has a non-digit.
+ */
+static ssn_key_t reference_pack(const char *ssn)
+{
+	ssn_key_t key = 0;
+	for (int i = 0; i < SSN_DIGITS; i++)
+	{
+		if (ssn[i] < '0' || ssn[i] > '9')
+			return SSN_KEY_INVALID;
+		key = key * 10 + (ssn[i] - '0');
+	}
+	return key;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+/**
+ * @brief Fills the keys with random digits, every fourth key gets one byte replaced by a
+ *        byte just outside the digits or far from them, at a random position.
+ */
+static void make_keys(char *ssns)
+{
+	static const char invalid[] = {'0' - 1, '9' + 1, ' ', 0, (char)0x80, (char)0xff, (char)('0' + 0x80)};
+	uint32_t state = 12345;
+	for (int i = 0; i < KEYS; i++)
+	{
+		char *ssn = ssns + i * STRIDE;
+		for (int at = 0; at < STRIDE; at++)
+			ssn[at] = '0' + next_random(&state) % 10;
+		if (i % 4 == 3)
+			ssn[next_random(&state) % SSN_DIGITS] = invalid[next_random(&state) % sizeof(invalid)];
+	}
+	// the smallest and the largest key
+	memset(ssns, '0', SSN_DIGITS);
+	memset(ssns + STRIDE, '9', SSN_DIGITS);
+}
+
+static void test_pack(const char *ssns)
+{
+	for (int i = 0; i < KEYS; i++)
+	{
+		const char *ssn = ssns + i * STRIDE;
+		ssn_key_t expected = reference_pack(ssn), key = SSN_KEY_INVALID;
+		bool valid = ssn_pack(ssn, &key);
+		CHECK(valid == (expected != SSN_KEY_INVALID));
+		if (valid)
+		{
+			char unpacked[SSN_DIGITS];
+			CHECK(key == expected);
+			ssn_unpack(key, unpacked);
+			CHECK(memcmp(unpacked, ssn, SSN_DIGITS) == 0);
+		}
+	}
+}
+
+static void test_pack_batch(const char *ssns)
+{
+	static ssn_key_t keys[KEYS];
+	for (int count = 0; count <= 5; count++)
+	{
+		size_t valid = 0;
+		for (int i = 0; i < count; i++)
+			valid += reference_pack(ssns + i * STRIDE) != SSN_KEY_INVALID;
+		CHECK(ssn_pack_batch(ssns, STRIDE, count, keys) == valid);
+	}
+
+	size_t valid = ssn_pack_batch(ssns, STRIDE, KEYS, keys), expected_valid = 0;
+	for (int i = 0; i < KEYS; i++)
+	{
+		ssn_key_t expected = reference_pack(ssns + i * STRIDE);
+		CHECK(keys[i] == expected);
+		expected_valid += expected != SSN_KEY_INVALID;
+	}
+	CHECK(valid == expected_valid);
+	CHECK(keys[0] == 0);
+	CHECK(keys[1] == 999999999999ULL);
+}
+
+int main(void)
+{
+	static char ssns[KEYS * STRIDE];
+	make_keys(ssns);
+	test_pack(ssns);
+	test_pack_batch(ssns);
+	return check_report("test_ssn_key");
+}
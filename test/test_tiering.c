@@ -0,0 +1,202 @@
+/**
+ * File: test_tiering.c
+ * Tests of the RAM budget: values over the budget are demoted to the cold store, a
+ * lookup promotes one back with the same bytes and compaction of the cold file keeps
+ * every reference in the table valid. The store is reduced to the hash table and the
+ * slab arenas, the functions of the node that tiering.c calls are provided below.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hash_handling.h"
+#include "check.h"
+
+#define KEYS 240000
+#define BUDGET (1 << 20)
+#define TICK_EVERY 1000 // inserts between two main loop ticks
+#define NAME_LENGTH 200
+#define EMAIL_LENGTH 250
+
+static struct self_data node;
+static char dir[] = "/tmp/test_tiering.XXXXXX";
+
+// ---------------------------------------------------------------- the node, reduced to its store
+
+void store_value(struct self_data *self_data, char *ssn, uint8_t name_length, uint8_t email_length, const uint8_t *name, const uint8_t *email)
+{
+	struct value_pair *pair = slab_alloc(&self_data->record_arenas[hash_ssn(ssn)], sizeof(struct value_pair) + name_length + email_length);
+	pair->name_length = name_length;
+	pair->email_length = email_length;
+	pair->flags = 0;
+	pair->access = TIERING_ACCESS_ON_INSERT;
+	memcpy(pair->data, name, name_length);
+	memcpy(pair->data + name_length, email, email_length);
+	self_data->hash_table = ht_insert(self_data->hash_table, ssn, pair);
+}
+
+void free_value_pair(void *value)
+{
+	value_release(value_resolve(value));
+	if (value_is_cold(value))
+		cold_store_discard(value);
+	else
+		slab_free(value);
+}
+
+void flush_udp_views(struct self_data *self_data)
+{
+}
+
+void memory_track(enum memory_category category, ssize_t delta)
+{
+}
+
+void log_write(struct log_site *site, const char *format, ...)
+{
+}
+
+void exit_with_error(const char *msg, struct self_data *my_data)
+{
+	fprintf(stderr, "%s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+// ---------------------------------------------------------------- helpers
+
+static void key_of(int i, char ssn[SSN_DIGITS])
+{
+	char text[24];
+	snprintf(text, sizeof(text), "%012d", i);
+	memcpy(ssn, text, SSN_DIGITS);
+}
+
+/**
+ * @brief The name and email stored for the i-th key, distinct for every key.
+ */
+static void fields_of(int i, uint8_t name[NAME_LENGTH], uint8_t email[EMAIL_LENGTH])
+{
+	memset(name, 'a' + i % 26, NAME_LENGTH);
+	memset(email, 'A' + i % 26, EMAIL_LENGTH);
+	memcpy(name, &i, sizeof(i));
+	memcpy(email + EMAIL_LENGTH - sizeof(i), &i, sizeof(i));
+}
+
+/**
+ * @brief Whether a table value holds the fields of the i-th key.
+ */
+static bool holds(const void *value, int i)
+{
+	uint8_t name[NAME_LENGTH], email[EMAIL_LENGTH];
+	fields_of(i, name, email);
+	const struct value_pair *pair = value_resolve(value);
+	return pair->name_length == NAME_LENGTH && pair->email_length == EMAIL_LENGTH &&
+	       memcmp(pair->data, name, NAME_LENGTH) == 0 && memcmp(pair->data + NAME_LENGTH, email, EMAIL_LENGTH) == 0;
+}
+
+static void *lookup(int i)
+{
+	char ssn[SSN_DIGITS];
+	key_of(i, ssn);
+	return ht_lookup(node.hash_table, ssn);
+}
+
+// ---------------------------------------------------------------- tests
+
+/**
+ * @brief Inserts far more than the budget while the main loop ticks. The values in RAM stay
+ *        near the budget and every value, hot or cold, still reads back as stored.
+ */
+static void test_demote(void)
+{
+	char ssn[SSN_DIGITS];
+	uint8_t name[NAME_LENGTH], email[EMAIL_LENGTH];
+	for (int i = 0; i < KEYS; i++)
+	{
+		key_of(i, ssn);
+		fields_of(i, name, email);
+		store_value(&node, ssn, NAME_LENGTH, EMAIL_LENGTH, name, email);
+		if (i % TICK_EVERY == TICK_EVERY - 1)
+			tiering_tick(&node);
+	}
+	tiering_tick(&node);
+
+	CHECK(tiering_hot_bytes(&node) <= BUDGET);
+	CHECK(node.tiering.demoted > KEYS / 2);
+	CHECK(cold_store_live_bytes() > (size_t)KEYS / 2 * (NAME_LENGTH + EMAIL_LENGTH)); // the file was grown and moved many times
+	CHECK(cold_store_dead_bytes() == 0);
+	for (int i = 0; i < KEYS; i++)
+		CHECK(holds(lookup(i), i));
+}
+
+/**
+ * @brief A lookup of a cold value brings it back into RAM, the cold copy becomes dead.
+ */
+static void test_promote(void)
+{
+	int cold_key = 0;
+	while (cold_key < KEYS && !value_is_cold(lookup(cold_key)))
+		cold_key++;
+	CHECK(cold_key < KEYS);
+
+	char ssn[SSN_DIGITS];
+	key_of(cold_key, ssn);
+	size_t live = cold_store_live_bytes();
+	tiering_touch(&node, ssn, lookup(cold_key));
+
+	void *value = lookup(cold_key);
+	CHECK(!value_is_cold(value));
+	CHECK(holds(value, cold_key));
+	CHECK(node.tiering.promoted == 1);
+	CHECK(cold_store_live_bytes() < live);
+	CHECK(cold_store_dead_bytes() == live - cold_store_live_bytes());
+}
+
+/**
+ * @brief Removes three of every four keys, which leaves the cold file mostly dead. The next
+ *        tick rewrites it and every reference left in the table must point into the new file.
+ */
+static void test_compaction(void)
+{
+	char ssn[SSN_DIGITS];
+	for (int i = 0; i < KEYS; i++)
+	{
+		if (i % 4 == 0)
+			continue;
+		key_of(i, ssn);
+		node.hash_table = ht_remove(node.hash_table, ssn);
+	}
+	size_t live = cold_store_live_bytes();
+	CHECK(cold_store_dead_bytes() > live); // over the minimum and half of the file
+
+	tiering_tick(&node);
+	CHECK(cold_store_dead_bytes() == 0);
+	CHECK(cold_store_live_bytes() == live);
+	CHECK(get_num_entries(node.hash_table) == KEYS / 4);
+	for (int i = 0; i < KEYS; i++)
+	{
+		void *value = lookup(i);
+		CHECK(i % 4 ? value == NULL : holds(value, i));
+	}
+}
+
+int main(void)
+{
+	if (!mkdtemp(dir))
+	{
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+	node.hash_table = ht_create(free_value_pair);
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+		slab_arena_init(&node.record_arenas[slot]);
+	tiering_init(&node.tiering, BUDGET, dir);
+
+	test_demote();
+	test_promote();
+	test_compaction();
+
+	ht_destroy(node.hash_table);
+	rmdir(dir); // the cold file was unlinked when it was created
+	return check_report("test_tiering");
+}
@@ -0,0 +1,164 @@
+/**
+ * File: test_timer_wheel.c
+ * Tests of the timer wheel on a simulated clock: timers on every level fire when due
+ * after moving down the levels, cancelled ones never fire and a timer can be added
+ * again from its own function.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "timer_wheel.h"
+#include "check.h"
+
+#define BASE_TIME 5000003 // not at a slot boundary of any level
+#define MAX_DELAY 20000000 // beyond the span of the wheel, about 4.7 hours
+
+static uint64_t clock_ms; // the simulated timer_now()
+
+struct test_timer
+{
+	struct timer timer;
+	uint64_t fired_at; // 0 while it has not fired
+	int fire_count;
+};
+
+static void record_fire(struct self_data *self_data, struct timer *timer)
+{
+	struct test_timer *test_timer = timer->arg;
+	test_timer->fired_at = clock_ms;
+	test_timer->fire_count++;
+}
+
+static void start_wheel(struct timer_wheel *wheel)
+{
+	timer_wheel_init(wheel);
+	clock_ms = BASE_TIME;
+	wheel->now = clock_ms;
+}
+
+static void add_timer(struct timer_wheel *wheel, struct test_timer *test_timer, uint64_t expires)
+{
+	test_timer->timer.fire = record_fire;
+	test_timer->timer.arg = test_timer;
+	test_timer->fired_at = 0;
+	test_timer->fire_count = 0;
+	timer_add(wheel, &test_timer->timer, expires);
+}
+
+/**
+ * @brief Timers just below, at and above the turn of every level, run every millisecond. Each fires
+ *        exactly once, at its expiry, however many levels it went down on the way.
+ */
+static void test_cascade(void)
+{
+	static const uint64_t delays[] = {1, 2, 63, 64, 65, 127, 4095, 4096, 4097, 5000, 262143, 262144, 262145,
+					  1000000, 16777215, 16777216, 16777217, MAX_DELAY};
+	enum { COUNT = sizeof(delays) / sizeof(delays[0]) };
+	struct test_timer timers[COUNT] = {0};
+	struct timer_wheel wheel;
+	start_wheel(&wheel);
+
+	for (int i = 0; i < COUNT; i++)
+		add_timer(&wheel, &timers[i], BASE_TIME + delays[i]);
+	CHECK(timer_wheel_timeout(&wheel, clock_ms) == 1);
+
+	for (clock_ms = BASE_TIME + 1; clock_ms <= BASE_TIME + MAX_DELAY; clock_ms++)
+		timer_wheel_run(&wheel, NULL, clock_ms);
+	for (int i = 0; i < COUNT; i++)
+	{
+		CHECK(timers[i].fire_count == 1);
+		CHECK(timers[i].fired_at == BASE_TIME + delays[i]);
+		CHECK(!timer_armed(&timers[i].timer));
+	}
+	CHECK(timer_wheel_timeout(&wheel, clock_ms) == -1);
+}
+
+/**
+ * @brief The clock jumps ahead by several turns of a level at a time, as after a long poll.
+ *        Timers fire on the first run at or after their expiry, in time order across runs.
+ */
+static void test_jumps(void)
+{
+	enum { COUNT = 300, STEP = 9973 };
+	static struct test_timer timers[COUNT];
+	struct timer_wheel wheel;
+	start_wheel(&wheel);
+
+	for (int i = 0; i < COUNT; i++)
+		add_timer(&wheel, &timers[i], BASE_TIME + (uint64_t)i * i * 97 + 1);
+	while (wheel.next != UINT64_MAX)
+	{
+		clock_ms += STEP;
+		timer_wheel_run(&wheel, NULL, clock_ms);
+	}
+	for (int i = 0; i < COUNT; i++)
+	{
+		CHECK(timers[i].fire_count == 1);
+		CHECK(timers[i].fired_at >= timers[i].timer.expires);
+		CHECK(timers[i].fired_at < timers[i].timer.expires + STEP);
+	}
+}
+
+/**
+ * @brief Cancelling a timer that has moved down a level, and moving one to another level, keep
+ *        the wheel consistent: the cancelled one never fires, the moved one fires at its new time.
+ */
+static void test_cancel_and_move(void)
+{
+	struct test_timer cancelled = {0}, moved = {0}, kept = {0};
+	struct timer_wheel wheel;
+	start_wheel(&wheel);
+
+	add_timer(&wheel, &cancelled, BASE_TIME + 300000);
+	add_timer(&wheel, &moved, BASE_TIME + 10);
+	add_timer(&wheel, &kept, BASE_TIME + 300001);
+	timer_add(&wheel, &moved.timer, BASE_TIME + 70000);
+	CHECK(timer_armed(&moved.timer));
+
+	for (clock_ms = BASE_TIME + 1; clock_ms <= BASE_TIME + 299990; clock_ms += 10)
+		timer_wheel_run(&wheel, NULL, clock_ms);
+	CHECK(moved.fired_at == BASE_TIME + 70001); // the first run at or after its expiry
+	CHECK(cancelled.fire_count == 0);
+	timer_cancel(&wheel, &cancelled.timer);
+	timer_cancel(&wheel, &cancelled.timer);
+	CHECK(!timer_armed(&cancelled.timer));
+
+	for (; clock_ms <= BASE_TIME + 400000; clock_ms++)
+		timer_wheel_run(&wheel, NULL, clock_ms);
+	CHECK(cancelled.fire_count == 0);
+	CHECK(kept.fired_at == BASE_TIME + 300001);
+	CHECK(moved.fire_count == 1);
+}
+
+static struct timer_wheel periodic_wheel;
+
+static void fire_again(struct self_data *self_data, struct timer *timer)
+{
+	record_fire(self_data, timer);
+	timer_add(&periodic_wheel, timer, clock_ms + 1000);
+}
+
+/**
+ * @brief A timer added again from its function fires once per period and not within the same run.
+ */
+static void test_periodic(void)
+{
+	struct test_timer periodic = {0};
+	start_wheel(&periodic_wheel);
+	add_timer(&periodic_wheel, &periodic, BASE_TIME + 1000);
+	periodic.timer.fire = fire_again;
+
+	for (clock_ms = BASE_TIME + 1; clock_ms <= BASE_TIME + 100000; clock_ms++)
+		timer_wheel_run(&periodic_wheel, NULL, clock_ms);
+	CHECK(periodic.fire_count == 100);
+	CHECK(periodic.fired_at == BASE_TIME + 100000);
+	CHECK(timer_armed(&periodic.timer));
+}
+
+int main(void)
+{
+	test_cascade();
+	test_jumps();
+	test_cancel_and_move();
+	test_periodic();
+	return check_report("test_timer_wheel");
+}
@@ -0,0 +1,142 @@
+/**
+ * File: test_value_codec.c
+ * Tests of the value dictionary: encoded values decode to what was stored, shared
+ * strings are counted once per reference and ids of freed strings are reused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "value_codec.h"
+#include "check.h"
+
+/**
+ * @brief Encodes a value the way the node stores it, checking that it decodes to name and email.
+ */
+static struct value_pair *make_value(const char *name, const char *email)
+{
+	struct value_pair *pair = malloc(sizeof(struct value_pair) + VALUE_MAX_ENCODED);
+	pair->name_length = strlen(name);
+	pair->email_length = strlen(email);
+	pair->access = 0;
+	size_t size = value_encode(pair->data, &pair->flags, pair->name_length, pair->email_length, (const uint8_t *)name, (const uint8_t *)email);
+	CHECK(value_size(pair) == sizeof(struct value_pair) + size);
+
+	struct value_fields fields;
+	value_fields(pair, &fields);
+	CHECK(memcmp(fields.name, name, pair->name_length) == 0);
+	CHECK(memcmp(fields.email, email, pair->email_length) == 0);
+	return pair;
+}
+
+static void free_value(struct value_pair *pair)
+{
+	value_release(pair);
+	free(pair);
+}
+
+/**
+ * @brief The dictionary id a value refers to for its name.
+ */
+static uint16_t name_id(const struct value_pair *pair)
+{
+	return (uint16_t)(pair->data[0] | pair->data[1] << 8);
+}
+
+static void test_encodings(void)
+{
+	struct value_pair *plain = make_value("Bo", "bo@se");
+	CHECK(!(plain->flags & (VALUE_NAME_REF | VALUE_EMAIL_DOMAIN_REF))); // too short to share
+	CHECK(value_dictionary_entries() == 0);
+
+	struct value_pair *prefixed = make_value("anna.berg", "anna.berg99@example.com");
+	CHECK(prefixed->flags & VALUE_NAME_REF);
+	CHECK(prefixed->flags & VALUE_EMAIL_NAME_PREFIX);
+	CHECK(prefixed->flags & VALUE_EMAIL_DOMAIN_REF);
+	CHECK(value_size(prefixed) < sizeof(struct value_pair) + prefixed->name_length + prefixed->email_length);
+
+	struct value_pair *no_domain = make_value("Carl Dahl", "carl-at-home");
+	CHECK(!(no_domain->flags & VALUE_EMAIL_DOMAIN_REF));
+	struct value_pair *empty = make_value("", "");
+
+	free_value(plain);
+	free_value(prefixed);
+	free_value(no_domain);
+	free_value(empty);
+	CHECK(value_dictionary_entries() == 0);
+	CHECK(value_dictionary_bytes() == 0);
+}
+
+/**
+ * @brief Values sharing a name and a domain hold one dictionary entry each, which lives until
+ *        the last value referring to it is released.
+ */
+static void test_refcount(void)
+{
+	struct value_pair *first = make_value("Erik Falk", "erik@example.com");
+	struct value_pair *second = make_value("Erik Falk", "falk@example.com");
+	struct value_pair *third = make_value("Greta Holm", "greta@example.com");
+	CHECK(name_id(first) == name_id(second));
+	CHECK(value_dictionary_entries() == 3);
+	CHECK(value_dictionary_bytes() == strlen("Erik Falk") + strlen("example.com") + strlen("Greta Holm"));
+
+	free_value(first);
+	CHECK(value_dictionary_entries() == 3);
+	struct value_fields fields;
+	value_fields(second, &fields);
+	CHECK(memcmp(fields.name, "Erik Falk", second->name_length) == 0);
+	CHECK(memcmp(fields.email, "falk@example.com", second->email_length) == 0);
+
+	free_value(second);
+	CHECK(value_dictionary_entries() == 2); // the domain is still used by the third value
+	value_fields(third, &fields);
+	CHECK(memcmp(fields.email, "greta@example.com", third->email_length) == 0);
+
+	free_value(third);
+	CHECK(value_dictionary_entries() == 0);
+	CHECK(value_dictionary_bytes() == 0);
+}
+
+/**
+ * @brief A freed id is handed to the next new string, and replacing values for a long time
+ *        keeps the dictionary at the size of what is live.
+ */
+static void test_free_id_reuse(void)
+{
+	struct value_pair *kept = make_value("Ida Jonsson", "ida@example.org");
+	struct value_pair *dropped = make_value("Karl Lund", "karl@example.org");
+	uint16_t freed = name_id(dropped);
+	free_value(dropped);
+
+	struct value_pair *next = make_value("Lena Moberg", "lena@example.org");
+	CHECK(name_id(next) == freed);
+	CHECK(name_id(next) != name_id(kept));
+	free_value(next);
+
+	enum { LIVE = 1000, ROUNDS = 100000 };
+	static struct value_pair *values[LIVE];
+	char name[32];
+	for (int i = 0; i < ROUNDS; i++)
+	{
+		if (values[i % LIVE])
+			free_value(values[i % LIVE]);
+		snprintf(name, sizeof(name), "name %d", i);
+		values[i % LIVE] = make_value(name, "user@example.net");
+	}
+	size_t memory = value_dictionary_memory();
+	CHECK(value_dictionary_entries() == LIVE + 3); // and the kept name and the two domains
+	CHECK(name_id(values[(ROUNDS - 1) % LIVE]) < LIVE + 3); // freed ids are handed out before new ones
+	CHECK(memory < 4 * LIVE * 64); // ids are reused, the entries do not grow with every string ever stored
+	for (int i = 0; i < LIVE; i++)
+		free_value(values[i]);
+	free_value(kept);
+	CHECK(value_dictionary_entries() == 0);
+}
+
+int main(void)
+{
+	value_codec_enable(true);
+	test_encodings();
+	test_refcount();
+	test_free_id_reuse();
+	return check_report("test_value_codec");
+}
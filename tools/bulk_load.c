@@ -0,0 +1,297 @@
+/**
+ * File: bulk_load.c
+ * Turns a CSV of ssn,name,email rows into a snapshot file that nodes adopt with --load,
+ * so a cluster can be seeded without sending any PDUs. The CSV is split into one chunk
+ * per thread, each thread packs its keys in batches and sorts its rows into the 256 hash
+ * slots, and the slots are then written in order.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "snapshot.h"
+
+#define PACK_BATCH 256
+#define MAX_THREADS 64
+
+struct row
+{
+	ssn_key_t key;
+	uint64_t name_offset; // into the CSV, the email follows the name and a comma
+	uint8_t name_length;
+	uint8_t email_length;
+};
+
+struct slot_rows
+{
+	struct row *rows;
+	size_t count;
+	size_t capacity;
+};
+
+struct chunk
+{
+	const char *csv;
+	size_t start; // first byte of the chunk's first line
+	size_t end;   // one past the chunk's last line
+	struct slot_rows slots[HT_SLOTS];
+	size_t rows;
+	size_t skipped;
+	int failed;
+};
+
+struct pending_row
+{
+	const char *line;
+	size_t name_offset;
+	uint8_t name_length;
+	uint8_t email_length;
+};
+
+static void print_usage(const char *program)
+{
+	printf("Usage: %s [options] <input.csv> <output>\n", program);
+	printf("Options:\n");
+	printf("  -j N   number of parser threads (default: online CPUs)\n");
+	printf("  -o     use the ordered partitioning, for nodes started with --ordered\n");
+}
+
+static int append_row(struct slot_rows *slot, const struct row *row)
+{
+	if (slot->count == slot->capacity)
+	{
+		size_t capacity = slot->capacity ? slot->capacity * 2 : 64;
+		struct row *rows = realloc(slot->rows, capacity * sizeof(struct row));
+		if (!rows)
+			return -1;
+		slot->rows = rows;
+		slot->capacity = capacity;
+	}
+	slot->rows[slot->count++] = *row;
+	return 0;
+}
+
+/**
+ * @brief Packs the keys of a batch of parsed lines and files the rows under their slots.
+ */
+static void flush_batch(struct chunk *chunk, const struct pending_row *pending, size_t count)
+{
+	char ssns[PACK_BATCH * SSN_DIGITS] = {0};
+	ssn_key_t keys[PACK_BATCH];
+
+	if (count == 0)
+		return;
+	for (size_t i = 0; i < count; i++)
+		memcpy(ssns + i * SSN_DIGITS, pending[i].line, SSN_DIGITS);
+	ssn_pack_batch(ssns, SSN_DIGITS, count, keys);
+
+	for (size_t i = 0; i < count && !chunk->failed; i++)
+	{
+		if (keys[i] == SSN_KEY_INVALID)
+		{
+			chunk->skipped++;
+			continue;
+		}
+
+		struct row row = {
+		    .key = keys[i],
+		    .name_offset = pending[i].name_offset,
+		    .name_length = pending[i].name_length,
+		    .email_length = pending[i].email_length,
+		};
+		if (append_row(&chunk->slots[hash_ssn(ssns + i * SSN_DIGITS)], &row) < 0)
+			chunk->failed = 1;
+		chunk->rows++;
+	}
+}
+
+/**
+ * @brief Thread entry, parses the lines of one chunk.
+ */
+static void *parse_chunk(void *arg)
+{
+	struct chunk *chunk = arg;
+	const char *csv = chunk->csv;
+	struct pending_row pending[PACK_BATCH];
+	size_t count = 0;
+
+	size_t position = chunk->start;
+	while (position < chunk->end && !chunk->failed)
+	{
+		const char *line = csv + position;
+		const char *line_end = memchr(line, '\n', chunk->end - position);
+		if (!line_end)
+			line_end = csv + chunk->end;
+		position = line_end - csv + 1;
+
+		size_t length = line_end - line;
+		if (length > 0 && line[length - 1] == '\r')
+			length--;
+
+		const char *first_comma = memchr(line, ',', length);
+		const char *second_comma = first_comma ? memchr(first_comma + 1, ',', line + length - first_comma - 1) : NULL;
+		if (!second_comma || first_comma - line != SSN_DIGITS)
+		{
+			if (length > 0)
+				chunk->skipped++;
+			continue;
+		}
+
+		size_t name_length = second_comma - first_comma - 1;
+		size_t email_length = line + length - second_comma - 1;
+		if (name_length > UINT8_MAX || email_length > UINT8_MAX)
+		{
+			chunk->skipped++;
+			continue;
+		}
+
+		pending[count++] = (struct pending_row){
+		    .line = line,
+		    .name_offset = first_comma + 1 - csv,
+		    .name_length = (uint8_t)name_length,
+		    .email_length = (uint8_t)email_length,
+		};
+		if (count == PACK_BATCH)
+		{
+			flush_batch(chunk, pending, count);
+			count = 0;
+		}
+	}
+	flush_batch(chunk, pending, count);
+	return NULL;
+}
+
+/**
+ * @brief Moves a chunk boundary forward to the start of the next line.
+ */
+static size_t next_line(const char *csv, size_t size, size_t position)
+{
+	if (position == 0 || position >= size)
+		return position;
+	const char *newline = memchr(csv + position - 1, '\n', size - position + 1);
+	return newline ? (size_t)(newline - csv) + 1 : size;
+}
+
+int main(int argc, char *argv[])
+{
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int option;
+	while ((option = getopt(argc, argv, "j:o")) != -1)
+	{
+		switch (option)
+		{
+		case 'j':
+			threads = strtol(optarg, NULL, 10);
+			break;
+		case 'o':
+			ht_set_partitioning(HT_PARTITION_ORDERED);
+			break;
+		default:
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 2 || threads < 1)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	const char *input = argv[optind];
+	const char *output = argv[optind + 1];
+
+	int fd = open(input, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror(input);
+		return 1;
+	}
+	size_t size = st.st_size;
+	const char *csv = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+	close(fd);
+	if (csv == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	if (size > 0)
+		madvise((void *)csv, size, MADV_SEQUENTIAL);
+
+	struct chunk *chunks = calloc(threads, sizeof(struct chunk));
+	pthread_t *thread_ids = calloc(threads, sizeof(pthread_t));
+	if (!chunks || !thread_ids)
+	{
+		perror("calloc");
+		return 1;
+	}
+
+	for (long i = 0; i < threads; i++)
+	{
+		chunks[i].csv = csv;
+		chunks[i].start = next_line(csv, size, size * i / threads);
+		chunks[i].end = next_line(csv, size, size * (i + 1) / threads);
+		if (pthread_create(&thread_ids[i], NULL, parse_chunk, &chunks[i]) != 0)
+		{
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	size_t rows = 0, skipped = 0;
+	for (long i = 0; i < threads; i++)
+	{
+		pthread_join(thread_ids[i], NULL);
+		if (chunks[i].failed)
+		{
+			fprintf(stderr, "Out of memory while parsing %s\n", input);
+			return 1;
+		}
+		rows += chunks[i].rows;
+		skipped += chunks[i].skipped;
+	}
+
+	// chunks are visited in file order so a repeated SSN keeps its last row when loaded
+	static uint8_t snapshot_buffer[SNAPSHOT_BUFFER_SIZE];
+	struct snapshot_writer writer;
+	if (snapshot_writer_open(&writer, output, snapshot_buffer) < 0)
+	{
+		perror(output);
+		return 1;
+	}
+	for (int slot = 0; slot < HT_SLOTS; slot++)
+	{
+		snapshot_writer_begin_slot(&writer, slot);
+		for (long i = 0; i < threads; i++)
+		{
+			const struct slot_rows *slot_rows = &chunks[i].slots[slot];
+			for (size_t r = 0; r < slot_rows->count; r++)
+			{
+				const struct row *row = &slot_rows->rows[r];
+				const uint8_t *name = (const uint8_t *)csv + row->name_offset;
+				if (snapshot_writer_add(&writer, row->key, row->name_length, row->email_length, name, name + row->name_length + 1) < 0)
+				{
+					snapshot_writer_abort(&writer);
+					perror(output);
+					return 1;
+				}
+			}
+		}
+	}
+	if (snapshot_writer_close(&writer, 0, 0, HT_SLOTS - 1) < 0)
+	{
+		perror(output);
+		return 1;
+	}
+
+	printf("Wrote %zu rows to %s using %ld threads, skipped %zu lines\n", rows, output, threads, skipped);
+	return 0;
+}